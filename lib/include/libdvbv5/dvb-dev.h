@@ -339,6 +339,74 @@ int dvb_dev_get_fd(struct dvb_open_descriptor *open_dev);
 ssize_t dvb_dev_read(struct dvb_open_descriptor *open_dev,
 		     void *buf, size_t count);
 
+/**
+ * @brief Sets up memory-mapped buffers on a dvb demux or dvr file
+ * @ingroup dvb_device
+ *
+ * @param open_dev	Points to the struct dvb_open_descriptor
+ * @param count		number of buffers. Use 0 for the default (64)
+ * @param size		size of each buffer, in bytes. Use 0 for the
+ *			default (64 TS packets). The Kernel may adjust it.
+ *
+ * This is a wrapper function for DMX_REQBUFS, DMX_QUERYBUF and DMX_QBUF
+ * ioctls. It maps the buffers and queues them, after that, the data
+ * should be retrieved with dvb_dev_mmap_read(), instead of
+ * dvb_dev_read(). The buffers are released by dvb_dev_mmap_stop() or
+ * when the device is closed.
+ *
+ * See http://linuxtv.org/downloads/v4l-dvb-apis/dvb_demux.html
+ * for more details.
+ *
+ * @return Retuns zero on success, a negative errno value otherwise.
+ * -ENOTTY or -EINVAL means that the Kernel doesn't support memory-mapped
+ * demux buffers, and -ENOTSUP that the device (e. g. a remote one) doesn't;
+ * applications should then fall back to dvb_dev_read().
+ *
+ * @note valid only for DVB_DEVICE_DEMUX or DVB_DEVICE_DVR.
+ */
+int dvb_dev_mmap_start(struct dvb_open_descriptor *open_dev,
+		       unsigned int count, unsigned int size);
+
+/**
+ * @brief Gets the next filled memory-mapped buffer
+ * @ingroup dvb_device
+ *
+ * @param open_dev	Points to the struct dvb_open_descriptor
+ * @param buf		Returns a pointer to the data, valid until the next
+ *			call, or until dvb_dev_mmap_stop()
+ * @param flags		If not NULL, returns the buffer flags
+ *			(DMX_BUFFER_FLAG_DISCONTINUITY_DETECTED, etc.)
+ *
+ * Gives the buffer returned by the previous call back to the Kernel,
+ * and gets the next buffer filled by the Kernel. This is a wrapper
+ * function for DMX_QBUF and DMX_DQBUF ioctls. No data is copied.
+ *
+ * If the device was opened without O_NONBLOCK, this waits until the Kernel
+ * has completely filled a buffer, which, with low bitrates, may take a
+ * while. If it was opened with O_NONBLOCK, the Kernel hands out partially
+ * filled buffers as soon as it has data. Applications should then wait
+ * with poll() on dvb_dev_get_fd() for data. At the end of a recording, they
+ * should call this function until it returns -EAGAIN, to get the data still
+ * pending.
+ *
+ * @return On success, returns the number of bytes at buf. Returns a
+ * negative errno value on error: -EAGAIN if there is no data yet with
+ * O_NONBLOCK, -EINTR if a signal interrupted the wait.
+ */
+ssize_t dvb_dev_mmap_read(struct dvb_open_descriptor *open_dev,
+			  const void **buf, unsigned int *flags);
+
+/**
+ * @brief Unmaps and frees the buffers set up by dvb_dev_mmap_start()
+ * @ingroup dvb_device
+ *
+ * @param open_dev	Points to the struct dvb_open_descriptor
+ *
+ * This stops the Kernel from streaming into the buffers. Data in buffers
+ * not yet retrieved with dvb_dev_mmap_read() is dropped.
+ */
+void dvb_dev_mmap_stop(struct dvb_open_descriptor *open_dev);
+
 /**
  * @brief Stops the demux filter for a given file descriptor
  * @ingroup dvb_device
@@ -361,7 +429,9 @@ void dvb_dev_dmx_stop(struct dvb_open_descriptor *open_dev);
  * @param open_dev	Points to the struct dvb_open_descriptor
  * @param buffersize	Size of the buffer to be allocated to store the filtered data.
  *
- * This is a wrapper function for DMX_SET_BUFFER_SIZE ioctl.
+ * This is a wrapper function for DMX_SET_BUFFER_SIZE ioctl. On remote
+ * devices, the buffer that holds the data received from the dvbv5-daemon
+ * is also enlarged to buffersize, if smaller.
  *
  * See http://linuxtv.org/downloads/v4l-dvb-apis/dvb_demux.html
  * for more details.
@@ -480,6 +550,15 @@ struct dvb_v5_descriptors *dvb_dev_scan(struct dvb_open_descriptor *open_dev,
 
 #define REMOTE_BUF_SIZE (87 * 188)	/* 16356 bytes */
 
+/*
+ * Data read from the demux/dvr devices is sent by the dvbv5-daemon as
+ * binary frames, flagged by REMOTE_DATA_FRAME at the message size. Each
+ * frame batches one or more chunks, each one being a big endian int32 uid,
+ * a big endian int32 size (or a negative error code) and size bytes of data.
+ */
+#define REMOTE_DATA_FRAME	0x80000000
+#define REMOTE_DATA_FRAME_SIZE	(REMOTE_BUF_SIZE * 16)	/* 261696 bytes */
+
 
 /**
  * @brief initialize the dvb-dev to use a remote device running the
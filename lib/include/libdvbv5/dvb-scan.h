@@ -262,6 +262,9 @@ void dvb_scan_free_handler_table(struct dvb_v5_descriptors *dvb_scan_handler);
  * available at the transport stream, and parses the following tables:
  * PAT, PMT, NIT, SDT (and VCT, if the delivery system is ATSC).
  *
+ * By default, the tables are read one after the other. See
+ * dvb_scan_set_max_filters() for reading them in parallel.
+ *
  * On sucess, it returns a pointer to a struct dvb_v5_descriptors, that can
  * either be used to tune into a service or to be stored inside a file.
  */
@@ -270,6 +273,28 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *parms, int
 					  unsigned other_nit,
 					  unsigned timeout_multiply);
 
+/**
+ * @brief Sets how many tables dvb_get_ts_tables() may read at the same time
+ * @ingroup frontend_scan
+ *
+ * @param parms			pointer to struct dvb_v5_fe_parms created when
+ *				the frontend is opened
+ * @param max_filters		maximum number of section filters to use. 0 or
+ *				1 reads one table at a time (the default).
+ *
+ * With more than one filter, dvb_get_ts_tables() opens more file
+ * descriptors for the demux it was given, and sets a section filter on each
+ * of them for PAT, NIT, SDT (or VCT) and, once PAT is read, the PMTs. The
+ * sections are handled as they arrive, so scanning a transponder takes
+ * about as long as its slowest table, instead of the sum of all of them.
+ * Less filters get used if the demux can't provide that many.
+ *
+ * This also applies to dvb_scan_transponder() and dvb_dev_scan(), when the
+ * device is local.
+ */
+void dvb_scan_set_max_filters(struct dvb_v5_fe_parms *parms,
+			      unsigned max_filters);
+
 /**
  * @brief frees a struct dvb_v5_descriptors
  * @ingroup frontend_scan
@@ -48,6 +48,11 @@ LIBV4L_PUBLIC extern FILE *v4l2_log_file;
    Another difference is that you can make v4l2_read() calls even on devices
    which do not support the regular read() method.
 
+   When converting, USERPTR and DMABUF buffers can be used too, libv4l2 then
+   uses mmap buffers with the driver and converts into the application's
+   buffer when it gets dequeued. Converted mmap buffers can be exported as
+   dmabufs with VIDIOC_EXPBUF, this requires kernel udmabuf support.
+
    Note the device name passed to v4l2_open must be of a video4linux2 device,
    if it is anything else (including a video4linux1 device), v4l2_open will
    fail.
@@ -100,6 +105,81 @@ LIBV4L_PUBLIC int v4l2_get_control(int fd, int cid);
 /* This flag is *OBSOLETE*, since version 0.5.98 libv4l *always* reports
    emulated formats to ENUM_FMT, except when conversion is disabled. */
 #define V4L2_ENABLE_ENUM_FMT_EMULATION 0x02
+/* When in mmap conversion mode (because of software controls) and a frame
+   needs no conversion, libv4l2 maps the real driver buffer at the address of
+   the buffer the app mmap-ed instead of copying the frame. Use this flag to
+   always copy the frame data instead. */
+#define V4L2_DISABLE_MMAP_PASSTHROUGH 0x04
+/* When in mmap conversion mode, use a libv4l2 owned thread which dequeues and
+   converts the next frame while the app is still busy with the current one,
+   so that VIDIOC_DQBUF hands out an already converted frame. Since that thread
+   takes the frames from the driver, apps using this should not wait for
+   frames with poll() / select() on the fd, but simply call VIDIOC_DQBUF, which
+   blocks until a converted frame is available (or fails with EAGAIN when the
+   fd is non-blocking). */
+#define V4L2_ENABLE_PIPELINED_CONVERSION 0x08
+/* Make v4l2_read() return the newest frame: when more frames are ready, the
+   older ones get handed back to the driver without converting them. This
+   keeps the latency down for apps which do not keep up with the frame rate.
+   Setting the LIBV4L2_READ_LATEST_FRAME environment variable to 1 does the
+   same for all devices. Note this only applies to read() emulated on top
+   of mmap buffers, which is what libv4l2 uses whenever it can. */
+#define V4L2_READ_LATEST_FRAME 0x10
+
+/* Per device counters, times are in nanoseconds. The conversion counters
+   (convert_ns ... copy_ns) are as kept by libv4lconvert, see
+   v4lconvert_get_stats(). */
+struct v4l2_stats {
+	uint64_t frames;		/* frames handed to the app */
+	uint64_t dropped_frames;	/* frames dropped on decode errors */
+	uint64_t short_frames;		/* short frames handed to the app */
+	uint64_t stale_frames;		/* frames skipped by read() for being
+					   too old or not the newest */
+	uint64_t driver_drops;		/* frames the driver dropped, going by
+					   gaps in the buffer sequence nos */
+	uint64_t dqbuf_wait_ns;		/* waiting for frames in dqbuf / read */
+	uint64_t convert_ns;		/* pixelformat conversion / decoding */
+	uint64_t processing_ns;		/* whitebalance, gamma correction, ... */
+	uint64_t transform_ns;		/* rotate90, flipping and cropping */
+	uint64_t copy_ns;		/* copying frames needing no conversion */
+	/* Buffer queue occupancy: the sum over all frames handed to the app of
+	   the no of buffers still queued with the driver at that time, divide
+	   by frames to get the average, and how often that was 0 */
+	uint64_t queued_sum;
+	uint64_t underruns;
+	unsigned int buffers;		/* no of buffers */
+	unsigned int queued;		/* buffers currently queued */
+};
+
+/* Get the counters for fd, when reset is non 0 they are reset afterwards
+   (except for buffers and queued). Setting the LIBV4L2_STATS_INTERVAL
+   environment variable to a no of seconds makes libv4l2 log the counters
+   of each device at that interval, and on close.
+
+   Returns 0 on success, -1 and sets errno when fd is not a libv4l2 fd. */
+LIBV4L_PUBLIC int v4l2_get_stats(int fd, struct v4l2_stats *stats, int reset);
+
+/* Make v4l2_read() skip frames older than max_age_ms milliseconds (going by
+   the buffer timestamp, so only with drivers using monotonic timestamps),
+   0 turns this off again, which is the default. The default can also be set
+   through the LIBV4L2_READ_MAX_AGE environment variable. Like
+   V4L2_READ_LATEST_FRAME, this only applies to read() emulated on top of
+   mmap buffers. Returns 0 on success, -1 and sets errno on error. */
+LIBV4L_PUBLIC int v4l2_set_read_max_age(int fd, unsigned int max_age_ms);
+
+/* Get / set the no of buffers libv4l2 uses for emulating read() on top of
+   mmap buffers, the default is 4. More buffers make frame drops under load
+   less likely, less keep the latency down. When max_count is larger than
+   count, libv4l2 adds a buffer each time the driver drops frames (as seen
+   from gaps in the buffer sequence nos), up to max_count. The default can
+   also be set through the LIBV4L2_READ_BUFFERS environment variable, as
+   "count" or "count-max_count". A new count is used from the next read(),
+   restarting the stream when it is already running for read().
+   set returns 0 on success, get the current count, both return -1 and set
+   errno on error. */
+LIBV4L_PUBLIC int v4l2_set_read_buffers(int fd, unsigned int count,
+		unsigned int max_count);
+LIBV4L_PUBLIC int v4l2_get_read_buffers(int fd);
 
 /* v4l2_fd_open: open an already opened fd for further use through
    v4l2lib and possibly modify libv4l2's default behavior through the
@@ -42,6 +42,8 @@
 #include <linux/videodev2.h>
 #endif
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
@@ -93,6 +95,14 @@ LIBV4L_PUBLIC int v4lconvert_needs_conversion(struct v4lconvert_data *data,
 		const struct v4l2_format *src_fmt,   /* in */
 		const struct v4l2_format *dest_fmt); /* in */
 
+/* Would v4lconvert_convert() currently just return a copy of the frame, iow
+   is no conversion needed and is none of the processing / flipping active ?
+   Unlike v4lconvert_needs_conversion() this takes the current settings of the
+   software controls into account, so the answer may change per frame. */
+LIBV4L_PUBLIC int v4lconvert_is_passthrough(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,   /* in */
+		const struct v4l2_format *dest_fmt); /* in */
+
 /* This function does the following conversions:
     - format conversion
     - cropping
@@ -116,6 +126,32 @@ LIBV4L_PUBLIC int v4lconvert_convert(struct v4lconvert_data *data,
 		const struct v4l2_format *dest_fmt, /* in */
 		unsigned char *src, int src_size, unsigned char *dest, int dest_size);
 
+/* Returns the no of planes in separate buffers of the multi-planar formats
+   v4lconvert_convert_mplane() can convert from (NV12M, YUV420M and YVU420M),
+   1 for all other formats */
+LIBV4L_PUBLIC int v4lconvert_get_num_planes(unsigned int pixelformat);
+
+/* Just like v4lconvert_convert(), but for a src frame whose planes are in
+   separate buffers, as captured through the multi-planar API. src and
+   src_size hold v4lconvert_get_num_planes() entries, 1 for single-planar
+   formats. src_fmt may be a multi-planar format, then the bytesperline of
+   each plane is used, or a single-planar format, then the bytesperline of
+   the other planes follows from that of the first. Note that v4lconvert_convert()
+   can convert multi-planar formats too, if their planes are one after
+   the other in a single buffer. dest_fmt must describe a single buffer. */
+LIBV4L_PUBLIC int v4lconvert_convert_mplane(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt, /* in */
+		unsigned char *src[], const int src_size[],
+		unsigned char *dest, int dest_size);
+
+/* Do a VIDIOC_TRY_FMT or VIDIOC_S_FMT (request) for the single-planar src
+   format fmt. Formats with their planes in separate buffers can only be set
+   through the multi-planar API, these are passed on as the multi-planar format
+   and fmt gets the single-planar view of the result. */
+LIBV4L_PUBLIC int v4lconvert_src_fmt_ioctl(struct v4lconvert_data *data,
+		unsigned long request, struct v4l2_format *fmt);
+
 /* get a string describing the last error */
 LIBV4L_PUBLIC const char *v4lconvert_get_error_message(struct v4lconvert_data *data);
 
@@ -151,6 +187,73 @@ LIBV4L_PUBLIC int v4lconvert_supported_dst_format(unsigned int pixelformat);
 LIBV4L_PUBLIC int v4lconvert_get_fps(struct v4lconvert_data *data);
 LIBV4L_PUBLIC void v4lconvert_set_fps(struct v4lconvert_data *data, int fps);
 
+/* Get/set the no threads used by v4lconvert_convert(). When more then 1 the
+   band safe conversion steps (bayer demosaicing, packed yuv to rgb, software
+   processing and flipping) are split over that many threads, and so is the
+   decoding of (M)JPEG frames with restart markers. Other steps such as
+   rotate90 stay single threaded. Passing 0 uses 1 thread per online
+   cpu. The default is 1, set_threads returns -1 and sets errno on error */
+LIBV4L_PUBLIC int v4lconvert_get_threads(struct v4lconvert_data *data);
+LIBV4L_PUBLIC int v4lconvert_set_threads(struct v4lconvert_data *data, int threads);
+
+/* Get/set the algorithm used for demosaicing bayer data to rgb24 / bgr24.
+   The default is bilinear, edge aware interpolates along edges instead of
+   across them which avoids most zippering for a small speed penalty.
+   set_demosaic returns -1 and sets errno on error */
+#define V4LCONVERT_DEMOSAIC_BILINEAR	0
+#define V4LCONVERT_DEMOSAIC_EDGE_AWARE	1
+LIBV4L_PUBLIC int v4lconvert_get_demosaic(struct v4lconvert_data *data);
+LIBV4L_PUBLIC int v4lconvert_set_demosaic(struct v4lconvert_data *data, int mode);
+
+/* Counters kept by v4lconvert_convert() / v4lconvert_convert_mplane(), times
+   are in nanoseconds. When conversion, flipping and cropping are done in a
+   single pass, all of it counts as conversion time */
+struct v4lconvert_stats {
+	uint64_t frames;		/* frames converted */
+	uint64_t errors;		/* frames which could not be converted */
+	uint64_t short_frames;		/* of those, frames which were short */
+	uint64_t convert_ns;		/* pixelformat conversion / decoding */
+	uint64_t processing_ns;		/* whitebalance, gamma correction, ... */
+	uint64_t transform_ns;		/* rotate90, flipping and cropping */
+	uint64_t copy_ns;		/* copying frames needing no conversion */
+};
+
+/* Get / reset the counters, these are cheap enough to be always on */
+LIBV4L_PUBLIC void v4lconvert_get_stats(struct v4lconvert_data *data,
+		struct v4lconvert_stats *stats);
+LIBV4L_PUBLIC void v4lconvert_reset_stats(struct v4lconvert_data *data);
+
+/* Convert count frames of the same src_fmt, for instance from a recorded
+   raw stream, src / src_size hold the count frames and dest the count
+   destination buffers of dest_size bytes each. The frames get divided over
+   the threads set up through v4lconvert_set_threads(), each with its own
+   scratch buffers. Software processing (whitebalance, etc.) can not be
+   split like this, as it adapts itself from frame to frame, with it active,
+   or with a src format which is decoded relative to the previous frame, the
+   frames are converted one after the other by the calling thread.
+
+   dest_result[i] gets what v4lconvert_convert() would have returned for
+   frame i. Returns the no of frames converted, with errno and the error
+   message set for the first frame which failed when that is less than
+   count, or -1 when the arguments are invalid. stats, when not NULL, gets
+   the totals of the batch, the per stage times are added to the counters
+   of v4lconvert_get_stats(). */
+struct v4lconvert_batch_stats {
+	uint64_t frames;		/* frames converted */
+	uint64_t errors;		/* frames which could not be converted */
+	uint64_t src_bytes;		/* src bytes of the converted frames */
+	uint64_t dest_bytes;		/* bytes written to dest */
+	uint64_t elapsed_ns;		/* wall clock time of the batch */
+	int threads;			/* no of threads used */
+};
+
+LIBV4L_PUBLIC int v4lconvert_convert_batch(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt, /* in */
+		unsigned char *src[], const int src_size[],
+		unsigned char *dest[], int dest_size, int dest_result[],
+		int count, struct v4lconvert_batch_stats *stats);
+
 /* Fixup bytesperline and sizeimage for supported destination formats */
 LIBV4L_PUBLIC void v4lconvert_fixup_fmt(struct v4l2_format *fmt);
 
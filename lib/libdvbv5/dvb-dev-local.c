@@ -26,6 +26,7 @@
 #include <locale.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include <config.h>
 
@@ -510,6 +511,8 @@ static int dvb_local_close(struct dvb_open_descriptor *open_dev)
 		if (dev->dvb_type == DVB_DEVICE_DEMUX)
 			dvb_dev_dmx_stop(open_dev);
 
+		dvb_dev_mmap_stop(open_dev);
+
 		close(open_dev->fd);
 	}
 
@@ -633,6 +636,173 @@ static ssize_t dvb_local_read(struct dvb_open_descriptor *open_dev,
 	return ret;
 }
 
+/*
+ * Memory-mapped demux / dvr buffers: the Kernel fills the buffers directly
+ * from the demux, and dvb_local_mmap_read() hands them out without copying.
+ *
+ * On a blocking file descriptor, the Kernel only hands out a buffer once
+ * it is full, so the buffers are kept small enough to fill within a second
+ * or so even for a single low bitrate service.
+ */
+
+#define DVB_MMAP_DEFAULT_COUNT	64
+#define DVB_MMAP_DEFAULT_SIZE	(64 * 188)
+
+static void dvb_local_mmap_stop(struct dvb_open_descriptor *open_dev)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dmx_requestbuffers req;
+	unsigned int i;
+
+	if (!open_dev->buffers)
+		return;
+
+	for (i = 0; i < open_dev->n_buffers; i++) {
+		if (open_dev->buffers[i].start != MAP_FAILED)
+			munmap(open_dev->buffers[i].start,
+			       open_dev->buffers[i].length);
+	}
+	free(open_dev->buffers);
+	open_dev->buffers = NULL;
+	open_dev->n_buffers = 0;
+	open_dev->dq_buffer = -1;
+
+	/*
+	 * Freeing the Kernel buffers stops streaming into them. Buffers
+	 * still queued at that point are dropped.
+	 */
+	memset(&req, 0, sizeof(req));
+	if (xioctl(open_dev->fd, DMX_REQBUFS, &req) == -1)
+		dvb_perror(_("DMX_REQBUFS failed"));
+}
+
+static int dvb_local_mmap_start(struct dvb_open_descriptor *open_dev,
+				unsigned int count, unsigned int size)
+{
+	struct dvb_dev_list *dev = open_dev->dev;
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dmx_requestbuffers req;
+	struct dmx_buffer buf;
+	int ret, fd = open_dev->fd;
+	unsigned int i;
+
+	if (dev->dvb_type != DVB_DEVICE_DEMUX && dev->dvb_type != DVB_DEVICE_DVR)
+		return -EINVAL;
+
+	if (open_dev->buffers)
+		return -EBUSY;
+
+	memset(&req, 0, sizeof(req));
+	req.count = count ? count : DVB_MMAP_DEFAULT_COUNT;
+	req.size = size ? size : DVB_MMAP_DEFAULT_SIZE;
+
+	if (xioctl(fd, DMX_REQBUFS, &req) == -1) {
+		ret = -errno;
+		/* Kernels without CONFIG_DVB_MMAP: the caller can use read() */
+		if (errno != ENOTTY && errno != EINVAL)
+			dvb_perror(_("DMX_REQBUFS failed"));
+		return ret;
+	}
+	if (!req.count) {
+		dvb_logerr(_("DMX_REQBUFS: no buffers allocated"));
+		return -ENOMEM;
+	}
+
+	open_dev->buffers = calloc(req.count, sizeof(*open_dev->buffers));
+	if (!open_dev->buffers) {
+		dvb_perror(_("Can't allocate mmap buffers"));
+		return -ENOMEM;
+	}
+	for (i = 0; i < req.count; i++)
+		open_dev->buffers[i].start = MAP_FAILED;
+	open_dev->n_buffers = req.count;
+	open_dev->dq_buffer = -1;
+
+	for (i = 0; i < req.count; i++) {
+		memset(&buf, 0, sizeof(buf));
+		buf.index = i;
+		if (xioctl(fd, DMX_QUERYBUF, &buf) == -1) {
+			ret = -errno;
+			dvb_perror(_("DMX_QUERYBUF failed"));
+			goto err;
+		}
+
+		open_dev->buffers[i].length = buf.length;
+		open_dev->buffers[i].start = mmap(NULL, buf.length, PROT_READ,
+						  MAP_SHARED, fd, buf.offset);
+		if (open_dev->buffers[i].start == MAP_FAILED) {
+			ret = -errno;
+			dvb_perror(_("mmap of demux buffer failed"));
+			goto err;
+		}
+	}
+
+	/* The Kernel starts streaming into the buffers once they're queued */
+	for (i = 0; i < req.count; i++) {
+		memset(&buf, 0, sizeof(buf));
+		buf.index = i;
+		if (xioctl(fd, DMX_QBUF, &buf) == -1) {
+			ret = -errno;
+			dvb_perror(_("DMX_QBUF failed"));
+			goto err;
+		}
+	}
+
+	if (parms->p.verbose)
+		dvb_log(_("Using %d memory-mapped buffers of %d bytes"),
+			req.count, req.size);
+
+	return 0;
+
+err:
+	dvb_local_mmap_stop(open_dev);
+	return ret;
+}
+
+static ssize_t dvb_local_mmap_read(struct dvb_open_descriptor *open_dev,
+				   const void **data, unsigned int *flags)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dmx_buffer buf;
+	int fd = open_dev->fd;
+
+	if (!open_dev->buffers)
+		return -EINVAL;
+
+	/* Give the buffer handed out by the previous call back to the Kernel */
+	if (open_dev->dq_buffer >= 0) {
+		memset(&buf, 0, sizeof(buf));
+		buf.index = open_dev->dq_buffer;
+		if (TEMP_FAILURE_RETRY(ioctl(fd, DMX_QBUF, &buf)) == -1) {
+			dvb_perror(_("DMX_QBUF failed"));
+			return -errno;
+		}
+		open_dev->dq_buffer = -1;
+	}
+
+	/* Not retried on EINTR, so that signals can stop a waiting caller */
+	memset(&buf, 0, sizeof(buf));
+	if (ioctl(fd, DMX_DQBUF, &buf) == -1) {
+		if (errno != EAGAIN && errno != EINTR)
+			dvb_perror(_("DMX_DQBUF failed"));
+		return -errno;
+	}
+	if (buf.index >= open_dev->n_buffers) {
+		dvb_logerr(_("DMX_DQBUF: invalid buffer index %d"), buf.index);
+		return -EINVAL;
+	}
+
+	open_dev->dq_buffer = buf.index;
+	*data = open_dev->buffers[buf.index].start;
+	if (flags)
+		*flags = buf.flags;
+
+	return buf.bytesused;
+}
+
 static int dvb_local_dmx_set_pesfilter(struct dvb_open_descriptor *open_dev,
 			      int pid, dmx_pes_type_t type,
 			      dmx_output_t output, int bufsize)
@@ -847,6 +1017,9 @@ void dvb_dev_local_init(struct dvb_device_priv *dvb)
 	ops->dmx_stop = dvb_local_dmx_stop;
 	ops->set_bufsize = dvb_local_set_bufsize;
 	ops->read = dvb_local_read;
+	ops->mmap_start = dvb_local_mmap_start;
+	ops->mmap_read = dvb_local_mmap_read;
+	ops->mmap_stop = dvb_local_mmap_stop;
 	ops->dmx_set_pesfilter = dvb_local_dmx_set_pesfilter;
 	ops->dmx_set_section_filter = dvb_local_dmx_set_section_filter;
 	ops->dmx_get_pmt_pid = dvb_local_dmx_get_pmt_pid;
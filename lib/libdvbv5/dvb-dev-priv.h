@@ -24,11 +24,21 @@
 
 struct dvb_device_priv;
 
+struct dvb_mmap_buffer {
+	void *start;
+	size_t length;
+};
+
 struct dvb_open_descriptor {
 	int fd;
 	struct dvb_dev_list *dev;
 	struct dvb_device_priv *dvb;
 	struct dvb_open_descriptor *next;
+
+	/* Memory-mapped demux buffers, if dvb_dev_mmap_start() was called */
+	struct dvb_mmap_buffer *buffers;
+	unsigned int n_buffers;
+	int dq_buffer;		/* handed out by dvb_dev_mmap_read(), or -1 */
 };
 
 struct dvb_dev_ops {
@@ -49,6 +59,11 @@ struct dvb_dev_ops {
 			   int buffersize);
 	ssize_t (*read)(struct dvb_open_descriptor *open_dev,
 			void *buf, size_t count);
+	int (*mmap_start)(struct dvb_open_descriptor *open_dev,
+			  unsigned int count, unsigned int size);
+	ssize_t (*mmap_read)(struct dvb_open_descriptor *open_dev,
+			     const void **buf, unsigned int *flags);
+	void (*mmap_stop)(struct dvb_open_descriptor *open_dev);
 	int (*dmx_set_pesfilter)(struct dvb_open_descriptor *open_dev,
 				 int pid, dmx_pes_type_t type,
 				 dmx_output_t output, int bufsize);
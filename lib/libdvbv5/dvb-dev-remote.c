@@ -28,6 +28,7 @@
 #endif
 
 #include <ctype.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <libudev.h>
 #include <stdio.h>
@@ -65,17 +66,27 @@ const char *daemon_version = "dvbv5-daemon version " V4L_UTILS_VERSION;
  * Internal data structures
  */
 
+/* Default ringbuffer size, dvb_dev_set_bufsize() can make it larger */
 #define RINGBUF_SIZE (REMOTE_BUF_SIZE * 32)
 
+/*
+ * Data received for an open device, written by the receive_data() thread
+ * and read by dvb_remote_read(). As the receive thread also handles the
+ * command responses, it never waits for space: data which doesn't fit is
+ * dropped, and the next read returns -EOVERFLOW, like a local demux does.
+ */
 struct ringbuffer {
 	/* Should be the first member of struct */
 	struct dvb_open_descriptor open_dev;
 
 	/* ringbuffer handling */
 	int rc;
-	ssize_t read, write;
-	char buf[RINGBUF_SIZE];
+	size_t size, read, used;
+	char *buf;
+	uint64_t dropped;		/* bytes dropped due to overflows */
+	int nonblock;			/* opened with O_NONBLOCK */
 	pthread_mutex_t lock;
+	pthread_cond_t cond;		/* signaled on new data and errors */
 };
 
 struct queued_msg {
@@ -103,6 +114,9 @@ struct dvb_dev_remote_priv {
 	pthread_t recv_id;
 	pthread_mutex_t lock_io;
 
+	/* buffer for the binary data frames */
+	char *data_buf;
+
 	char output_charset[256];
 	char default_charset[256];
 
@@ -502,8 +516,10 @@ static ssize_t scan_data(struct dvb_v5_fe_parms_priv *parms, char *buf,
 	return p - buf;
 }
 
-static void dvb_dev_remote_disconnect(struct dvb_dev_remote_priv *priv)
+static void dvb_dev_remote_disconnect(struct dvb_device_priv *dvb)
 {
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct dvb_open_descriptor *cur;
 	struct queued_msg *msg;
 
 	priv->disconnected = 1;
@@ -512,6 +528,15 @@ static void dvb_dev_remote_disconnect(struct dvb_dev_remote_priv *priv)
 		msg->retval = -ENODEV;
 		pthread_cond_signal(&msg->cond);
 	}
+
+	/* Wake up anyone waiting for data */
+	for (cur = dvb->open_list.next; cur; cur = cur->next) {
+		struct ringbuffer *ringbuf = (struct ringbuffer *)cur;
+
+		pthread_mutex_lock(&ringbuf->lock);
+		pthread_cond_broadcast(&ringbuf->cond);
+		pthread_mutex_unlock(&ringbuf->lock);
+	}
 	/* Close the socket */
 	if (priv->fd > 0) {
 		close(priv->fd);
@@ -523,66 +548,119 @@ static void write_ringbuffer(struct dvb_open_descriptor *open_dev,
 			    ssize_t size, char *buf)
 {
 	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
-	ssize_t len = size, split;
+	size_t write, split;
 
 	pthread_mutex_lock(&ringbuf->lock);
 
-	split = (ringbuf->write + size > RINGBUF_SIZE) ?
-		 RINGBUF_SIZE - ringbuf->write : 0;
-
-	if (split > 0) {
-		memcpy(&ringbuf->buf[ringbuf->write], buf, split);
-		buf += split;
-		len -= split;
-		ringbuf->write = 0;
+	/* Drop what doesn't fit, keeping the data already queued intact */
+	if (size > ringbuf->size - ringbuf->used) {
+		ringbuf->dropped += size;
+		ringbuf->rc = -EOVERFLOW;
+		pthread_cond_signal(&ringbuf->cond);
+		pthread_mutex_unlock(&ringbuf->lock);
+		return;
 	}
 
-	memcpy(&ringbuf->buf[ringbuf->write], buf, len);
-	ringbuf->write = (ringbuf->write + len) % RINGBUF_SIZE;
+	write = (ringbuf->read + ringbuf->used) % ringbuf->size;
+	split = ringbuf->size - write;
+	if (split > size)
+		split = size;
 
-	/* Detect buffer overflows */
-	if ((unsigned)((ringbuf->write - ringbuf->read) % RINGBUF_SIZE) < size)
-		ringbuf->rc = -EOVERFLOW;
+	memcpy(&ringbuf->buf[write], buf, split);
+	memcpy(ringbuf->buf, buf + split, size - split);
+	ringbuf->used += size;
 
+	pthread_cond_signal(&ringbuf->cond);
 	pthread_mutex_unlock(&ringbuf->lock);
 }
 
-static void read_ringbuffer(struct dvb_open_descriptor *open_dev,
-			    size_t *len, char *buf)
+/*
+ * Waits for data to arrive, and returns as much as there is, up to *len,
+ * unless an error got queued, or the remote end disconnected. If the
+ * device was opened with O_NONBLOCK, returns -EAGAIN instead of waiting.
+ */
+static int read_ringbuffer(struct dvb_open_descriptor *open_dev,
+			   size_t *len, char *buf)
 {
 	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
-	ssize_t size, split;
-
-	/* Sets the read size */
-	if (*len > REMOTE_BUF_SIZE)
-		*len = REMOTE_BUF_SIZE;
+	struct dvb_dev_remote_priv *priv = open_dev->dvb->priv;
+	size_t size, split;
+	int ret;
 
-	/* Wait for data to arrive */
 	pthread_mutex_lock(&ringbuf->lock);
-	while ((unsigned)((ringbuf->write - ringbuf->read) % RINGBUF_SIZE) < *len) {
+	if (ringbuf->nonblock && !ringbuf->used && !ringbuf->rc &&
+	    !priv->disconnected) {
 		pthread_mutex_unlock(&ringbuf->lock);
-		usleep(1);
-		pthread_mutex_lock(&ringbuf->lock);
+		return -EAGAIN;
+	}
+	while (!ringbuf->used && !ringbuf->rc && !priv->disconnected)
+		pthread_cond_wait(&ringbuf->cond, &ringbuf->lock);
+
+	if (ringbuf->rc) {
+		ret = ringbuf->rc;
+		ringbuf->rc = 0;
+		pthread_mutex_unlock(&ringbuf->lock);
+		return ret;
+	}
+	if (!ringbuf->used) {
+		pthread_mutex_unlock(&ringbuf->lock);
+		return -ENODEV;
 	}
 
 	size = *len;
+	if (size > ringbuf->used)
+		size = ringbuf->used;
+
+	split = ringbuf->size - ringbuf->read;
+	if (split > size)
+		split = size;
 
-	*len = 0;
-	split = (ringbuf->read + size > RINGBUF_SIZE) ? RINGBUF_SIZE - ringbuf->read : 0;
-	if (split > 0) {
+	memcpy(buf, &ringbuf->buf[ringbuf->read], split);
+	memcpy(buf + split, ringbuf->buf, size - split);
+
+	ringbuf->read = (ringbuf->read + size) % ringbuf->size;
+	ringbuf->used -= size;
+	*len = size;
+
+	pthread_mutex_unlock(&ringbuf->lock);
+
+	return 0;
+}
+
+/* Grows the ringbuffer, keeping any data already there */
+static int resize_ringbuffer(struct dvb_open_descriptor *open_dev,
+			     size_t size)
+{
+	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
+	size_t split;
+	char *buf;
 
-		memcpy(buf, &ringbuf->buf[ringbuf->read], split);
-		buf += split;
-		size -= split;
-		*len += split;
-		ringbuf->read = 0;
+	pthread_mutex_lock(&ringbuf->lock);
+	if (size <= ringbuf->size) {
+		pthread_mutex_unlock(&ringbuf->lock);
+		return 0;
+	}
+
+	buf = malloc(size);
+	if (!buf) {
+		pthread_mutex_unlock(&ringbuf->lock);
+		return -ENOMEM;
 	}
-	memcpy(buf, &ringbuf->buf[ringbuf->read], size);
-	*len += size;
 
-	ringbuf->read = (ringbuf->read + size) % RINGBUF_SIZE;
+	split = ringbuf->size - ringbuf->read;
+	if (split > ringbuf->used)
+		split = ringbuf->used;
+	memcpy(buf, &ringbuf->buf[ringbuf->read], split);
+	memcpy(buf + split, ringbuf->buf, ringbuf->used - split);
+
+	free(ringbuf->buf);
+	ringbuf->buf = buf;
+	ringbuf->size = size;
+	ringbuf->read = 0;
 
 	pthread_mutex_unlock(&ringbuf->lock);
+
+	return 0;
 }
 
 static void log_hexdump(struct dvb_v5_fe_parms_priv *parms, int len,
@@ -613,36 +691,111 @@ static void log_hexdump(struct dvb_v5_fe_parms_priv *parms, int len,
 	}
 }
 
+static void set_ringbuffer_error(struct dvb_open_descriptor *open_dev,
+				 int retval)
+{
+	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
+
+	pthread_mutex_lock(&ringbuf->lock);
+	ringbuf->rc = retval;
+	pthread_cond_signal(&ringbuf->cond);
+	pthread_mutex_unlock(&ringbuf->lock);
+}
+
+/* Stores the data chunks of a REMOTE_DATA_FRAME at the ringbuffers */
+static void receive_data_frame(struct dvb_device_priv *dvb, char *buf,
+			       ssize_t size)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_open_descriptor *cur;
+	int32_t uid, len;
+
+	while (size >= 8) {
+		memcpy(&uid, buf, 4);
+		memcpy(&len, buf + 4, 4);
+		uid = be32toh(uid);
+		len = be32toh(len);
+		buf += 8;
+		size -= 8;
+
+		if (len > size) {
+			dvb_logerr("invalid data frame chunk with size %d", len);
+			return;
+		}
+
+		for (cur = dvb->open_list.next; cur; cur = cur->next) {
+			if (cur->fd == uid)
+				break;
+		}
+		/* FIXME: should we abort here? */
+		if (!cur)
+			dvb_logerr("received data for unknown ID %d", uid);
+		else if (len < 0)
+			set_ringbuffer_error(cur, len);
+		else
+			write_ringbuffer(cur, len, buf);
+
+		if (len > 0) {
+			buf += len;
+			size -= len;
+		}
+	}
+}
+
 static void *receive_data(void *privdata)
 {
 	struct dvb_device_priv *dvb = privdata;
 	struct dvb_dev_remote_priv *priv = dvb->priv;
 	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
 	struct queued_msg *msg;
-	struct dvb_open_descriptor *cur;
 	char buf[REMOTE_BUF_SIZE + 8], cmd[REMOTE_BUF_SIZE], *args;
 	ssize_t size, args_size;
-	int ret, retval, seq, handled, uid, found;
+	uint32_t len;
+	int ret, retval, seq, handled;
 
 	do {
-		size = recv(priv->fd, buf, 4, MSG_WAITALL);
+		size = recv(priv->fd, &len, 4, MSG_WAITALL);
 		if (size < 4) {
 			if (size < 0)
 				dvb_perror("recv");
 			else
 				dvb_logerr("remote end disconnected");
-			dvb_dev_remote_disconnect(priv);
+			dvb_dev_remote_disconnect(dvb);
+			return NULL;
+		}
+		len = be32toh(len);
+
+		/* Data read from the devices */
+		if (len & REMOTE_DATA_FRAME) {
+			size = len & ~REMOTE_DATA_FRAME;
+			if (size > REMOTE_DATA_FRAME_SIZE) {
+				dvb_logerr("data frame too big: %zd", size);
+				dvb_dev_remote_disconnect(dvb);
+				return NULL;
+			}
+			ret = recv(priv->fd, priv->data_buf, size, MSG_WAITALL);
+			if (ret != size) {
+				dvb_logerr("remote end disconnected");
+				dvb_dev_remote_disconnect(dvb);
+				return NULL;
+			}
+			receive_data_frame(dvb, priv->data_buf, size);
+			continue;
+		}
+
+		size = len;
+		if (size > sizeof(buf)) {
+			dvb_logerr("message too big: %zd", size);
+			dvb_dev_remote_disconnect(dvb);
 			return NULL;
 		}
-		size = (uint32_t)buf[0] << 24 | (uint32_t)buf[1] << 16 |
-		       (uint32_t)buf[2] << 8 | (uint32_t)buf[3];
 		ret = recv(priv->fd, buf, size, MSG_WAITALL);
 		if (ret != size) {
 			if (size < 0)
 				dvb_perror("recv");
 			else
 				dvb_logerr("remote end disconnected");
-			dvb_dev_remote_disconnect(priv);
+			dvb_dev_remote_disconnect(dvb);
 			return NULL;
 		}
 
@@ -687,33 +840,6 @@ static void *receive_data(void *privdata)
 					args += ret;
 					args_size -= ret;
 				}
-			} else if (!strcmp(cmd, "data_read")) {
-				ret = scan_data(parms, args, args_size,
-						"%i", &uid);
-				if (ret <= 0)
-					continue;
-
-				args += ret;
-				args_size -= ret;
-
-				found = 0;
-				for (cur = dvb->open_list.next; cur; cur = cur->next) {
-					if (cur->fd == uid) {
-						struct ringbuffer *ringbuf = (struct ringbuffer *)cur;
-
-						found = 1;
-						if (retval < 0) {
-							ringbuf->rc = retval;
-							continue;
-						}
-						write_ringbuffer(cur, args_size, args);
-					}
-				}
-				/* FIXME: should we abort here? */
-				if (!found)
-					dvb_logerr("received data for unknown ID %d", uid);
-				args += args_size;
-				args_size = 0;
 			} else {
 				dvb_logerr("unexpected message type: %s", cmd);
 				ret = -1;
@@ -1039,9 +1165,22 @@ static struct dvb_open_descriptor *dvb_remote_open(struct dvb_device_priv *dvb,
 	}
 	open_dev = &ringbuf->open_dev;
 
+	/* The daemon ignores O_NONBLOCK, it is handled by read_ringbuffer() */
+	ringbuf->nonblock = !!(flags & O_NONBLOCK);
+	ringbuf->size = RINGBUF_SIZE;
+	ringbuf->buf = malloc(ringbuf->size);
+	if (!ringbuf->buf) {
+		dvb_perror("Can't create file descriptor");
+		free(ringbuf);
+		return NULL;
+	}
+
 	msg = send_fmt(dvb, priv->fd, "dev_open", "%s%i", sysname, flags);
-	if (!msg)
+	if (!msg) {
+		free(ringbuf->buf);
+		free(ringbuf);
 		return NULL;
+	}
 
 	ret = pthread_cond_wait(&msg->cond, &msg->lock);
 	if (ret < 0) {
@@ -1059,6 +1198,7 @@ static struct dvb_open_descriptor *dvb_remote_open(struct dvb_device_priv *dvb,
 
 	/* Initialize ringbuffer data*/
 	pthread_mutex_init(&ringbuf->lock, NULL);
+	pthread_cond_init(&ringbuf->cond, NULL);
 
 	cur = &dvb->open_list;
 	while (cur->next)
@@ -1076,6 +1216,8 @@ error:
 	pthread_mutex_unlock(&msg->lock);
 
 	free_msg(dvb, msg);
+	free(ringbuf->buf);
+	free(ringbuf);
 	return NULL;
 }
 
@@ -1114,7 +1256,12 @@ error:
 	for (cur = &dvb->open_list; cur->next; cur = cur->next) {
 		if (cur->next == open_dev) {
 			cur->next = open_dev->next;
+			if (ringbuffer->dropped)
+				dvb_logwarn("dropped %llu bytes due to buffer overflows",
+					    (unsigned long long)ringbuffer->dropped);
+			pthread_cond_destroy(&ringbuffer->cond);
 			pthread_mutex_destroy(&ringbuffer->lock);
+			free(ringbuffer->buf);
 			free(ringbuffer);
 			goto ret;
 		}
@@ -1175,6 +1322,13 @@ static int dvb_remote_set_bufsize(struct dvb_open_descriptor *open_dev,
 	if (priv->disconnected)
 		return -ENODEV;
 
+	/* The data is buffered here too, so it should fit as well */
+	ret = bufsize > 0 ? resize_ringbuffer(open_dev, bufsize) : 0;
+	if (ret < 0) {
+		dvb_logerr("Can't resize buffer to %d bytes", bufsize);
+		return ret;
+	}
+
 	msg = send_fmt(dvb, priv->fd, "dev_set_bufsize", "%i%i",
 		       open_dev->fd, bufsize);
 	if (!msg)
@@ -1199,7 +1353,6 @@ error:
 static ssize_t dvb_remote_read(struct dvb_open_descriptor *open_dev,
 		     void *buf, size_t count)
 {
-	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
 	struct dvb_device_priv *dvb = open_dev->dvb;
 	struct dvb_dev_remote_priv *priv = dvb->priv;
 	int ret;
@@ -1207,13 +1360,9 @@ static ssize_t dvb_remote_read(struct dvb_open_descriptor *open_dev,
 	if (priv->disconnected)
 		return -ENODEV;
 
-	if (ringbuf->rc) {
-		ret = ringbuf->rc;
-		ringbuf->rc = 0;
+	ret = read_ringbuffer(open_dev, &count, buf);
+	if (ret < 0)
 		return ret;
-	}
-
-	read_ringbuffer(open_dev, &count, buf);
 
 	return count;
 }
@@ -1231,6 +1380,10 @@ static int dvb_remote_dmx_set_pesfilter(struct dvb_open_descriptor *open_dev,
 	if (priv->disconnected)
 		return -ENODEV;
 
+	/* Failing here is not fatal, as for local devices */
+	if (bufsize > 0 && resize_ringbuffer(open_dev, bufsize) < 0)
+		dvb_logerr("Can't resize buffer to %d bytes", bufsize);
+
 	msg = send_fmt(dvb, priv->fd, "dev_dmx_set_pesfilter", "%i%i%i%i%i",
 		       open_dev->fd, pid, type, output, bufsize);
 	if (!msg)
@@ -1659,7 +1812,7 @@ static void dvb_dev_remote_free(struct dvb_device_priv *dvb)
 	pthread_cancel(priv->recv_id);
 
 	/* Cancel any pending messages */
-	dvb_dev_remote_disconnect(priv);
+	dvb_dev_remote_disconnect(dvb);
 
 	/* Give some time any pending message to be handled */
 	do {
@@ -1683,6 +1836,7 @@ static void dvb_dev_remote_free(struct dvb_device_priv *dvb)
 		priv->fd = 0;
 	}
 
+	free(priv->data_buf);
 	free(priv);
 }
 
@@ -1702,6 +1856,13 @@ int dvb_dev_remote_init(struct dvb_device *d, char *server, int port)
 	if (!priv)
 		return -ENOMEM;
 
+	priv->data_buf = malloc(REMOTE_DATA_FRAME_SIZE);
+	if (!priv->data_buf) {
+		free(priv);
+		dvb->priv = NULL;
+		return -ENOMEM;
+	}
+
 	strcpy(priv->output_charset, "utf-8");
 	strcpy(priv->default_charset, "iso-8859-1");
 
@@ -1731,7 +1892,7 @@ int dvb_dev_remote_init(struct dvb_device *d, char *server, int port)
 	}
 
 	/* Set large buffer for read() to work better */
-	bufsize = REMOTE_BUF_SIZE;
+	bufsize = RINGBUF_SIZE;
 	setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
 		   (void *)&bufsize, (int)sizeof(bufsize));
 
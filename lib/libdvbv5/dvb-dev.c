@@ -22,6 +22,7 @@
 #include <locale.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 
 #include <config.h>
 
@@ -284,6 +285,39 @@ ssize_t dvb_dev_read(struct dvb_open_descriptor *open_dev,
 	return ops->read(open_dev, buf, count);
 }
 
+int dvb_dev_mmap_start(struct dvb_open_descriptor *open_dev,
+		       unsigned int count, unsigned int size)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_dev_ops *ops = &dvb->ops;
+
+	if (!ops->mmap_start)
+		return -ENOTSUP;
+
+	return ops->mmap_start(open_dev, count, size);
+}
+
+ssize_t dvb_dev_mmap_read(struct dvb_open_descriptor *open_dev,
+			  const void **buf, unsigned int *flags)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_dev_ops *ops = &dvb->ops;
+
+	if (!ops->mmap_read)
+		return -ENOTSUP;
+
+	return ops->mmap_read(open_dev, buf, flags);
+}
+
+void dvb_dev_mmap_stop(struct dvb_open_descriptor *open_dev)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_dev_ops *ops = &dvb->ops;
+
+	if (ops->mmap_stop)
+		ops->mmap_stop(open_dev);
+}
+
 int dvb_dev_dmx_set_pesfilter(struct dvb_open_descriptor *open_dev,
 			      int pid, dmx_pes_type_t type,
 			      dmx_output_t output, int bufsize)
@@ -76,6 +76,9 @@ struct dvb_v5_fe_parms_priv {
 	int				high_band;
 	unsigned			freq_offset;
 
+	/* Max number of section filters used by dvb_get_ts_tables() */
+	unsigned			scan_filters;
+
 	dvb_logfunc_priv		logfunc_priv;
 	void				*logpriv;
 };
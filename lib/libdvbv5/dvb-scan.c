@@ -35,6 +35,9 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/time.h>
 
 #include "dvb-fe-priv.h"
@@ -447,6 +450,539 @@ void dvb_scan_free_handler_table(struct dvb_v5_descriptors *dvb_scan_handler)
 	free(dvb_scan_handler);
 }
 
+/*
+ * Reading the tables in parallel: instead of reading one table after the
+ * other, each table gets a section filter on its own demux file descriptor,
+ * and the sections of all of them are handled by a single poll() loop, as
+ * they arrive. The time spent per transponder is then bounded by the
+ * slowest table, and not by the sum of all of them.
+ *
+ * Tables that depend on others (PMTs on PAT, SDT on VCT, other NIT/SDT on
+ * NIT/SDT) are started once the table they depend on is done. At most
+ * parms->scan_filters filters are kept active at the same time, as the
+ * number of hardware section filters is limited on several demods.
+ */
+
+enum ts_table_type {
+	TS_TABLE_PAT,
+	TS_TABLE_VCT,
+	TS_TABLE_PMT,
+	TS_TABLE_NIT,
+	TS_TABLE_SDT,
+	TS_TABLE_NIT2,
+	TS_TABLE_SDT2,
+};
+
+enum ts_table_state {
+	TS_TABLE_WAITING,	/* waits for the table it depends on */
+	TS_TABLE_PENDING,	/* waits for a free section filter */
+	TS_TABLE_ACTIVE,
+	TS_TABLE_DONE,
+};
+
+struct ts_table_req {
+	enum ts_table_type type;
+	enum ts_table_state state;
+	struct dvb_table_filter sect;
+	unsigned timeout;		/* in seconds */
+	int after;			/* index of the table it depends on */
+	int prog;			/* PMT: index at the program array */
+	int filter;			/* index at the filters array */
+	uint64_t deadline;		/* in ms */
+};
+
+struct ts_table_filter {
+	int fd;
+	int owned;			/* opened here, should be closed */
+	int busy;
+};
+
+struct ts_tables {
+	struct dvb_v5_fe_parms_priv *parms;
+	struct dvb_v5_descriptors *dvb_scan_handler;
+	unsigned other_nit, pat_pmt_time;
+
+	struct ts_table_req *req;
+	int num_req;
+
+	struct ts_table_filter *filters;
+	int num_filters, max_filters;
+	char dmx_path[PATH_MAX];
+};
+
+static uint64_t ts_tables_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int ts_tables_add(struct ts_tables *t, enum ts_table_type type,
+			 unsigned char tid, uint16_t pid, void **table,
+			 unsigned timeout, int after)
+{
+	struct dvb_v5_fe_parms_priv *parms = t->parms;
+	struct ts_table_req *req;
+
+	req = realloc(t->req, sizeof(*t->req) * (t->num_req + 1));
+	if (!req) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		return -1;
+	}
+	t->req = req;
+	req += t->num_req;
+
+	memset(req, 0, sizeof(*req));
+	req->type = type;
+	req->state = after < 0 ? TS_TABLE_PENDING : TS_TABLE_WAITING;
+	req->sect.tid = tid;
+	req->sect.pid = pid;
+	req->sect.ts_id = -1;
+	req->sect.table = table;
+	req->timeout = timeout;
+	req->after = after;
+	req->prog = -1;
+	req->filter = -1;
+
+	return t->num_req++;
+}
+
+/* Returns a free section filter, opening a new demux fd if needed */
+static int ts_tables_get_filter(struct ts_tables *t)
+{
+	struct dvb_v5_fe_parms_priv *parms = t->parms;
+	struct ts_table_filter *f;
+	int i, fd;
+
+	for (i = 0; i < t->num_filters; i++)
+		if (!t->filters[i].busy)
+			return i;
+
+	if (t->num_filters >= t->max_filters || !t->dmx_path[0])
+		return -1;
+
+	fd = open(t->dmx_path, O_RDWR | O_NONBLOCK);
+	if (fd < 0) {
+		if (parms->p.verbose)
+			dvb_perror(t->dmx_path);
+		/* Don't try to open more of them */
+		t->max_filters = t->num_filters;
+		return -1;
+	}
+
+	f = &t->filters[t->num_filters];
+	f->fd = fd;
+	f->owned = 1;
+	f->busy = 0;
+
+	return t->num_filters++;
+}
+
+static int ts_tables_start(struct ts_tables *t, struct ts_table_req *req)
+{
+	struct dvb_v5_fe_parms_priv *parms = t->parms;
+	uint8_t mask = 0xff;
+	int i, fd, ret;
+
+	i = ts_tables_get_filter(t);
+	if (i < 0)
+		return -EBUSY;
+	fd = t->filters[i].fd;
+
+	ret = dvb_parse_section_alloc(parms, &req->sect);
+	if (ret < 0)
+		return ret;
+
+	if (dvb_set_section_filter(fd, req->sect.pid, 1,
+				   &req->sect.tid, &mask, NULL,
+				   DMX_IMMEDIATE_START | DMX_CHECK_CRC)) {
+		dvb_dmx_stop(fd);
+		dvb_table_filter_free(&req->sect);
+		return -EBUSY;
+	}
+	if (parms->p.verbose)
+		dvb_log(_("%s: waiting for table ID 0x%02x, program ID 0x%02x"),
+			__func__, req->sect.tid, req->sect.pid);
+
+	t->filters[i].busy = 1;
+	req->filter = i;
+	req->state = TS_TABLE_ACTIVE;
+	req->deadline = ts_tables_now() + req->timeout * 1000;
+
+	return 0;
+}
+
+/* Handles the PAT, adding a PMT request for each program */
+static int ts_tables_add_pmts(struct ts_tables *t, int pat)
+{
+	struct dvb_v5_fe_parms_priv *parms = t->parms;
+	struct dvb_v5_descriptors *dvb_scan_handler = t->dvb_scan_handler;
+	unsigned num_pmt = 0;
+	int n;
+
+	dvb_scan_handler->program = calloc(dvb_scan_handler->pat->programs,
+					   sizeof(*dvb_scan_handler->program));
+	if (!dvb_scan_handler->program) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		return -1;
+	}
+
+	dvb_pat_program_foreach(program, dvb_scan_handler->pat) {
+		dvb_scan_handler->program[num_pmt].pat_pgm = program;
+
+		if (!program->service_id) {
+			if (parms->p.verbose)
+				dvb_log(_("Program #%d is network PID: 0x%04x"),
+					num_pmt, program->pid);
+			num_pmt++;
+			continue;
+		}
+		if (parms->p.verbose)
+			dvb_log(_("Program #%d ID 0x%04x, service ID 0x%04x"),
+				num_pmt, program->pid, program->service_id);
+
+		n = ts_tables_add(t, TS_TABLE_PMT, DVB_TABLE_PMT, program->pid,
+				  (void **)&dvb_scan_handler->program[num_pmt].pmt,
+				  t->pat_pmt_time, pat);
+		if (n < 0) {
+			dvb_scan_handler->num_program = num_pmt;
+			return -1;
+		}
+		t->req[n].prog = num_pmt;
+		num_pmt++;
+	}
+	dvb_scan_handler->num_program = num_pmt;
+
+	return 0;
+}
+
+/*
+ * Marks a table as done, reporting it just like dvb_get_ts_tables() does,
+ * and wakes up the tables that depend on it. Returns -1 if the scan of this
+ * transponder can't continue (e. g. no PAT), 0 otherwise.
+ */
+static int ts_tables_done(struct ts_tables *t, int n, int rc)
+{
+	struct dvb_v5_fe_parms_priv *parms = t->parms;
+	struct dvb_v5_descriptors *dvb_scan_handler = t->dvb_scan_handler;
+	struct ts_table_req *req = &t->req[n];
+	struct dvb_v5_descriptors_program *program;
+	int i, skip = 0;
+
+	if (req->state == TS_TABLE_ACTIVE) {
+		dvb_dmx_stop(t->filters[req->filter].fd);
+		t->filters[req->filter].busy = 0;
+		dvb_table_filter_free(&req->sect);
+	}
+	req->state = TS_TABLE_DONE;
+
+	switch (req->type) {
+	case TS_TABLE_PAT:
+		if (rc < 0) {
+			dvb_logerr(_("error while waiting for PAT table"));
+			return -1;
+		}
+		if (parms->p.verbose)
+			dvb_table_pat_print(&parms->p, dvb_scan_handler->pat);
+		if (ts_tables_add_pmts(t, n) < 0)
+			return -1;
+		/* ts_tables_add() may have moved the array */
+		req = &t->req[n];
+		break;
+	case TS_TABLE_VCT:
+		if (rc < 0)
+			dvb_logerr(_("error while waiting for VCT table"));
+		else if (parms->p.verbose)
+			atsc_table_vct_print(&parms->p, dvb_scan_handler->vct);
+
+		/* SDT is only needed if there's no VCT */
+		if (dvb_scan_handler->vct && !t->other_nit)
+			skip = 1;
+		break;
+	case TS_TABLE_PMT:
+		program = &dvb_scan_handler->program[req->prog];
+		if (rc < 0) {
+			dvb_logerr(_("error while reading the PMT table for service 0x%04x"),
+				   program->pat_pgm->service_id);
+			if (program->pmt)
+				dvb_table_pmt_free(program->pmt);
+			program->pmt = NULL;
+		} else if (parms->p.verbose) {
+			dvb_table_pmt_print(&parms->p, program->pmt);
+		}
+		break;
+	case TS_TABLE_NIT:
+	case TS_TABLE_NIT2:
+		if (rc < 0)
+			dvb_logerr(_("error while reading the NIT table"));
+		else if (parms->p.verbose)
+			dvb_table_nit_print(&parms->p, dvb_scan_handler->nit);
+		break;
+	case TS_TABLE_SDT:
+	case TS_TABLE_SDT2:
+		if (rc < 0)
+			dvb_logerr(_("error while reading the SDT table"));
+		else if (parms->p.verbose)
+			dvb_table_sdt_print(&parms->p, dvb_scan_handler->sdt);
+		break;
+	}
+
+	for (i = 0; i < t->num_req; i++) {
+		if (t->req[i].after != n || t->req[i].state != TS_TABLE_WAITING)
+			continue;
+		if (skip)
+			t->req[i].state = TS_TABLE_DONE;
+		else
+			t->req[i].state = TS_TABLE_PENDING;
+	}
+
+	return 0;
+}
+
+/* Reads a section from the filter of table n */
+static int ts_tables_read(struct ts_tables *t, int n, uint8_t *buf)
+{
+	struct dvb_v5_fe_parms_priv *parms = t->parms;
+	struct ts_table_req *req = &t->req[n];
+	ssize_t buf_length;
+	uint32_t crc;
+
+	buf_length = read(t->filters[req->filter].fd, buf,
+			  DVB_MAX_PAYLOAD_PACKET_SIZE);
+	if (buf_length < 0) {
+		if (errno == EAGAIN || errno == EINTR || errno == EOVERFLOW)
+			return 0;
+		dvb_perror(_("dvb_read_section: read error"));
+		return -2;
+	}
+	if (!buf_length) {
+		dvb_logerr(_("%s: buf returned an empty buffer"), __func__);
+		return -1;
+	}
+
+	req->deadline = ts_tables_now() + req->timeout * 1000;
+
+	crc = dvb_crc32(buf, buf_length, 0xFFFFFFFF);
+	if (crc != 0) {
+		dvb_logerr(_("%s: crc error"), __func__);
+		return -3;
+	}
+
+	return dvb_parse_section(parms, &req->sect, buf, buf_length);
+}
+
+/* Stops all active filters and closes the file descriptors opened here */
+static void ts_tables_free(struct ts_tables *t)
+{
+	struct ts_table_req *req;
+	int i;
+
+	for (i = 0; i < t->num_req; i++) {
+		req = &t->req[i];
+		if (req->state != TS_TABLE_ACTIVE)
+			continue;
+		dvb_dmx_stop(t->filters[req->filter].fd);
+		dvb_table_filter_free(&req->sect);
+	}
+	for (i = 0; i < t->num_filters; i++)
+		if (t->filters[i].owned)
+			dvb_dmx_close(t->filters[i].fd);
+
+	free(t->filters);
+	free(t->req);
+}
+
+static struct dvb_v5_descriptors *
+dvb_get_ts_tables_parallel(struct dvb_v5_fe_parms_priv *parms, int dmx_fd,
+			   struct dvb_v5_descriptors *dvb_scan_handler,
+			   int atsc_filter, unsigned other_nit,
+			   unsigned pat_pmt_time, unsigned vct_time,
+			   unsigned sdt_time, unsigned nit_time)
+{
+	struct ts_tables t;
+	struct ts_table_req *req;
+	struct pollfd *fds = NULL;
+	int *fds_req = NULL;
+	uint8_t *buf = NULL;
+	int i, k, ret, rc, active, num_fds, timeout;
+	int pat, vct = -1, nit, sdt;
+	char fd_path[64];
+	ssize_t len;
+	uint64_t now;
+
+	memset(&t, 0, sizeof(t));
+	t.parms = parms;
+	t.dvb_scan_handler = dvb_scan_handler;
+	t.other_nit = other_nit;
+	t.pat_pmt_time = pat_pmt_time;
+	t.max_filters = parms->scan_filters;
+
+	t.filters = calloc(t.max_filters, sizeof(*t.filters));
+	fds = calloc(t.max_filters, sizeof(*fds));
+	fds_req = calloc(t.max_filters, sizeof(*fds_req));
+	buf = calloc(DVB_MAX_PAYLOAD_PACKET_SIZE, 1);
+	if (!t.filters || !fds || !fds_req || !buf) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		goto error;
+	}
+
+	/*
+	 * The caller's demux fd is the first filter. The other ones are
+	 * opened as needed, from the same demux device node.
+	 */
+	t.filters[0].fd = dmx_fd;
+	t.num_filters = 1;
+
+	snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", dmx_fd);
+	len = readlink(fd_path, t.dmx_path, sizeof(t.dmx_path) - 1);
+	if (len > 0)
+		t.dmx_path[len] = '\0';
+	else
+		dvb_logwarn(_("%s: can't find the demux device, reading one table at a time"),
+			    __func__);
+
+	pat = ts_tables_add(&t, TS_TABLE_PAT, DVB_TABLE_PAT, DVB_TABLE_PAT_PID,
+			    (void **)&dvb_scan_handler->pat, pat_pmt_time, -1);
+	if (pat < 0)
+		goto error;
+	if (atsc_filter) {
+		vct = ts_tables_add(&t, TS_TABLE_VCT, atsc_filter,
+				    ATSC_TABLE_VCT_PID,
+				    (void **)&dvb_scan_handler->vct,
+				    vct_time, -1);
+		if (vct < 0)
+			goto error;
+	}
+	nit = ts_tables_add(&t, TS_TABLE_NIT, DVB_TABLE_NIT, DVB_TABLE_NIT_PID,
+			    (void **)&dvb_scan_handler->nit, nit_time, -1);
+	if (nit < 0)
+		goto error;
+
+	/* On ATSC, SDT is only read if there's no VCT */
+	sdt = ts_tables_add(&t, TS_TABLE_SDT, DVB_TABLE_SDT, DVB_TABLE_SDT_PID,
+			    (void **)&dvb_scan_handler->sdt, sdt_time, vct);
+	if (sdt < 0)
+		goto error;
+
+	/*
+	 * The other NIT/SDT tables are stored at the same place as the
+	 * NIT/SDT ones, so they should be read after them.
+	 */
+	if (other_nit) {
+		if (ts_tables_add(&t, TS_TABLE_NIT2, DVB_TABLE_NIT2,
+				  DVB_TABLE_NIT_PID,
+				  (void **)&dvb_scan_handler->nit,
+				  nit_time, nit) < 0)
+			goto error;
+		if (ts_tables_add(&t, TS_TABLE_SDT2, DVB_TABLE_SDT2,
+				  DVB_TABLE_SDT_PID,
+				  (void **)&dvb_scan_handler->sdt,
+				  sdt_time, sdt) < 0)
+			goto error;
+	}
+
+	while (!parms->p.abort) {
+		active = 0;
+		for (i = 0; i < t.num_req; i++)
+			if (t.req[i].state == TS_TABLE_ACTIVE)
+				active++;
+
+		/*
+		 * Start the pending tables. As a table only depends on
+		 * tables added before it, this also starts the ones that
+		 * got unblocked by a table that failed to start.
+		 */
+		for (i = 0; i < t.num_req; i++) {
+			if (t.req[i].state != TS_TABLE_PENDING)
+				continue;
+
+			ret = ts_tables_start(&t, &t.req[i]);
+			if (!ret) {
+				active++;
+				continue;
+			}
+			/* Wait for a filter to be released */
+			if (ret == -EBUSY && active) {
+				t.max_filters = active;
+				break;
+			}
+			if (ts_tables_done(&t, i, -1) < 0)
+				goto error;
+		}
+		if (!active)
+			break;
+
+		now = ts_tables_now();
+		timeout = -1;
+		for (i = 0, num_fds = 0; i < t.num_req; i++) {
+			req = &t.req[i];
+			if (req->state != TS_TABLE_ACTIVE)
+				continue;
+
+			fds[num_fds].fd = t.filters[req->filter].fd;
+			fds[num_fds].events = POLLIN | POLLPRI;
+			fds[num_fds].revents = 0;
+			fds_req[num_fds++] = i;
+
+			if (req->deadline <= now)
+				timeout = 0;
+			else if (timeout < 0 || req->deadline - now < timeout)
+				timeout = req->deadline - now;
+		}
+
+		ret = poll(fds, num_fds, timeout);
+		if (ret < 0 && errno != EINTR && errno != EOVERFLOW) {
+			dvb_perror("poll");
+			break;
+		}
+
+		for (k = 0; ret > 0 && k < num_fds; k++) {
+			if (!fds[k].revents)
+				continue;
+			i = fds_req[k];
+			if (t.req[i].state != TS_TABLE_ACTIVE)
+				continue;
+
+			rc = ts_tables_read(&t, i, buf);
+			if (rc && ts_tables_done(&t, i, rc > 0 ? 0 : rc) < 0)
+				goto error;
+		}
+
+		if (parms->p.abort)
+			break;
+
+		/* Give up on the tables without data for too long */
+		now = ts_tables_now();
+		for (i = 0; i < t.num_req; i++) {
+			req = &t.req[i];
+			if (req->state != TS_TABLE_ACTIVE || req->deadline > now)
+				continue;
+			dvb_logerr(_("%s: no data read on section filter for table ID 0x%02x, program ID 0x%02x"),
+				   __func__, req->sect.tid, req->sect.pid);
+			if (ts_tables_done(&t, i, -1) < 0)
+				goto error;
+		}
+	}
+
+	ts_tables_free(&t);
+	free(fds);
+	free(fds_req);
+	free(buf);
+
+	return dvb_scan_handler;
+
+error:
+	ts_tables_free(&t);
+	free(fds);
+	free(fds_req);
+	free(buf);
+	dvb_scan_free_handler_table(dvb_scan_handler);
+
+	return NULL;
+}
+
 struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
 					     int dmx_fd,
 					     uint32_t delivery_system,
@@ -455,7 +991,7 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
 	int rc;
-	unsigned pat_pmt_time, sdt_time, nit_time, vct_time;
+	unsigned pat_pmt_time, sdt_time, nit_time, vct_time = 0;
 	int atsc_filter = 0;
 	unsigned num_pmt = 0;
 
@@ -511,6 +1047,15 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
 			break;
 	};
 
+	if (parms->scan_filters > 1)
+		return dvb_get_ts_tables_parallel(parms, dmx_fd,
+						  dvb_scan_handler,
+						  atsc_filter, other_nit,
+						  pat_pmt_time * timeout_multiply,
+						  vct_time * timeout_multiply,
+						  sdt_time * timeout_multiply,
+						  nit_time * timeout_multiply);
+
 	/* PAT table */
 	rc = dvb_read_section(&parms->p, dmx_fd,
 			      DVB_TABLE_PAT, DVB_TABLE_PAT_PID,
@@ -634,6 +1179,14 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
 	return dvb_scan_handler;
 }
 
+void dvb_scan_set_max_filters(struct dvb_v5_fe_parms *__p,
+			      unsigned max_filters)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+
+	parms->scan_filters = max_filters;
+}
+
 struct dvb_v5_descriptors *dvb_scan_transponder(struct dvb_v5_fe_parms *__p,
 					        struct dvb_entry *entry,
 						int dmx_fd,
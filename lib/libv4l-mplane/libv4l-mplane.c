@@ -57,21 +57,24 @@ struct mplane_plugin {
 		};
 		unsigned int mplane;
 	};
+	/* no of planes of the current capture resp. output format */
+	unsigned int capture_num_planes;
+	unsigned int output_num_planes;
 };
 
+/*
+ * Requests using the multi-planar buffer types are passed on as is, so that
+ * apps which know about the multi-planar API get the real planes (with e.g.
+ * libv4lconvert's v4lconvert_convert_mplane()), everything else gets
+ * translated to the multi-planar API.
+ */
 #define SIMPLE_CONVERT_IOCTL(fd, cmd, arg, __struc) ({		\
 	int __ret;						\
 	struct __struc *req = arg;				\
 	uint32_t type = req->type;				\
-	if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ||	\
-	    type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) {	\
-		errno = EINVAL;					\
-		__ret = -1;					\
-	} else {						\
-		req->type = convert_type(type);			\
-		__ret = SYS_IOCTL(fd, cmd, arg);		\
-		req->type = type;				\
-	}							\
+	req->type = convert_type(type);				\
+	__ret = SYS_IOCTL(fd, cmd, arg);			\
+	req->type = type;					\
 	__ret;							\
 	})
 
@@ -109,6 +112,8 @@ static void *plugin_init(int fd)
 		perror("Couldn't allocate memory for plugin");
 		return NULL;
 	}
+	plugin.capture_num_planes = 1;
+	plugin.output_num_planes = 1;
 	*ret_plugin = plugin;
 
 	printf("Using mplane plugin for %s%s\n",
@@ -175,6 +180,32 @@ static int convert_type(int type)
 	}
 }
 
+static unsigned int *num_planes_ptr(struct mplane_plugin *plugin, int type)
+{
+	switch (type) {
+	case V4L2_BUF_TYPE_VIDEO_CAPTURE:
+	case V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE:
+		return &plugin->capture_num_planes;
+	default:
+		return &plugin->output_num_planes;
+	}
+}
+
+/*
+ * Formats with more then 1 plane are reported with the bytesperline of the
+ * first plane and the size of all planes together, the bytesperline of the
+ * other planes follows from that of the first.
+ */
+static unsigned int total_sizeimage(const struct v4l2_format *fmt)
+{
+	unsigned int i, size = 0;
+
+	for (i = 0; i < fmt->fmt.pix_mp.num_planes && i < VIDEO_MAX_PLANES; i++)
+		size += fmt->fmt.pix_mp.plane_fmt[i].sizeimage;
+
+	return size;
+}
+
 static void sanitize_format(struct v4l2_format *fmt)
 {
 	unsigned int offset;
@@ -201,8 +232,8 @@ static void sanitize_format(struct v4l2_format *fmt)
 	       sizeof(fmt->fmt.pix) - offset);
 }
 
-static int try_set_fmt_ioctl(int fd, unsigned long int cmd,
-			     struct v4l2_format *arg)
+static int try_set_fmt_ioctl(struct mplane_plugin *plugin, int fd,
+			     unsigned long int cmd, struct v4l2_format *arg)
 {
 	struct v4l2_format fmt = { 0 };
 	struct v4l2_format *org = arg;
@@ -217,8 +248,11 @@ static int try_set_fmt_ioctl(int fd, unsigned long int cmd,
 		break;
 	case V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE:
 	case V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE:
-		errno = EINVAL;
-		return -1;
+		ret = SYS_IOCTL(fd, cmd, arg);
+		if (ret == 0 && cmd == VIDIOC_S_FMT)
+			*num_planes_ptr(plugin, arg->type) =
+				arg->fmt.pix_mp.num_planes;
+		return ret;
 	default:
 		return SYS_IOCTL(fd, cmd, arg);
 	}
@@ -238,10 +272,34 @@ static int try_set_fmt_ioctl(int fd, unsigned long int cmd,
 	fmt.fmt.pix_mp.plane_fmt[0].bytesperline = org->fmt.pix.bytesperline;
 	fmt.fmt.pix_mp.plane_fmt[0].sizeimage = org->fmt.pix.sizeimage;
 
+	/*
+	 * A single-planar buffer cannot describe formats whose planes are in
+	 * separate buffers, so these are only available through the
+	 * multi-planar buffer types (which is how libv4lconvert sets them when
+	 * converting from them). Check before S_FMT changes the format.
+	 */
+	if (cmd == VIDIOC_S_FMT) {
+		struct v4l2_format try_fmt = fmt;
+
+		if (SYS_IOCTL(fd, VIDIOC_TRY_FMT, &try_fmt) == 0 &&
+		    try_fmt.fmt.pix_mp.num_planes > 1) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
 	ret = SYS_IOCTL(fd, cmd, &fmt);
 	if (ret)
 		return ret;
 
+	if (cmd == VIDIOC_TRY_FMT && fmt.fmt.pix_mp.num_planes > 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (cmd == VIDIOC_S_FMT)
+		*num_planes_ptr(plugin, fmt.type) = fmt.fmt.pix_mp.num_planes;
+
 	org->fmt.pix.width = fmt.fmt.pix_mp.width;
 	org->fmt.pix.height = fmt.fmt.pix_mp.height;
 	org->fmt.pix.pixelformat = fmt.fmt.pix_mp.pixelformat;
@@ -251,7 +309,7 @@ static int try_set_fmt_ioctl(int fd, unsigned long int cmd,
 	org->fmt.pix.ycbcr_enc = fmt.fmt.pix_mp.ycbcr_enc;
 	org->fmt.pix.quantization = fmt.fmt.pix_mp.quantization;
 	org->fmt.pix.bytesperline = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
-	org->fmt.pix.sizeimage = fmt.fmt.pix_mp.plane_fmt[0].sizeimage;
+	org->fmt.pix.sizeimage = total_sizeimage(&fmt);
 	org->fmt.pix.flags = fmt.fmt.pix_mp.flags;
 
 	return 0;
@@ -272,10 +330,6 @@ static int create_bufs_ioctl(int fd, unsigned long int cmd,
 	case V4L2_BUF_TYPE_VIDEO_OUTPUT:
 		fmt->type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
 		break;
-	case V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE:
-	case V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE:
-		errno = EINVAL;
-		return -1;
 	default:
 		return SYS_IOCTL(fd, cmd, arg);
 	}
@@ -310,13 +364,14 @@ static int create_bufs_ioctl(int fd, unsigned long int cmd,
 	org->fmt.pix.ycbcr_enc = fmt->fmt.pix_mp.ycbcr_enc;
 	org->fmt.pix.quantization = fmt->fmt.pix_mp.quantization;
 	org->fmt.pix.bytesperline = fmt->fmt.pix_mp.plane_fmt[0].bytesperline;
-	org->fmt.pix.sizeimage = fmt->fmt.pix_mp.plane_fmt[0].sizeimage;
+	org->fmt.pix.sizeimage = total_sizeimage(fmt);
 	org->fmt.pix.flags = fmt->fmt.pix_mp.flags;
 
 	return ret;
 }
 
-static int get_fmt_ioctl(int fd, unsigned long int cmd, struct v4l2_format *arg)
+static int get_fmt_ioctl(struct mplane_plugin *plugin, int fd,
+			 unsigned long int cmd, struct v4l2_format *arg)
 {
 	struct v4l2_format fmt = { 0 };
 	struct v4l2_format *org = arg;
@@ -331,8 +386,11 @@ static int get_fmt_ioctl(int fd, unsigned long int cmd, struct v4l2_format *arg)
 		break;
 	case V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE:
 	case V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE:
-		errno = EINVAL;
-		return -1;
+		ret = SYS_IOCTL(fd, cmd, arg);
+		if (ret == 0)
+			*num_planes_ptr(plugin, arg->type) =
+				arg->fmt.pix_mp.num_planes;
+		return ret;
 	default:
 		return SYS_IOCTL(fd, cmd, arg);
 	}
@@ -341,6 +399,8 @@ static int get_fmt_ioctl(int fd, unsigned long int cmd, struct v4l2_format *arg)
 	if (ret)
 		return ret;
 
+	*num_planes_ptr(plugin, fmt.type) = fmt.fmt.pix_mp.num_planes;
+
 	memset(&org->fmt.pix, 0, sizeof(org->fmt.pix));
 	org->fmt.pix.width = fmt.fmt.pix_mp.width;
 	org->fmt.pix.height = fmt.fmt.pix_mp.height;
@@ -351,45 +411,49 @@ static int get_fmt_ioctl(int fd, unsigned long int cmd, struct v4l2_format *arg)
 	org->fmt.pix.ycbcr_enc = fmt.fmt.pix_mp.ycbcr_enc;
 	org->fmt.pix.quantization = fmt.fmt.pix_mp.quantization;
 	org->fmt.pix.bytesperline = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
-	org->fmt.pix.sizeimage = fmt.fmt.pix_mp.plane_fmt[0].sizeimage;
+	org->fmt.pix.sizeimage = total_sizeimage(&fmt);
 	org->fmt.pix.priv = V4L2_PIX_FMT_PRIV_MAGIC;
 	org->fmt.pix.flags = fmt.fmt.pix_mp.flags;
 
-	/*
-	 * If the device doesn't support just one plane, there's
-	 * nothing we can do, except return an error condition.
-	 */
-	if (fmt.fmt.pix_mp.num_planes > 1) {
-		errno = EINVAL;
-		return -1;
-	}
-
 	return ret;
 }
 
-static int buf_ioctl(int fd, unsigned long int cmd, struct v4l2_buffer *arg)
+/*
+ * With formats with more then 1 plane the buffer is described by its first
+ * plane, only mmap buffers can be used then. Such formats can only be set
+ * through the multi-planar buffer types (see try_set_fmt_ioctl()), this is
+ * for libv4l2, which gets at the other planes with a multi-planar
+ * VIDIOC_QUERYBUF.
+ */
+static int buf_ioctl(struct mplane_plugin *plugin, int fd,
+		     unsigned long int cmd, struct v4l2_buffer *arg)
 {
 	struct v4l2_buffer buf = *arg;
-	struct v4l2_plane plane = { 0 };
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	struct v4l2_plane *plane = &planes[0];
+	unsigned int num_planes;
 	int ret;
 
-	if (arg->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ||
-	    arg->type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) {
-		errno = EINVAL;
-		return -1;
-	}
-
 	buf.type = convert_type(arg->type);
 
 	if (buf.type == arg->type)
 		return SYS_IOCTL(fd, cmd, &buf);
 
-	memcpy(&plane.m, &arg->m, sizeof(plane.m));
-	plane.length = arg->length;
-	plane.bytesused = arg->bytesused;
-	
-	buf.m.planes = &plane;
-	buf.length = 1;
+	num_planes = *num_planes_ptr(plugin, arg->type);
+	if (num_planes < 1 || num_planes > VIDEO_MAX_PLANES)
+		num_planes = 1;
+	if (num_planes > 1 && arg->memory != V4L2_MEMORY_MMAP) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(planes, 0, sizeof(planes));
+	memcpy(&plane->m, &arg->m, sizeof(plane->m));
+	plane->length = arg->length;
+	plane->bytesused = arg->bytesused;
+
+	buf.m.planes = planes;
+	buf.length = num_planes;
 
 	ret = SYS_IOCTL(fd, cmd, &buf);
 
@@ -401,9 +465,9 @@ static int buf_ioctl(int fd, unsigned long int cmd, struct v4l2_buffer *arg)
 	arg->timecode = buf.timecode;
 	arg->sequence = buf.sequence;
 
-	arg->length = plane.length;
-	arg->bytesused = plane.bytesused;
-	memcpy(&arg->m, &plane.m, sizeof(arg->m));
+	arg->length = plane->length;
+	arg->bytesused = plane->bytesused;
+	memcpy(&arg->m, &plane->m, sizeof(arg->m));
 
 	return ret;
 }
@@ -411,14 +475,16 @@ static int buf_ioctl(int fd, unsigned long int cmd, struct v4l2_buffer *arg)
 static int plugin_ioctl(void *dev_ops_priv, int fd,
 			unsigned long int cmd, void *arg)
 {
+	struct mplane_plugin *plugin = dev_ops_priv;
+
 	switch (cmd) {
 	case VIDIOC_QUERYCAP:
 		return querycap_ioctl(fd, cmd, arg);
 	case VIDIOC_TRY_FMT:
 	case VIDIOC_S_FMT:
-		return try_set_fmt_ioctl(fd, cmd, arg);
+		return try_set_fmt_ioctl(plugin, fd, cmd, arg);
 	case VIDIOC_G_FMT:
-		return get_fmt_ioctl(fd, cmd, arg);
+		return get_fmt_ioctl(plugin, fd, cmd, arg);
 	case VIDIOC_ENUM_FMT:
 		return SIMPLE_CONVERT_IOCTL(fd, cmd, arg, v4l2_fmtdesc);
 	case VIDIOC_S_PARM:
@@ -428,7 +494,7 @@ static int plugin_ioctl(void *dev_ops_priv, int fd,
 	case VIDIOC_DQBUF:
 	case VIDIOC_QUERYBUF:
 	case VIDIOC_PREPARE_BUF:
-		return buf_ioctl(fd, cmd, arg);
+		return buf_ioctl(plugin, fd, cmd, arg);
 	case VIDIOC_CREATE_BUFS:
 		return create_bufs_ioctl(fd, cmd, arg);
 	case VIDIOC_REQBUFS:
@@ -436,14 +502,7 @@ static int plugin_ioctl(void *dev_ops_priv, int fd,
 	case VIDIOC_STREAMON:
 	case VIDIOC_STREAMOFF:
 	{
-		int type = *(int *)arg;
-
-		if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ||
-		    type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) {
-			errno = EINVAL;
-			return -1;
-		}
-		type = convert_type(type);
+		int type = convert_type(*(int *)arg);
 
 		return SYS_IOCTL(fd, cmd, &type);
 	}
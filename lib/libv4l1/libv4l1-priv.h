@@ -23,8 +23,8 @@
 #include <pthread.h>
 
 #include "../libv4lconvert/libv4lsyscall-priv.h"
+#include "../libv4lconvert/libv4lfdtable-priv.h"
 
-#define V4L1_MAX_DEVICES 16
 #define V4L1_NO_FRAMES 4
 #define V4L1_FRAME_BUF_SIZE (4096 * 4096)
 
@@ -72,6 +72,7 @@ struct v4l1_dev_info {
 	unsigned int min_width, min_height, max_width, max_height;
 	unsigned int width, height;
 	unsigned char *v4l1_frame_pointer;
+	struct v4l1_dev_info *next;
 };
 
 /* From log.c */
@@ -73,13 +73,12 @@
 #define V4L1_PIX_SIZE_TOUCHED   0x08
 
 static pthread_mutex_t v4l1_open_mutex = PTHREAD_MUTEX_INITIALIZER;
-static struct v4l1_dev_info devices[V4L1_MAX_DEVICES] = {
-	{ .fd = -1 },
-	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 },
-	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 },
-	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }
-};
-static int devices_used;
+/* fd -> struct v4l1_dev_info, for the fds we manage */
+static struct v4l_fd_table *v4l1_fd_table;
+/* All device structs ever allocated, linked through their next member. These
+   are never freed, only re-used, so that v4l1_munmap() can walk the list
+   without taking a lock */
+static struct v4l1_dev_info *devices;
 
 static unsigned int palette_to_pixelformat(unsigned int palette)
 {
@@ -159,7 +158,7 @@ static int count_inputs(int fd)
 	return i;
 }
 
-static int v4l1_set_format(int index, unsigned int width,
+static int v4l1_set_format(struct v4l1_dev_info *dev, unsigned int width,
 		unsigned int height, int v4l1_pal, int width_height_may_differ)
 {
 	int result;
@@ -174,19 +173,19 @@ static int v4l1_set_format(int index, unsigned int width,
 			return -1;
 		}
 	} else {
-		v4l2_pixfmt = devices[index].v4l2_pixfmt;
-		v4l1_pal = devices[index].v4l1_pal;
+		v4l2_pixfmt = dev->v4l2_pixfmt;
+		v4l1_pal = dev->v4l1_pal;
 	}
 
 	/* Do we need to change the resolution / format ? */
-	if (width == devices[index].width && height == devices[index].height &&
-			v4l2_pixfmt == devices[index].v4l2_pixfmt) {
-		devices[index].v4l1_pal = v4l1_pal;
+	if (width == dev->width && height == dev->height &&
+			v4l2_pixfmt == dev->v4l2_pixfmt) {
+		dev->v4l1_pal = v4l1_pal;
 		return 0;
 	}
 
 	/* Get current settings, apply our changes and try the new setting */
-	result = v4l2_ioctl(devices[index].fd, VIDIOC_G_FMT, &fmt2);
+	result = v4l2_ioctl(dev->fd, VIDIOC_G_FMT, &fmt2);
 	if (result) {
 		int saved_err = errno;
 
@@ -198,7 +197,7 @@ static int v4l1_set_format(int index, unsigned int width,
 	fmt2.fmt.pix.pixelformat = v4l2_pixfmt;
 	fmt2.fmt.pix.width  = width;
 	fmt2.fmt.pix.height = height;
-	result = v4l2_ioctl(devices[index].fd, VIDIOC_TRY_FMT, &fmt2);
+	result = v4l2_ioctl(dev->fd, VIDIOC_TRY_FMT, &fmt2);
 	if (result) {
 		int saved_err = errno;
 
@@ -216,14 +215,14 @@ static int v4l1_set_format(int index, unsigned int width,
 	}
 
 	/* Maybe after the TRY_FMT things haven't changed after all ? */
-	if (fmt2.fmt.pix.width  == devices[index].width &&
-			fmt2.fmt.pix.height == devices[index].height &&
-			fmt2.fmt.pix.pixelformat == devices[index].v4l2_pixfmt) {
-		devices[index].v4l1_pal = v4l1_pal;
+	if (fmt2.fmt.pix.width  == dev->width &&
+			fmt2.fmt.pix.height == dev->height &&
+			fmt2.fmt.pix.pixelformat == dev->v4l2_pixfmt) {
+		dev->v4l1_pal = v4l1_pal;
 		return 0;
 	}
 
-	result = v4l2_ioctl(devices[index].fd, VIDIOC_S_FMT, &fmt2);
+	result = v4l2_ioctl(dev->fd, VIDIOC_S_FMT, &fmt2);
 	if (result) {
 		int saved_err = errno;
 
@@ -232,52 +231,52 @@ static int v4l1_set_format(int index, unsigned int width,
 		return result;
 	}
 
-	devices[index].width  = fmt2.fmt.pix.width;
-	devices[index].height = fmt2.fmt.pix.height;
-	devices[index].v4l2_pixfmt = v4l2_pixfmt;
-	devices[index].v4l1_pal = v4l1_pal;
-	devices[index].depth = ((fmt2.fmt.pix.bytesperline << 3) +
+	dev->width  = fmt2.fmt.pix.width;
+	dev->height = fmt2.fmt.pix.height;
+	dev->v4l2_pixfmt = v4l2_pixfmt;
+	dev->v4l1_pal = v4l1_pal;
+	dev->depth = ((fmt2.fmt.pix.bytesperline << 3) +
 			(fmt2.fmt.pix.width - 1)) / fmt2.fmt.pix.width;
 
 	return result;
 }
 
-static void v4l1_find_min_and_max_size(int index, struct v4l2_format *fmt2)
+static void v4l1_find_min_and_max_size(struct v4l1_dev_info *dev, struct v4l2_format *fmt2)
 {
 	int i;
 	struct v4l2_fmtdesc fmtdesc2 = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
 
-	devices[index].min_width = -1;
-	devices[index].min_height = -1;
-	devices[index].max_width = 0;
-	devices[index].max_height = 0;
+	dev->min_width = -1;
+	dev->min_height = -1;
+	dev->max_width = 0;
+	dev->max_height = 0;
 
 	for (i = 0; ; i++) {
 		fmtdesc2.index = i;
 
-		if (v4l2_ioctl(devices[index].fd, VIDIOC_ENUM_FMT, &fmtdesc2))
+		if (v4l2_ioctl(dev->fd, VIDIOC_ENUM_FMT, &fmtdesc2))
 			break;
 
 		fmt2->fmt.pix.pixelformat = fmtdesc2.pixelformat;
 		fmt2->fmt.pix.width = 48;
 		fmt2->fmt.pix.height = 32;
 
-		if (v4l2_ioctl(devices[index].fd, VIDIOC_TRY_FMT, fmt2) == 0) {
-			if (fmt2->fmt.pix.width < devices[index].min_width)
-				devices[index].min_width = fmt2->fmt.pix.width;
-			if (fmt2->fmt.pix.height < devices[index].min_height)
-				devices[index].min_height = fmt2->fmt.pix.height;
+		if (v4l2_ioctl(dev->fd, VIDIOC_TRY_FMT, fmt2) == 0) {
+			if (fmt2->fmt.pix.width < dev->min_width)
+				dev->min_width = fmt2->fmt.pix.width;
+			if (fmt2->fmt.pix.height < dev->min_height)
+				dev->min_height = fmt2->fmt.pix.height;
 		}
 
 		fmt2->fmt.pix.pixelformat = fmtdesc2.pixelformat;
 		fmt2->fmt.pix.width = 100000;
 		fmt2->fmt.pix.height = 100000;
 
-		if (v4l2_ioctl(devices[index].fd, VIDIOC_TRY_FMT, fmt2) == 0) {
-			if (fmt2->fmt.pix.width > devices[index].max_width)
-				devices[index].max_width = fmt2->fmt.pix.width;
-			if (fmt2->fmt.pix.height > devices[index].max_height)
-				devices[index].max_height = fmt2->fmt.pix.height;
+		if (v4l2_ioctl(dev->fd, VIDIOC_TRY_FMT, fmt2) == 0) {
+			if (fmt2->fmt.pix.width > dev->max_width)
+				dev->max_width = fmt2->fmt.pix.width;
+			if (fmt2->fmt.pix.height > dev->max_height)
+				dev->max_height = fmt2->fmt.pix.height;
 		}
 	}
 }
@@ -285,7 +284,8 @@ static void v4l1_find_min_and_max_size(int index, struct v4l2_format *fmt2)
 
 int v4l1_open(const char *file, int oflag, ...)
 {
-	int index, fd;
+	struct v4l1_dev_info *dev;
+	int fd;
 	char *lfname;
 	struct v4l2_capability cap2;
 	struct v4l2_format fmt2;
@@ -360,47 +360,52 @@ int v4l1_open(const char *file, int oflag, ...)
 	}
 
 	/* So we have a device on which we can (and want to) emulate v4l1, register
-	   it in our devices array */
+	   it in our devices list */
 	pthread_mutex_lock(&v4l1_open_mutex);
-	for (index = 0; index < V4L1_MAX_DEVICES; index++)
-		if (devices[index].fd == -1) {
-			devices[index].fd = fd;
+	for (dev = devices; dev; dev = dev->next)
+		if (dev->fd == -1)
 			break;
+	if (!dev) {
+		dev = calloc(1, sizeof(*dev));
+		if (dev) {
+			dev->fd = -1;
+			dev->v4l1_frame_pointer = MAP_FAILED;
+			pthread_mutex_init(&dev->stream_lock, NULL);
+			dev->next = devices;
+			__atomic_store_n(&devices, dev, __ATOMIC_RELEASE);
 		}
-	pthread_mutex_unlock(&v4l1_open_mutex);
-
-	if (index == V4L1_MAX_DEVICES) {
-		V4L1_LOG_ERR("attempting to open more than %d video devices\n",
-				V4L1_MAX_DEVICES);
+	}
+	if (!dev || v4l_fd_table_set(&v4l1_fd_table, fd, dev)) {
+		pthread_mutex_unlock(&v4l1_open_mutex);
+		V4L1_LOG_ERR("allocating device info\n");
 		v4l2_close(fd);
-		errno = EBUSY;
+		errno = ENOMEM;
 		return -1;
 	}
+	dev->fd = fd;
+	pthread_mutex_unlock(&v4l1_open_mutex);
 
-	if (index >= devices_used)
-		devices_used = index + 1;
-
-	devices[index].flags = 0;
-	devices[index].open_count = 1;
-	devices[index].v4l1_frame_buf_map_count = 0;
-	devices[index].v4l1_frame_pointer = MAP_FAILED;
-	devices[index].width  = fmt2.fmt.pix.width;
-	devices[index].height = fmt2.fmt.pix.height;
-	devices[index].v4l2_pixfmt = fmt2.fmt.pix.pixelformat;
-	devices[index].v4l1_pal = pixelformat_to_palette(fmt2.fmt.pix.pixelformat);
-	devices[index].depth = ((fmt2.fmt.pix.bytesperline << 3) +
+	dev->flags = 0;
+	dev->open_count = 1;
+	dev->v4l1_frame_buf_map_count = 0;
+	dev->v4l1_frame_pointer = MAP_FAILED;
+	dev->width  = fmt2.fmt.pix.width;
+	dev->height = fmt2.fmt.pix.height;
+	dev->v4l2_pixfmt = fmt2.fmt.pix.pixelformat;
+	dev->v4l1_pal = pixelformat_to_palette(fmt2.fmt.pix.pixelformat);
+	dev->depth = ((fmt2.fmt.pix.bytesperline << 3) +
 			(fmt2.fmt.pix.width - 1)) / fmt2.fmt.pix.width;
 
-	v4l1_find_min_and_max_size(index, &fmt2);
+	v4l1_find_min_and_max_size(dev, &fmt2);
 
 	/* Check ENUM_INPUT and ENUM_STD support */
 	input2.index = 0;
 	if (v4l2_ioctl(fd, VIDIOC_ENUMINPUT, &input2) == 0)
-		devices[index].flags |= V4L1_SUPPORTS_ENUMINPUT;
+		dev->flags |= V4L1_SUPPORTS_ENUMINPUT;
 
 	standard2.index = 0;
 	if (v4l2_ioctl(fd, VIDIOC_ENUMSTD, &standard2) == 0)
-		devices[index].flags |= V4L1_SUPPORTS_ENUMSTD;
+		dev->flags |= V4L1_SUPPORTS_ENUMSTD;
 
 	V4L1_LOG("open: %d\n", fd);
 
@@ -408,57 +413,48 @@ int v4l1_open(const char *file, int oflag, ...)
 }
 
 /* Is this an fd for which we are emulating v4l1 ? */
-static int v4l1_get_index(int fd)
+static struct v4l1_dev_info *v4l1_get_dev(int fd)
 {
-	int index;
-
-	/* We never handle fd -1 */
-	if (fd == -1)
-		return -1;
-
-	for (index = 0; index < devices_used; index++)
-		if (devices[index].fd == fd)
-			break;
-
-	if (index == devices_used)
-		return -1;
-
-	return index;
+	return v4l_fd_table_get(&v4l1_fd_table, fd);
 }
 
 int v4l1_close(int fd)
 {
-	int index, result;
+	struct v4l1_dev_info *dev;
+	int result;
 
-	index = v4l1_get_index(fd);
-	if (index == -1)
+	dev = v4l1_get_dev(fd);
+	if (!dev)
 		return SYS_CLOSE(fd);
 
 	/* Abuse stream_lock to stop 2 closes from racing and trying to free the
 	   resources twice */
-	pthread_mutex_lock(&devices[index].stream_lock);
-	devices[index].open_count--;
-	result = devices[index].open_count != 0;
-	pthread_mutex_unlock(&devices[index].stream_lock);
+	pthread_mutex_lock(&dev->stream_lock);
+	dev->open_count--;
+	result = dev->open_count != 0;
+	pthread_mutex_unlock(&dev->stream_lock);
 
 	if (result)
 		return v4l2_close(fd);
 
 	/* Free resources */
-	if (devices[index].v4l1_frame_pointer != MAP_FAILED) {
-		if (devices[index].v4l1_frame_buf_map_count)
+	if (dev->v4l1_frame_pointer != MAP_FAILED) {
+		if (dev->v4l1_frame_buf_map_count)
 			V4L1_LOG("v4l1 capture buffer still mapped: %d times on close()\n",
-					devices[index].v4l1_frame_buf_map_count);
+					dev->v4l1_frame_buf_map_count);
 		else
-			SYS_MUNMAP(devices[index].v4l1_frame_pointer,
+			SYS_MUNMAP(dev->v4l1_frame_pointer,
 					V4L1_NO_FRAMES * V4L1_FRAME_BUF_SIZE);
-		devices[index].v4l1_frame_pointer = MAP_FAILED;
+		dev->v4l1_frame_pointer = MAP_FAILED;
 	}
 
 	/* Remove the fd from our list of managed fds before closing it, because as
 	   soon as we've done the actual close the fd maybe returned by an open in
 	   another thread and we don't want to intercept calls to this new fd. */
-	devices[index].fd = -1;
+	pthread_mutex_lock(&v4l1_open_mutex);
+	v4l_fd_table_set(&v4l1_fd_table, fd, NULL);
+	dev->fd = -1;
+	pthread_mutex_unlock(&v4l1_open_mutex);
 
 	result = v4l2_close(fd);
 
@@ -469,12 +465,12 @@ int v4l1_close(int fd)
 
 int v4l1_dup(int fd)
 {
-	int index = v4l1_get_index(fd);
+	struct v4l1_dev_info *dev = v4l1_get_dev(fd);
 
-	if (index == -1)
+	if (!dev)
 		return syscall(SYS_dup, fd);
 
-	devices[index].open_count++;
+	dev->open_count++;
 
 	return v4l2_dup(fd);
 }
@@ -483,14 +479,15 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 {
 	void *arg;
 	va_list ap;
-	int result, index, saved_err, stream_locked = 0;
+	struct v4l1_dev_info *dev;
+	int result, saved_err, stream_locked = 0;
 
 	va_start(ap, request);
 	arg = va_arg(ap, void *);
 	va_end(ap);
 
-	index = v4l1_get_index(fd);
-	if (index == -1)
+	dev = v4l1_get_dev(fd);
+	if (!dev)
 		return SYS_IOCTL(fd, request, arg);
 
 	/* Appearantly the kernel and / or glibc ignore the 32 most significant bits
@@ -508,7 +505,7 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 	case VIDIOCMCAPTURE:
 	case VIDIOCSYNC:
 	case VIDIOC_S_FMT:
-		pthread_mutex_lock(&devices[index].stream_lock);
+		pthread_mutex_lock(&dev->stream_lock);
 		stream_locked = 1;
 	}
 
@@ -548,17 +545,17 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 			cap->type |= VID_TYPE_CLIPPING;
 
 		cap->channels  = count_inputs(fd);
-		cap->minwidth  = devices[index].min_width;
-		cap->minheight = devices[index].min_height;
-		cap->maxwidth  = devices[index].max_width;
-		cap->maxheight = devices[index].max_height;
+		cap->minwidth  = dev->min_width;
+		cap->minheight = dev->min_height;
+		cap->maxwidth  = dev->max_width;
+		cap->maxheight = dev->max_height;
 		break;
 	}
 
 	case VIDIOCSPICT: {
 		struct video_picture *pic = arg;
 
-		devices[index].flags |= V4L1_PIX_FMT_TOUCHED;
+		dev->flags |= V4L1_PIX_FMT_TOUCHED;
 
 		v4l2_set_control(fd, V4L2_CID_BRIGHTNESS, pic->brightness);
 		v4l2_set_control(fd, V4L2_CID_HUE, pic->hue);
@@ -566,8 +563,8 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 		v4l2_set_control(fd, V4L2_CID_SATURATION, pic->colour);
 		v4l2_set_control(fd, V4L2_CID_WHITENESS, pic->whiteness);
 
-		result = v4l1_set_format(index, devices[index].width,
-				devices[index].height, pic->palette, 0);
+		result = v4l1_set_format(dev, dev->width,
+				dev->height, pic->palette, 0);
 		break;
 	}
 
@@ -580,32 +577,32 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 		   palette which does (and which we emulate when necessary) so
 		   that applications which just query the current format and
 		   then take whatever they get will work */
-		if (!(devices[index].flags & V4L1_PIX_FMT_TOUCHED) &&
-		    !pixelformat_to_palette(devices[index].v4l2_pixfmt))
-			v4l1_set_format(index, devices[index].width,
-					devices[index].height,
+		if (!(dev->flags & V4L1_PIX_FMT_TOUCHED) &&
+		    !pixelformat_to_palette(dev->v4l2_pixfmt))
+			v4l1_set_format(dev, dev->width,
+					dev->height,
 					VIDEO_PALETTE_RGB24,
-					(devices[index].flags &
+					(dev->flags &
 					 V4L1_PIX_SIZE_TOUCHED) ? 0 : 1);
 
-		devices[index].flags |= V4L1_PIX_FMT_TOUCHED;
+		dev->flags |= V4L1_PIX_FMT_TOUCHED;
 
 		memset(pic, 0, sizeof(*pic));
-		pic->depth = devices[index].depth;
-		pic->palette = devices[index].v4l1_pal;
-		i = v4l2_get_control(devices[index].fd, V4L2_CID_HUE);
+		pic->depth = dev->depth;
+		pic->palette = dev->v4l1_pal;
+		i = v4l2_get_control(dev->fd, V4L2_CID_HUE);
 		if (i >= 0)
 			pic->hue = i;
-		i = v4l2_get_control(devices[index].fd, V4L2_CID_SATURATION);
+		i = v4l2_get_control(dev->fd, V4L2_CID_SATURATION);
 		if (i >= 0)
 			pic->colour = i;
-		i = v4l2_get_control(devices[index].fd, V4L2_CID_CONTRAST);
+		i = v4l2_get_control(dev->fd, V4L2_CID_CONTRAST);
 		if (i >= 0)
 			pic->contrast = i;
-		i = v4l2_get_control(devices[index].fd, V4L2_CID_WHITENESS);
+		i = v4l2_get_control(dev->fd, V4L2_CID_WHITENESS);
 		if (i >= 0)
 			pic->whiteness = i;
-		i = v4l2_get_control(devices[index].fd, V4L2_CID_BRIGHTNESS);
+		i = v4l2_get_control(dev->fd, V4L2_CID_BRIGHTNESS);
 		if (i >= 0)
 			pic->brightness = i;
 
@@ -617,18 +614,18 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 	case VIDIOCGWIN: {
 		struct video_window *win = arg;
 
-		devices[index].flags |= V4L1_PIX_SIZE_TOUCHED;
+		dev->flags |= V4L1_PIX_SIZE_TOUCHED;
 
 		if (request == VIDIOCSWIN)
-			result = v4l1_set_format(index, win->width, win->height, -1, 1);
+			result = v4l1_set_format(dev, win->width, win->height, -1, 1);
 		else
 			result = 0;
 
 		if (result == 0) {
 			win->x = 0;
 			win->y = 0;
-			win->width  = devices[index].width;
-			win->height = devices[index].height;
+			win->width  = dev->width;
+			win->height = dev->height;
 			win->flags = 0;
 		}
 		break;
@@ -643,7 +640,7 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 		chan->type = VIDEO_TYPE_CAMERA;
 		chan->norm = 0;
 
-		if (devices[index].flags & V4L1_SUPPORTS_ENUMINPUT) {
+		if (dev->flags & V4L1_SUPPORTS_ENUMINPUT) {
 			struct v4l2_input input2 = { .index = chan->channel };
 
 			result = v4l2_ioctl(fd, VIDIOC_ENUMINPUT, &input2);
@@ -672,7 +669,7 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 
 		/* In case of no ENUMSTD support, ignore the norm member of the
 		   channel struct */
-		if (devices[index].flags & V4L1_SUPPORTS_ENUMSTD) {
+		if (dev->flags & V4L1_SUPPORTS_ENUMSTD) {
 			v4l2_std_id sid;
 
 			result = v4l2_ioctl(fd, VIDIOC_G_STD, &sid);
@@ -694,7 +691,7 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 	case VIDIOCSCHAN: {
 		struct video_channel *chan = arg;
 
-		if (devices[index].flags & V4L1_SUPPORTS_ENUMINPUT) {
+		if (dev->flags & V4L1_SUPPORTS_ENUMINPUT) {
 			result = v4l2_ioctl(fd, VIDIOC_S_INPUT, &chan->channel);
 			if (result < 0)
 				break;
@@ -710,7 +707,7 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 
 		/* In case of no ENUMSTD support, ignore the norm member of the
 		   channel struct */
-		if (devices[index].flags & V4L1_SUPPORTS_ENUMSTD) {
+		if (dev->flags & V4L1_SUPPORTS_ENUMSTD) {
 			v4l2_std_id sid = 0;
 
 			switch (chan->norm) {
@@ -748,12 +745,12 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 		for (i = 0; i < mbuf->frames; i++)
 			mbuf->offsets[i] = i * V4L1_FRAME_BUF_SIZE;
 
-		if (devices[index].v4l1_frame_pointer == MAP_FAILED) {
-			devices[index].v4l1_frame_pointer = (void *)SYS_MMAP(NULL,
+		if (dev->v4l1_frame_pointer == MAP_FAILED) {
+			dev->v4l1_frame_pointer = (void *)SYS_MMAP(NULL,
 					(size_t)mbuf->size,
 					PROT_READ | PROT_WRITE,
 					MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-			if (devices[index].v4l1_frame_pointer == MAP_FAILED) {
+			if (dev->v4l1_frame_pointer == MAP_FAILED) {
 				saved_err = errno;
 				V4L1_LOG_ERR("allocating v4l1 buffer: %s\n", strerror(errno));
 				errno = saved_err;
@@ -761,7 +758,7 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 				break;
 			}
 			V4L1_LOG("allocated v4l1 buffer @ %p\n",
-					devices[index].v4l1_frame_pointer);
+					dev->v4l1_frame_pointer);
 		}
 		result = 0;
 		break;
@@ -770,10 +767,10 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 	case VIDIOCMCAPTURE: {
 		struct video_mmap *map = arg;
 
-		devices[index].flags |= V4L1_PIX_FMT_TOUCHED |
+		dev->flags |= V4L1_PIX_FMT_TOUCHED |
 			V4L1_PIX_SIZE_TOUCHED;
 
-		result = v4l1_set_format(index, map->width, map->height,
+		result = v4l1_set_format(dev, map->width, map->height,
 				map->format, 0);
 		break;
 	}
@@ -781,15 +778,15 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 	case VIDIOCSYNC: {
 		int *frame_index = arg;
 
-		if (devices[index].v4l1_frame_pointer == MAP_FAILED ||
+		if (dev->v4l1_frame_pointer == MAP_FAILED ||
 				*frame_index < 0 || *frame_index >= V4L1_NO_FRAMES) {
 			errno = EINVAL;
 			result = -1;
 			break;
 		}
 
-		result = v4l2_read(devices[index].fd,
-				devices[index].v4l1_frame_pointer +
+		result = v4l2_read(dev->fd,
+				dev->v4l1_frame_pointer +
 				*frame_index * V4L1_FRAME_BUF_SIZE,
 				V4L1_FRAME_BUF_SIZE);
 		result = (result > 0) ? 0 : result;
@@ -809,13 +806,13 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 		result = v4l2_ioctl(fd, request, arg);
 
 		if (result == 0 && fmt2->type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
-			if (devices[index].v4l2_pixfmt != fmt2->fmt.pix.pixelformat) {
-				devices[index].v4l2_pixfmt = fmt2->fmt.pix.pixelformat;
-				devices[index].v4l1_pal =
+			if (dev->v4l2_pixfmt != fmt2->fmt.pix.pixelformat) {
+				dev->v4l2_pixfmt = fmt2->fmt.pix.pixelformat;
+				dev->v4l1_pal =
 					pixelformat_to_palette(fmt2->fmt.pix.pixelformat);
 			}
-			devices[index].width  = fmt2->fmt.pix.width;
-			devices[index].height = fmt2->fmt.pix.height;
+			dev->width  = fmt2->fmt.pix.width;
+			dev->height = fmt2->fmt.pix.height;
 		}
 		break;
 	}
@@ -1182,7 +1179,7 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 	}
 
 	if (stream_locked)
-		pthread_mutex_unlock(&devices[index].stream_lock);
+		pthread_mutex_unlock(&dev->stream_lock);
 
 	saved_err = errno;
 	v4l1_log_ioctl(request, arg, result);
@@ -1194,15 +1191,15 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 
 ssize_t v4l1_read(int fd, void *buffer, size_t n)
 {
-	int index = v4l1_get_index(fd);
+	struct v4l1_dev_info *dev = v4l1_get_dev(fd);
 	ssize_t result;
 
-	if (index == -1)
+	if (!dev)
 		return SYS_READ(fd, buffer, n);
 
-	pthread_mutex_lock(&devices[index].stream_lock);
+	pthread_mutex_lock(&dev->stream_lock);
 	result = v4l2_read(fd, buffer, n);
-	pthread_mutex_unlock(&devices[index].stream_lock);
+	pthread_mutex_unlock(&dev->stream_lock);
 
 	return result;
 }
@@ -1211,68 +1208,69 @@ ssize_t v4l1_read(int fd, void *buffer, size_t n)
 void *v4l1_mmap(void *start, size_t length, int prot, int flags, int fd,
 		int64_t offset)
 {
-	int index;
+	struct v4l1_dev_info *dev;
 	void *result;
 
 	/* Check if the mmap data matches our answer to VIDIOCGMBUF, if not
 	   pass through libv4l2 for applications which are using v4l2 through
 	   libv4l1 (this can happen with the v4l1compat.so wrapper preloaded */
-	index = v4l1_get_index(fd);
-	if (index == -1 || start || offset ||
+	dev = v4l1_get_dev(fd);
+	if (!dev || start || offset ||
 			length != (V4L1_NO_FRAMES * V4L1_FRAME_BUF_SIZE))
 		return v4l2_mmap(start, length, prot, flags, fd, offset);
 
 
-	pthread_mutex_lock(&devices[index].stream_lock);
+	pthread_mutex_lock(&dev->stream_lock);
 
 	/* It could be that we get called with an mmap which seems to match what
 	   we expect, but no VIDIOCGMBUF has been done yet, then it is certainly not
 	   for us so pass it through */
-	if (devices[index].v4l1_frame_pointer == MAP_FAILED) {
+	if (dev->v4l1_frame_pointer == MAP_FAILED) {
 		result = v4l2_mmap(start, length, prot, flags, fd, offset);
 		goto leave;
 	}
 
-	devices[index].v4l1_frame_buf_map_count++;
+	dev->v4l1_frame_buf_map_count++;
 
 	V4L1_LOG("v4l1 buffer @ %p mapped by application\n",
-			devices[index].v4l1_frame_pointer);
+			dev->v4l1_frame_pointer);
 
-	result = devices[index].v4l1_frame_pointer;
+	result = dev->v4l1_frame_pointer;
 
 leave:
-	pthread_mutex_unlock(&devices[index].stream_lock);
+	pthread_mutex_unlock(&dev->stream_lock);
 
 	return result;
 }
 
 int v4l1_munmap(void *_start, size_t length)
 {
-	int index;
+	struct v4l1_dev_info *dev;
 	unsigned char *start = _start;
 
 	/* Is this memory ours? */
 	if (start != MAP_FAILED &&
 			length == (V4L1_FRAME_BUF_SIZE * V4L1_NO_FRAMES)) {
-		for (index = 0; index < devices_used; index++)
-			if (devices[index].fd != -1 &&
-					start == devices[index].v4l1_frame_pointer)
+		for (dev = __atomic_load_n(&devices, __ATOMIC_ACQUIRE); dev;
+				dev = dev->next)
+			if (dev->fd != -1 &&
+					start == dev->v4l1_frame_pointer)
 				break;
 
-		if (index != devices_used) {
+		if (dev) {
 			int unmapped = 0;
 
-			pthread_mutex_lock(&devices[index].stream_lock);
+			pthread_mutex_lock(&dev->stream_lock);
 
 			/* Redo our checks now that we have the lock, things may have changed */
-			if (start == devices[index].v4l1_frame_pointer) {
-				if (devices[index].v4l1_frame_buf_map_count > 0)
-					devices[index].v4l1_frame_buf_map_count--;
+			if (start == dev->v4l1_frame_pointer) {
+				if (dev->v4l1_frame_buf_map_count > 0)
+					dev->v4l1_frame_buf_map_count--;
 
 				unmapped = 1;
 			}
 
-			pthread_mutex_unlock(&devices[index].stream_lock);
+			pthread_mutex_unlock(&dev->stream_lock);
 
 			if (unmapped) {
 				V4L1_LOG("v4l1 buffer munmap %p, %d\n", start, (int)length);
@@ -21,15 +21,15 @@
 
 #include <stdio.h>
 #include <pthread.h>
+#include <sys/types.h>
 #include <libv4lconvert.h> /* includes videodev2.h for us */
 
 #include "../libv4lconvert/libv4lsyscall-priv.h"
+#include "../libv4lconvert/libv4lfdtable-priv.h"
 
-#define V4L2_MAX_DEVICES 16
-/* Warning when making this larger the frame_queued and frame_mapped members of
-   the v4l2_dev_info struct can no longer be a bitfield, so the code needs to
-   be adjusted! */
-#define V4L2_MAX_NO_FRAMES 32
+/* The no of buffers is only limited by how many buffer indexes fit in our
+   fake mmap offsets (see V4L2_MMAP_OFFSET_MAGIC in libv4l2.c) */
+#define V4L2_MAX_NO_FRAMES 0x100000
 #define V4L2_DEFAULT_NREADBUFFERS 4
 #define V4L2_IGNORE_FIRST_FRAME_ERRORS 3
 #define V4L2_DEFAULT_FPS 30
@@ -46,7 +46,7 @@
 #define V4L2_PERROR(format, ...)		\
 	do { 					\
 		if (errno == ENODEV) {		\
-			devices[index].gone = 1;\
+			dev->gone = 1;	\
 			break;			\
 		}				\
 		V4L2_LOG_ERR(format ": %s\n", ##__VA_ARGS__, strerror(errno)); \
@@ -70,6 +70,45 @@
 	} while (0)
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+enum v4l2_pipeline_state {
+	V4L2_PIPELINE_STOPPED,
+	V4L2_PIPELINE_RUNNING,
+	V4L2_PIPELINE_STOPPING,
+	V4L2_PIPELINE_EXITED, /* The thread stopped itself after an error */
+};
+
+/* Per buffer bookkeeping, only done when in read or mmap-conversion mode */
+struct v4l2_frame_info {
+	unsigned char *pointer; /* our mapping of the real buffer */
+	int size;
+	unsigned int offset;
+	/* with multi-planar src formats our mappings of all num_planes planes,
+	   plane 0 is pointer / size / offset */
+	unsigned int num_planes;
+	unsigned char *plane_pointer[VIDEO_MAX_PLANES];
+	int plane_size[VIDEO_MAX_PLANES];
+	/* mapping tracking of our fake (converting mmap) frame buffer */
+	unsigned int map_count;
+	unsigned char queued;
+	/* 1 when the real buffer is mapped over the fake one (passthrough) */
+	unsigned char passthrough;
+	/* the app's buffer we convert into when it uses USERPTR / DMABUF */
+	unsigned char *app_pointer;
+	unsigned int app_length;
+	int app_fd; /* the dmabuf fd as passed by the app */
+	int app_dmabuf_fd; /* our dup of it, -1 when app_pointer is not ours */
+	dev_t app_dmabuf_dev;
+	ino_t app_dmabuf_ino;
+};
+
+/* A frame dequeued and converted by the pipeline thread */
+struct v4l2_pipeline_frame {
+	struct v4l2_buffer buf;
+	int result;
+	int error;
+};
 
 struct v4l2_dev_info {
 	int fd;
@@ -83,27 +122,57 @@ struct v4l2_dev_info {
 	struct v4l2_format dest_fmt;
 	pthread_mutex_t stream_lock;
 	unsigned int no_frames;
+	/* buffer memory type as seen by the app (iow may differ from the real
+	   buffers, which always are MMAP when converting) */
+	enum v4l2_memory memory;
 	unsigned int nreadbuffers;
+	unsigned int max_nreadbuffers; /* grow nreadbuffers up to this */
+	/* sequence no of the last dequeued buffer, to spot driver drops */
+	uint32_t last_sequence;
+	int last_sequence_valid;
+	int read_buffer_starved; /* set when the driver dropped frames */
+	uint64_t read_max_age; /* in ns, 0 for no limit */
 	int fps;
 	int first_frame;
 	struct v4lconvert_data *convert;
 	unsigned char *convert_mmap_buf;
 	size_t convert_mmap_buf_size;
 	size_t convert_mmap_frame_size;
-	/* Frame bookkeeping is only done when in read or mmap-conversion mode */
-	unsigned char *frame_pointers[V4L2_MAX_NO_FRAMES];
-	int frame_sizes[V4L2_MAX_NO_FRAMES];
-	int frame_queued; /* 1 status bit per frame */
+	int convert_mmap_fd; /* memfd backing convert_mmap_buf or -1 */
+	/* Frame bookkeeping, no_frames entries in use out of frames_size */
+	struct v4l2_frame_info *frames;
+	unsigned int frames_size;
+	/* counters so that we need not walk frames to find out if any are
+	   queued (by us) / mapped (by the app) */
+	unsigned int frames_queued;
+	unsigned int frames_mapped;
 	int frame_info_generation;
-	/* mapping tracking of our fake (converting mmap) frame buffers */
-	unsigned char frame_map_count[V4L2_MAX_NO_FRAMES];
+	/* counters, see v4l2_get_stats(). convert_stats is a copy of
+	   libv4lconvert's counters taken after each conversion, as the pipeline
+	   thread may be converting when the app asks for them, and
+	   convert_stats_base the copy at the last reset */
+	struct v4l2_stats stats;
+	struct v4lconvert_stats convert_stats;
+	struct v4lconvert_stats convert_stats_base;
+	uint64_t stats_dump_time;
 	/* buffer when doing conversion and using read() for read() */
 	int readbuf_size;
 	unsigned char *readbuf;
+	/* pipelined conversion, see V4L2_ENABLE_PIPELINED_CONVERSION */
+	enum v4l2_pipeline_state pipeline_state;
+	pthread_t pipeline_thread;
+	pthread_cond_t pipeline_cond;
+	int pipeline_wake_pipe[2];
+	/* ring of converted frames waiting for the app to dequeue them */
+	struct v4l2_pipeline_frame *pipeline_frames;
+	unsigned int pipeline_frames_size;
+	unsigned int pipeline_head;
+	unsigned int pipeline_count;
 	/* plugin info */
 	void *plugin_library;
 	void *dev_ops_priv;
 	const struct libv4l_dev_ops *dev_ops;
+	struct v4l2_dev_info *next;
 };
 
 /* From v4l2-plugin.c */
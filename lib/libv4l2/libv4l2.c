@@ -67,9 +67,13 @@
 #include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <linux/dma-buf.h>
+#include <linux/udmabuf.h>
 #include "libv4l2.h"
 #include "libv4l2-priv.h"
 #include "libv4l-plugin.h"
@@ -84,62 +88,326 @@
 #define V4L2_STREAM_TOUCHED		0x1000
 #define V4L2_USE_READ_FOR_READ		0x2000
 #define V4L2_SUPPORTS_TIMEPERFRAME	0x4000
+#define V4L2_BUFFERS_EXPORTED		0x8000
 
-#define V4L2_MMAP_OFFSET_MAGIC      0xABCDEF00u
+/* The fake mmap offsets we hand out for our conversion buffers are
+   V4L2_MMAP_OFFSET_MAGIC | buffer index */
+#define V4L2_MMAP_OFFSET_MAGIC      0xABC00000u
+#define V4L2_MMAP_OFFSET_INDEX_MASK (V4L2_MAX_NO_FRAMES - 1)
 
-static void v4l2_adjust_src_fmt_to_fps(int index, int fps);
-static void v4l2_set_src_and_dest_format(int index,
+static void v4l2_adjust_src_fmt_to_fps(struct v4l2_dev_info *dev, int fps);
+static void v4l2_set_src_and_dest_format(struct v4l2_dev_info *dev,
 		struct v4l2_format *src_fmt, struct v4l2_format *dest_fmt);
+static int v4l2_pix_fmt_identical(struct v4l2_format *a, struct v4l2_format *b);
+static void v4l2_pipeline_stop(struct v4l2_dev_info *dev);
 
 static pthread_mutex_t v4l2_open_mutex = PTHREAD_MUTEX_INITIALIZER;
-static struct v4l2_dev_info devices[V4L2_MAX_DEVICES] = {
-	{ .fd = -1 },
-	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 },
-	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 },
-	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }
-};
-static int devices_used;
+/* fd -> struct v4l2_dev_info, for the fds we manage */
+static struct v4l_fd_table *v4l2_fd_table;
+/* All device structs ever allocated, linked through their next member. These
+   are never freed, only re-used, so that v4l2_munmap() can walk the list
+   without taking a lock, and lookups racing with a close stay safe */
+static struct v4l2_dev_info *devices;
+/* LIBV4L2_STATS_INTERVAL in ns, 0 when not set */
+static uint64_t v4l2_stats_interval;
+
+/* Set the no of buffers, growing the frame bookkeeping when necessary */
+static int v4l2_set_no_frames(struct v4l2_dev_info *dev, unsigned int count)
+{
+	struct v4l2_frame_info *frames;
+	unsigned int i;
+
+	count = MIN(count, V4L2_MAX_NO_FRAMES);
+	if (count > dev->frames_size) {
+		frames = realloc(dev->frames, count * sizeof(*frames));
+		if (!frames) {
+			V4L2_LOG_ERR("allocating info for %u buffers\n", count);
+			errno = ENOMEM;
+			return -1;
+		}
+		for (i = dev->frames_size; i < count; i++) {
+			memset(&frames[i], 0, sizeof(frames[i]));
+			frames[i].pointer = MAP_FAILED;
+			frames[i].app_dmabuf_fd = -1;
+		}
+		dev->frames = frames;
+		dev->frames_size = count;
+	}
+	dev->no_frames = count;
+	dev->stats.buffers = count;
+
+	return 0;
+}
+
+static uint64_t v4l2_stats_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Fill stats with the counters since the last reset */
+static void v4l2_collect_stats(struct v4l2_dev_info *dev, struct v4l2_stats *stats)
+{
+	const struct v4lconvert_stats *now = &dev->convert_stats;
+	const struct v4lconvert_stats *base = &dev->convert_stats_base;
+
+	*stats = dev->stats;
+	stats->convert_ns = now->convert_ns - base->convert_ns;
+	stats->processing_ns = now->processing_ns - base->processing_ns;
+	stats->transform_ns = now->transform_ns - base->transform_ns;
+	stats->copy_ns = now->copy_ns - base->copy_ns;
+}
+
+static void v4l2_dump_stats(struct v4l2_dev_info *dev)
+{
+	struct v4l2_stats stats;
+	double frames;
+
+	v4l2_collect_stats(dev, &stats);
+	frames = stats.frames ? stats.frames : 1;
+	fprintf(v4l2_log_file ? v4l2_log_file : stderr,
+		"libv4l2: stats fd %d: %llu frames, %llu dropped, %llu short, "
+		"%llu stale, %llu driver drops, "
+		"avg us per frame: dqbuf wait %.1f convert %.1f processing %.1f "
+		"transform %.1f copy %.1f, avg queued %.1f of %u, %llu underruns\n",
+		dev->fd, (unsigned long long)stats.frames,
+		(unsigned long long)stats.dropped_frames,
+		(unsigned long long)stats.short_frames,
+		(unsigned long long)stats.stale_frames,
+		(unsigned long long)stats.driver_drops,
+		stats.dqbuf_wait_ns / frames / 1000,
+		stats.convert_ns / frames / 1000,
+		stats.processing_ns / frames / 1000,
+		stats.transform_ns / frames / 1000,
+		stats.copy_ns / frames / 1000,
+		stats.queued_sum / frames, stats.buffers,
+		(unsigned long long)stats.underruns);
+	if (v4l2_log_file)
+		fflush(v4l2_log_file);
+}
+
+/* Called after each conversion, with the stream_lock held */
+static void v4l2_stats_converted(struct v4l2_dev_info *dev)
+{
+	v4lconvert_get_stats(dev->convert, &dev->convert_stats);
+}
+
+/* Called for each frame handed to the app, with the stream_lock held */
+static void v4l2_stats_frame(struct v4l2_dev_info *dev)
+{
+	uint64_t now;
+
+	dev->stats.frames++;
+	dev->stats.queued_sum += dev->stats.queued;
+	if (!dev->stats.queued)
+		dev->stats.underruns++;
+
+	if (!v4l2_stats_interval)
+		return;
+
+	now = v4l2_stats_ns();
+	if (!dev->stats_dump_time)
+		dev->stats_dump_time = now;
+	if (now - dev->stats_dump_time >= v4l2_stats_interval) {
+		v4l2_dump_stats(dev);
+		dev->stats_dump_time = now;
+	}
+}
+
+/* Count the frames the driver dropped since the last dequeued buffer */
+static void v4l2_check_sequence(struct v4l2_dev_info *dev, struct v4l2_buffer *buf)
+{
+	uint32_t dropped = buf->sequence - dev->last_sequence - 1;
+
+	if (dev->last_sequence_valid && dropped &&
+			dropped < V4L2_MAX_NO_FRAMES) {
+		dev->stats.driver_drops += dropped;
+		dev->read_buffer_starved = 1;
+	}
+	dev->last_sequence = buf->sequence;
+	dev->last_sequence_valid = 1;
+}
+
+/* Called for each buffer we get back from the driver through DQBUF */
+static int v4l2_buffer_dequeued(struct v4l2_dev_info *dev, struct v4l2_buffer *buf)
+{
+	if (dev->stats.queued)
+		dev->stats.queued--;
+	v4l2_check_sequence(dev, buf);
+
+	if (buf->index >= dev->no_frames) {
+		V4L2_LOG_ERR("driver returned invalid buffer index %u\n",
+				buf->index);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (dev->frames[buf->index].queued) {
+		dev->frames[buf->index].queued = 0;
+		dev->frames_queued--;
+	}
+
+	return 0;
+}
+
+static void v4l2_free_convert_mmap_buf(struct v4l2_dev_info *dev)
+{
+	if (dev->convert_mmap_buf != MAP_FAILED)
+		SYS_MUNMAP(dev->convert_mmap_buf, dev->convert_mmap_buf_size);
+	dev->convert_mmap_buf = MAP_FAILED;
+	dev->convert_mmap_buf_size = 0;
+	if (dev->convert_mmap_fd != -1)
+		SYS_CLOSE(dev->convert_mmap_fd);
+	dev->convert_mmap_fd = -1;
+	/* Exported buffers keep their own reference to the memory */
+	dev->flags &= ~V4L2_BUFFERS_EXPORTED;
+}
 
-static int v4l2_ensure_convert_mmap_buf(int index)
+static int v4l2_ensure_convert_mmap_buf(struct v4l2_dev_info *dev)
 {
-	if (devices[index].convert_mmap_buf != MAP_FAILED) {
+	unsigned int i;
+
+	if (dev->convert_mmap_buf != MAP_FAILED) {
 		return 0;
 	}
 
-	devices[index].convert_mmap_buf_size =
-		devices[index].convert_mmap_frame_size * devices[index].no_frames;
+	dev->convert_mmap_buf_size =
+		dev->convert_mmap_frame_size * dev->no_frames;
 
-	devices[index].convert_mmap_buf = (void *)SYS_MMAP(NULL,
-			devices[index].convert_mmap_buf_size,
-			PROT_READ | PROT_WRITE,
-			MAP_ANONYMOUS | MAP_PRIVATE,
-			-1, 0);
+#ifdef HAVE_MEMFD_CREATE
+	/* Back the buffer with a memfd, so that VIDIOC_EXPBUF can turn our
+	   buffers into dmabufs. Not fatal, we then simply cannot export */
+	dev->convert_mmap_fd = memfd_create("libv4l2-conversion",
+					    MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (dev->convert_mmap_fd != -1 &&
+			(ftruncate(dev->convert_mmap_fd,
+				   dev->convert_mmap_buf_size) ||
+			 fcntl(dev->convert_mmap_fd, F_ADD_SEALS,
+			       F_SEAL_SHRINK))) {
+		V4L2_LOG("setting up conversion memfd: %s\n", strerror(errno));
+		SYS_CLOSE(dev->convert_mmap_fd);
+		dev->convert_mmap_fd = -1;
+	}
+#endif
 
-	if (devices[index].convert_mmap_buf == MAP_FAILED) {
-		devices[index].convert_mmap_buf_size = 0;
+	if (dev->convert_mmap_fd != -1)
+		dev->convert_mmap_buf = (void *)SYS_MMAP(NULL,
+				dev->convert_mmap_buf_size,
+				PROT_READ | PROT_WRITE, MAP_SHARED,
+				dev->convert_mmap_fd, 0);
+	else
+		dev->convert_mmap_buf = (void *)SYS_MMAP(NULL,
+				dev->convert_mmap_buf_size,
+				PROT_READ | PROT_WRITE,
+				MAP_ANONYMOUS | MAP_PRIVATE,
+				-1, 0);
 
+	if (dev->convert_mmap_buf == MAP_FAILED) {
 		int saved_err = errno;
+
 		V4L2_LOG_ERR("allocating conversion buffer\n");
+		v4l2_free_convert_mmap_buf(dev);
 		errno = saved_err;
 		return -1;
 	}
 
+	for (i = 0; i < dev->frames_size; i++)
+		dev->frames[i].passthrough = 0;
+
 	return 0;
 }
 
-static int v4l2_request_read_buffers(int index)
+/* In mmap conversion mode, frames which need no conversion (iow when none of
+   the software processing / flipping is active) are not copied. Instead we
+   map the real buffer at the address of the fake buffer the app sees. When
+   conversion is needed again, our own memory gets mapped back. */
+static int v4l2_map_conversion_frame(struct v4l2_dev_info *dev, unsigned int buffer_index)
+{
+	unsigned char *addr = dev->convert_mmap_buf +
+		buffer_index * dev->convert_mmap_frame_size;
+
+	if (!dev->frames[buffer_index].passthrough)
+		return 0;
+
+	if (dev->convert_mmap_fd != -1)
+		addr = (void *)SYS_MMAP(addr, dev->convert_mmap_frame_size,
+				PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+				dev->convert_mmap_fd,
+				buffer_index * dev->convert_mmap_frame_size);
+	else
+		addr = (void *)SYS_MMAP(addr, dev->convert_mmap_frame_size,
+				PROT_READ | PROT_WRITE,
+				MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED,
+				-1, 0);
+	if ((void *)addr == MAP_FAILED) {
+		int saved_err = errno;
+
+		V4L2_LOG_ERR("remapping conversion buffer %u: %s\n",
+				buffer_index, strerror(errno));
+		errno = saved_err;
+		return -1;
+	}
+
+	dev->frames[buffer_index].passthrough = 0;
+	V4L2_LOG("buffer %u: conversion\n", buffer_index);
+
+	return 0;
+}
+
+/* Returns 1 if the frame can be handed to the app without conversion */
+static int v4l2_map_passthrough_frame(struct v4l2_dev_info *dev, unsigned int buffer_index)
+{
+	unsigned char *addr = dev->convert_mmap_buf +
+		buffer_index * dev->convert_mmap_frame_size;
+
+	/* Exported buffers must always hold the frame data themselves */
+	if ((dev->flags & (V4L2_DISABLE_MMAP_PASSTHROUGH |
+			   V4L2_BUFFERS_EXPORTED)) ||
+			!v4l2_pix_fmt_identical(&dev->src_fmt,
+						&dev->dest_fmt) ||
+			dev->frames[buffer_index].size <
+				dev->convert_mmap_frame_size ||
+			!v4lconvert_is_passthrough(dev->convert,
+				&dev->src_fmt, &dev->dest_fmt))
+		return 0;
+
+	if (dev->frames[buffer_index].passthrough)
+		return 1;
+
+	if ((void *)SYS_MMAP(addr, dev->convert_mmap_frame_size,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+			dev->fd,
+			dev->frames[buffer_index].offset) == MAP_FAILED) {
+		V4L2_LOG("mapping buffer %u for passthrough failed: %s\n",
+				buffer_index, strerror(errno));
+		/* A failed MAP_FIXED mmap may have unmapped the old mapping */
+		dev->frames[buffer_index].passthrough = 1;
+		v4l2_map_conversion_frame(dev, buffer_index);
+		return 0;
+	}
+
+	dev->frames[buffer_index].passthrough = 1;
+	V4L2_LOG("buffer %u: passthrough\n", buffer_index);
+
+	return 1;
+}
+
+static int v4l2_request_read_buffers(struct v4l2_dev_info *dev)
 {
 	int result;
 	struct v4l2_requestbuffers req;
 
 	/* Note we re-request the buffers if they are already requested as the format
 	   and thus the needed buffer size may have changed. */
-	req.count = (devices[index].no_frames) ? devices[index].no_frames :
-		devices[index].nreadbuffers;
+	req.count = (dev->no_frames &&
+		     !(dev->flags & V4L2_BUFFERS_REQUESTED_BY_READ)) ?
+		dev->no_frames : dev->nreadbuffers;
 	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	req.memory = V4L2_MEMORY_MMAP;
-	result = devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-			devices[index].fd, VIDIOC_REQBUFS, &req);
+	result = dev->dev_ops->ioctl(dev->dev_ops_priv,
+			dev->fd, VIDIOC_REQBUFS, &req);
 	if (result < 0) {
 		int saved_err = errno;
 
@@ -148,19 +416,20 @@ static int v4l2_request_read_buffers(int index)
 		return result;
 	}
 
-	if (!devices[index].no_frames && req.count)
-		devices[index].flags |= V4L2_BUFFERS_REQUESTED_BY_READ;
+	if ((!dev->no_frames ||
+	     (dev->flags & V4L2_BUFFERS_REQUESTED_BY_READ)) && req.count)
+		dev->flags |= V4L2_BUFFERS_REQUESTED_BY_READ;
 
-	devices[index].no_frames = MIN(req.count, V4L2_MAX_NO_FRAMES);
-	return 0;
+	dev->memory = V4L2_MEMORY_MMAP;
+	return v4l2_set_no_frames(dev, req.count);
 }
 
-static void v4l2_unrequest_read_buffers(int index)
+static void v4l2_unrequest_read_buffers(struct v4l2_dev_info *dev)
 {
 	struct v4l2_requestbuffers req;
 
-	if (!(devices[index].flags & V4L2_BUFFERS_REQUESTED_BY_READ) ||
-			devices[index].no_frames == 0)
+	if (!(dev->flags & V4L2_BUFFERS_REQUESTED_BY_READ) ||
+			dev->no_frames == 0)
 		return;
 
 	/* (Un)Request buffers, note not all driver support this, and those
@@ -168,32 +437,91 @@ static void v4l2_unrequest_read_buffers(int index)
 	req.count = 0;
 	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	req.memory = V4L2_MEMORY_MMAP;
-	if (devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-			devices[index].fd, VIDIOC_REQBUFS, &req) < 0)
+	if (dev->dev_ops->ioctl(dev->dev_ops_priv,
+			dev->fd, VIDIOC_REQBUFS, &req) < 0)
 		return;
 
-	devices[index].no_frames = MIN(req.count, V4L2_MAX_NO_FRAMES);
-	if (devices[index].no_frames == 0)
-		devices[index].flags &= ~V4L2_BUFFERS_REQUESTED_BY_READ;
+	v4l2_set_no_frames(dev, req.count);
+	if (dev->no_frames == 0)
+		dev->flags &= ~V4L2_BUFFERS_REQUESTED_BY_READ;
 }
 
-static int v4l2_map_buffers(int index)
+/* The planes of multi-planar src formats are in separate buffers, which are
+   only visible through the multi-planar API, so we query and map those
+   ourselves, the single-planar view of the buffer describes plane 0 */
+static int v4l2_map_planes(struct v4l2_dev_info *dev, unsigned int index,
+		unsigned int num_planes)
 {
-	int result = 0;
+	struct v4l2_frame_info *frame = &dev->frames[index];
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	struct v4l2_buffer buf;
 	unsigned int i;
+
+	memset(&buf, 0, sizeof(buf));
+	memset(planes, 0, sizeof(planes));
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.index = index;
+	buf.m.planes = planes;
+	buf.length = num_planes;
+	if (dev->dev_ops->ioctl(dev->dev_ops_priv,
+			dev->fd, VIDIOC_QUERYBUF, &buf)) {
+		int saved_err = errno;
+
+		V4L2_PERROR("querying planes of buffer %u", index);
+		errno = saved_err;
+		return -1;
+	}
+
+	frame->plane_pointer[0] = frame->pointer;
+	frame->plane_size[0] = frame->size;
+	for (i = 1; i < num_planes; i++) {
+		frame->plane_pointer[i] = (void *)SYS_MMAP(NULL,
+				(size_t)planes[i].length, PROT_READ | PROT_WRITE,
+				MAP_SHARED, dev->fd, planes[i].m.mem_offset);
+		if (frame->plane_pointer[i] == MAP_FAILED) {
+			int saved_err = errno;
+
+			V4L2_PERROR("mmapping plane %u of buffer %u", i, index);
+			errno = saved_err;
+			break;
+		}
+		frame->plane_size[i] = planes[i].length;
+	}
+	frame->num_planes = i;
+
+	return i == num_planes ? 0 : -1;
+}
+
+static void v4l2_unmap_planes(struct v4l2_frame_info *frame)
+{
+	unsigned int i;
+
+	for (i = 1; i < frame->num_planes; i++)
+		SYS_MUNMAP(frame->plane_pointer[i], frame->plane_size[i]);
+	frame->num_planes = 0;
+}
+
+static int v4l2_map_buffers(struct v4l2_dev_info *dev)
+{
+	int result = 0;
+	unsigned int i, num_planes;
 	struct v4l2_buffer buf;
 
-	for (i = 0; i < devices[index].no_frames; i++) {
-		if (devices[index].frame_pointers[i] != MAP_FAILED)
+	num_planes = v4lconvert_get_num_planes(
+			dev->src_fmt.fmt.pix.pixelformat);
+
+	for (i = 0; i < dev->no_frames; i++) {
+		if (dev->frames[i].pointer != MAP_FAILED)
 			continue;
 
 		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 		buf.memory = V4L2_MEMORY_MMAP;
 		buf.index = i;
 		buf.reserved = buf.reserved2 = 0;
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
-				devices[index].fd, VIDIOC_QUERYBUF, &buf);
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
+				dev->fd, VIDIOC_QUERYBUF, &buf);
 		if (result) {
 			int saved_err = errno;
 
@@ -202,10 +530,10 @@ static int v4l2_map_buffers(int index)
 			break;
 		}
 
-		devices[index].frame_pointers[i] = (void *)SYS_MMAP(NULL,
-				(size_t)buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, devices[index].fd,
+		dev->frames[i].pointer = (void *)SYS_MMAP(NULL,
+				(size_t)buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd,
 				buf.m.offset);
-		if (devices[index].frame_pointers[i] == MAP_FAILED) {
+		if (dev->frames[i].pointer == MAP_FAILED) {
 			int saved_err = errno;
 
 			V4L2_PERROR("mmapping buffer %u", i);
@@ -214,38 +542,51 @@ static int v4l2_map_buffers(int index)
 			break;
 		}
 		V4L2_LOG("mapped buffer %u at %p\n", i,
-				devices[index].frame_pointers[i]);
+				dev->frames[i].pointer);
 
-		devices[index].frame_sizes[i] = buf.length;
+		dev->frames[i].size = buf.length;
+		dev->frames[i].offset = buf.m.offset;
+
+		if (num_planes > 1) {
+			result = v4l2_map_planes(dev, i, num_planes);
+			if (result) {
+				v4l2_unmap_planes(&dev->frames[i]);
+				SYS_MUNMAP(dev->frames[i].pointer,
+						dev->frames[i].size);
+				dev->frames[i].pointer = MAP_FAILED;
+				break;
+			}
+		}
 	}
 
 	return result;
 }
 
-static void v4l2_unmap_buffers(int index)
+static void v4l2_unmap_buffers(struct v4l2_dev_info *dev)
 {
 	unsigned int i;
 
 	/* unmap the buffers */
-	for (i = 0; i < devices[index].no_frames; i++) {
-		if (devices[index].frame_pointers[i] != MAP_FAILED) {
-			SYS_MUNMAP(devices[index].frame_pointers[i],
-					devices[index].frame_sizes[i]);
-			devices[index].frame_pointers[i] = MAP_FAILED;
+	for (i = 0; i < dev->no_frames; i++) {
+		if (dev->frames[i].pointer != MAP_FAILED) {
+			v4l2_unmap_planes(&dev->frames[i]);
+			SYS_MUNMAP(dev->frames[i].pointer,
+					dev->frames[i].size);
+			dev->frames[i].pointer = MAP_FAILED;
 			V4L2_LOG("unmapped buffer %u\n", i);
 		}
 	}
 }
 
-static int v4l2_streamon(int index)
+static int v4l2_streamon(struct v4l2_dev_info *dev)
 {
 	int result;
 	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-	if (!(devices[index].flags & V4L2_STREAMON)) {
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
-				devices[index].fd, VIDIOC_STREAMON, &type);
+	if (!(dev->flags & V4L2_STREAMON)) {
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
+				dev->fd, VIDIOC_STREAMON, &type);
 		if (result) {
 			int saved_err = errno;
 
@@ -253,22 +594,28 @@ static int v4l2_streamon(int index)
 			errno = saved_err;
 			return result;
 		}
-		devices[index].flags |= V4L2_STREAMON;
-		devices[index].first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
+		dev->flags |= V4L2_STREAMON;
+		dev->first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
+		dev->last_sequence_valid = 0;
+		dev->read_buffer_starved = 0;
 	}
 
 	return 0;
 }
 
-static int v4l2_streamoff(int index)
+static int v4l2_streamoff(struct v4l2_dev_info *dev)
 {
 	int result;
+	unsigned int i;
 	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-	if (devices[index].flags & V4L2_STREAMON) {
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
-				devices[index].fd, VIDIOC_STREAMOFF, &type);
+	if (dev->flags & V4L2_STREAMON) {
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
+				dev->fd, VIDIOC_STREAMOFF, &type);
+		/* Stop the pipeline after the streamoff, which wakes it up when it
+		   is blocked in DQBUF, the buffers it holds are dequeued anyways */
+		v4l2_pipeline_stop(dev);
 		if (result) {
 			int saved_err = errno;
 
@@ -276,29 +623,32 @@ static int v4l2_streamoff(int index)
 			errno = saved_err;
 			return result;
 		}
-		devices[index].flags &= ~V4L2_STREAMON;
+		dev->flags &= ~V4L2_STREAMON;
 
 		/* Stream off also dequeues all our buffers! */
-		devices[index].frame_queued = 0;
+		for (i = 0; i < dev->no_frames; i++)
+			dev->frames[i].queued = 0;
+		dev->frames_queued = 0;
+		dev->stats.queued = 0;
 	}
 
 	return 0;
 }
 
-static int v4l2_queue_read_buffer(int index, int buffer_index)
+static int v4l2_queue_read_buffer(struct v4l2_dev_info *dev, int buffer_index)
 {
 	int result;
 	struct v4l2_buffer buf;
 
-	if (devices[index].frame_queued & (1 << buffer_index))
+	if (dev->frames[buffer_index].queued)
 		return 0;
 
 	memset(&buf, 0, sizeof(buf));
 	buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	buf.memory = V4L2_MEMORY_MMAP;
 	buf.index  = buffer_index;
-	result = devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-			devices[index].fd, VIDIOC_QBUF, &buf);
+	result = dev->dev_ops->ioctl(dev->dev_ops_priv,
+			dev->fd, VIDIOC_QBUF, &buf);
 	if (result) {
 		int saved_err = errno;
 
@@ -307,28 +657,231 @@ static int v4l2_queue_read_buffer(int index, int buffer_index)
 		return result;
 	}
 
-	devices[index].frame_queued |= 1 << buffer_index;
+	dev->frames[buffer_index].queued = 1;
+	dev->frames_queued++;
+	dev->stats.queued++;
 	return 0;
 }
 
-static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
+/* Convert the just dequeued buf into dest, or when dest is NULL into our fake
+   mmap buffer or the app's USERPTR / DMABUF buffer for it. On errors the
+   buffer gets queued again, except when this is the last try and the frame
+   is short, as we then return the (short) buffer to the caller. Must be
+   called with the stream_lock held, when unlock is set the lock is dropped
+   during the actual conversion. */
+static int v4l2_convert_buffer(struct v4l2_dev_info *dev, struct v4l2_buffer *buf,
+		unsigned char *dest, int dest_size, int last_try, int unlock)
+{
+	struct v4l2_format src_fmt = dev->src_fmt;
+	struct v4l2_format dest_fmt = dev->dest_fmt;
+	unsigned char *src = dev->frames[buf->index].pointer;
+	struct dma_buf_sync sync = { .flags = DMA_BUF_SYNC_WRITE };
+	int result, dmabuf_fd = -1;
+
+	if (!dest && dev->memory != V4L2_MEMORY_MMAP) {
+		dest = dev->frames[buf->index].app_pointer;
+		dest_size = dev->frames[buf->index].app_length;
+		dmabuf_fd = dev->frames[buf->index].app_dmabuf_fd;
+		if (!dest) {
+			V4L2_LOG_ERR("no app buffer for buffer %u\n", buf->index);
+			errno = EINVAL;
+			return -1;
+		}
+	} else if (!dest) {
+		if (v4l2_map_passthrough_frame(dev, buf->index))
+			return buf->bytesused;
+		if (v4l2_map_conversion_frame(dev, buf->index)) {
+			int saved_err = errno;
+
+			v4l2_queue_read_buffer(dev, buf->index);
+			errno = saved_err;
+			return -1;
+		}
+		dest = dev->convert_mmap_buf +
+			buf->index * dev->convert_mmap_frame_size;
+	}
+
+	if (unlock)
+		pthread_mutex_unlock(&dev->stream_lock);
+	if (dmabuf_fd != -1) {
+		sync.flags |= DMA_BUF_SYNC_START;
+		SYS_IOCTL(dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+	}
+	if (dev->frames[buf->index].num_planes > 1) {
+		struct v4l2_frame_info *frame = &dev->frames[buf->index];
+		int plane_size[VIDEO_MAX_PLANES];
+		unsigned int i;
+
+		/* we only get to see the bytesused of plane 0 */
+		plane_size[0] = buf->bytesused;
+		for (i = 1; i < frame->num_planes; i++)
+			plane_size[i] = frame->plane_size[i];
+		result = v4lconvert_convert_mplane(dev->convert, &src_fmt,
+				&dest_fmt, frame->plane_pointer, plane_size,
+				dest, dest_size);
+	} else {
+		result = v4lconvert_convert(dev->convert, &src_fmt, &dest_fmt,
+				src, buf->bytesused, dest, dest_size);
+	}
+	if (dmabuf_fd != -1) {
+		int saved_err = errno;
+
+		sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE;
+		SYS_IOCTL(dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+		errno = saved_err;
+	}
+	if (unlock) {
+		int saved_err = errno;
+
+		pthread_mutex_lock(&dev->stream_lock);
+		errno = saved_err;
+	}
+	v4l2_stats_converted(dev);
+
+	if (dev->first_frame) {
+		/* Always treat convert errors as EAGAIN during the first few frames, as
+		   some cams produce bad frames at the start of the stream
+		   (hsync and vsync still syncing ??). */
+		if (result < 0)
+			errno = EAGAIN;
+		dev->first_frame--;
+	}
+
+	if (result < 0) {
+		int saved_err = errno;
+
+		if (errno == EAGAIN || errno == EPIPE)
+			V4L2_LOG("warning error while converting frame data: %s",
+					v4lconvert_get_error_message(dev->convert));
+		else
+			V4L2_LOG_ERR("converting / decoding frame data: %s",
+					v4lconvert_get_error_message(dev->convert));
+
+		if (last_try && saved_err == EPIPE) {
+			dev->stats.short_frames++;
+		} else {
+			dev->stats.dropped_frames++;
+			v4l2_queue_read_buffer(dev, buf->index);
+		}
+		errno = saved_err;
+	}
+
+	return result;
+}
+
+/* Turn the error of the last conversion try into what we report to the app */
+static int v4l2_convert_result(struct v4l2_dev_info *dev, int result, int max_tries)
+{
+	if (result < 0 && errno == EAGAIN) {
+		V4L2_LOG_ERR("got %d consecutive frame decode errors, last error: %s",
+				max_tries, v4lconvert_get_error_message(dev->convert));
+		errno = EIO;
+	}
+
+	if (result < 0 && errno == EPIPE) {
+		V4L2_LOG("got %d consecutive short frame errors, "
+			 "returning short frame", max_tries);
+		result = dev->dest_fmt.fmt.pix.sizeimage;
+		errno = 0;
+	}
+
+	return result;
+}
+
+/* Is buf too old for v4l2_read() ? Only monotonic timestamps can be
+   compared with the current time */
+static int v4l2_read_frame_too_old(struct v4l2_dev_info *dev,
+		struct v4l2_buffer *buf)
+{
+	uint64_t timestamp;
+
+	if (!dev->read_max_age ||
+			(buf->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) !=
+				V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+		return 0;
+
+	timestamp = buf->timestamp.tv_sec * 1000000000ULL +
+		buf->timestamp.tv_usec * 1000ULL;
+
+	return v4l2_stats_ns() - timestamp > dev->read_max_age;
+}
+
+/* For v4l2_read(): as long as buf is stale, because a newer frame is ready
+   (in V4L2_READ_LATEST_FRAME mode) or because it is too old, give it back
+   to the driver and dequeue the next one. Frames which are too old are only
+   skipped until all buffers have been cycled once, as the driver might be
+   producing nothing but old frames. Must be called with the stream_lock
+   held, which gets dropped while waiting for a frame. */
+static int v4l2_read_skip_stale_frames(struct v4l2_dev_info *dev,
+		struct v4l2_buffer *buf)
+{
+	struct pollfd pfd = { .fd = dev->fd, .events = POLLIN };
+	unsigned int too_old = 0;
+	int result, frame_info_gen;
+
+	while (1) {
+		if ((dev->flags & V4L2_READ_LATEST_FRAME) &&
+				poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN)) {
+			/* A newer frame is ready */
+		} else if (too_old < dev->no_frames &&
+				v4l2_read_frame_too_old(dev, buf)) {
+			too_old++;
+		} else {
+			return 0;
+		}
+
+		dev->stats.stale_frames++;
+		result = v4l2_queue_read_buffer(dev, buf->index);
+		if (result)
+			return result;
+
+		frame_info_gen = dev->frame_info_generation;
+		pthread_mutex_unlock(&dev->stream_lock);
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
+				dev->fd, VIDIOC_DQBUF, buf);
+		pthread_mutex_lock(&dev->stream_lock);
+		if (result) {
+			if (errno != EAGAIN) {
+				int saved_err = errno;
+
+				V4L2_PERROR("dequeuing buf");
+				errno = saved_err;
+			}
+			return result;
+		}
+
+		if (v4l2_buffer_dequeued(dev, buf))
+			return -1;
+
+		if (frame_info_gen != dev->frame_info_generation) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+}
+
+static int v4l2_dequeue_and_convert(struct v4l2_dev_info *dev, struct v4l2_buffer *buf,
 		unsigned char *dest, int dest_size)
 {
 	const int max_tries = V4L2_IGNORE_FIRST_FRAME_ERRORS + 1;
 	int result, tries = max_tries, frame_info_gen;
 
 	/* Make sure we have the real v4l2 buffers mapped */
-	result = v4l2_map_buffers(index);
+	result = v4l2_map_buffers(dev);
 	if (result)
 		return result;
 
 	do {
-		frame_info_gen = devices[index].frame_info_generation;
-		pthread_mutex_unlock(&devices[index].stream_lock);
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
-				devices[index].fd, VIDIOC_DQBUF, buf);
-		pthread_mutex_lock(&devices[index].stream_lock);
+		uint64_t start = v4l2_stats_ns();
+
+		frame_info_gen = dev->frame_info_generation;
+		pthread_mutex_unlock(&dev->stream_lock);
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
+				dev->fd, VIDIOC_DQBUF, buf);
+		pthread_mutex_lock(&dev->stream_lock);
+		dev->stats.dqbuf_wait_ns += v4l2_stats_ns() - start;
 		if (result) {
 			if (errno != EAGAIN) {
 				int saved_err = errno;
@@ -339,90 +892,296 @@ static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 			return result;
 		}
 
-		devices[index].frame_queued &= ~(1 << buf->index);
+		if (v4l2_buffer_dequeued(dev, buf))
+			return -1;
 
-		if (frame_info_gen != devices[index].frame_info_generation) {
+		if (frame_info_gen != dev->frame_info_generation) {
 			errno = -EINVAL;
 			return -1;
 		}
 
-		result = v4lconvert_convert(devices[index].convert,
-				&devices[index].src_fmt, &devices[index].dest_fmt,
-				devices[index].frame_pointers[buf->index],
-				buf->bytesused, dest ? dest : (devices[index].convert_mmap_buf +
-					buf->index * devices[index].convert_mmap_frame_size),
-				dest_size);
+		/* dest is only passed in by v4l2_read() */
+		if (dest && (dev->read_max_age ||
+			     (dev->flags & V4L2_READ_LATEST_FRAME))) {
+			result = v4l2_read_skip_stale_frames(dev, buf);
+			if (result)
+				return result;
+		}
 
-		if (devices[index].first_frame) {
-			/* Always treat convert errors as EAGAIN during the first few frames, as
-			   some cams produce bad frames at the start of the stream
-			   (hsync and vsync still syncing ??). */
-			if (result < 0)
-				errno = EAGAIN;
-			devices[index].first_frame--;
+		result = v4l2_convert_buffer(dev, buf, dest, dest_size,
+					     tries == 1, 0);
+		tries--;
+	} while (result < 0 && (errno == EAGAIN || errno == EPIPE) && tries);
+
+	return v4l2_convert_result(dev, result, max_tries);
+}
+
+/* Pipelined conversion: a thread per device dequeues frames from the driver
+   and converts them into our fake mmap buffers, putting them in the
+   pipeline_frames ring from which VIDIOC_DQBUF hands them to the app. The
+   thread only drops the stream_lock while waiting for and converting a frame,
+   everything which changes the buffers or formats requires the stream to be
+   off, and turning the stream off stops the thread first. */
+#define V4L2_PIPE_READ_END  0
+#define V4L2_PIPE_WRITE_END 1
+
+static void v4l2_pipeline_push(struct v4l2_dev_info *dev, struct v4l2_buffer *buf,
+		int result, int error)
+{
+	struct v4l2_pipeline_frame *frame;
+
+	frame = &dev->pipeline_frames[
+		(dev->pipeline_head + dev->pipeline_count) %
+		dev->pipeline_frames_size];
+	frame->buf = *buf;
+	frame->result = result;
+	frame->error = error;
+	dev->pipeline_count++;
+
+	pthread_cond_broadcast(&dev->pipeline_cond);
+}
+
+static void *v4l2_pipeline_thread(void *arg)
+{
+	const int max_tries = V4L2_IGNORE_FIRST_FRAME_ERRORS + 1;
+	struct v4l2_dev_info *dev = arg;
+	int result, tries = max_tries;
+	struct v4l2_buffer buf;
+	struct pollfd fds[2] = {
+		{ .fd = dev->fd, .events = POLLIN },
+		{ .fd = dev->pipeline_wake_pipe[V4L2_PIPE_READ_END],
+		  .events = POLLIN },
+	};
+
+	pthread_mutex_lock(&dev->stream_lock);
+	while (dev->pipeline_state == V4L2_PIPELINE_RUNNING) {
+		pthread_mutex_unlock(&dev->stream_lock);
+		result = poll(fds, 2, -1);
+		if (result > 0 && fds[0].revents && !fds[1].revents) {
+			memset(&buf, 0, sizeof(buf));
+			buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			buf.memory = V4L2_MEMORY_MMAP;
+			result = dev->dev_ops->ioctl(
+					dev->dev_ops_priv,
+					dev->fd, VIDIOC_DQBUF, &buf);
+		} else if (result >= 0) {
+			result = -1;
+			errno = EINTR;
 		}
+		pthread_mutex_lock(&dev->stream_lock);
 
-		if (result < 0) {
-			int saved_err = errno;
+		if (dev->pipeline_state != V4L2_PIPELINE_RUNNING)
+			break;
 
-			if (errno == EAGAIN || errno == EPIPE)
-				V4L2_LOG("warning error while converting frame data: %s",
-						v4lconvert_get_error_message(devices[index].convert));
-			else
-				V4L2_LOG_ERR("converting / decoding frame data: %s",
-						v4lconvert_get_error_message(devices[index].convert));
-
-			/*
-			 * If this is the last try, and the frame is short
-			 * we will return the (short) buffer to the caller,
-			 * so we must not re-queue it then!
-			 */
-			if (!(tries == 1 && errno == EPIPE))
-				v4l2_queue_read_buffer(index, buf->index);
-			errno = saved_err;
+		if (result) {
+			if (errno == EINTR)
+				continue;
+			/* Some (older) kernels report POLLERR when no buffers are
+			   queued, wait for the app to queue one */
+			if (errno == EAGAIN) {
+				if (fds[0].revents & POLLERR)
+					pthread_cond_wait(&dev->pipeline_cond,
+							  &dev->stream_lock);
+				continue;
+			}
+			V4L2_PERROR("dequeuing buf");
+			v4l2_pipeline_push(dev, &buf, -1, errno);
+			break;
 		}
+
+		if (v4l2_buffer_dequeued(dev, &buf)) {
+			v4l2_pipeline_push(dev, &buf, -1, errno);
+			break;
+		}
+
+		result = v4l2_convert_buffer(dev, &buf, NULL,
+				dev->convert_mmap_frame_size,
+				tries == 1, 1);
+		if (dev->pipeline_state != V4L2_PIPELINE_RUNNING)
+			break;
+
 		tries--;
-	} while (result < 0 && (errno == EAGAIN || errno == EPIPE) && tries);
+		if (result < 0 && (errno == EAGAIN || errno == EPIPE) && tries)
+			continue;
 
-	if (result < 0 && errno == EAGAIN) {
-		V4L2_LOG_ERR("got %d consecutive frame decode errors, last error: %s",
-				max_tries, v4lconvert_get_error_message(devices[index].convert));
-		errno = EIO;
+		result = v4l2_convert_result(dev, result, max_tries);
+		v4l2_pipeline_push(dev, &buf, result, errno);
+		tries = max_tries;
 	}
 
-	if (result < 0 && errno == EPIPE) {
-		V4L2_LOG("got %d consecutive short frame errors, "
-			 "returning short frame", max_tries);
-		result = devices[index].dest_fmt.fmt.pix.sizeimage;
-		errno = 0;
+	if (dev->pipeline_state == V4L2_PIPELINE_RUNNING) {
+		dev->pipeline_state = V4L2_PIPELINE_EXITED;
+		pthread_cond_broadcast(&dev->pipeline_cond);
 	}
+	pthread_mutex_unlock(&dev->stream_lock);
 
-	return result;
+	return NULL;
 }
 
-static int v4l2_read_and_convert(int index, unsigned char *dest, int dest_size)
+static void v4l2_pipeline_free(struct v4l2_dev_info *dev)
+{
+	SYS_CLOSE(dev->pipeline_wake_pipe[V4L2_PIPE_READ_END]);
+	SYS_CLOSE(dev->pipeline_wake_pipe[V4L2_PIPE_WRITE_END]);
+	free(dev->pipeline_frames);
+	dev->pipeline_frames = NULL;
+	dev->pipeline_frames_size = 0;
+	dev->pipeline_head = 0;
+	dev->pipeline_count = 0;
+}
+
+/* Must be called with the stream_lock held */
+static int v4l2_pipeline_start(struct v4l2_dev_info *dev)
+{
+	int result;
+
+	result = v4l2_map_buffers(dev);
+	if (result)
+		return result;
+
+	/* Every buffer can be in the ring only once, plus one error */
+	dev->pipeline_frames_size = dev->no_frames + 1;
+	dev->pipeline_frames = calloc(
+			dev->pipeline_frames_size,
+			sizeof(struct v4l2_pipeline_frame));
+	if (!dev->pipeline_frames) {
+		V4L2_LOG_ERR("allocating pipeline frames\n");
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (pipe(dev->pipeline_wake_pipe)) {
+		int saved_err = errno;
+
+		V4L2_LOG_ERR("creating pipeline pipe: %s\n", strerror(errno));
+		free(dev->pipeline_frames);
+		dev->pipeline_frames = NULL;
+		errno = saved_err;
+		return -1;
+	}
+
+	dev->pipeline_state = V4L2_PIPELINE_RUNNING;
+	result = pthread_create(&dev->pipeline_thread, NULL,
+			v4l2_pipeline_thread, dev);
+	if (result) {
+		V4L2_LOG_ERR("creating pipeline thread: %s\n", strerror(result));
+		dev->pipeline_state = V4L2_PIPELINE_STOPPED;
+		v4l2_pipeline_free(dev);
+		errno = result;
+		return -1;
+	}
+
+	V4L2_LOG("started pipeline thread\n");
+
+	return 0;
+}
+
+/* Stop the pipeline thread and drop the frames it converted. Must be called
+   with the stream_lock held, note this temporarily drops it. */
+static void v4l2_pipeline_stop(struct v4l2_dev_info *dev)
+{
+	char c = 0;
+
+	switch (dev->pipeline_state) {
+	case V4L2_PIPELINE_STOPPED:
+		return;
+	case V4L2_PIPELINE_STOPPING:
+		/* Another thread is already stopping it */
+		while (dev->pipeline_state != V4L2_PIPELINE_STOPPED)
+			pthread_cond_wait(&dev->pipeline_cond,
+					  &dev->stream_lock);
+		return;
+	case V4L2_PIPELINE_RUNNING:
+	case V4L2_PIPELINE_EXITED:
+		break;
+	}
+
+	dev->pipeline_state = V4L2_PIPELINE_STOPPING;
+	SYS_WRITE(dev->pipeline_wake_pipe[V4L2_PIPE_WRITE_END], &c, 1);
+	pthread_cond_broadcast(&dev->pipeline_cond);
+
+	pthread_mutex_unlock(&dev->stream_lock);
+	pthread_join(dev->pipeline_thread, NULL);
+	pthread_mutex_lock(&dev->stream_lock);
+
+	v4l2_pipeline_free(dev);
+	dev->pipeline_state = V4L2_PIPELINE_STOPPED;
+	pthread_cond_broadcast(&dev->pipeline_cond);
+
+	V4L2_LOG("stopped pipeline thread\n");
+}
+
+/* VIDIOC_DQBUF for pipelined conversion, returns the bytesused of the
+   converted frame */
+static int v4l2_pipeline_dequeue(struct v4l2_dev_info *dev, struct v4l2_buffer *buf)
+{
+	struct v4l2_pipeline_frame *frame;
+	uint64_t start;
+
+	/* (Re)start the thread when it is not running, or exited on an error
+	   we've already reported */
+	if (dev->pipeline_state == V4L2_PIPELINE_EXITED &&
+			!dev->pipeline_count)
+		v4l2_pipeline_stop(dev);
+	if (dev->pipeline_state == V4L2_PIPELINE_STOPPED &&
+			v4l2_pipeline_start(dev))
+		return -1;
+
+	start = v4l2_stats_ns();
+	while (!dev->pipeline_count) {
+		if (dev->pipeline_state != V4L2_PIPELINE_RUNNING) {
+			/* The stream got turned off while we were waiting */
+			errno = EINVAL;
+			return -1;
+		}
+		if (fcntl(dev->fd, F_GETFL) & O_NONBLOCK) {
+			errno = EAGAIN;
+			return -1;
+		}
+		pthread_cond_wait(&dev->pipeline_cond,
+				  &dev->stream_lock);
+	}
+	dev->stats.dqbuf_wait_ns += v4l2_stats_ns() - start;
+
+	frame = &dev->pipeline_frames[dev->pipeline_head];
+	dev->pipeline_head = (dev->pipeline_head + 1) %
+		dev->pipeline_frames_size;
+	dev->pipeline_count--;
+
+	if (frame->result < 0) {
+		errno = frame->error;
+		return -1;
+	}
+
+	*buf = frame->buf;
+	return frame->result;
+}
+
+static int v4l2_read_and_convert(struct v4l2_dev_info *dev, unsigned char *dest, int dest_size)
 {
 	const int max_tries = V4L2_IGNORE_FIRST_FRAME_ERRORS + 1;
 	int result, buf_size, tries = max_tries;
 
-	buf_size = devices[index].dest_fmt.fmt.pix.sizeimage;
+	buf_size = dev->dest_fmt.fmt.pix.sizeimage;
 
-	if (devices[index].readbuf_size < buf_size) {
+	if (dev->readbuf_size < buf_size) {
 		unsigned char *new_buf;
 
-		new_buf = realloc(devices[index].readbuf, buf_size);
+		new_buf = realloc(dev->readbuf, buf_size);
 		if (!new_buf)
 			return -1;
 
-		devices[index].readbuf = new_buf;
-		devices[index].readbuf_size = buf_size;
+		dev->readbuf = new_buf;
+		dev->readbuf_size = buf_size;
 	}
 
 	do {
-		result = devices[index].dev_ops->read(
-				devices[index].dev_ops_priv,
-				devices[index].fd, devices[index].readbuf,
+		uint64_t start = v4l2_stats_ns();
+
+		result = dev->dev_ops->read(
+				dev->dev_ops_priv,
+				dev->fd, dev->readbuf,
 				buf_size);
+		dev->stats.dqbuf_wait_ns += v4l2_stats_ns() - start;
 		if (result <= 0) {
 			if (result && errno != EAGAIN) {
 				int saved_err = errno;
@@ -433,17 +1192,18 @@ static int v4l2_read_and_convert(int index, unsigned char *dest, int dest_size)
 			return result;
 		}
 
-		result = v4lconvert_convert(devices[index].convert,
-				&devices[index].src_fmt, &devices[index].dest_fmt,
-				devices[index].readbuf, result, dest, dest_size);
+		result = v4lconvert_convert(dev->convert,
+				&dev->src_fmt, &dev->dest_fmt,
+				dev->readbuf, result, dest, dest_size);
+		v4l2_stats_converted(dev);
 
-		if (devices[index].first_frame) {
+		if (dev->first_frame) {
 			/* Always treat convert errors as EAGAIN during the first few frames, as
 			   some cams produce bad frames at the start of the stream
 			   (hsync and vsync still syncing ??). */
 			if (result < 0)
 				errno = EAGAIN;
-			devices[index].first_frame--;
+			dev->first_frame--;
 		}
 
 		if (result < 0) {
@@ -451,11 +1211,15 @@ static int v4l2_read_and_convert(int index, unsigned char *dest, int dest_size)
 
 			if (errno == EAGAIN || errno == EPIPE)
 				V4L2_LOG("warning error while converting frame data: %s",
-						v4lconvert_get_error_message(devices[index].convert));
+						v4lconvert_get_error_message(dev->convert));
 			else
 				V4L2_LOG_ERR("converting / decoding frame data: %s",
-						v4lconvert_get_error_message(devices[index].convert));
+						v4lconvert_get_error_message(dev->convert));
 
+			if (tries == 1 && saved_err == EPIPE)
+				dev->stats.short_frames++;
+			else
+				dev->stats.dropped_frames++;
 			errno = saved_err;
 		}
 		tries--;
@@ -463,29 +1227,29 @@ static int v4l2_read_and_convert(int index, unsigned char *dest, int dest_size)
 
 	if (result < 0 && errno == EAGAIN) {
 		V4L2_LOG_ERR("got %d consecutive frame decode errors, last error: %s",
-				max_tries, v4lconvert_get_error_message(devices[index].convert));
+				max_tries, v4lconvert_get_error_message(dev->convert));
 		errno = EIO;
 	}
 
 	if (result < 0 && errno == EPIPE) {
 		V4L2_LOG("got %d consecutive short frame errors, "
 			 "returning short frame", max_tries);
-		result = devices[index].dest_fmt.fmt.pix.sizeimage;
+		result = dev->dest_fmt.fmt.pix.sizeimage;
 		errno = 0;
 	}
 
 	return result;
 }
 
-static int v4l2_queue_read_buffers(int index)
+static int v4l2_queue_read_buffers(struct v4l2_dev_info *dev)
 {
 	unsigned int i;
 	int last_error = EIO, queued = 0;
 
-	for (i = 0; i < devices[index].no_frames; i++) {
+	for (i = 0; i < dev->no_frames; i++) {
 		/* Don't queue unmapped buffers (should never happen) */
-		if (devices[index].frame_pointers[i] != MAP_FAILED) {
-			if (v4l2_queue_read_buffer(index, i)) {
+		if (dev->frames[i].pointer != MAP_FAILED) {
+			if (v4l2_queue_read_buffer(dev, i)) {
 				last_error = errno;
 				continue;
 			}
@@ -500,89 +1264,309 @@ static int v4l2_queue_read_buffers(int index)
 	return 0;
 }
 
-static int v4l2_activate_read_stream(int index)
+static int v4l2_activate_read_stream(struct v4l2_dev_info *dev)
 {
 	int result;
 
-	if ((devices[index].flags & V4L2_STREAMON) || devices[index].frame_queued) {
+	if ((dev->flags & V4L2_STREAMON) || dev->frames_queued) {
 		errno = EBUSY;
 		return -1;
 	}
 
-	result = v4l2_request_read_buffers(index);
+	result = v4l2_request_read_buffers(dev);
 	if (!result)
-		result = v4l2_map_buffers(index);
+		result = v4l2_map_buffers(dev);
 	if (!result)
-		result = v4l2_queue_read_buffers(index);
+		result = v4l2_queue_read_buffers(dev);
 	if (result)
 		return result;
 
-	devices[index].flags |= V4L2_STREAM_CONTROLLED_BY_READ;
+	dev->flags |= V4L2_STREAM_CONTROLLED_BY_READ;
 
-	return v4l2_streamon(index);
+	return v4l2_streamon(dev);
 }
 
-static int v4l2_deactivate_read_stream(int index)
+static int v4l2_deactivate_read_stream(struct v4l2_dev_info *dev)
 {
 	int result;
 
-	result = v4l2_streamoff(index);
+	result = v4l2_streamoff(dev);
 	if (result)
 		return result;
 
 	/* No need to dequeue our buffers, streamoff does that for us */
 
-	v4l2_unmap_buffers(index);
+	v4l2_unmap_buffers(dev);
 
-	v4l2_unrequest_read_buffers(index);
+	v4l2_unrequest_read_buffers(dev);
 
-	devices[index].flags &= ~V4L2_STREAM_CONTROLLED_BY_READ;
+	dev->flags &= ~V4L2_STREAM_CONTROLLED_BY_READ;
 
 	return 0;
 }
 
-static int v4l2_needs_conversion(int index)
+/* Add a read buffer after the driver dropped frames, while streaming when
+   the driver supports VIDIOC_CREATE_BUFS, otherwise the stream gets
+   restarted with more buffers by the next read() */
+static void v4l2_grow_read_buffers(struct v4l2_dev_info *dev)
 {
-	if (devices[index].convert == NULL)
+	struct v4l2_create_buffers create;
+	unsigned int index;
+
+	dev->read_buffer_starved = 0;
+	if (dev->nreadbuffers >= dev->max_nreadbuffers ||
+			!(dev->flags & V4L2_BUFFERS_REQUESTED_BY_READ))
+		return;
+
+	dev->nreadbuffers++;
+	V4L2_LOG("driver dropped frames, using %u read buffers\n",
+			dev->nreadbuffers);
+
+	memset(&create, 0, sizeof(create));
+	create.count = 1;
+	create.memory = V4L2_MEMORY_MMAP;
+	create.format = dev->src_fmt;
+	if (dev->dev_ops->ioctl(dev->dev_ops_priv,
+			dev->fd, VIDIOC_CREATE_BUFS, &create) ||
+			create.count != 1) {
+		v4l2_deactivate_read_stream(dev);
+		return;
+	}
+
+	index = create.index;
+	if (v4l2_set_no_frames(dev, index + 1) ||
+			v4l2_map_buffers(dev) ||
+			v4l2_queue_read_buffer(dev, index)) {
+		V4L2_LOG_WARN("adding read buffer %u failed, restarting stream\n",
+				index);
+		v4l2_deactivate_read_stream(dev);
+	}
+}
+
+static int v4l2_needs_conversion(struct v4l2_dev_info *dev)
+{
+	if (dev->convert == NULL)
 		return 0;
 
-	return v4lconvert_needs_conversion(devices[index].convert,
-			&devices[index].src_fmt, &devices[index].dest_fmt);
+	return v4lconvert_needs_conversion(dev->convert,
+			&dev->src_fmt, &dev->dest_fmt);
+}
+
+/* When converting with USERPTR / DMABUF buffers, the real buffers are MMAP
+   buffers and we convert into the buffer the app passed to QBUF when the
+   frame gets dequeued. We keep dmabufs mapped for as long as the app keeps
+   queuing the same dmabuf for a buffer index. */
+static void v4l2_release_app_buffer(struct v4l2_frame_info *frame)
+{
+	if (frame->app_dmabuf_fd != -1) {
+		SYS_MUNMAP(frame->app_pointer, frame->app_length);
+		SYS_CLOSE(frame->app_dmabuf_fd);
+		frame->app_dmabuf_fd = -1;
+	}
+	frame->app_pointer = NULL;
+	frame->app_length = 0;
+}
+
+static void v4l2_release_app_buffers(struct v4l2_dev_info *dev)
+{
+	unsigned int i;
+
+	for (i = 0; i < dev->frames_size; i++)
+		v4l2_release_app_buffer(&dev->frames[i]);
+}
+
+/* VIDIOC_QBUF of an USERPTR / DMABUF buffer when converting */
+static int v4l2_queue_app_buffer(struct v4l2_dev_info *dev, struct v4l2_buffer *buf)
+{
+	struct v4l2_frame_info *frame, app = { .app_dmabuf_fd = -1 };
+	struct v4l2_buffer real_buf = *buf;
+	struct stat st;
+	int result;
+
+	if (buf->memory != dev->memory || buf->index >= dev->no_frames ||
+			buf->length < dev->dest_fmt.fmt.pix.sizeimage) {
+		errno = EINVAL;
+		return -1;
+	}
+	frame = &dev->frames[buf->index];
+
+	app.app_length = buf->length;
+	if (buf->memory == V4L2_MEMORY_USERPTR) {
+		app.app_pointer = (unsigned char *)buf->m.userptr;
+		if (!app.app_pointer) {
+			errno = EINVAL;
+			return -1;
+		}
+	} else {
+		if (fstat(buf->m.fd, &st))
+			return -1;
+
+		app.app_fd = buf->m.fd;
+		app.app_dmabuf_dev = st.st_dev;
+		app.app_dmabuf_ino = st.st_ino;
+		/* Only map it when this is not the dmabuf we have mapped */
+		if (frame->app_dmabuf_fd == -1 ||
+				frame->app_dmabuf_dev != st.st_dev ||
+				frame->app_dmabuf_ino != st.st_ino ||
+				frame->app_length != app.app_length) {
+			app.app_pointer = (void *)SYS_MMAP(NULL,
+					app.app_length,
+					PROT_READ | PROT_WRITE, MAP_SHARED,
+					buf->m.fd, 0);
+			if ((void *)app.app_pointer == MAP_FAILED) {
+				int saved_err = errno;
+
+				V4L2_LOG_ERR("mapping dmabuf %d: %s\n",
+						buf->m.fd, strerror(errno));
+				errno = saved_err;
+				return -1;
+			}
+			app.app_dmabuf_fd = fcntl(buf->m.fd, F_DUPFD_CLOEXEC, 0);
+			if (app.app_dmabuf_fd == -1) {
+				int saved_err = errno;
+
+				SYS_MUNMAP(app.app_pointer, app.app_length);
+				errno = saved_err;
+				return -1;
+			}
+		}
+	}
+
+	real_buf.memory = V4L2_MEMORY_MMAP;
+	real_buf.m.offset = 0;
+	result = dev->dev_ops->ioctl(dev->dev_ops_priv,
+			dev->fd, VIDIOC_QBUF, &real_buf);
+	if (result) {
+		int saved_err = errno;
+
+		v4l2_release_app_buffer(&app);
+		errno = saved_err;
+		return result;
+	}
+
+	if (buf->memory == V4L2_MEMORY_USERPTR ||
+			app.app_dmabuf_fd != -1) {
+		v4l2_release_app_buffer(frame);
+		frame->app_pointer = app.app_pointer;
+		frame->app_dmabuf_fd = app.app_dmabuf_fd;
+		frame->app_dmabuf_dev = app.app_dmabuf_dev;
+		frame->app_dmabuf_ino = app.app_dmabuf_ino;
+	}
+	frame->app_length = app.app_length;
+	frame->app_fd = app.app_fd;
+
+	buf->flags = real_buf.flags;
+	return 0;
+}
+
+/* VIDIOC_EXPBUF when converting, export our conversion buffer (which is a
+   memfd) as a dmabuf through udmabuf */
+static int v4l2_export_buffer(struct v4l2_dev_info *dev, struct v4l2_exportbuffer *expbuf)
+{
+	struct udmabuf_create create;
+	int fd, result;
+
+	if (dev->memory != V4L2_MEMORY_MMAP ||
+			expbuf->index >= dev->no_frames || expbuf->plane) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (v4l2_ensure_convert_mmap_buf(dev))
+		return -1;
+
+	if (dev->convert_mmap_fd == -1) {
+		V4L2_LOG_ERR("exporting buffer: no memfd support\n");
+		errno = ENOTTY;
+		return -1;
+	}
+
+	fd = SYS_OPEN("/dev/udmabuf", O_RDWR | O_CLOEXEC, 0);
+	if (fd == -1) {
+		int saved_err = errno;
+
+		V4L2_LOG_ERR("exporting buffer, opening /dev/udmabuf: %s\n",
+				strerror(errno));
+		errno = saved_err;
+		return -1;
+	}
+
+	memset(&create, 0, sizeof(create));
+	create.memfd = dev->convert_mmap_fd;
+	create.flags = (expbuf->flags & O_CLOEXEC) ? UDMABUF_FLAGS_CLOEXEC : 0;
+	create.offset = expbuf->index * dev->convert_mmap_frame_size;
+	create.size = dev->convert_mmap_frame_size;
+	result = SYS_IOCTL(fd, UDMABUF_CREATE, &create);
+	if (result < 0) {
+		int saved_err = errno;
+
+		V4L2_LOG_ERR("exporting buffer %u: %s\n", expbuf->index,
+				strerror(errno));
+		SYS_CLOSE(fd);
+		errno = saved_err;
+		return -1;
+	}
+	SYS_CLOSE(fd);
+
+	/* From now on the data must always be in our buffers */
+	dev->flags |= V4L2_BUFFERS_EXPORTED;
+	expbuf->fd = result;
+
+	return 0;
 }
 
-static void v4l2_set_conversion_buf_params(int index, struct v4l2_buffer *buf)
+static void v4l2_set_conversion_buf_params(struct v4l2_dev_info *dev, struct v4l2_buffer *buf)
 {
-	if (!v4l2_needs_conversion(index))
+	struct v4l2_frame_info *frame;
+
+	if (!v4l2_needs_conversion(dev))
 		return;
 
 	/* This may happen if the ioctl failed */
-	if (buf->index >= devices[index].no_frames)
+	if (buf->index >= dev->no_frames)
 		buf->index = 0;
-
-	buf->m.offset = V4L2_MMAP_OFFSET_MAGIC | buf->index;
-	buf->length = devices[index].convert_mmap_frame_size;
-	if (devices[index].frame_map_count[buf->index])
-		buf->flags |= V4L2_BUF_FLAG_MAPPED;
-	else
+	if (!dev->no_frames)
+		return;
+	frame = &dev->frames[buf->index];
+
+	buf->memory = dev->memory;
+	switch (dev->memory) {
+	case V4L2_MEMORY_USERPTR:
+	case V4L2_MEMORY_DMABUF:
+		if (dev->memory == V4L2_MEMORY_USERPTR)
+			buf->m.userptr = (unsigned long)frame->app_pointer;
+		else
+			buf->m.fd = frame->app_pointer ? frame->app_fd : -1;
+		buf->length = frame->app_pointer ? frame->app_length :
+			dev->dest_fmt.fmt.pix.sizeimage;
 		buf->flags &= ~V4L2_BUF_FLAG_MAPPED;
+		break;
+	default:
+		buf->m.offset = V4L2_MMAP_OFFSET_MAGIC | buf->index;
+		buf->length = dev->convert_mmap_frame_size;
+		if (frame->map_count)
+			buf->flags |= V4L2_BUF_FLAG_MAPPED;
+		else
+			buf->flags &= ~V4L2_BUF_FLAG_MAPPED;
+	}
 }
 
-static int v4l2_buffers_mapped(int index)
+static int v4l2_buffers_mapped(struct v4l2_dev_info *dev)
 {
 	unsigned int i;
 
-	if (!v4l2_needs_conversion(index)) {
+	if (!v4l2_needs_conversion(dev)) {
 		/* Normal (no conversion) mode */
 		struct v4l2_buffer buf;
 
-		for (i = 0; i < devices[index].no_frames; i++) {
+		for (i = 0; i < dev->no_frames; i++) {
 			buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 			buf.memory = V4L2_MEMORY_MMAP;
 			buf.index = i;
 			buf.reserved = buf.reserved2 = 0;
-			if (devices[index].dev_ops->ioctl(
-					devices[index].dev_ops_priv,
-					devices[index].fd, VIDIOC_QUERYBUF,
+			if (dev->dev_ops->ioctl(
+					dev->dev_ops_priv,
+					dev->fd, VIDIOC_QUERYBUF,
 					&buf)) {
 				int saved_err = errno;
 
@@ -595,27 +1579,25 @@ static int v4l2_buffers_mapped(int index)
 		}
 	} else {
 		/* Conversion mode */
-		for (i = 0; i < devices[index].no_frames; i++)
-			if (devices[index].frame_map_count[i])
-				break;
+		i = dev->frames_mapped ? 0 : dev->no_frames;
 	}
 
-	if (i != devices[index].no_frames)
+	if (i != dev->no_frames)
 		V4L2_LOG("v4l2_buffers_mapped(): buffers still mapped\n");
 
-	return i != devices[index].no_frames;
+	return i != dev->no_frames;
 }
 
-static void v4l2_update_fps(int index, struct v4l2_streamparm *parm)
+static void v4l2_update_fps(struct v4l2_dev_info *dev, struct v4l2_streamparm *parm)
 {
-	if ((devices[index].flags & V4L2_SUPPORTS_TIMEPERFRAME) &&
+	if ((dev->flags & V4L2_SUPPORTS_TIMEPERFRAME) &&
 	    parm->parm.capture.timeperframe.numerator != 0) {
 		int fps = parm->parm.capture.timeperframe.denominator;
 		fps += parm->parm.capture.timeperframe.numerator - 1;
 		fps /= parm->parm.capture.timeperframe.numerator;
-		devices[index].fps = fps;
+		dev->fps = fps;
 	} else
-		devices[index].fps = 0;
+		dev->fps = 0;
 }
 
 int v4l2_open(const char *file, int oflag, ...)
@@ -654,8 +1636,8 @@ int v4l2_open(const char *file, int oflag, ...)
 
 int v4l2_fd_open(int fd, int v4l2_flags)
 {
-	int i, index;
-	char *lfname;
+	char *lfname, *s;
+	struct v4l2_dev_info *dev;
 	struct v4l2_capability cap;
 	struct v4l2_format fmt = { 0, };
 	struct v4l2_streamparm parm = { 0, };
@@ -675,6 +1657,14 @@ int v4l2_fd_open(int fd, int v4l2_flags)
 			v4l2_log_file = fopen(lfname, "w");
 	}
 
+	s = getenv("LIBV4L2_STATS_INTERVAL");
+	if (s)
+		v4l2_stats_interval = strtoull(s, NULL, 0) * 1000000000ULL;
+
+	s = getenv("LIBV4L2_READ_LATEST_FRAME");
+	if (s && atoi(s))
+		v4l2_flags |= V4L2_READ_LATEST_FRAME;
+
 	/* Get page_size (for mmap emulation) */
 	page_size = sysconf(_SC_PAGESIZE);
 	if (page_size < 0) {
@@ -729,140 +1719,170 @@ int v4l2_fd_open(int fd, int v4l2_flags)
 	}
 
 no_capture:
-	/* So we have a v4l2 capture device, register it in our devices array */
+	/* So we have a v4l2 capture device, register it in our devices list */
 	pthread_mutex_lock(&v4l2_open_mutex);
-	for (index = 0; index < V4L2_MAX_DEVICES; index++) {
-		if (devices[index].fd == -1) {
-			devices[index].fd = fd;
-			devices[index].plugin_library = plugin_library;
-			devices[index].dev_ops_priv = dev_ops_priv;
-			devices[index].dev_ops = dev_ops;
+	for (dev = devices; dev; dev = dev->next)
+		if (dev->fd == -1)
 			break;
+	if (!dev) {
+		dev = calloc(1, sizeof(*dev));
+		if (dev) {
+			dev->fd = -1;
+			dev->convert_mmap_buf = MAP_FAILED;
+			dev->next = devices;
+			__atomic_store_n(&devices, dev, __ATOMIC_RELEASE);
 		}
 	}
-	pthread_mutex_unlock(&v4l2_open_mutex);
-
-	if (index == V4L2_MAX_DEVICES) {
-		V4L2_LOG_ERR("attempting to open more than %d video devices\n",
-				V4L2_MAX_DEVICES);
+	if (!dev || v4l_fd_table_set(&v4l2_fd_table, fd, dev)) {
+		pthread_mutex_unlock(&v4l2_open_mutex);
+		V4L2_LOG_ERR("allocating device info\n");
 		v4l2_plugin_cleanup(plugin_library, dev_ops_priv, dev_ops);
-		errno = EBUSY;
+		v4lconvert_destroy(convert);
+		errno = ENOMEM;
 		return -1;
 	}
+	dev->fd = fd;
+	dev->plugin_library = plugin_library;
+	dev->dev_ops_priv = dev_ops_priv;
+	dev->dev_ops = dev_ops;
+	pthread_mutex_unlock(&v4l2_open_mutex);
 
-	devices[index].flags = v4l2_flags;
+	dev->flags = v4l2_flags;
 	if (cap.capabilities & V4L2_CAP_READWRITE)
-		devices[index].flags |= V4L2_SUPPORTS_READ;
+		dev->flags |= V4L2_SUPPORTS_READ;
 	if (!(cap.capabilities & V4L2_CAP_STREAMING)) {
-		devices[index].flags |= V4L2_USE_READ_FOR_READ;
+		dev->flags |= V4L2_USE_READ_FOR_READ;
 		/* This device only supports read so the stream gets started by the
 		   driver on the first read */
-		devices[index].first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
+		dev->first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
 	}
 	if ((parm.type == V4L2_BUF_TYPE_VIDEO_CAPTURE) &&
 	    (parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME))
-		devices[index].flags |= V4L2_SUPPORTS_TIMEPERFRAME;
-	devices[index].open_count = 1;
-	devices[index].page_size = page_size;
-	devices[index].src_fmt  = fmt;
-	devices[index].dest_fmt = fmt;
-	v4l2_set_src_and_dest_format(index, &devices[index].src_fmt,
-				     &devices[index].dest_fmt);
-
-	pthread_mutex_init(&devices[index].stream_lock, NULL);
-
-	devices[index].no_frames = 0;
-	devices[index].nreadbuffers = V4L2_DEFAULT_NREADBUFFERS;
-	devices[index].convert = convert;
-	devices[index].convert_mmap_buf = MAP_FAILED;
-	devices[index].convert_mmap_buf_size = 0;
-	for (i = 0; i < V4L2_MAX_NO_FRAMES; i++) {
-		devices[index].frame_pointers[i] = MAP_FAILED;
-		devices[index].frame_map_count[i] = 0;
-	}
-	devices[index].frame_queued = 0;
-	devices[index].readbuf = NULL;
-	devices[index].readbuf_size = 0;
-
-	if (index >= devices_used)
-		devices_used = index + 1;
+		dev->flags |= V4L2_SUPPORTS_TIMEPERFRAME;
+	dev->open_count = 1;
+	dev->gone = 0;
+	dev->page_size = page_size;
+	dev->src_fmt  = fmt;
+	dev->dest_fmt = fmt;
+	v4l2_set_src_and_dest_format(dev, &dev->src_fmt,
+				     &dev->dest_fmt);
+
+	pthread_mutex_init(&dev->stream_lock, NULL);
+	pthread_cond_init(&dev->pipeline_cond, NULL);
+	dev->pipeline_state = V4L2_PIPELINE_STOPPED;
+
+	dev->no_frames = 0;
+	dev->memory = V4L2_MEMORY_MMAP;
+	dev->nreadbuffers = V4L2_DEFAULT_NREADBUFFERS;
+	dev->max_nreadbuffers = dev->nreadbuffers;
+	s = getenv("LIBV4L2_READ_BUFFERS");
+	if (s) {
+		char *end;
+		unsigned long count = strtoul(s, &end, 0);
+
+		if (count >= 1 && count <= V4L2_MAX_NO_FRAMES) {
+			dev->nreadbuffers = dev->max_nreadbuffers = count;
+			count = *end == '-' ? strtoul(end + 1, NULL, 0) : 0;
+			if (count > dev->nreadbuffers &&
+					count <= V4L2_MAX_NO_FRAMES)
+				dev->max_nreadbuffers = count;
+		}
+	}
+	dev->last_sequence_valid = 0;
+	dev->read_buffer_starved = 0;
+	s = getenv("LIBV4L2_READ_MAX_AGE");
+	dev->read_max_age = s ? strtoull(s, NULL, 0) * 1000000ULL : 0;
+	dev->convert = convert;
+	dev->convert_mmap_buf = MAP_FAILED;
+	dev->convert_mmap_buf_size = 0;
+	dev->convert_mmap_fd = -1;
+	dev->frames = NULL;
+	dev->frames_size = 0;
+	dev->frames_queued = 0;
+	dev->frames_mapped = 0;
+	dev->readbuf = NULL;
+	dev->readbuf_size = 0;
+	memset(&dev->stats, 0, sizeof(dev->stats));
+	memset(&dev->convert_stats, 0, sizeof(dev->convert_stats));
+	memset(&dev->convert_stats_base, 0, sizeof(dev->convert_stats_base));
+	dev->stats_dump_time = 0;
 
 	/* Note we always tell v4lconvert to optimize src fmt selection for
 	   our default fps, the only exception is the app explicitly selecting
 	   a frame rate using the S_PARM ioctl after a S_FMT */
-	if (devices[index].convert)
-		v4lconvert_set_fps(devices[index].convert, V4L2_DEFAULT_FPS);
-	v4l2_update_fps(index, &parm);
+	if (dev->convert)
+		v4lconvert_set_fps(dev->convert, V4L2_DEFAULT_FPS);
+	v4l2_update_fps(dev, &parm);
 
 	V4L2_LOG("open: %d\n", fd);
 
 	return fd;
 }
 
-/* Is this an fd for which we are emulating v4l1 ? */
-static int v4l2_get_index(int fd)
+/* Is this an fd for which we are doing conversion / emulation ? */
+static struct v4l2_dev_info *v4l2_get_dev(int fd)
 {
-	int index;
-
-	/* We never handle fd -1 */
-	if (fd == -1)
-		return -1;
-
-	for (index = 0; index < devices_used; index++)
-		if (devices[index].fd == fd)
-			break;
-
-	if (index == devices_used)
-		return -1;
-
-	return index;
+	return v4l_fd_table_get(&v4l2_fd_table, fd);
 }
 
 
 int v4l2_close(int fd)
 {
-	int index, result;
+	struct v4l2_dev_info *dev;
+	int result;
 
-	index = v4l2_get_index(fd);
-	if (index == -1)
+	dev = v4l2_get_dev(fd);
+	if (!dev)
 		return SYS_CLOSE(fd);
 
 	/* Abuse stream_lock to stop 2 closes from racing and trying to free
 	   the resources twice */
-	pthread_mutex_lock(&devices[index].stream_lock);
-	devices[index].open_count--;
-	result = devices[index].open_count != 0;
-	pthread_mutex_unlock(&devices[index].stream_lock);
+	pthread_mutex_lock(&dev->stream_lock);
+	dev->open_count--;
+	result = dev->open_count != 0;
+	/* The close would turn the stream off anyways, doing it ourselves also
+	   stops the pipeline thread */
+	if (!result && dev->pipeline_state != V4L2_PIPELINE_STOPPED)
+		v4l2_streamoff(dev);
+	pthread_mutex_unlock(&dev->stream_lock);
 
 	if (result)
 		return 0;
 
-	v4l2_plugin_cleanup(devices[index].plugin_library,
-			devices[index].dev_ops_priv,
-			devices[index].dev_ops);
+	if (v4l2_stats_interval)
+		v4l2_dump_stats(dev);
+
+	v4l2_plugin_cleanup(dev->plugin_library,
+			dev->dev_ops_priv,
+			dev->dev_ops);
 
 	/* Free resources */
-	v4l2_unmap_buffers(index);
-	if (devices[index].convert_mmap_buf != MAP_FAILED) {
-		if (v4l2_buffers_mapped(index)) {
-			if (!devices[index].gone)
-				V4L2_LOG_WARN("v4l2 mmap buffers still mapped on close()\n");
-		} else {
-			SYS_MUNMAP(devices[index].convert_mmap_buf,
-					devices[index].convert_mmap_buf_size);
-		}
-		devices[index].convert_mmap_buf = MAP_FAILED;
-		devices[index].convert_mmap_buf_size = 0;
-	}
-	v4lconvert_destroy(devices[index].convert);
-	free(devices[index].readbuf);
-	devices[index].readbuf = NULL;
-	devices[index].readbuf_size = 0;
+	v4l2_unmap_buffers(dev);
+	v4l2_release_app_buffers(dev);
+	if (dev->convert_mmap_buf != MAP_FAILED &&
+			v4l2_buffers_mapped(dev)) {
+		if (!dev->gone)
+			V4L2_LOG_WARN("v4l2 mmap buffers still mapped on close()\n");
+		/* Leave the mapping alone, the app is still using it */
+		dev->convert_mmap_buf = MAP_FAILED;
+	}
+	v4l2_free_convert_mmap_buf(dev);
+	v4lconvert_destroy(dev->convert);
+	pthread_cond_destroy(&dev->pipeline_cond);
+	free(dev->readbuf);
+	dev->readbuf = NULL;
+	dev->readbuf_size = 0;
+	free(dev->frames);
+	dev->frames = NULL;
+	dev->frames_size = 0;
 
 	/* Remove the fd from our list of managed fds before closing it, because as
 	   soon as we've done the actual close, the fd maybe returned by an open() in
 	   another thread and we don't want to intercept calls to this new fd. */
-	devices[index].fd = -1;
+	pthread_mutex_lock(&v4l2_open_mutex);
+	v4l_fd_table_set(&v4l2_fd_table, fd, NULL);
+	dev->fd = -1;
+	pthread_mutex_unlock(&v4l2_open_mutex);
 
 	/* Since we've marked the fd as no longer used, and freed the resources,
 	   redo the close in case it was interrupted */
@@ -877,26 +1897,33 @@ int v4l2_close(int fd)
 
 int v4l2_dup(int fd)
 {
-	int index = v4l2_get_index(fd);
+	struct v4l2_dev_info *dev = v4l2_get_dev(fd);
 
-	if (index == -1)
+	if (!dev)
 		return syscall(SYS_dup, fd);
 
-	devices[index].open_count++;
+	dev->open_count++;
 
 	return fd;
 }
 
-static int v4l2_check_buffer_change_ok(int index)
+static int v4l2_check_buffer_change_ok(struct v4l2_dev_info *dev)
 {
-	devices[index].frame_info_generation++;
-	v4l2_unmap_buffers(index);
+	/* The pipeline thread is using the buffers (so the stream is on) */
+	if (dev->pipeline_state != V4L2_PIPELINE_STOPPED) {
+		V4L2_LOG("v4l2_check_buffer_change_ok(): stream busy\n");
+		errno = EBUSY;
+		return -1;
+	}
+
+	dev->frame_info_generation++;
+	v4l2_unmap_buffers(dev);
 
 	/* Check if the app itself still is using the stream */
-	if (v4l2_buffers_mapped(index) ||
-			(!(devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) &&
-			 ((devices[index].flags & V4L2_STREAMON) ||
-			  devices[index].frame_queued))) {
+	if (v4l2_buffers_mapped(dev) ||
+			(!(dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) &&
+			 ((dev->flags & V4L2_STREAMON) ||
+			  dev->frames_queued))) {
 		V4L2_LOG("v4l2_check_buffer_change_ok(): stream busy\n");
 		errno = EBUSY;
 		return -1;
@@ -905,14 +1932,11 @@ static int v4l2_check_buffer_change_ok(int index)
 	/* We may change from convert to non conversion mode and
 	   v4l2_unrequest_read_buffers may change the no_frames, so free the
 	   convert mmap buffer */
-	SYS_MUNMAP(devices[index].convert_mmap_buf,
-			devices[index].convert_mmap_buf_size);
-	devices[index].convert_mmap_buf = MAP_FAILED;
-	devices[index].convert_mmap_buf_size = 0;
+	v4l2_free_convert_mmap_buf(dev);
 
-	if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+	if (dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
 		V4L2_LOG("deactivating read-stream for settings change\n");
-		return v4l2_deactivate_read_stream(index);
+		return v4l2_deactivate_read_stream(dev);
 	}
 
 	return 0;
@@ -939,7 +1963,7 @@ static int v4l2_pix_fmt_identical(struct v4l2_format *a, struct v4l2_format *b)
 	return 0;
 }
 
-static void v4l2_set_src_and_dest_format(int index,
+static void v4l2_set_src_and_dest_format(struct v4l2_dev_info *dev,
 		struct v4l2_format *src_fmt, struct v4l2_format *dest_fmt)
 {
 	/*
@@ -970,15 +1994,15 @@ static void v4l2_set_src_and_dest_format(int index,
 	} else
 		v4lconvert_fixup_fmt(dest_fmt);
 
-	devices[index].src_fmt = *src_fmt;
-	devices[index].dest_fmt = *dest_fmt;
+	dev->src_fmt = *src_fmt;
+	dev->dest_fmt = *dest_fmt;
 	/* round up to full page size */
-	devices[index].convert_mmap_frame_size =
-		(((dest_fmt->fmt.pix.sizeimage + devices[index].page_size - 1)
-		/ devices[index].page_size) * devices[index].page_size);
+	dev->convert_mmap_frame_size =
+		(((dest_fmt->fmt.pix.sizeimage + dev->page_size - 1)
+		/ dev->page_size) * dev->page_size);
 }
 
-static int v4l2_s_fmt(int index, struct v4l2_format *dest_fmt)
+static int v4l2_s_fmt(struct v4l2_dev_info *dev, struct v4l2_format *dest_fmt)
 {
 	struct v4l2_format src_fmt;
 	struct v4l2_pix_format req_pix_fmt;
@@ -994,7 +2018,7 @@ static int v4l2_s_fmt(int index, struct v4l2_format *dest_fmt)
 				pixfmt >> 24);
 	}
 
-	result = v4lconvert_try_format(devices[index].convert,
+	result = v4lconvert_try_format(dev->convert,
 				       dest_fmt, &src_fmt);
 	if (result) {
 		int saved_err = errno;
@@ -1013,19 +2037,18 @@ static int v4l2_s_fmt(int index, struct v4l2_format *dest_fmt)
 			(pixfmt >> 16) & 0xff, pixfmt >> 24);
 	}
 
-	result = v4l2_check_buffer_change_ok(index);
+	result = v4l2_check_buffer_change_ok(dev);
 	if (result)
 		return result;
 
 	req_pix_fmt = src_fmt.fmt.pix;
-	result = devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-					       devices[index].fd,
-					       VIDIOC_S_FMT, &src_fmt);
+	result = v4lconvert_src_fmt_ioctl(dev->convert,
+			VIDIOC_S_FMT, &src_fmt);
 	if (result) {
 		int saved_err = errno;
 		V4L2_PERROR("setting pixformat");
 		/* Report to the app dest_fmt has not changed */
-		*dest_fmt = devices[index].dest_fmt;
+		*dest_fmt = dev->dest_fmt;
 		errno = saved_err;
 		return result;
 	}
@@ -1040,17 +2063,17 @@ static int v4l2_s_fmt(int index, struct v4l2_format *dest_fmt)
 		*dest_fmt = src_fmt;
 	}
 
-	v4l2_set_src_and_dest_format(index, &src_fmt, dest_fmt);
+	v4l2_set_src_and_dest_format(dev, &src_fmt, dest_fmt);
 
-	if (devices[index].flags & V4L2_SUPPORTS_TIMEPERFRAME) {
+	if (dev->flags & V4L2_SUPPORTS_TIMEPERFRAME) {
 		struct v4l2_streamparm parm = {
 			.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
 		};
-		if (devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-						  devices[index].fd,
+		if (dev->dev_ops->ioctl(dev->dev_ops_priv,
+						  dev->fd,
 						  VIDIOC_G_PARM, &parm))
 			return 0;
-		v4l2_update_fps(index, &parm);
+		v4l2_update_fps(dev, &parm);
 	}
 
 	return 0;
@@ -1060,15 +2083,16 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 {
 	void *arg;
 	va_list ap;
-	int result, index, saved_err;
+	struct v4l2_dev_info *dev;
+	int result, saved_err;
 	int is_capture_request = 0, stream_needs_locking = 0;
 
 	va_start(ap, request);
 	arg = va_arg(ap, void *);
 	va_end(ap);
 
-	index = v4l2_get_index(fd);
-	if (index == -1)
+	dev = v4l2_get_dev(fd);
+	if (!dev)
 		return SYS_IOCTL(fd, request, arg);
 
 	/* Apparently the kernel and / or glibc ignore the 32 most significant bits
@@ -1076,7 +2100,7 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 	   ioctl, causing it to get sign extended, depending upon this behavior */
 	request = (unsigned int)request;
 
-	if (devices[index].convert == NULL)
+	if (dev->convert == NULL)
 		goto no_capture_request;
 
 	/* Is this a capture request and do we need to take the stream lock? */
@@ -1126,6 +2150,13 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 			stream_needs_locking = 1;
 		}
 		break;
+	case VIDIOC_EXPBUF:
+		if (((struct v4l2_exportbuffer *)arg)->type ==
+				V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+			is_capture_request = 1;
+			stream_needs_locking = 1;
+		}
+		break;
 	case VIDIOC_STREAMON:
 	case VIDIOC_STREAMOFF:
 		if (*((enum v4l2_buf_type *)arg) ==
@@ -1138,7 +2169,7 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 		if (((struct v4l2_streamparm *)arg)->type ==
 				V4L2_BUF_TYPE_VIDEO_CAPTURE) {
 			is_capture_request = 1;
-			if (devices[index].flags & V4L2_SUPPORTS_TIMEPERFRAME)
+			if (dev->flags & V4L2_SUPPORTS_TIMEPERFRAME)
 				stream_needs_locking = 1;
 		}
 		break;
@@ -1152,8 +2183,8 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 
 	if (!is_capture_request) {
 no_capture_request:
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, request, arg);
 		saved_err = errno;
 		v4l2_log_ioctl(request, arg, result);
@@ -1163,55 +2194,55 @@ no_capture_request:
 
 
 	if (stream_needs_locking) {
-		pthread_mutex_lock(&devices[index].stream_lock);
+		pthread_mutex_lock(&dev->stream_lock);
 		/* If this is the first stream-related ioctl, and we should only allow
 		   libv4lconvert supported destination formats (so that it can do flipping,
 		   processing, etc.) and the current destination format is not supported,
 		   try setting the format to RGB24 (which is a supported dest. format). */
-		if (!(devices[index].flags & V4L2_STREAM_TOUCHED) &&
-				v4lconvert_supported_dst_fmt_only(devices[index].convert) &&
+		if (!(dev->flags & V4L2_STREAM_TOUCHED) &&
+				v4lconvert_supported_dst_fmt_only(dev->convert) &&
 				!v4lconvert_supported_dst_format(
-					devices[index].dest_fmt.fmt.pix.pixelformat)) {
-			struct v4l2_format fmt = devices[index].dest_fmt;
+					dev->dest_fmt.fmt.pix.pixelformat)) {
+			struct v4l2_format fmt = dev->dest_fmt;
 
 			V4L2_LOG("Setting pixelformat to RGB24 (supported_dst_fmt_only)");
 			fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_RGB24;
-			v4l2_s_fmt(index, &fmt);
+			v4l2_s_fmt(dev, &fmt);
 			V4L2_LOG("Done setting pixelformat (supported_dst_fmt_only)");
 		}
-		devices[index].flags |= V4L2_STREAM_TOUCHED;
+		dev->flags |= V4L2_STREAM_TOUCHED;
 	}
 
 	switch (request) {
 	case VIDIOC_QUERYCTRL:
-		result = v4lconvert_vidioc_queryctrl(devices[index].convert, arg);
+		result = v4lconvert_vidioc_queryctrl(dev->convert, arg);
 		break;
 
 	case VIDIOC_G_CTRL:
-		result = v4lconvert_vidioc_g_ctrl(devices[index].convert, arg);
+		result = v4lconvert_vidioc_g_ctrl(dev->convert, arg);
 		break;
 
 	case VIDIOC_S_CTRL:
-		result = v4lconvert_vidioc_s_ctrl(devices[index].convert, arg);
+		result = v4lconvert_vidioc_s_ctrl(dev->convert, arg);
 		break;
 
 	case VIDIOC_G_EXT_CTRLS:
-		result = v4lconvert_vidioc_g_ext_ctrls(devices[index].convert, arg);
+		result = v4lconvert_vidioc_g_ext_ctrls(dev->convert, arg);
 		break;
 
 	case VIDIOC_TRY_EXT_CTRLS:
-		result = v4lconvert_vidioc_try_ext_ctrls(devices[index].convert, arg);
+		result = v4lconvert_vidioc_try_ext_ctrls(dev->convert, arg);
 		break;
 
 	case VIDIOC_S_EXT_CTRLS:
-		result = v4lconvert_vidioc_s_ext_ctrls(devices[index].convert, arg);
+		result = v4lconvert_vidioc_s_ext_ctrls(dev->convert, arg);
 		break;
 
 	case VIDIOC_QUERYCAP: {
 		struct v4l2_capability *cap = arg;
 
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, VIDIOC_QUERYCAP, cap);
 		if (result == 0) {
 			/* We always support read() as we fake it using mmap mode */
@@ -1222,33 +2253,33 @@ no_capture_request:
 	}
 
 	case VIDIOC_ENUM_FMT:
-		result = v4lconvert_enum_fmt(devices[index].convert, arg);
+		result = v4lconvert_enum_fmt(dev->convert, arg);
 		break;
 
 	case VIDIOC_ENUM_FRAMESIZES:
-		result = v4lconvert_enum_framesizes(devices[index].convert, arg);
+		result = v4lconvert_enum_framesizes(dev->convert, arg);
 		break;
 
 	case VIDIOC_ENUM_FRAMEINTERVALS:
-		result = v4lconvert_enum_frameintervals(devices[index].convert, arg);
+		result = v4lconvert_enum_frameintervals(dev->convert, arg);
 		if (result)
 			V4L2_LOG("ENUM_FRAMEINTERVALS Error: %s",
-					v4lconvert_get_error_message(devices[index].convert));
+					v4lconvert_get_error_message(dev->convert));
 		break;
 
 	case VIDIOC_TRY_FMT:
-		result = v4lconvert_try_format(devices[index].convert,
+		result = v4lconvert_try_format(dev->convert,
 					       arg, NULL);
 		break;
 
 	case VIDIOC_S_FMT:
-		result = v4l2_s_fmt(index, arg);
+		result = v4l2_s_fmt(dev, arg);
 		break;
 
 	case VIDIOC_G_FMT: {
 		struct v4l2_format *fmt = arg;
 
-		*fmt = devices[index].dest_fmt;
+		*fmt = dev->dest_fmt;
 		result = 0;
 		break;
 	}
@@ -1258,18 +2289,18 @@ no_capture_request:
 	case VIDIOC_S_DV_TIMINGS: {
 		struct v4l2_format src_fmt = { 0 };
 		unsigned int orig_dest_pixelformat =
-			devices[index].dest_fmt.fmt.pix.pixelformat;
+			dev->dest_fmt.fmt.pix.pixelformat;
 
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, request, arg);
 		if (result)
 			break;
 
 		/* These ioctls may have changed the device's fmt */
 		src_fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, VIDIOC_G_FMT, &src_fmt);
 		if (result) {
 			V4L2_PERROR("getting pixformat after %s",
@@ -1278,20 +2309,20 @@ no_capture_request:
 			break;
 		}
 
-		if (v4l2_pix_fmt_compat(&devices[index].src_fmt, &src_fmt)) {
-			v4l2_set_src_and_dest_format(index, &src_fmt,
-						     &devices[index].dest_fmt);
+		if (v4l2_pix_fmt_compat(&dev->src_fmt, &src_fmt)) {
+			v4l2_set_src_and_dest_format(dev, &src_fmt,
+						     &dev->dest_fmt);
 			break;
 		}
 
 		/* The fmt has been changed, remember the new format ... */
-		devices[index].src_fmt  = src_fmt;
-		devices[index].dest_fmt = src_fmt;
-		v4l2_set_src_and_dest_format(index, &devices[index].src_fmt,
-					     &devices[index].dest_fmt);
+		dev->src_fmt  = src_fmt;
+		dev->dest_fmt = src_fmt;
+		v4l2_set_src_and_dest_format(dev, &dev->src_fmt,
+					     &dev->dest_fmt);
 		/* and try to restore the last set destination pixelformat. */
 		src_fmt.fmt.pix.pixelformat = orig_dest_pixelformat;
-		result = v4l2_s_fmt(index, &src_fmt);
+		result = v4l2_s_fmt(dev, &src_fmt);
 		if (result) {
 			V4L2_LOG_WARN("restoring destination pixelformat after %s failed\n",
 				      v4l2_ioctls[_IOC_NR(request)]);
@@ -1303,15 +2334,17 @@ no_capture_request:
 
 	case VIDIOC_REQBUFS: {
 		struct v4l2_requestbuffers *req = arg;
+		enum v4l2_memory memory = req->memory;
 
-		/* IMPROVEME (maybe?) add support for userptr's? */
-		if (req->memory != V4L2_MEMORY_MMAP) {
+		if (memory != V4L2_MEMORY_MMAP &&
+				memory != V4L2_MEMORY_USERPTR &&
+				memory != V4L2_MEMORY_DMABUF) {
 			errno = EINVAL;
 			result = -1;
 			break;
 		}
 
-		result = v4l2_check_buffer_change_ok(index);
+		result = v4l2_check_buffer_change_ok(dev);
 		if (result)
 			break;
 
@@ -1319,114 +2352,166 @@ no_capture_request:
 		if (req->count > V4L2_MAX_NO_FRAMES)
 			req->count = V4L2_MAX_NO_FRAMES;
 
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		/* When converting we always use MMAP buffers ourselves, and
+		   convert into the app's buffers */
+		v4l2_release_app_buffers(dev);
+		if (v4l2_needs_conversion(dev))
+			req->memory = V4L2_MEMORY_MMAP;
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, VIDIOC_REQBUFS, req);
+		req->memory = memory;
 		if (result < 0)
 			break;
 		result = 0; /* some drivers return the number of buffers on success */
 
-		devices[index].no_frames = MIN(req->count, V4L2_MAX_NO_FRAMES);
-		devices[index].flags &= ~V4L2_BUFFERS_REQUESTED_BY_READ;
+		dev->memory = memory;
+
+		if (v4l2_set_no_frames(dev, req->count)) {
+			result = -1;
+			break;
+		}
+		dev->stats.queued = 0;
+		dev->flags &= ~V4L2_BUFFERS_REQUESTED_BY_READ;
 		break;
 	}
 
 	case VIDIOC_QUERYBUF: {
 		struct v4l2_buffer *buf = arg;
 
-		if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
-			result = v4l2_deactivate_read_stream(index);
+		if (dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+			result = v4l2_deactivate_read_stream(dev);
 			if (result)
 				break;
 		}
 
 		/* Do a real query even when converting to let the driver fill in
 		   things like buf->field */
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		if (v4l2_needs_conversion(dev))
+			buf->memory = V4L2_MEMORY_MMAP;
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, VIDIOC_QUERYBUF, buf);
 
-		v4l2_set_conversion_buf_params(index, buf);
+		v4l2_set_conversion_buf_params(dev, buf);
 		break;
 	}
 
 	case VIDIOC_QBUF: {
 		struct v4l2_buffer *buf = arg;
 
-		if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
-			result = v4l2_deactivate_read_stream(index);
+		if (dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+			result = v4l2_deactivate_read_stream(dev);
 			if (result)
 				break;
 		}
 
 		/* With some drivers the buffers must be mapped before queuing */
-		if (v4l2_needs_conversion(index)) {
-			result = v4l2_map_buffers(index);
+		if (v4l2_needs_conversion(dev)) {
+			result = v4l2_map_buffers(dev);
 			if (result)
 				break;
 		}
 
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
-				fd, VIDIOC_QBUF, arg);
+		if (v4l2_needs_conversion(dev) &&
+				dev->memory != V4L2_MEMORY_MMAP)
+			result = v4l2_queue_app_buffer(dev, buf);
+		else
+			result = dev->dev_ops->ioctl(
+					dev->dev_ops_priv,
+					fd, VIDIOC_QBUF, arg);
+		if (!result)
+			dev->stats.queued++;
+
+		/* The pipeline thread may be waiting for this */
+		if (dev->pipeline_state == V4L2_PIPELINE_RUNNING)
+			pthread_cond_broadcast(&dev->pipeline_cond);
 
-		v4l2_set_conversion_buf_params(index, buf);
+		v4l2_set_conversion_buf_params(dev, buf);
 		break;
 	}
 
 	case VIDIOC_DQBUF: {
 		struct v4l2_buffer *buf = arg;
 
-		if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
-			result = v4l2_deactivate_read_stream(index);
+		if (dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+			result = v4l2_deactivate_read_stream(dev);
 			if (result)
 				break;
 		}
 
-		if (!v4l2_needs_conversion(index)) {
-			pthread_mutex_unlock(&devices[index].stream_lock);
-			result = devices[index].dev_ops->ioctl(
-					devices[index].dev_ops_priv,
+		if (!v4l2_needs_conversion(dev)) {
+			uint64_t start = v4l2_stats_ns();
+
+			pthread_mutex_unlock(&dev->stream_lock);
+			result = dev->dev_ops->ioctl(
+					dev->dev_ops_priv,
 					fd, VIDIOC_DQBUF, buf);
-			pthread_mutex_lock(&devices[index].stream_lock);
+			pthread_mutex_lock(&dev->stream_lock);
+			dev->stats.dqbuf_wait_ns += v4l2_stats_ns() - start;
 			if (result) {
 				saved_err = errno;
 				V4L2_PERROR("dequeuing buf");
 				errno = saved_err;
+				break;
 			}
+			if (dev->stats.queued)
+				dev->stats.queued--;
+			v4l2_check_sequence(dev, buf);
+			v4l2_stats_frame(dev);
 			break;
 		}
 
 		/* An application can do a DQBUF before mmap-ing in the buffer,
 		   but we need the buffer _now_ to write our converted data
 		   to it! */
-		result = v4l2_ensure_convert_mmap_buf(index);
-		if (result)
-			break;
+		if (dev->memory == V4L2_MEMORY_MMAP) {
+			result = v4l2_ensure_convert_mmap_buf(dev);
+			if (result)
+				break;
+		}
+
+		buf->memory = V4L2_MEMORY_MMAP;
 
-		result = v4l2_dequeue_and_convert(index, buf, 0,
-				devices[index].convert_mmap_frame_size);
+		if ((dev->flags & V4L2_ENABLE_PIPELINED_CONVERSION) &&
+				(dev->flags & V4L2_STREAMON))
+			result = v4l2_pipeline_dequeue(dev, buf);
+		else
+			result = v4l2_dequeue_and_convert(dev, buf, 0,
+					dev->convert_mmap_frame_size);
 		if (result >= 0) {
 			buf->bytesused = result;
 			result = 0;
+			v4l2_stats_frame(dev);
 		}
 
-		v4l2_set_conversion_buf_params(index, buf);
+		v4l2_set_conversion_buf_params(dev, buf);
 		break;
 	}
 
+	case VIDIOC_EXPBUF:
+		if (!v4l2_needs_conversion(dev)) {
+			result = dev->dev_ops->ioctl(
+					dev->dev_ops_priv,
+					fd, VIDIOC_EXPBUF, arg);
+			break;
+		}
+
+		result = v4l2_export_buffer(dev, arg);
+		break;
+
 	case VIDIOC_STREAMON:
 	case VIDIOC_STREAMOFF:
-		if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
-			result = v4l2_deactivate_read_stream(index);
+		if (dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+			result = v4l2_deactivate_read_stream(dev);
 			if (result)
 				break;
 		}
 
 		if (request == VIDIOC_STREAMON)
-			result = v4l2_streamon(index);
+			result = v4l2_streamon(dev);
 		else
-			result = v4l2_streamoff(index);
+			result = v4l2_streamoff(dev);
 		break;
 
 	case VIDIOC_S_PARM: {
@@ -1434,33 +2519,33 @@ no_capture_request:
 
 		/* See if libv4lconvert wishes to use a different src_fmt
 		   for the new frame rate and set that first */
-		if ((devices[index].flags & V4L2_SUPPORTS_TIMEPERFRAME) &&
+		if ((dev->flags & V4L2_SUPPORTS_TIMEPERFRAME) &&
 		    parm->parm.capture.timeperframe.numerator != 0) {
 			int fps = parm->parm.capture.timeperframe.denominator;
 			fps += parm->parm.capture.timeperframe.numerator - 1;
 			fps /= parm->parm.capture.timeperframe.numerator;
-			v4l2_adjust_src_fmt_to_fps(index, fps);
+			v4l2_adjust_src_fmt_to_fps(dev, fps);
 		}
 
-		result = devices[index].dev_ops->ioctl(
-						devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+						dev->dev_ops_priv,
 						fd, VIDIOC_S_PARM, parm);
 		if (result)
 			break;
 
-		v4l2_update_fps(index, parm);
+		v4l2_update_fps(dev, parm);
 		break;
 	}
 
 	default:
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, request, arg);
 		break;
 	}
 
 	if (stream_needs_locking)
-		pthread_mutex_unlock(&devices[index].stream_lock);
+		pthread_mutex_unlock(&dev->stream_lock);
 
 	saved_err = errno;
 	v4l2_log_ioctl(request, arg, result);
@@ -1469,24 +2554,24 @@ no_capture_request:
 	return result;
 }
 
-static void v4l2_adjust_src_fmt_to_fps(int index, int fps)
+static void v4l2_adjust_src_fmt_to_fps(struct v4l2_dev_info *dev, int fps)
 {
 	struct v4l2_pix_format req_pix_fmt;
 	struct v4l2_format src_fmt;
-	struct v4l2_format dest_fmt = devices[index].dest_fmt;
-	struct v4l2_format orig_src_fmt = devices[index].src_fmt;
-	struct v4l2_format orig_dest_fmt = devices[index].dest_fmt;
+	struct v4l2_format dest_fmt = dev->dest_fmt;
+	struct v4l2_format orig_src_fmt = dev->src_fmt;
+	struct v4l2_format orig_dest_fmt = dev->dest_fmt;
 	int r;
 
-	if (fps == devices[index].fps)
+	if (fps == dev->fps)
 		return;
 
-	if (v4l2_check_buffer_change_ok(index))
+	if (v4l2_check_buffer_change_ok(dev))
 		return;
 
-	v4lconvert_set_fps(devices[index].convert, fps);
-	r = v4lconvert_try_format(devices[index].convert, &dest_fmt, &src_fmt);
-	v4lconvert_set_fps(devices[index].convert, V4L2_DEFAULT_FPS);
+	v4lconvert_set_fps(dev->convert, fps);
+	r = v4lconvert_try_format(dev->convert, &dest_fmt, &src_fmt);
+	v4lconvert_set_fps(dev->convert, V4L2_DEFAULT_FPS);
 	if (r)
 		return;
 
@@ -1495,11 +2580,11 @@ static void v4l2_adjust_src_fmt_to_fps(int index, int fps)
 		return;
 
 	req_pix_fmt = src_fmt.fmt.pix;
-	if (devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-			devices[index].fd, VIDIOC_S_FMT, &src_fmt))
+	if (v4lconvert_src_fmt_ioctl(dev->convert,
+			VIDIOC_S_FMT, &src_fmt))
 		return;
 
-	v4l2_set_src_and_dest_format(index, &src_fmt, &dest_fmt);
+	v4l2_set_src_and_dest_format(dev, &src_fmt, &dest_fmt);
 
 	/* Check we've gotten what try_fmt promised us and that the
 	   new dest fmt matches the original, if this is true we're done. */
@@ -1523,12 +2608,12 @@ static void v4l2_adjust_src_fmt_to_fps(int index, int fps)
 	src_fmt = orig_src_fmt;
 	dest_fmt = orig_dest_fmt;
 	req_pix_fmt = src_fmt.fmt.pix;
-	if (devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-			devices[index].fd, VIDIOC_S_FMT, &src_fmt)) {
+	if (v4lconvert_src_fmt_ioctl(dev->convert,
+			VIDIOC_S_FMT, &src_fmt)) {
 		V4L2_PERROR("restoring src fmt");
 		return;
 	}
-	v4l2_set_src_and_dest_format(index, &src_fmt, &dest_fmt);
+	v4l2_set_src_and_dest_format(dev, &src_fmt, &dest_fmt);
 	if (src_fmt.fmt.pix.width != req_pix_fmt.width ||
 	    src_fmt.fmt.pix.height != req_pix_fmt.height ||
 	    src_fmt.fmt.pix.pixelformat != req_pix_fmt.pixelformat ||
@@ -1540,26 +2625,31 @@ ssize_t v4l2_read(int fd, void *dest, size_t n)
 {
 	ssize_t result;
 	int saved_errno;
-	int index = v4l2_get_index(fd);
+	struct v4l2_dev_info *dev = v4l2_get_dev(fd);
 
-	if (index == -1)
+	if (!dev)
 		return SYS_READ(fd, dest, n);
 
-	if (!devices[index].dev_ops->read) {
+	if (!dev->dev_ops->read) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	pthread_mutex_lock(&devices[index].stream_lock);
+	pthread_mutex_lock(&dev->stream_lock);
 
 	/* When not converting and the device supports read(), let the kernel handle
 	   it */
-	if (devices[index].convert == NULL ||
-	    ((devices[index].flags & V4L2_SUPPORTS_READ) &&
-			!v4l2_needs_conversion(index))) {
-		result = devices[index].dev_ops->read(
-				devices[index].dev_ops_priv,
+	if (dev->convert == NULL ||
+	    ((dev->flags & V4L2_SUPPORTS_READ) &&
+			!v4l2_needs_conversion(dev))) {
+		uint64_t start = v4l2_stats_ns();
+
+		result = dev->dev_ops->read(
+				dev->dev_ops_priv,
 				fd, dest, n);
+		dev->stats.dqbuf_wait_ns += v4l2_stats_ns() - start;
+		if (result > 0)
+			v4l2_stats_frame(dev);
 		goto leave;
 	}
 
@@ -1571,33 +2661,37 @@ ssize_t v4l2_read(int fd, void *dest, size_t n)
 	   select or poll() is done before any buffers are requested. So using mmap
 	   mode under the hood will fail if a select() or poll() is done before the
 	   first emulated read() call. */
-	if (!(devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) &&
-			!(devices[index].flags & V4L2_USE_READ_FOR_READ)) {
-		result = v4l2_activate_read_stream(index);
+	if (!(dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) &&
+			!(dev->flags & V4L2_USE_READ_FOR_READ)) {
+		result = v4l2_activate_read_stream(dev);
 		if (result) {
 			/* Activating mmap mode failed, use read() instead */
-			devices[index].flags |= V4L2_USE_READ_FOR_READ;
+			dev->flags |= V4L2_USE_READ_FOR_READ;
 			/* The read call done by v4l2_read_and_convert will start the stream */
-			devices[index].first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
+			dev->first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
 		}
 	}
 
-	if (devices[index].flags & V4L2_USE_READ_FOR_READ) {
-		result = v4l2_read_and_convert(index, dest, n);
+	if (dev->flags & V4L2_USE_READ_FOR_READ) {
+		result = v4l2_read_and_convert(dev, dest, n);
 	} else {
 		struct v4l2_buffer buf;
 
 		buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 		buf.memory = V4L2_MEMORY_MMAP;
-		result = v4l2_dequeue_and_convert(index, &buf, dest, n);
+		result = v4l2_dequeue_and_convert(dev, &buf, dest, n);
 
 		if (result >= 0)
-			v4l2_queue_read_buffer(index, buf.index);
+			v4l2_queue_read_buffer(dev, buf.index);
+		if (dev->read_buffer_starved)
+			v4l2_grow_read_buffers(dev);
 	}
+	if (result > 0)
+		v4l2_stats_frame(dev);
 
 leave:
 	saved_errno = errno;
-	pthread_mutex_unlock(&devices[index].stream_lock);
+	pthread_mutex_unlock(&dev->stream_lock);
 	errno = saved_errno;
 
 	return result;
@@ -1605,34 +2699,35 @@ leave:
 
 ssize_t v4l2_write(int fd, const void *buffer, size_t n)
 {
-	int index = v4l2_get_index(fd);
+	struct v4l2_dev_info *dev = v4l2_get_dev(fd);
 
-	if (index == -1)
+	if (!dev)
 		return SYS_WRITE(fd, buffer, n);
 
-	if (!devices[index].dev_ops->write) {
+	if (!dev->dev_ops->write) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	return devices[index].dev_ops->write(
-			devices[index].dev_ops_priv, fd, buffer, n);
+	return dev->dev_ops->write(
+			dev->dev_ops_priv, fd, buffer, n);
 }
 
 void *v4l2_mmap(void *start, size_t length, int prot, int flags, int fd,
 		int64_t offset)
 {
-	int index;
+	struct v4l2_dev_info *dev;
 	unsigned int buffer_index;
 	void *result;
 
-	index = v4l2_get_index(fd);
-	if (index == -1 ||
+	dev = v4l2_get_dev(fd);
+	if (!dev ||
 			/* Check if the mmap data matches our answer to QUERY_BUF. If it doesn't,
 			   let the kernel handle it (to allow for mmap-based non capture use) */
-			start || length != devices[index].convert_mmap_frame_size ||
-			((unsigned int)offset & ~0xFFu) != V4L2_MMAP_OFFSET_MAGIC) {
-		if (index != -1)
+			start || length != dev->convert_mmap_frame_size ||
+			((unsigned int)offset & ~V4L2_MMAP_OFFSET_INDEX_MASK) !=
+				V4L2_MMAP_OFFSET_MAGIC) {
+		if (dev)
 			V4L2_LOG("Passing mmap(%p, %d, ..., %x, through to the driver\n",
 					start, (int)length, (int)offset);
 
@@ -1644,72 +2739,75 @@ void *v4l2_mmap(void *start, size_t length, int prot, int flags, int fd,
 		return (void *)SYS_MMAP(start, length, prot, flags, fd, offset);
 	}
 
-	pthread_mutex_lock(&devices[index].stream_lock);
+	pthread_mutex_lock(&dev->stream_lock);
 
-	buffer_index = offset & 0xff;
-	if (buffer_index >= devices[index].no_frames ||
+	buffer_index = offset & V4L2_MMAP_OFFSET_INDEX_MASK;
+	if (buffer_index >= dev->no_frames ||
 			/* Got magic offset and not converting ?? */
-			!v4l2_needs_conversion(index)) {
+			!v4l2_needs_conversion(dev)) {
 		errno = EINVAL;
 		result = MAP_FAILED;
 		goto leave;
 	}
 
-	if (v4l2_ensure_convert_mmap_buf(index)) {
+	if (v4l2_ensure_convert_mmap_buf(dev)) {
 		errno = EINVAL;
 		result = MAP_FAILED;
 		goto leave;
 	}
 
-	devices[index].frame_map_count[buffer_index]++;
+	if (dev->frames[buffer_index].map_count++ == 0)
+		dev->frames_mapped++;
 
-	result = devices[index].convert_mmap_buf +
-		buffer_index * devices[index].convert_mmap_frame_size;
+	result = dev->convert_mmap_buf +
+		buffer_index * dev->convert_mmap_frame_size;
 
 	V4L2_LOG("Fake (conversion) mmap buf %u, seen by app at: %p\n",
 			buffer_index, result);
 
 leave:
-	pthread_mutex_unlock(&devices[index].stream_lock);
+	pthread_mutex_unlock(&dev->stream_lock);
 
 	return result;
 }
 
 int v4l2_munmap(void *_start, size_t length)
 {
-	int index;
+	struct v4l2_dev_info *dev;
 	unsigned int buffer_index;
 	unsigned char *start = _start;
 
 	/* Is this memory ours? */
 	if (start != MAP_FAILED) {
-		for (index = 0; index < devices_used; index++)
-			if (devices[index].fd != -1 &&
-					devices[index].convert_mmap_buf != MAP_FAILED &&
-					length == devices[index].convert_mmap_frame_size &&
-					start >= devices[index].convert_mmap_buf &&
-					(start - devices[index].convert_mmap_buf) % length == 0)
+		for (dev = __atomic_load_n(&devices, __ATOMIC_ACQUIRE); dev;
+				dev = dev->next)
+			if (dev->fd != -1 &&
+					dev->convert_mmap_buf != MAP_FAILED &&
+					length == dev->convert_mmap_frame_size &&
+					start >= dev->convert_mmap_buf &&
+					(start - dev->convert_mmap_buf) % length == 0)
 				break;
 
-		if (index != devices_used) {
+		if (dev) {
 			int unmapped = 0;
 
-			pthread_mutex_lock(&devices[index].stream_lock);
+			pthread_mutex_lock(&dev->stream_lock);
 
-			buffer_index = (start - devices[index].convert_mmap_buf) / length;
+			buffer_index = (start - dev->convert_mmap_buf) / length;
 
 			/* Re-do our checks now that we have the lock, things may have changed */
-			if (devices[index].convert_mmap_buf != MAP_FAILED &&
-					length == devices[index].convert_mmap_frame_size &&
-					start >= devices[index].convert_mmap_buf &&
-					(start - devices[index].convert_mmap_buf) % length == 0 &&
-					buffer_index < devices[index].no_frames) {
-				if (devices[index].frame_map_count[buffer_index] > 0)
-					devices[index].frame_map_count[buffer_index]--;
+			if (dev->convert_mmap_buf != MAP_FAILED &&
+					length == dev->convert_mmap_frame_size &&
+					start >= dev->convert_mmap_buf &&
+					(start - dev->convert_mmap_buf) % length == 0 &&
+					buffer_index < dev->no_frames) {
+				if (dev->frames[buffer_index].map_count > 0 &&
+						--dev->frames[buffer_index].map_count == 0)
+					dev->frames_mapped--;
 				unmapped = 1;
 			}
 
-			pthread_mutex_unlock(&devices[index].stream_lock);
+			pthread_mutex_unlock(&dev->stream_lock);
 
 			if (unmapped) {
 				V4L2_LOG("v4l2 fake buffer munmap %p, %d\n", start, (int)length);
@@ -1724,20 +2822,108 @@ int v4l2_munmap(void *_start, size_t length)
 }
 
 /* Misc utility functions */
+int v4l2_get_stats(int fd, struct v4l2_stats *stats, int reset)
+{
+	struct v4l2_dev_info *dev = v4l2_get_dev(fd);
+
+	if (!dev) {
+		errno = EBADF;
+		return -1;
+	}
+
+	pthread_mutex_lock(&dev->stream_lock);
+	v4l2_collect_stats(dev, stats);
+	if (reset) {
+		unsigned int buffers = dev->stats.buffers;
+		unsigned int queued = dev->stats.queued;
+
+		memset(&dev->stats, 0, sizeof(dev->stats));
+		dev->stats.buffers = buffers;
+		dev->stats.queued = queued;
+		dev->convert_stats_base = dev->convert_stats;
+	}
+	pthread_mutex_unlock(&dev->stream_lock);
+
+	return 0;
+}
+
+int v4l2_set_read_max_age(int fd, unsigned int max_age_ms)
+{
+	struct v4l2_dev_info *dev = v4l2_get_dev(fd);
+
+	if (!dev) {
+		errno = EBADF;
+		return -1;
+	}
+
+	pthread_mutex_lock(&dev->stream_lock);
+	dev->read_max_age = max_age_ms * 1000000ULL;
+	pthread_mutex_unlock(&dev->stream_lock);
+
+	return 0;
+}
+
+int v4l2_set_read_buffers(int fd, unsigned int count, unsigned int max_count)
+{
+	struct v4l2_dev_info *dev = v4l2_get_dev(fd);
+	int result = 0;
+
+	if (!dev) {
+		errno = EBADF;
+		return -1;
+	}
+
+	if (count < 1 || count > V4L2_MAX_NO_FRAMES) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&dev->stream_lock);
+	if (dev->nreadbuffers != count &&
+			(dev->flags & V4L2_STREAM_CONTROLLED_BY_READ))
+		result = v4l2_deactivate_read_stream(dev);
+	if (!result) {
+		dev->nreadbuffers = count;
+		dev->max_nreadbuffers = MIN(MAX(count, max_count),
+					    V4L2_MAX_NO_FRAMES);
+	}
+	pthread_mutex_unlock(&dev->stream_lock);
+
+	return result;
+}
+
+int v4l2_get_read_buffers(int fd)
+{
+	struct v4l2_dev_info *dev = v4l2_get_dev(fd);
+	int result;
+
+	if (!dev) {
+		errno = EBADF;
+		return -1;
+	}
+
+	pthread_mutex_lock(&dev->stream_lock);
+	result = dev->nreadbuffers;
+	pthread_mutex_unlock(&dev->stream_lock);
+
+	return result;
+}
+
 int v4l2_set_control(int fd, int cid, int value)
 {
 	struct v4l2_queryctrl qctrl = { .id = cid };
 	struct v4l2_control ctrl = { .id = cid };
-	int index, result;
+	struct v4l2_dev_info *dev;
+	int result;
 
-	index = v4l2_get_index(fd);
-	if (index == -1 || devices[index].convert == NULL) {
+	dev = v4l2_get_dev(fd);
+	if (!dev || dev->convert == NULL) {
 		V4L2_LOG_ERR("v4l2_set_control called with invalid fd: %d\n", fd);
 		errno = EBADF;
 		return -1;
 	}
 
-	result = v4lconvert_vidioc_queryctrl(devices[index].convert, &qctrl);
+	result = v4lconvert_vidioc_queryctrl(dev->convert, &qctrl);
 	if (result)
 		return result;
 
@@ -1749,7 +2935,7 @@ int v4l2_set_control(int fd, int cid, int value)
 			ctrl.value = ((long long) value * (qctrl.maximum - qctrl.minimum) + 32767) / 65535 +
 				qctrl.minimum;
 
-		result = v4lconvert_vidioc_s_ctrl(devices[index].convert, &ctrl);
+		result = v4lconvert_vidioc_s_ctrl(dev->convert, &ctrl);
 	}
 
 	return result;
@@ -1759,15 +2945,15 @@ int v4l2_get_control(int fd, int cid)
 {
 	struct v4l2_queryctrl qctrl = { .id = cid };
 	struct v4l2_control ctrl = { .id = cid };
-	int index = v4l2_get_index(fd);
+	struct v4l2_dev_info *dev = v4l2_get_dev(fd);
 
-	if (index == -1 || devices[index].convert == NULL) {
+	if (!dev || dev->convert == NULL) {
 		V4L2_LOG_ERR("v4l2_set_control called with invalid fd: %d\n", fd);
 		errno = EBADF;
 		return -1;
 	}
 
-	if (v4lconvert_vidioc_queryctrl(devices[index].convert, &qctrl))
+	if (v4lconvert_vidioc_queryctrl(dev->convert, &qctrl))
 		return -1;
 
 	if (qctrl.flags & V4L2_CTRL_FLAG_DISABLED) {
@@ -1775,7 +2961,7 @@ int v4l2_get_control(int fd, int cid)
 		return -1;
 	}
 
-	if (v4lconvert_vidioc_g_ctrl(devices[index].convert, &ctrl))
+	if (v4lconvert_vidioc_g_ctrl(dev->convert, &ctrl))
 		return -1;
 
 	return (((long long) ctrl.value - qctrl.minimum) * 65535 +
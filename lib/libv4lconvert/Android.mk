@@ -4,6 +4,7 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
     bayer.c \
+    bayer-simd.c \
     cpia1.c \
     crop.c \
     flip.c \
@@ -17,7 +18,10 @@ LOCAL_SRC_FILES := \
     libv4lconvert.c \
     mr97310a.c \
     pac207.c \
+    parallel.c \
+    pipeline.c \
     rgbyuv.c \
+    rgbyuv-simd.c \
     se401.c \
     sn9c10x.c \
     sn9c2028-decomp.c \
@@ -27,6 +31,7 @@ LOCAL_SRC_FILES := \
     sq905c.c \
     stv0680.c \
     tinyjpeg.c \
+    tinyjpeg-simd.c \
     control/libv4lcontrol.c \
     processing/autogain.c  \
     processing/gamma.c \
@@ -0,0 +1,308 @@
+/*
+
+# SIMD (SSE2 / AVX2 / NEON) versions of the bayer.c demosaicing inner loop
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+/*
+ * All code in here must produce exactly the same output as the plain C loop
+ * in bayer_inner_line_to_bgr24(), for both the bilinear and the edge aware
+ * mode. Each pixel pair consists of a red / blue site (where we interpolate
+ * green and the diagonal color) and a green site (where we interpolate the
+ * 2 other colors from the horizontal and vertical neighbours).
+ *
+ * SSE2 and AVX2 split the even and odd samples into 16 bit lanes, so that
+ * the 4 sample sums fit, and combine the results of a pixel pair back into
+ * one 16 bit lane, which gives the 2 pixels in the right byte order for free.
+ * NEON does the same using vld2 / vzip. Pixel pairs left over at the end of
+ * a line are done by the C code.
+ */
+
+#include "libv4lconvert-priv.h"
+#include "libv4lconvert-simd.h"
+
+static int bayer_c_inner_pairs(const unsigned char *above,
+		const unsigned char *line, const unsigned char *below,
+		unsigned char *bgr, int pairs, int blue_line, int edge_aware)
+{
+	return 0;
+}
+
+static const struct v4lconvert_bayer_ops bayer_c_ops = {
+	.inner_pairs = bayer_c_inner_pairs,
+};
+
+#ifdef HAVE_SIMD_X86
+
+/* Edge aware choice between the average of p0 / p1 and that of q0 / q1,
+   taking the pair which differs the least, or all if they differ equally */
+static inline SSE2 __m128i sse2_edge_pick(__m128i p0, __m128i p1,
+		__m128i q0, __m128i q1, __m128i all)
+{
+	__m128i dp = _mm_sub_epi16(_mm_max_epi16(p0, p1), _mm_min_epi16(p0, p1));
+	__m128i dq = _mm_sub_epi16(_mm_max_epi16(q0, q1), _mm_min_epi16(q0, q1));
+	__m128i use_p = _mm_cmplt_epi16(dp, dq);
+	__m128i use_q = _mm_cmplt_epi16(dq, dp);
+
+	return _mm_or_si128(
+		_mm_or_si128(_mm_and_si128(use_p, _mm_avg_epu16(p0, p1)),
+			     _mm_and_si128(use_q, _mm_avg_epu16(q0, q1))),
+		_mm_andnot_si128(_mm_or_si128(use_p, use_q), all));
+}
+
+/* 8 pixel pairs -> 48 bytes rgb24 / bgr24 */
+static inline SSE2 void sse2_bayer_pairs8(const unsigned char *a,
+		const unsigned char *l, const unsigned char *b,
+		unsigned char *bgr, int blue_line, int edge_aware)
+{
+	const __m128i lo = _mm_set1_epi16(0x00ff);
+	const __m128i two = _mm_set1_epi16(2);
+	__m128i va = _mm_loadu_si128((const __m128i *)a);
+	__m128i va2 = _mm_loadu_si128((const __m128i *)(a + 2));
+	__m128i vl = _mm_loadu_si128((const __m128i *)l);
+	__m128i vl2 = _mm_loadu_si128((const __m128i *)(l + 2));
+	__m128i vb = _mm_loadu_si128((const __m128i *)b);
+	__m128i vb2 = _mm_loadu_si128((const __m128i *)(b + 2));
+	/* aN, lN, bN are samples a[2k + N], l[2k + N], b[2k + N] of pair k */
+	__m128i a0 = _mm_and_si128(va, lo), a1 = _mm_srli_epi16(va, 8);
+	__m128i a2 = _mm_and_si128(va2, lo);
+	__m128i l0 = _mm_and_si128(vl, lo), l1 = _mm_srli_epi16(vl, 8);
+	__m128i l2 = _mm_and_si128(vl2, lo), l3 = _mm_srli_epi16(vl2, 8);
+	__m128i b0 = _mm_and_si128(vb, lo), b1 = _mm_srli_epi16(vb, 8);
+	__m128i b2 = _mm_and_si128(vb2, lo);
+	__m128i diag, green, x, g, y;
+
+	diag = _mm_srli_epi16(_mm_add_epi16(
+			_mm_add_epi16(_mm_add_epi16(a0, a2), _mm_add_epi16(b0, b2)),
+			two), 2);
+	green = _mm_srli_epi16(_mm_add_epi16(
+			_mm_add_epi16(_mm_add_epi16(a1, l0), _mm_add_epi16(l2, b1)),
+			two), 2);
+	if (edge_aware) {
+		diag = sse2_edge_pick(a0, b2, a2, b0, diag);
+		green = sse2_edge_pick(l0, l2, a1, b1, green);
+	}
+
+	x = _mm_or_si128(diag, _mm_slli_epi16(_mm_avg_epu16(a2, b2), 8));
+	g = _mm_or_si128(green, _mm_slli_epi16(l2, 8));
+	y = _mm_or_si128(l1, _mm_slli_epi16(_mm_avg_epu16(l1, l3), 8));
+
+	if (blue_line)
+		sse2_store_rgb24(bgr, x, g, y);
+	else
+		sse2_store_rgb24(bgr, y, g, x);
+}
+
+static SSE2 int sse2_inner_pairs(const unsigned char *above,
+		const unsigned char *line, const unsigned char *below,
+		unsigned char *bgr, int pairs, int blue_line, int edge_aware)
+{
+	int i;
+
+	for (i = 0; i + 8 <= pairs; i += 8)
+		sse2_bayer_pairs8(above + 2 * i, line + 2 * i, below + 2 * i,
+				bgr + 6 * i, blue_line, edge_aware);
+
+	return i;
+}
+
+static inline AVX2 __m256i avx2_edge_pick(__m256i p0, __m256i p1,
+		__m256i q0, __m256i q1, __m256i all)
+{
+	__m256i dp = _mm256_abs_epi16(_mm256_sub_epi16(p0, p1));
+	__m256i dq = _mm256_abs_epi16(_mm256_sub_epi16(q0, q1));
+	__m256i use_p = _mm256_cmpgt_epi16(dq, dp);
+	__m256i use_q = _mm256_cmpgt_epi16(dp, dq);
+
+	return _mm256_or_si256(
+		_mm256_or_si256(_mm256_and_si256(use_p, _mm256_avg_epu16(p0, p1)),
+				_mm256_and_si256(use_q, _mm256_avg_epu16(q0, q1))),
+		_mm256_andnot_si256(_mm256_or_si256(use_p, use_q), all));
+}
+
+/* 16 pixel pairs -> 96 bytes rgb24 / bgr24 */
+static inline AVX2 void avx2_bayer_pairs16(const unsigned char *a,
+		const unsigned char *l, const unsigned char *b,
+		unsigned char *bgr, int blue_line, int edge_aware)
+{
+	const __m256i lo = _mm256_set1_epi16(0x00ff);
+	const __m256i two = _mm256_set1_epi16(2);
+	__m256i va = _mm256_loadu_si256((const __m256i *)a);
+	__m256i va2 = _mm256_loadu_si256((const __m256i *)(a + 2));
+	__m256i vl = _mm256_loadu_si256((const __m256i *)l);
+	__m256i vl2 = _mm256_loadu_si256((const __m256i *)(l + 2));
+	__m256i vb = _mm256_loadu_si256((const __m256i *)b);
+	__m256i vb2 = _mm256_loadu_si256((const __m256i *)(b + 2));
+	__m256i a0 = _mm256_and_si256(va, lo), a1 = _mm256_srli_epi16(va, 8);
+	__m256i a2 = _mm256_and_si256(va2, lo);
+	__m256i l0 = _mm256_and_si256(vl, lo), l1 = _mm256_srli_epi16(vl, 8);
+	__m256i l2 = _mm256_and_si256(vl2, lo), l3 = _mm256_srli_epi16(vl2, 8);
+	__m256i b0 = _mm256_and_si256(vb, lo), b1 = _mm256_srli_epi16(vb, 8);
+	__m256i b2 = _mm256_and_si256(vb2, lo);
+	__m256i diag, green, x, g, y;
+
+	diag = _mm256_srli_epi16(_mm256_add_epi16(
+			_mm256_add_epi16(_mm256_add_epi16(a0, a2),
+					 _mm256_add_epi16(b0, b2)), two), 2);
+	green = _mm256_srli_epi16(_mm256_add_epi16(
+			_mm256_add_epi16(_mm256_add_epi16(a1, l0),
+					 _mm256_add_epi16(l2, b1)), two), 2);
+	if (edge_aware) {
+		diag = avx2_edge_pick(a0, b2, a2, b0, diag);
+		green = avx2_edge_pick(l0, l2, a1, b1, green);
+	}
+
+	x = _mm256_or_si256(diag,
+			_mm256_slli_epi16(_mm256_avg_epu16(a2, b2), 8));
+	g = _mm256_or_si256(green, _mm256_slli_epi16(l2, 8));
+	y = _mm256_or_si256(l1,
+			_mm256_slli_epi16(_mm256_avg_epu16(l1, l3), 8));
+	if (!blue_line) {
+		__m256i t = x;
+
+		x = y;
+		y = t;
+	}
+
+	avx2_store_rgb24(bgr, _mm256_castsi256_si128(x),
+			_mm256_castsi256_si128(g), _mm256_castsi256_si128(y));
+	avx2_store_rgb24(bgr + 48, _mm256_extracti128_si256(x, 1),
+			_mm256_extracti128_si256(g, 1),
+			_mm256_extracti128_si256(y, 1));
+}
+
+static AVX2 int avx2_inner_pairs(const unsigned char *above,
+		const unsigned char *line, const unsigned char *below,
+		unsigned char *bgr, int pairs, int blue_line, int edge_aware)
+{
+	int i;
+
+	for (i = 0; i + 16 <= pairs; i += 16)
+		avx2_bayer_pairs16(above + 2 * i, line + 2 * i, below + 2 * i,
+				bgr + 6 * i, blue_line, edge_aware);
+	if (i + 8 <= pairs) {
+		sse2_bayer_pairs8(above + 2 * i, line + 2 * i, below + 2 * i,
+				bgr + 6 * i, blue_line, edge_aware);
+		i += 8;
+	}
+
+	return i;
+}
+
+static const struct v4lconvert_bayer_ops bayer_sse2_ops = {
+	.inner_pairs = sse2_inner_pairs,
+};
+
+static const struct v4lconvert_bayer_ops bayer_avx2_ops = {
+	.inner_pairs = avx2_inner_pairs,
+};
+
+#endif /* HAVE_SIMD_X86 */
+
+#ifdef HAVE_SIMD_NEON
+
+static inline uint8x16_t neon_edge_pick(uint8x16_t p0, uint8x16_t p1,
+		uint8x16_t q0, uint8x16_t q1, uint8x16_t all)
+{
+	uint8x16_t dp = vabdq_u8(p0, p1);
+	uint8x16_t dq = vabdq_u8(q0, q1);
+
+	return vbslq_u8(vcltq_u8(dp, dq), vrhaddq_u8(p0, p1),
+			vbslq_u8(vcltq_u8(dq, dp), vrhaddq_u8(q0, q1), all));
+}
+
+/* (w + x + y + z + 2) >> 2 */
+static inline uint8x16_t neon_avg4(uint8x16_t w, uint8x16_t x,
+		uint8x16_t y, uint8x16_t z)
+{
+	uint16x8_t lo = vaddq_u16(vaddl_u8(vget_low_u8(w), vget_low_u8(x)),
+				  vaddl_u8(vget_low_u8(y), vget_low_u8(z)));
+	uint16x8_t hi = vaddq_u16(vaddl_high_u8(w, x), vaddl_high_u8(y, z));
+
+	return vcombine_u8(vrshrn_n_u16(lo, 2), vrshrn_n_u16(hi, 2));
+}
+
+/* 16 pixel pairs -> 96 bytes rgb24 / bgr24 */
+static inline void neon_bayer_pairs16(const unsigned char *a,
+		const unsigned char *l, const unsigned char *b,
+		unsigned char *bgr, int blue_line, int edge_aware)
+{
+	uint8x16x2_t va = vld2q_u8(a), va2 = vld2q_u8(a + 2);
+	uint8x16x2_t vl = vld2q_u8(l), vl2 = vld2q_u8(l + 2);
+	uint8x16x2_t vb = vld2q_u8(b), vb2 = vld2q_u8(b + 2);
+	uint8x16_t a0 = va.val[0], a1 = va.val[1], a2 = va2.val[0];
+	uint8x16_t l0 = vl.val[0], l1 = vl.val[1];
+	uint8x16_t l2 = vl2.val[0], l3 = vl2.val[1];
+	uint8x16_t b0 = vb.val[0], b1 = vb.val[1], b2 = vb2.val[0];
+	uint8x16_t diag = neon_avg4(a0, a2, b0, b2);
+	uint8x16_t green = neon_avg4(a1, l0, l2, b1);
+	uint8x16x2_t x, g, y;
+	uint8x16x3_t rgb;
+
+	if (edge_aware) {
+		diag = neon_edge_pick(a0, b2, a2, b0, diag);
+		green = neon_edge_pick(l0, l2, a1, b1, green);
+	}
+
+	x = vzipq_u8(diag, vrhaddq_u8(a2, b2));
+	g = vzipq_u8(green, l2);
+	y = vzipq_u8(l1, vrhaddq_u8(l1, l3));
+
+	rgb.val[0] = blue_line ? x.val[0] : y.val[0];
+	rgb.val[1] = g.val[0];
+	rgb.val[2] = blue_line ? y.val[0] : x.val[0];
+	vst3q_u8(bgr, rgb);
+	rgb.val[0] = blue_line ? x.val[1] : y.val[1];
+	rgb.val[1] = g.val[1];
+	rgb.val[2] = blue_line ? y.val[1] : x.val[1];
+	vst3q_u8(bgr + 48, rgb);
+}
+
+static int neon_inner_pairs(const unsigned char *above,
+		const unsigned char *line, const unsigned char *below,
+		unsigned char *bgr, int pairs, int blue_line, int edge_aware)
+{
+	int i;
+
+	for (i = 0; i + 16 <= pairs; i += 16)
+		neon_bayer_pairs16(above + 2 * i, line + 2 * i, below + 2 * i,
+				bgr + 6 * i, blue_line, edge_aware);
+
+	return i;
+}
+
+static const struct v4lconvert_bayer_ops bayer_neon_ops = {
+	.inner_pairs = neon_inner_pairs,
+};
+
+#endif /* HAVE_SIMD_NEON */
+
+const struct v4lconvert_bayer_ops *v4lconvert_get_bayer_ops(void)
+{
+#ifdef HAVE_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return &bayer_avx2_ops;
+	if (__builtin_cpu_supports("sse2"))
+		return &bayer_sse2_ops;
+#endif
+#ifdef HAVE_SIMD_NEON
+	/* Advanced SIMD is mandatory on aarch64 */
+	return &bayer_neon_ops;
+#endif
+	return &bayer_c_ops;
+}
@@ -29,6 +29,7 @@
  * see bayer.c from libdc1394 for all supported algorithms
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include "libv4lconvert-priv.h"
 
@@ -162,172 +163,331 @@ static void v4lconvert_border_bayer_line_to_bgr24(
 	}
 }
 
-/* From libdc1394, which on turn was based on OpenCV's Bayer decoding */
-static void bayer_to_rgbbgr24(const unsigned char *bayer,
-		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt,
-		int start_with_green, int blue_line)
+/* Green at a red / blue site of an inner line, l points to the pixel left of
+   it. In edge aware mode we interpolate along the edge (the direction with
+   the smallest gradient) instead of across it */
+static inline int bayer_inner_green(const unsigned char *a,
+		const unsigned char *l, const unsigned char *b, int edge_aware)
 {
-	/* render the first line */
-	v4lconvert_border_bayer_line_to_bgr24(bayer, bayer + stride, bgr, width,
-			start_with_green, blue_line);
-	bgr += width * 3;
+	if (edge_aware) {
+		int dh = abs(l[0] - l[2]);
+		int dv = abs(a[1] - b[1]);
+
+		if (dh < dv)
+			return (l[0] + l[2] + 1) >> 1;
+		if (dv < dh)
+			return (a[1] + b[1] + 1) >> 1;
+	}
+	return (a[1] + l[0] + l[2] + b[1] + 2) >> 2;
+}
 
-	/* reduce height by 2 because of the special case top/bottom line */
-	for (height -= 2; height; height--) {
-		int t0, t1;
-		/* (width - 2) because of the border */
-		const unsigned char *bayer_end = bayer + (width - 2);
+/* Blue at a red site or red at a blue site of an inner line, same as above
+   but using the diagonal neighbours */
+static inline int bayer_inner_diagonal(const unsigned char *a,
+		const unsigned char *b, int edge_aware)
+{
+	if (edge_aware) {
+		int d0 = abs(a[0] - b[2]);
+		int d1 = abs(a[2] - b[0]);
+
+		if (d0 < d1)
+			return (a[0] + b[2] + 1) >> 1;
+		if (d1 < d0)
+			return (a[2] + b[0] + 1) >> 1;
+	}
+	return (a[0] + a[2] + b[0] + b[2] + 2) >> 2;
+}
 
-		if (start_with_green) {
+/* From libdc1394, which on turn was based on OpenCV's Bayer decoding.
+   Renders an inner line (so not the first or last line) from the bayer lines
+   a(bove), l(ine) and b(elow), start_with_green and blue_line describe the
+   line above. The pixel pairs in the middle get handed to the SIMD version
+   for the cpu we are running on first, see bayer-simd.c. */
+static void bayer_inner_line_to_bgr24(const struct v4lconvert_bayer_ops *ops,
+		const unsigned char *a, const unsigned char *l,
+		const unsigned char *b, unsigned char *bgr, int width,
+		int start_with_green, int blue_line, int edge_aware)
+{
+	int t0, t1, done;
+	/* (width - 2) because of the border */
+	const unsigned char *a_end = a + (width - 2);
 
-			t0 = (bayer[1] + bayer[stride * 2 + 1] + 1) >> 1;
-			/* Write first pixel */
-			t1 = (bayer[0] + bayer[stride * 2] + bayer[stride + 1] + 1) / 3;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride];
-			} else {
-				*bgr++ = bayer[stride];
-				*bgr++ = t1;
-				*bgr++ = t0;
-			}
+	if (start_with_green) {
 
-			/* Write second pixel */
-			t1 = (bayer[stride] + bayer[stride + 2] + 1) >> 1;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t1;
-			} else {
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t0;
-			}
-			bayer++;
+		t0 = (a[1] + b[1] + 1) >> 1;
+		/* Write first pixel */
+		t1 = (a[0] + b[0] + l[1] + 1) / 3;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = l[0];
 		} else {
-			/* Write first pixel */
-			t0 = (bayer[0] + bayer[stride * 2] + 1) >> 1;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = bayer[stride];
-				*bgr++ = bayer[stride + 1];
-			} else {
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = bayer[stride];
-				*bgr++ = t0;
-			}
+			*bgr++ = l[0];
+			*bgr++ = t1;
+			*bgr++ = t0;
 		}
 
+		/* Write second pixel */
+		t1 = (l[0] + l[2] + 1) >> 1;
 		if (blue_line) {
-			for (; bayer <= bayer_end - 2; bayer += 2) {
-				t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
-					bayer[stride * 2 + 2] + 2) >> 2;
-				t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
-					bayer[stride * 2 + 1] + 2) >> 2;
-				*bgr++ = t0;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 1];
-
-				t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
-				t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
-				*bgr++ = t0;
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = t1;
-			}
+			*bgr++ = t0;
+			*bgr++ = l[1];
+			*bgr++ = t1;
 		} else {
-			for (; bayer <= bayer_end - 2; bayer += 2) {
-				t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
-					bayer[stride * 2 + 2] + 2) >> 2;
-				t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
-					bayer[stride * 2 + 1] + 2) >> 2;
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t1;
-				*bgr++ = t0;
-
-				t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
-				t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = t0;
-			}
+			*bgr++ = t1;
+			*bgr++ = l[1];
+			*bgr++ = t0;
 		}
+		a++;
+		l++;
+		b++;
+	} else {
+		/* Write first pixel */
+		t0 = (a[0] + b[0] + 1) >> 1;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = l[0];
+			*bgr++ = l[1];
+		} else {
+			*bgr++ = l[1];
+			*bgr++ = l[0];
+			*bgr++ = t0;
+		}
+	}
 
-		if (bayer < bayer_end) {
-			/* write second to last pixel */
-			t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
-				bayer[stride * 2 + 2] + 2) >> 2;
-			t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
-				bayer[stride * 2 + 1] + 2) >> 2;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 1];
-			} else {
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t1;
-				*bgr++ = t0;
-			}
-			/* write last pixel */
-			t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = bayer[stride + 1];
-			} else {
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = t0;
-			}
+	if (a <= a_end - 2) {
+		done = ops->inner_pairs(a, l, b, bgr, (a_end - 2 - a) / 2 + 1,
+				blue_line, edge_aware);
+		a += 2 * done;
+		l += 2 * done;
+		b += 2 * done;
+		bgr += 6 * done;
+	}
 
-			bayer++;
+	if (blue_line) {
+		for (; a <= a_end - 2; a += 2, l += 2, b += 2) {
+			t0 = bayer_inner_diagonal(a, b, edge_aware);
+			t1 = bayer_inner_green(a, l, b, edge_aware);
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = l[1];
 
-		} else {
-			/* write last pixel */
-			t0 = (bayer[0] + bayer[stride * 2] + 1) >> 1;
-			t1 = (bayer[1] + bayer[stride * 2 + 1] + bayer[stride] + 1) / 3;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 1];
-			} else {
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t1;
-				*bgr++ = t0;
-			}
+			t0 = (a[2] + b[2] + 1) >> 1;
+			t1 = (l[1] + l[3] + 1) >> 1;
+			*bgr++ = t0;
+			*bgr++ = l[2];
+			*bgr++ = t1;
+		}
+	} else {
+		for (; a <= a_end - 2; a += 2, l += 2, b += 2) {
+			t0 = bayer_inner_diagonal(a, b, edge_aware);
+			t1 = bayer_inner_green(a, l, b, edge_aware);
+			*bgr++ = l[1];
+			*bgr++ = t1;
+			*bgr++ = t0;
 
+			t0 = (a[2] + b[2] + 1) >> 1;
+			t1 = (l[1] + l[3] + 1) >> 1;
+			*bgr++ = t1;
+			*bgr++ = l[2];
+			*bgr++ = t0;
 		}
+	}
 
-		/* skip 2 border pixels and padding */
-		bayer += (stride - width) + 2;
+	if (a < a_end) {
+		/* write second to last pixel */
+		t0 = (a[0] + a[2] + b[0] + b[2] + 2) >> 2;
+		t1 = (a[1] + l[0] + l[2] + b[1] + 2) >> 2;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = l[1];
+		} else {
+			*bgr++ = l[1];
+			*bgr++ = t1;
+			*bgr++ = t0;
+		}
+		/* write last pixel */
+		t0 = (a[2] + b[2] + 1) >> 1;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = l[2];
+			*bgr++ = l[1];
+		} else {
+			*bgr++ = l[1];
+			*bgr++ = l[2];
+			*bgr++ = t0;
+		}
+	} else {
+		/* write last pixel */
+		t0 = (a[0] + b[0] + 1) >> 1;
+		t1 = (a[1] + b[1] + l[0] + 1) / 3;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = l[1];
+		} else {
+			*bgr++ = l[1];
+			*bgr++ = t1;
+			*bgr++ = t0;
+		}
+	}
+}
 
+unsigned int v4lconvert_bayer8_fmt(unsigned int pixfmt)
+{
+	switch (pixfmt) {
+	case V4L2_PIX_FMT_SBGGR8:
+	case V4L2_PIX_FMT_SBGGR10:
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SBGGR16:
+		return V4L2_PIX_FMT_SBGGR8;
+	case V4L2_PIX_FMT_SGBRG8:
+	case V4L2_PIX_FMT_SGBRG10:
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGBRG16:
+		return V4L2_PIX_FMT_SGBRG8;
+	case V4L2_PIX_FMT_SGRBG8:
+	case V4L2_PIX_FMT_SGRBG10:
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SGRBG16:
+		return V4L2_PIX_FMT_SGRBG8;
+	case V4L2_PIX_FMT_SRGGB8:
+	case V4L2_PIX_FMT_SRGGB10:
+	case V4L2_PIX_FMT_SRGGB10P:
+	case V4L2_PIX_FMT_SRGGB16:
+		return V4L2_PIX_FMT_SRGGB8;
+	}
+	return 0;
+}
+
+/* Returns bayer line row as 8 bit samples. 8 bit lines are used as is, 10 bit
+   (packed) and 16 bit lines get narrowed into buf the same way as
+   v4lconvert_bayer10(p|16)_to_bayer8() would do */
+static const unsigned char *bayer_get_line(const unsigned char *bayer,
+		int stride, unsigned int pixfmt, int width, int row,
+		unsigned char *buf)
+{
+	const unsigned char *src = bayer + row * stride;
+	int x;
+
+	switch (pixfmt) {
+	case V4L2_PIX_FMT_SBGGR10:
+	case V4L2_PIX_FMT_SGBRG10:
+	case V4L2_PIX_FMT_SGRBG10:
+	case V4L2_PIX_FMT_SRGGB10: {
+		const uint16_t *src16 = (const uint16_t *)src;
+
+		for (x = 0; x < width; x++)
+			buf[x] = src16[x] >> 2;
+		return buf;
+	}
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SRGGB10P:
+		/* The 4 high bytes of each 5 byte group are 8 bit samples */
+		for (x = 0; x + 4 <= width; x += 4, src += 5)
+			memcpy(buf + x, src, 4);
+		for (; x < width; x++)
+			buf[x] = *src++;
+		return buf;
+	case V4L2_PIX_FMT_SBGGR16:
+	case V4L2_PIX_FMT_SGBRG16:
+	case V4L2_PIX_FMT_SGRBG16:
+	case V4L2_PIX_FMT_SRGGB16:
+		for (x = 0; x < width; x++)
+			buf[x] = src[2 * x + 1];
+		return buf;
+	}
+	return src;
+}
+
+/* Only renders output lines first_row - (last_row - 1), so that a frame can
+   be demosaiced in independent horizontal bands, bgr points to where output
+   line first_row must be written. The bayer lines get fetched through a
+   window of 3 lines, so that 10 and 16 bit data can be narrowed to 8 bit
+   one line at a time, line_buf must be 3 * width bytes for those. */
+static void bayer_to_rgbbgr24(struct v4lconvert_data *data,
+		const unsigned char *bayer, unsigned char *bgr, int width,
+		int height, const unsigned int stride, unsigned int pixfmt,
+		unsigned char *line_buf, int start_with_green, int blue_line,
+		int first_row, int last_row)
+{
+	const unsigned char *above, *line, *below;
+	int row, slot = 2, top = first_row ? first_row - 1 : 0;
+	int edge_aware = data->demosaic == V4LCONVERT_DEMOSAIC_EDGE_AWARE;
+
+	above = bayer_get_line(bayer, stride, pixfmt, width, top, line_buf);
+	line = bayer_get_line(bayer, stride, pixfmt, width, top + 1,
+			line_buf + width);
+
+	/* render the first line */
+	if (first_row == 0) {
+		v4lconvert_border_bayer_line_to_bgr24(above, line, bgr,
+				width, start_with_green, blue_line);
+		bgr += width * 3;
+		first_row = 1;
+	}
+
+	/* Inner lines get rendered from the bayer line above them */
+	if ((first_row - 1) & 1) {
+		blue_line = !blue_line;
+		start_with_green = !start_with_green;
+	}
+
+	/* height - 1 because of the special case bottom line */
+	for (row = first_row; row < last_row && row < height - 1; row++) {
+		below = bayer_get_line(bayer, stride, pixfmt, width, row + 1,
+				line_buf + slot * width);
+		slot = (slot + 1) % 3;
+
+		bayer_inner_line_to_bgr24(data->bayer, above, line, below, bgr,
+				width, start_with_green, blue_line, edge_aware);
+		bgr += width * 3;
+
+		above = line;
+		line = below;
 		blue_line = !blue_line;
 		start_with_green = !start_with_green;
 	}
 
 	/* render the last line */
-	v4lconvert_border_bayer_line_to_bgr24(bayer + stride, bayer, bgr, width,
-			!start_with_green, !blue_line);
+	if (last_row == height)
+		v4lconvert_border_bayer_line_to_bgr24(line, above, bgr,
+				width, !start_with_green, !blue_line);
 }
 
-void v4lconvert_bayer_to_rgb24(const unsigned char *bayer,
-		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt)
+void v4lconvert_bayer_to_rgb24_rows(struct v4lconvert_data *data,
+		const unsigned char *bayer, unsigned char *bgr, int width,
+		int height, const unsigned int stride, unsigned int pixfmt,
+		unsigned char *line_buf, int first_row, int last_row)
 {
-	bayer_to_rgbbgr24(bayer, bgr, width, height, stride, pixfmt,
-			pixfmt == V4L2_PIX_FMT_SGBRG8		/* start with green */
-			|| pixfmt == V4L2_PIX_FMT_SGRBG8,
-			pixfmt != V4L2_PIX_FMT_SBGGR8		/* blue line */
-			&& pixfmt != V4L2_PIX_FMT_SGBRG8);
+	unsigned int pattern = v4lconvert_bayer8_fmt(pixfmt);
+
+	bayer_to_rgbbgr24(data, bayer, bgr, width, height, stride, pixfmt,
+			line_buf,
+			pattern == V4L2_PIX_FMT_SGBRG8		/* start with green */
+			|| pattern == V4L2_PIX_FMT_SGRBG8,
+			pattern != V4L2_PIX_FMT_SBGGR8		/* blue line */
+			&& pattern != V4L2_PIX_FMT_SGBRG8,
+			first_row, last_row);
 }
 
-void v4lconvert_bayer_to_bgr24(const unsigned char *bayer,
-		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt)
+void v4lconvert_bayer_to_bgr24_rows(struct v4lconvert_data *data,
+		const unsigned char *bayer, unsigned char *bgr, int width,
+		int height, const unsigned int stride, unsigned int pixfmt,
+		unsigned char *line_buf, int first_row, int last_row)
 {
-	bayer_to_rgbbgr24(bayer, bgr, width, height, stride, pixfmt,
-			pixfmt == V4L2_PIX_FMT_SGBRG8		/* start with green */
-			|| pixfmt == V4L2_PIX_FMT_SGRBG8,
-			pixfmt == V4L2_PIX_FMT_SBGGR8		/* blue line */
-			|| pixfmt == V4L2_PIX_FMT_SGBRG8);
+	unsigned int pattern = v4lconvert_bayer8_fmt(pixfmt);
+
+	bayer_to_rgbbgr24(data, bayer, bgr, width, height, stride, pixfmt,
+			line_buf,
+			pattern == V4L2_PIX_FMT_SGBRG8		/* start with green */
+			|| pattern == V4L2_PIX_FMT_SGRBG8,
+			pattern == V4L2_PIX_FMT_SBGGR8		/* blue line */
+			|| pattern == V4L2_PIX_FMT_SGBRG8,
+			first_row, last_row);
 }
 
 static void v4lconvert_border_bayer_line_to_y(
@@ -429,10 +589,12 @@ static void v4lconvert_border_bayer_line_to_y(
 	}
 }
 
-void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
-		int width, int height, const unsigned int stride, unsigned int src_pixfmt, int yvu)
+void v4lconvert_bayer_to_yuv420_rows(const unsigned char *bayer, unsigned char *yuv,
+		int width, int height, const unsigned int stride, unsigned int src_pixfmt, int yvu,
+		int first_row, int last_row)
 {
-	int blue_line = 0, start_with_green = 0, x, y;
+	int blue_line = 0, start_with_green = 0, x, y, row;
+	const unsigned char *bayer_start = bayer;
 	unsigned char *ydst = yuv;
 	unsigned char *udst, *vdst;
 
@@ -444,10 +606,15 @@ void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 		vdst = udst + width * height / 4;
 	}
 
+	/* first_row must be even, as u and v are calculated 2 lines at a time */
+	udst += (first_row / 2) * (width / 2);
+	vdst += (first_row / 2) * (width / 2);
+	bayer += first_row * stride;
+
 	/* First calculate the u and v planes 2x2 pixels at a time */
 	switch (src_pixfmt) {
 	case V4L2_PIX_FMT_SBGGR8:
-		for (y = 0; y < height; y += 2) {
+		for (y = first_row; y < last_row; y += 2) {
 			for (x = 0; x < width; x += 2) {
 				int b, g, r;
 
@@ -464,7 +631,7 @@ void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 		break;
 
 	case V4L2_PIX_FMT_SRGGB8:
-		for (y = 0; y < height; y += 2) {
+		for (y = first_row; y < last_row; y += 2) {
 			for (x = 0; x < width; x += 2) {
 				int b, g, r;
 
@@ -480,7 +647,7 @@ void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 		break;
 
 	case V4L2_PIX_FMT_SGBRG8:
-		for (y = 0; y < height; y += 2) {
+		for (y = first_row; y < last_row; y += 2) {
 			for (x = 0; x < width; x += 2) {
 				int b, g, r;
 
@@ -498,7 +665,7 @@ void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 		break;
 
 	case V4L2_PIX_FMT_SGRBG8:
-		for (y = 0; y < height; y += 2) {
+		for (y = first_row; y < last_row; y += 2) {
 			for (x = 0; x < width; x += 2) {
 				int b, g, r;
 
@@ -516,15 +683,25 @@ void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 	}
 
 	/* Point bayer back to start of frame */
-	bayer -= stride * height;
+	bayer = bayer_start;
 
 	/* render the first line */
-	v4lconvert_border_bayer_line_to_y(bayer, bayer + stride, ydst, width,
-			start_with_green, blue_line);
-	ydst += width;
+	if (first_row == 0) {
+		v4lconvert_border_bayer_line_to_y(bayer, bayer + stride, ydst,
+				width, start_with_green, blue_line);
+		first_row = 1;
+	}
+
+	/* Inner lines get rendered from the bayer line above them */
+	ydst += first_row * width;
+	bayer += (first_row - 1) * stride;
+	if ((first_row - 1) & 1) {
+		blue_line = !blue_line;
+		start_with_green = !start_with_green;
+	}
 
-	/* reduce height by 2 because of the border */
-	for (height -= 2; height; height--) {
+	/* height - 1 because of the border */
+	for (row = first_row; row < last_row && row < height - 1; row++) {
 		int t0, t1;
 		/* (width - 2) because of the border */
 		const unsigned char *bayer_end = bayer + (width - 2);
@@ -628,8 +805,16 @@ void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 	}
 
 	/* render the last line */
-	v4lconvert_border_bayer_line_to_y(bayer + stride, bayer, ydst, width,
-			!start_with_green, !blue_line);
+	if (last_row == height)
+		v4lconvert_border_bayer_line_to_y(bayer + stride, bayer, ydst,
+				width, !start_with_green, !blue_line);
+}
+
+void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
+		int width, int height, const unsigned int stride, unsigned int src_pixfmt, int yvu)
+{
+	v4lconvert_bayer_to_yuv420_rows(bayer, yuv, width, height, stride,
+			src_pixfmt, yvu, 0, height);
 }
 
 void v4lconvert_bayer10_to_bayer8(void *bayer10,
@@ -23,134 +23,40 @@
 #include <string.h>
 #include "libv4lconvert-priv.h"
 
-static void v4lconvert_vflip_rgbbgr24(unsigned char *src, unsigned char *dest,
-		struct v4l2_format *fmt)
-{
-	int y;
-
-	src += fmt->fmt.pix.height * fmt->fmt.pix.bytesperline;
-	for (y = 0; y < fmt->fmt.pix.height; y++) {
-		src -= fmt->fmt.pix.bytesperline;
-		memcpy(dest, src, fmt->fmt.pix.width * 3);
-		dest += fmt->fmt.pix.width * 3;
-	}
-}
-
-static void v4lconvert_vflip_yuv420(unsigned char *src, unsigned char *dest,
-		struct v4l2_format *fmt)
-{
-	int y;
-
-	/* First flip the Y plane */
-	src += fmt->fmt.pix.height * fmt->fmt.pix.bytesperline;
-	for (y = 0; y < fmt->fmt.pix.height; y++) {
-		src -= fmt->fmt.pix.bytesperline;
-		memcpy(dest, src, fmt->fmt.pix.width);
-		dest += fmt->fmt.pix.width;
-	}
-
-	/* Now flip the U plane */
-	src += fmt->fmt.pix.height * fmt->fmt.pix.bytesperline * 5 / 4;
-	for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-		src -= fmt->fmt.pix.bytesperline / 2;
-		memcpy(dest, src, fmt->fmt.pix.width / 2);
-		dest += fmt->fmt.pix.width / 2;
-	}
-
-	/* Last flip the V plane */
-	src += fmt->fmt.pix.height * fmt->fmt.pix.bytesperline / 2;
-	for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-		src -= fmt->fmt.pix.bytesperline / 2;
-		memcpy(dest, src, fmt->fmt.pix.width / 2);
-		dest += fmt->fmt.pix.width / 2;
-	}
-}
-
-static void v4lconvert_hflip_rgbbgr24(unsigned char *src, unsigned char *dest,
-		struct v4l2_format *fmt)
-{
-	int x, y;
-
-	for (y = 0; y < fmt->fmt.pix.height; y++) {
-		src += fmt->fmt.pix.width * 3;
-		for (x = 0; x < fmt->fmt.pix.width; x++) {
-			src -= 3;
-			dest[0] = src[0];
-			dest[1] = src[1];
-			dest[2] = src[2];
-			dest += 3;
-		}
-		src += fmt->fmt.pix.bytesperline;
-	}
-}
-
-static void v4lconvert_hflip_yuv420(unsigned char *src, unsigned char *dest,
-		struct v4l2_format *fmt)
+/* Flip lines first_row - (last_row - 1) of a plane into a plane without
+   padding, bpp is the number of bytes per pixel (3 for rgb, 1 for yuv) */
+static void v4lconvert_flip_plane(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride, int bpp,
+		int hflip, int vflip, int first_row, int last_row)
 {
 	int x, y;
 
-	/* First flip the Y plane */
-	for (y = 0; y < fmt->fmt.pix.height; y++) {
-		src += fmt->fmt.pix.width;
-		for (x = 0; x < fmt->fmt.pix.width; x++)
-			*dest++ = *--src;
-		src += fmt->fmt.pix.bytesperline;
-	}
+	for (y = first_row; y < last_row; y++) {
+		const unsigned char *s =
+			src + (vflip ? height - 1 - y : y) * stride;
+		unsigned char *d = dest + y * width * bpp;
 
-	/* Now flip the U plane */
-	for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-		src += fmt->fmt.pix.width / 2;
-		for (x = 0; x < fmt->fmt.pix.width / 2; x++)
-			*dest++ = *--src;
-		src += fmt->fmt.pix.bytesperline / 2;
-	}
-
-	/* Last flip the V plane */
-	for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-		src += fmt->fmt.pix.width / 2;
-		for (x = 0; x < fmt->fmt.pix.width / 2; x++)
-			*dest++ = *--src;
-		src += fmt->fmt.pix.bytesperline / 2;
-	}
-}
-
-static void v4lconvert_rotate180_rgbbgr24(const unsigned char *src,
-		unsigned char *dst, int width, int height)
-{
-	int i;
-
-	src += 3 * width * height - 3;
+		if (!hflip) {
+			memcpy(d, s, width * bpp);
+			continue;
+		}
 
-	for (i = 0; i < width * height; i++) {
-		dst[0] = src[0];
-		dst[1] = src[1];
-		dst[2] = src[2];
-		dst += 3;
-		src -= 3;
+		s += width * bpp;
+		if (bpp == 3) {
+			for (x = 0; x < width; x++) {
+				s -= 3;
+				d[0] = s[0];
+				d[1] = s[1];
+				d[2] = s[2];
+				d += 3;
+			}
+		} else {
+			for (x = 0; x < width; x++)
+				*d++ = *--s;
+		}
 	}
 }
 
-static void v4lconvert_rotate180_yuv420(const unsigned char *src,
-		unsigned char *dst, int width, int height)
-{
-	int i;
-
-	/* First flip x and y of the Y plane */
-	src += width * height - 1;
-	for (i = 0; i < width * height; i++)
-		*dst++ = *src--;
-
-	/* Now flip the U plane */
-	src += width * height * 5 / 4;
-	for (i = 0; i < width * height / 4; i++)
-		*dst++ = *src--;
-
-	/* Last flip the V plane */
-	src += width * height / 2;
-	for (i = 0; i < width * height / 4; i++)
-		*dst++ = *src--;
-}
-
 static void v4lconvert_rotate90_rgbbgr24(const unsigned char *src,
 		unsigned char *dst, int destwidth, int destheight)
 {
@@ -222,45 +128,48 @@ void v4lconvert_rotate90(unsigned char *src, unsigned char *dest,
 	v4lconvert_fixup_fmt(fmt);
 }
 
+void v4lconvert_flip_rows(unsigned char *src, unsigned char *dest,
+		const struct v4l2_format *fmt, int hflip, int vflip,
+		int first_row, int last_row)
+{
+	int width = fmt->fmt.pix.width;
+	int height = fmt->fmt.pix.height;
+	int bpl = fmt->fmt.pix.bytesperline;
+
+	switch (fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		v4lconvert_flip_plane(src, dest, width, height, bpl, 3,
+				hflip, vflip, first_row, last_row);
+		break;
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		/* First flip the Y plane */
+		v4lconvert_flip_plane(src, dest, width, height, bpl, 1,
+				hflip, vflip, first_row, last_row);
+		src += height * bpl;
+		dest += width * height;
+
+		/* Now flip the U plane */
+		v4lconvert_flip_plane(src, dest, width / 2, height / 2,
+				bpl / 2, 1, hflip, vflip,
+				first_row / 2, last_row / 2);
+		src += height * bpl / 4;
+		dest += width * height / 4;
+
+		/* Last flip the V plane */
+		v4lconvert_flip_plane(src, dest, width / 2, height / 2,
+				bpl / 2, 1, hflip, vflip,
+				first_row / 2, last_row / 2);
+		break;
+	}
+}
+
 void v4lconvert_flip(unsigned char *src, unsigned char *dest,
 		struct v4l2_format *fmt, int hflip, int vflip)
 {
-	if (vflip && hflip) {
-		switch (fmt->fmt.pix.pixelformat) {
-		case V4L2_PIX_FMT_RGB24:
-		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_rotate180_rgbbgr24(src, dest, fmt->fmt.pix.width,
-					fmt->fmt.pix.height);
-			break;
-		case V4L2_PIX_FMT_YUV420:
-		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_rotate180_yuv420(src, dest, fmt->fmt.pix.width,
-					fmt->fmt.pix.height);
-			break;
-		}
-	} else if (hflip) {
-		switch (fmt->fmt.pix.pixelformat) {
-		case V4L2_PIX_FMT_RGB24:
-		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_hflip_rgbbgr24(src, dest, fmt);
-			break;
-		case V4L2_PIX_FMT_YUV420:
-		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_hflip_yuv420(src, dest, fmt);
-			break;
-		}
-	} else if (vflip) {
-		switch (fmt->fmt.pix.pixelformat) {
-		case V4L2_PIX_FMT_RGB24:
-		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_vflip_rgbbgr24(src, dest, fmt);
-			break;
-		case V4L2_PIX_FMT_YUV420:
-		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_vflip_yuv420(src, dest, fmt);
-			break;
-		}
-	}
+	v4lconvert_flip_rows(src, dest, fmt, hflip, vflip, 0,
+			fmt->fmt.pix.height);
 
 	/* Our newly written data has no padding */
 	v4lconvert_fixup_fmt(fmt);
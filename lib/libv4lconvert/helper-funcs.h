@@ -29,6 +29,9 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "helper-shm.h"
 
 static int v4lconvert_helper_write(int fd, const void *b, size_t count,
   char *progname)
@@ -77,3 +80,46 @@ static int v4lconvert_helper_read(int fd, void *b, size_t count,
 
   return 0;
 }
+
+/* Get the src and dest pointers for a frame in the shared memory, libv4l
+   grows it before sending a request, so we remap when it has grown */
+static int v4lconvert_helper_shm_map(int src_size, unsigned char **src,
+  unsigned char **dest, size_t *dest_max, char *progname)
+{
+  static unsigned char *shm;
+  static size_t shm_size;
+  struct stat st;
+
+  if (fstat(V4LCONVERT_HELPER_SHM_FD, &st)) {
+    fprintf(stderr, "%s: error with shared memory: %s\n", progname,
+	    strerror(errno));
+    return -1;
+  }
+
+  if ((size_t)st.st_size != shm_size) {
+    if (shm)
+      munmap(shm, shm_size);
+    shm_size = st.st_size;
+    shm = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	       V4LCONVERT_HELPER_SHM_FD, 0);
+    if (shm == MAP_FAILED) {
+      fprintf(stderr, "%s: error mapping shared memory: %s\n", progname,
+	      strerror(errno));
+      shm = NULL;
+      shm_size = 0;
+      return -1;
+    }
+  }
+
+  if (src_size < 0 || (size_t)V4LCONVERT_HELPER_SHM_DEST(src_size) > shm_size) {
+    fprintf(stderr, "%s: error: src_size %d does not fit shared memory\n",
+	    progname, src_size);
+    return -1;
+  }
+
+  *src = shm;
+  *dest = shm + V4LCONVERT_HELPER_SHM_DEST(src_size);
+  *dest_max = shm_size - V4LCONVERT_HELPER_SHM_DEST(src_size);
+
+  return 0;
+}
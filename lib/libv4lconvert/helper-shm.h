@@ -0,0 +1,44 @@
+/* Shared memory protocol between libv4lconvert and its decompression helpers
+ *
+ * Copyright (c) 2009 Hans de Goede <hdegoede@redhat.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __LIBV4LCONVERT_HELPER_SHM_H
+#define __LIBV4LCONVERT_HELPER_SHM_H
+
+/* To avoid pushing all frame data through the pipes (see the protocol
+   description in helper.c), libv4l passes the helper a memfd as fd
+   V4LCONVERT_HELPER_SHM_FD, and asks it to use that by sending a request with
+   a width, height and data length of 0 and V4LCONVERT_HELPER_SHM as flags.
+   Helpers which support this answer with V4LCONVERT_HELPER_SHM as data
+   length (older ones answer -1). After that the data is not send through the
+   pipes, the frame data lives at the start of the shared memory and the
+   helper writes the decompressed data V4LCONVERT_HELPER_SHM_DEST(data length)
+   bytes into it. libv4l makes the shared memory large enough before sending
+   a request, the pipes now only serve as doorbell. */
+#define V4LCONVERT_HELPER_SHM		0x53484d31
+#define V4LCONVERT_HELPER_SHM_FD	3
+#define V4LCONVERT_HELPER_SHM_DEST(src_size) (((src_size) + 4095) & ~4095)
+
+#endif
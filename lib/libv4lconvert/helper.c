@@ -22,8 +22,11 @@
 #include <errno.h>
 #include <string.h>
 #include <signal.h>
+#include <fcntl.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 #include "libv4lconvert-priv.h"
+#include "helper-shm.h"
 
 #define READ_END  0
 #define WRITE_END 1
@@ -46,11 +49,20 @@
    From the helper to libv4l the following is send:
    int			data length (-1 in case of a decompression error)
    unsigned char[]	data (not present when a decompression error happened)
+
+   Helpers can also exchange the frame data through shared memory instead,
+   see helper-shm.h.
  */
 
 static int v4lconvert_helper_start(struct v4lconvert_data *data,
 		const char *helper)
 {
+#ifdef HAVE_MEMFD_CREATE
+	/* Not fatal, we can always use the pipes */
+	data->decompress_shm_fd = memfd_create("libv4lconvert-helper",
+					       MFD_CLOEXEC);
+#endif
+
 	if (pipe(data->decompress_in_pipe)) {
 		V4LCONVERT_ERR("with helper pipe: %s\n", strerror(errno));
 		goto error;
@@ -84,6 +96,16 @@ static int v4lconvert_helper_start(struct v4lconvert_data *data,
 			exit(1);
 		}
 
+		/* And pass the shared memory as fd 3 */
+		if (data->decompress_shm_fd == V4LCONVERT_HELPER_SHM_FD) {
+			fcntl(V4LCONVERT_HELPER_SHM_FD, F_SETFD, 0);
+		} else if (data->decompress_shm_fd != -1 &&
+			   dup2(data->decompress_shm_fd,
+				V4LCONVERT_HELPER_SHM_FD) == -1) {
+			perror("libv4lconvert: error with helper dup2");
+			exit(1);
+		}
+
 		/* And execute the helper */
 		execl(helper, helper, NULL);
 
@@ -105,6 +127,10 @@ error_close_in_pipe:
 	close(data->decompress_in_pipe[READ_END]);
 	close(data->decompress_in_pipe[WRITE_END]);
 error:
+	if (data->decompress_shm_fd != -1) {
+		close(data->decompress_shm_fd);
+		data->decompress_shm_fd = -1;
+	}
 	return -1;
 }
 
@@ -165,30 +191,111 @@ static int v4lconvert_helper_read(struct v4lconvert_data *data, void *b,
 	return 0;
 }
 
+static int v4lconvert_helper_write_header(struct v4lconvert_data *data,
+		int width, int height, int flags, int src_size)
+{
+	int header[4] = { width, height, flags, src_size };
+
+	return v4lconvert_helper_write(data, header, sizeof(header));
+}
+
+static void v4lconvert_helper_shm_free(struct v4lconvert_data *data)
+{
+	if (data->decompress_shm)
+		munmap(data->decompress_shm, data->decompress_shm_size);
+	if (data->decompress_shm_fd != -1)
+		close(data->decompress_shm_fd);
+	data->decompress_shm = NULL;
+	data->decompress_shm_size = 0;
+	data->decompress_shm_fd = -1;
+}
+
+/* Ask the helper to use shared memory, falls back to the pipes if it can't */
+static int v4lconvert_helper_shm_start(struct v4lconvert_data *data)
+{
+	int r;
+
+	if (data->decompress_shm_fd == -1)
+		return 0;
+
+	if (v4lconvert_helper_write_header(data, 0, 0,
+					   V4LCONVERT_HELPER_SHM, 0))
+		return -1;
+
+	if (v4lconvert_helper_read(data, &r, sizeof(int)))
+		return -1;
+
+	if (r != V4LCONVERT_HELPER_SHM)
+		v4lconvert_helper_shm_free(data);
+
+	return 0;
+}
+
+/* Make the shared memory at least size bytes large */
+static int v4lconvert_helper_shm_grow(struct v4lconvert_data *data,
+		size_t size)
+{
+	unsigned char *shm;
+
+	if (size <= data->decompress_shm_size)
+		return 0;
+
+	/* Avoid growing it a couple of bytes at a time */
+	size = (size + size / 4 + 65535) & ~(size_t)65535;
+
+	if (ftruncate(data->decompress_shm_fd, size)) {
+		V4LCONVERT_ERR("growing helper shared memory: %s\n",
+			       strerror(errno));
+		return -1;
+	}
+
+	shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   data->decompress_shm_fd, 0);
+	if (shm == MAP_FAILED) {
+		V4LCONVERT_ERR("mapping helper shared memory: %s\n",
+			       strerror(errno));
+		return -1;
+	}
+
+	if (data->decompress_shm)
+		munmap(data->decompress_shm, data->decompress_shm_size);
+	data->decompress_shm = shm;
+	data->decompress_shm_size = size;
+
+	return 0;
+}
+
 int v4lconvert_helper_decompress(struct v4lconvert_data *data,
 		const char *helper, const unsigned char *src, int src_size,
 		unsigned char *dest, int dest_size, int width, int height, int flags)
 {
-	int r;
+	int r, shm_dest = V4LCONVERT_HELPER_SHM_DEST(src_size);
 
 	if (data->decompress_pid == -1) {
 		if (v4lconvert_helper_start(data, helper))
 			return -1;
+		/* Don't leave a helper behind of which we don't know whether
+		   it agreed to use shared memory, start over next time */
+		if (v4lconvert_helper_shm_start(data)) {
+			v4lconvert_helper_cleanup(data);
+			return -1;
+		}
 	}
 
-	if (v4lconvert_helper_write(data, &width, sizeof(int)))
-		return -1;
-
-	if (v4lconvert_helper_write(data, &height, sizeof(int)))
-		return -1;
-
-	if (v4lconvert_helper_write(data, &flags, sizeof(int)))
-		return -1;
+	if (data->decompress_shm_fd != -1) {
+		/* The helpers always produce yuv420 */
+		if (v4lconvert_helper_shm_grow(data,
+				shm_dest + width * height * 3 / 2))
+			return -1;
+		memcpy(data->decompress_shm, src, src_size);
+	}
 
-	if (v4lconvert_helper_write(data, &src_size, sizeof(int)))
+	if (v4lconvert_helper_write_header(data, width, height, flags,
+					   src_size))
 		return -1;
 
-	if (v4lconvert_helper_write(data, src, src_size))
+	if (data->decompress_shm_fd == -1 &&
+	    v4lconvert_helper_write(data, src, src_size))
 		return -1;
 
 	if (v4lconvert_helper_read(data, &r, sizeof(int)))
@@ -204,6 +311,15 @@ int v4lconvert_helper_decompress(struct v4lconvert_data *data,
 		return -1;
 	}
 
+	if (data->decompress_shm_fd != -1) {
+		if (shm_dest + r > data->decompress_shm_size) {
+			V4LCONVERT_ERR("helper returned too much data\n");
+			return -1;
+		}
+		memcpy(dest, data->decompress_shm + shm_dest, r);
+		return 0;
+	}
+
 	return v4lconvert_helper_read(data, dest, r);
 }
 
@@ -217,4 +333,5 @@ void v4lconvert_helper_cleanup(struct v4lconvert_data *data)
 		waitpid(data->decompress_pid, &status, 0);
 		data->decompress_pid = -1;
 	}
+	v4lconvert_helper_shm_free(data);
 }
@@ -28,6 +28,57 @@
 #include "jpeg_memsrcdest.h"
 #endif
 
+static void v4lconvert_tinyjpeg_run(void *opaque,
+		void (*func)(void *arg, int band, int first, int last),
+		void *arg, int count)
+{
+	v4lconvert_pool_run(opaque, func, arg, count);
+}
+
+/* Returns 1 if the JPEG has restart markers, in which case tinyjpeg can
+   decode it in parallel. As we want (about) the same output as libjpeg,
+   only baseline 4:2:0 JPEGs decoded to yuv420 qualify: tinyjpeg does not
+   do fancy upsampling and its colorspace conversion rounds differently */
+int v4lconvert_jpeg_has_restarts(const unsigned char *src, int src_size,
+				 unsigned int dest_pix_fmt)
+{
+	const unsigned char *end = src + src_size;
+	int restarts = 0, sof0 = 0;
+
+	if (src_size < 4 || src[0] != 0xff || src[1] != 0xd8)
+		return 0;
+
+	/* Walk the marker segments until the start of the scan */
+	for (src += 2; src + 4 <= end; src += 2 + ((src[2] << 8) | src[3])) {
+		if (src[0] != 0xff)
+			return 0;
+		/* Progressive, lossless, arithmetic coded, ... */
+		if (src[1] >= 0xc1 && src[1] <= 0xcf && src[1] != 0xc4 &&
+		    src[1] != 0xc8 && src[1] != 0xcc)
+			return 0;
+		switch (src[1]) {
+		case 0xc0: /* SOF0, baseline */
+			if (src + 19 > end || src[9] != 3)
+				return 0;
+			/* Sampling factors of component i are at src[11 + 3*i] */
+			if (src[11] != 0x22 || src[14] != 0x11 ||
+			    src[17] != 0x11)
+				return 0;
+			if (dest_pix_fmt != V4L2_PIX_FMT_YUV420 &&
+			    dest_pix_fmt != V4L2_PIX_FMT_YVU420)
+				return 0;
+			sof0 = 1;
+			break;
+		case 0xdd: /* DRI */
+			restarts = src + 6 <= end && ((src[4] << 8) | src[5]) != 0;
+			break;
+		case 0xda: /* SOS */
+			return restarts && sof0;
+		}
+	}
+	return 0;
+}
+
 int v4lconvert_decode_jpeg_tinyjpeg(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest,
 	struct v4l2_format *fmt, unsigned int dest_pix_fmt, int flags)
@@ -42,6 +93,8 @@ int v4lconvert_decode_jpeg_tinyjpeg(struct v4lconvert_data *data,
 		data->tinyjpeg = tinyjpeg_init();
 		if (!data->tinyjpeg)
 			return v4lconvert_oom_error(data);
+		tinyjpeg_set_run_fct(data->tinyjpeg, v4lconvert_tinyjpeg_run,
+				     data);
 	}
 	flags |= TINYJPEG_FLAGS_MJPEG_TABLE;
 	tinyjpeg_set_flags(data->tinyjpeg, flags);
@@ -177,110 +230,94 @@ static void init_libjpeg_cinfo(struct v4lconvert_data *data)
 	data->cinfo_initialized = 1;
 }
 
-static int decode_libjpeg_h_samp1(struct v4lconvert_data *data,
-	unsigned char *ydest, unsigned char *udest, unsigned char *vdest,
-	int v_samp)
+/* The DCT output size of the components, less then 8 when libjpeg scales the
+   output down. libjpeg may pick a larger size for subsampled components, to
+   do (part of) the upsampling in the IDCT */
+#if JPEG_LIB_VERSION >= 70
+#define MIN_DCT_SCALED_SIZE(cinfo)	((cinfo)->min_DCT_v_scaled_size)
+#define COMP_DCT_SCALED_SIZE(compptr)	((compptr)->DCT_v_scaled_size)
+#else
+#define MIN_DCT_SCALED_SIZE(cinfo)	((cinfo)->min_DCT_scaled_size)
+#define COMP_DCT_SCALED_SIZE(compptr)	((compptr)->DCT_scaled_size)
+#endif
+
+/* Decode to yuv420 planes with raw_data_out, the y component must be the
+   one with the max sampling factors and u and v must be 1x1 sampled */
+static int decode_libjpeg_raw(struct v4lconvert_data *data,
+	unsigned char *ydest, unsigned char *udest, unsigned char *vdest)
 {
 	struct jpeg_decompress_struct *cinfo = &data->cinfo;
+	unsigned int width = cinfo->output_width;
+	int dct = MIN_DCT_SCALED_SIZE(cinfo);
+	int uv_dct = COMP_DCT_SCALED_SIZE(&cinfo->comp_info[1]);
+	int uv_width = cinfo->comp_info[1].width_in_blocks * uv_dct;
+	/* y lines we get per call */
+	int lines = cinfo->max_v_samp_factor * dct;
+	/* Every xstep-th u + v pixel of every ystep-th line is one of ours */
+	int xstep = uv_dct * 2 / (cinfo->max_h_samp_factor * dct);
+	int ystep = uv_dct * 2 / lines;
 	int x, y;
-	unsigned char *uv_buf;
-	unsigned int width = cinfo->image_width;
+	unsigned char *uv_buf = NULL;
 	JSAMPROW y_rows[16], u_rows[8], v_rows[8];
 	JSAMPARRAY rows[3] = { y_rows, u_rows, v_rows };
 
-	uv_buf = v4lconvert_alloc_buffer(width * 16,
-					 &data->convert_pixfmt_buf,
-					 &data->convert_pixfmt_buf_size);
-	if (!uv_buf)
-		return v4lconvert_oom_error(data);
-
-	for (y = 0; y < 8; y++) {
-		u_rows[y] = uv_buf;
-		uv_buf += width;
-		v_rows[y] = uv_buf;
-		uv_buf += width;
-	}
-	uv_buf -= width * 16;
-
-	while (cinfo->output_scanline < cinfo->image_height) {
-		for (y = 0; y < 8 * v_samp; y++) {
-			y_rows[y] = ydest;
-			ydest += cinfo->image_width;
-		}
-		y = jpeg_read_raw_data(cinfo, rows, 8 * v_samp);
-		if (y != 8 * v_samp)
-			return -1;
-
-		/* For v_samp == 1 skip copying uv vals every other time */
-		if (cinfo->output_scanline % 16)
-			continue;
+	if (xstep != 1) {
+		uv_buf = v4lconvert_alloc_buffer(uv_width * uv_dct * 2,
+						 &data->convert_pixfmt_buf,
+						 &data->convert_pixfmt_buf_size);
+		if (!uv_buf)
+			return v4lconvert_oom_error(data);
 
-		/* Copy over every other u + v pixel for 8 lines */
-		for (y = 0; y < 8; y++) {
-			for (x = 0; x < width; x += 2) {
-				*udest++ = *uv_buf++;
-				uv_buf++;
-			}
-			for (x = 0; x < width; x += 2) {
-				*vdest++ = *uv_buf++;
-				uv_buf++;
-			}
+		for (y = 0; y < uv_dct; y++) {
+			u_rows[y] = uv_buf + y * 2 * uv_width;
+			v_rows[y] = u_rows[y] + uv_width;
 		}
-		uv_buf -= width * 16;
 	}
-	return 0;
-}
 
-static int decode_libjpeg_h_samp2(struct v4lconvert_data *data,
-	unsigned char *ydest, unsigned char *udest, unsigned char *vdest,
-	int v_samp)
-{
-	struct jpeg_decompress_struct *cinfo = &data->cinfo;
-	int y;
-	unsigned int width = cinfo->image_width;
-	JSAMPROW y_rows[16], u_rows[8], v_rows[8];
-	JSAMPARRAY rows[3] = { y_rows, u_rows, v_rows };
-
-	while (cinfo->output_scanline < cinfo->image_height) {
-		for (y = 0; y < 8 * v_samp; y++) {
+	while (cinfo->output_scanline < cinfo->output_height) {
+		for (y = 0; y < lines; y++) {
 			y_rows[y] = ydest;
 			ydest += width;
 		}
 		/*
-		 * For v_samp == 1 were going to get 1 set of uv values per
-		 * line, but we need only 1 set per 2 lines since our output
-		 * has v_samp == 2. We store every 2 sets in 1 line,
-		 * effectively using the second set for each output line.
+		 * When we get more u + v lines then we need, because the
+		 * jpeg has v_samp == 1 for y, we store every ystep sets in
+		 * 1 line, effectively using the last set for each output line.
 		 */
-		if (v_samp == 1) {
-			for (y = 0; y < 8; y++) {
-				u_rows[y] = udest;
-				v_rows[y] = vdest;
-				y++;
-				u_rows[y] = udest;
-				v_rows[y] = vdest;
-				udest += width / 2;
-				vdest += width / 2;
-			}
-		} else { /* v_samp == 2 */
-			for (y = 0; y < 8; y++) {
-				u_rows[y] = udest;
-				v_rows[y] = vdest;
-				udest += width / 2;
-				vdest += width / 2;
+		if (xstep == 1) {
+			for (y = 0; y < uv_dct; y++) {
+				u_rows[y] = udest + (y / ystep) * width / 2;
+				v_rows[y] = vdest + (y / ystep) * width / 2;
 			}
 		}
 
-		y = jpeg_read_raw_data(cinfo, rows, 8 * v_samp);
-		if (y != 8 * v_samp)
+		y = jpeg_read_raw_data(cinfo, rows, lines);
+		if (y != lines)
 			return -1;
+
+		if (xstep == 1) {
+			udest += lines / 2 * width / 2;
+			vdest += lines / 2 * width / 2;
+			continue;
+		}
+
+		/* Copy over every xstep-th u + v pixel of the lines we want */
+		for (y = ystep - 1; y < uv_dct; y += ystep) {
+			for (x = 0; x < width / 2; x++)
+				*udest++ = u_rows[y][x * xstep];
+			for (x = 0; x < width / 2; x++)
+				*vdest++ = v_rows[y][x * xstep];
+		}
 	}
 	return 0;
 }
 
+/* When reduce is set the JPEG gets decoded at half its size, which libjpeg
+   does in the DCT domain for a fraction of the cost of a full decode, fmt
+   gets updated to the decoded size */
 int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest,
-	struct v4l2_format *fmt, unsigned int dest_pix_fmt)
+	struct v4l2_format *fmt, unsigned int dest_pix_fmt, int reduce)
 {
 	unsigned int width  = fmt->fmt.pix.width;
 	unsigned int height = fmt->fmt.pix.height;
@@ -318,6 +355,9 @@ int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 		return -1;
 	}
 
+	data->cinfo.scale_num = 1;
+	data->cinfo.scale_denom = reduce ? 2 : 1;
+
 	if (dest_pix_fmt == V4L2_PIX_FMT_RGB24 ||
 	    dest_pix_fmt == V4L2_PIX_FMT_BGR24) {
 		JSAMPROW row_pointer[1];
@@ -328,6 +368,8 @@ int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 #endif
 		row_pointer[0] = dest;
 		jpeg_start_decompress(&data->cinfo);
+		width = data->cinfo.output_width;
+		height = data->cinfo.output_height;
 		/* Make libjpeg errors report that we've got some data */
 		data->jerr_errno = EPIPE;
 		while (data->cinfo.output_scanline < height) {
@@ -348,13 +390,11 @@ int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 		    data->cinfo.cur_comp_info[1]->h_samp_factor == 1 &&
 		    data->cinfo.cur_comp_info[2]->h_samp_factor == 1) {
 			h_samp = 2;
-#if 0 /* HDG: untested, disable for now */
 		} else if (data->cinfo.max_h_samp_factor == 1 &&
 		    data->cinfo.cur_comp_info[0]->h_samp_factor == 1 &&
 		    data->cinfo.cur_comp_info[1]->h_samp_factor == 1 &&
 		    data->cinfo.cur_comp_info[2]->h_samp_factor == 1) {
 			h_samp = 1;
-#endif
 		} else {
 			fprintf(stderr,
 				"libv4lconvert: unsupported jpeg h-sampling "
@@ -397,6 +437,12 @@ int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 			return -1;
 		}
 
+		data->cinfo.raw_data_out = TRUE;
+		data->cinfo.do_fancy_upsampling = FALSE;
+		jpeg_start_decompress(&data->cinfo);
+		width = data->cinfo.output_width;
+		height = data->cinfo.output_height;
+
 		if (dest_pix_fmt == V4L2_PIX_FMT_YVU420) {
 			vdest = dest + width * height;
 			udest = vdest + (width * height) / 4;
@@ -404,25 +450,18 @@ int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 			udest = dest + width * height;
 			vdest = udest + (width * height) / 4;
 		}
-
-		data->cinfo.raw_data_out = TRUE;
-		data->cinfo.do_fancy_upsampling = FALSE;
-		jpeg_start_decompress(&data->cinfo);
 		/* Make libjpeg errors report that we've got some data */
 		data->jerr_errno = EPIPE;
-		if (h_samp == 1) {
-			result = decode_libjpeg_h_samp1(data, dest, udest,
-							vdest, v_samp);
-		} else {
-			result = decode_libjpeg_h_samp2(data, dest, udest,
-							vdest, v_samp);
-		}
+		result = decode_libjpeg_raw(data, dest, udest, vdest);
 		if (result)
 			jpeg_abort_decompress(&data->cinfo);
 		else
 			jpeg_finish_decompress(&data->cinfo);
 	}
 
+	fmt->fmt.pix.width = width;
+	fmt->fmt.pix.height = height;
+
 	return result;
 }
 
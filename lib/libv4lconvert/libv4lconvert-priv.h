@@ -51,6 +51,54 @@
 #define V4LCONVERT_IS_UVC                0x01
 #define V4LCONVERT_USE_TINYJPEG          0x02
 
+/* Where to find the planes of a 4:2:0 frame, these may be in separate
+   buffers (multi-planar formats) and may have padding at the end of each
+   line. For yvu420 u and v simply point to the other plane, for NV12 u points
+   to the interleaved uv plane and v is unused */
+struct v4lconvert_planes {
+	const unsigned char *y;
+	const unsigned char *u;
+	const unsigned char *v;
+	int y_stride;
+	int uv_stride;
+};
+
+/* The rgbyuv.c YUV converters, which have SIMD versions in rgbyuv-simd.c,
+   the best version for the CPU we are running on gets picked at create time */
+struct v4lconvert_rgbyuv_ops {
+	void (*yuv420_to_rgb24)(const struct v4lconvert_planes *src,
+			unsigned char *dst, int width, int height);
+	void (*yuv420_to_bgr24)(const struct v4lconvert_planes *src,
+			unsigned char *dst, int width, int height);
+	void (*yuyv_to_rgb24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+	void (*yuyv_to_bgr24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+	void (*yuyv_to_yuv420)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride, int yvu);
+	void (*yvyu_to_rgb24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+	void (*yvyu_to_bgr24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+	void (*uyvy_to_rgb24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+	void (*uyvy_to_bgr24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+	void (*uyvy_to_yuv420)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride, int yvu);
+	void (*nv12_to_rgb24)(const struct v4lconvert_planes *src,
+			unsigned char *dst, int width, int height, int bgr);
+};
+
+/* The inner loop of the bayer.c rgb24 / bgr24 demosaicing, which has SIMD
+   versions in bayer-simd.c. Converts up to pairs pixel pairs of an inner line
+   and returns how many it did, the C code in bayer.c does the rest */
+struct v4lconvert_bayer_ops {
+	int (*inner_pairs)(const unsigned char *above, const unsigned char *line,
+			const unsigned char *below, unsigned char *bgr, int pairs,
+			int blue_line, int edge_aware);
+};
+
 struct v4lconvert_data {
 	int fd;
 	int flags; /* bitfield */
@@ -76,14 +124,28 @@ struct v4lconvert_data {
 	int convert2_buf_size;
 	int rotate90_buf_size;
 	int flip_buf_size;
+	int pipeline_buf_size;
+	int bayer_buf_size;
 	int convert_pixfmt_buf_size;
+	int unpad_buf_size;
 	unsigned char *convert1_buf;
 	unsigned char *convert2_buf;
 	unsigned char *rotate90_buf;
 	unsigned char *flip_buf;
+	unsigned char *pipeline_buf;
+	unsigned char *bayer_buf;
 	unsigned char *convert_pixfmt_buf;
+	unsigned char *unpad_buf;
 	struct v4lcontrol_data *control;
 	struct v4lprocessing_data *processing;
+	const struct v4lconvert_rgbyuv_ops *rgbyuv;
+	const struct v4lconvert_bayer_ops *bayer;
+	int demosaic;
+	struct v4lconvert_pool *pool; /* NULL when converting single threaded */
+	/* per thread copies for v4lconvert_convert_batch(), when not NULL
+	   there are v4lconvert_get_threads() of them */
+	struct v4lconvert_data **batch_workers;
+	struct v4lconvert_stats stats;
 	void *dev_ops_priv;
 	const struct libv4l_dev_ops *dev_ops;
 
@@ -91,6 +153,9 @@ struct v4lconvert_data {
 	pid_t decompress_pid;
 	int decompress_in_pipe[2];  /* Data from helper to us */
 	int decompress_out_pipe[2]; /* Data from us to helper */
+	int decompress_shm_fd;      /* Frame data in shared memory, or -1 */
+	unsigned char *decompress_shm;
+	size_t decompress_shm_size;
 
 	/* For mr97310a decoder */
 	int frames_dropped;
@@ -109,6 +174,14 @@ struct v4lconvert_pixfmt {
 
 void v4lconvert_fixup_fmt(struct v4l2_format *fmt);
 
+uint64_t v4lconvert_ns(void);
+
+/* A copy of data with its own scratch buffers / decoder state for converting
+   in another thread, see v4lconvert_convert_batch(). It shares the controls
+   of data and does no software processing */
+struct v4lconvert_data *v4lconvert_create_worker(struct v4lconvert_data *data);
+void v4lconvert_destroy_worker(struct v4lconvert_data *worker);
+
 unsigned char *v4lconvert_alloc_buffer(int needed,
 		unsigned char **buf, int *buf_size);
 
@@ -117,11 +190,25 @@ int v4lconvert_oom_error(struct v4lconvert_data *data);
 void v4lconvert_rgb24_to_yuv420(const unsigned char *src, unsigned char *dest,
 		const struct v4l2_format *src_fmt, int bgr, int yvu, int bpp);
 
-void v4lconvert_yuv420_to_rgb24(const unsigned char *src, unsigned char *dst,
-		int width, int height, int yvu);
+/* Fill planes for a single buffer yuv420 / yvu420 resp. NV12 frame */
+void v4lconvert_yuv420_planes(struct v4lconvert_planes *planes,
+		const unsigned char *src, int width, int height,
+		int bytesperline, int yvu);
 
-void v4lconvert_yuv420_to_bgr24(const unsigned char *src, unsigned char *dst,
-		int width, int height, int yvu);
+void v4lconvert_nv12_planes(struct v4lconvert_planes *planes,
+		const unsigned char *src, int width, int height,
+		int bytesperline);
+
+void v4lconvert_yuv420_to_rgb24(const struct v4lconvert_planes *src,
+		unsigned char *dst, int width, int height);
+
+void v4lconvert_yuv420_to_bgr24(const struct v4lconvert_planes *src,
+		unsigned char *dst, int width, int height);
+
+/* Copy the planes to a yuv420 frame without padding, swapping u and v in
+   planes gives yvu420 */
+void v4lconvert_yuv420_copy(const struct v4lconvert_planes *src,
+		unsigned char *dst, int width, int height);
 
 void v4lconvert_yuyv_to_rgb24(const unsigned char *src, unsigned char *dst,
 		int width, int height, int stride);
@@ -153,9 +240,6 @@ void v4lconvert_uyvy_to_yuv420(const unsigned char *src, unsigned char *dst,
 void v4lconvert_swap_rgb(const unsigned char *src, unsigned char *dst,
 		int width, int height);
 
-void v4lconvert_swap_uv(const unsigned char *src, unsigned char *dst,
-		const struct v4l2_format *src_fmt);
-
 void v4lconvert_grey_to_rgb24(const unsigned char *src, unsigned char *dest,
 		int width, int height);
 
@@ -218,13 +302,16 @@ int v4lconvert_se401_to_rgb24(struct v4lconvert_data *data,
 		const unsigned char *src, int src_size,
 		unsigned char *dest, int width, int height);
 
+int v4lconvert_jpeg_has_restarts(const unsigned char *src, int src_size,
+		unsigned int dest_pix_fmt);
+
 int v4lconvert_decode_jpeg_tinyjpeg(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest,
 	struct v4l2_format *fmt, unsigned int dest_pix_fmt, int flags);
 
 int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest,
-	struct v4l2_format *fmt, unsigned int dest_pix_fmt);
+	struct v4l2_format *fmt, unsigned int dest_pix_fmt, int reduce);
 
 int v4lconvert_decode_jpgl(const unsigned char *src, int src_size,
 	unsigned int dest_pix_fmt, unsigned char *dest, int width, int height);
@@ -256,15 +343,32 @@ void v4lconvert_decode_sq905c(const unsigned char *src, unsigned char *dst,
 void v4lconvert_decode_stv0680(const unsigned char *src, unsigned char *dst,
 		int width, int height);
 
-void v4lconvert_bayer_to_rgb24(const unsigned char *bayer,
-		unsigned char *rgb, int width, int height, const unsigned int stride, unsigned int pixfmt);
-
-void v4lconvert_bayer_to_bgr24(const unsigned char *bayer,
-		unsigned char *rgb, int width, int height, const unsigned int stride, unsigned int pixfmt);
-
 void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 		int width, int height, const unsigned int stride, unsigned int src_pixfmt, int yvu);
 
+/* Only render lines first_row - (last_row - 1) of the frame. rgb points to
+   the output for line first_row, yuv to the start of the frame and for the
+   yuv420 version first_row must be even. The rgb24 / bgr24 versions also take
+   10 bit, 10 bit packed and 16 bit bayer data, line_buf must point to
+   3 * width bytes of scratch space for those. */
+void v4lconvert_bayer_to_rgb24_rows(struct v4lconvert_data *data,
+		const unsigned char *bayer, unsigned char *rgb, int width,
+		int height, const unsigned int stride, unsigned int pixfmt,
+		unsigned char *line_buf, int first_row, int last_row);
+
+void v4lconvert_bayer_to_bgr24_rows(struct v4lconvert_data *data,
+		const unsigned char *bayer, unsigned char *rgb, int width,
+		int height, const unsigned int stride, unsigned int pixfmt,
+		unsigned char *line_buf, int first_row, int last_row);
+
+/* Returns the 8 bit bayer format with the same pattern as pixfmt, 0 if pixfmt
+   is not a raw bayer format */
+unsigned int v4lconvert_bayer8_fmt(unsigned int pixfmt);
+
+void v4lconvert_bayer_to_yuv420_rows(const unsigned char *bayer, unsigned char *yuv,
+		int width, int height, const unsigned int stride, unsigned int src_pixfmt, int yvu,
+		int first_row, int last_row);
+
 void v4lconvert_bayer10_to_bayer8(void *bayer10,
 		unsigned char *bayer8, int width, int height);
 
@@ -286,11 +390,15 @@ void v4lconvert_hm12_to_yuv420(const unsigned char *src,
 void v4lconvert_hsv_to_rgb24(const unsigned char *src, unsigned char *dest,
 		int width, int height, int bgr, int Xin, unsigned char hsv_enc);
 
-void v4lconvert_nv12_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int bgr);
+void v4lconvert_nv12_to_rgb24(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int bgr);
 
-void v4lconvert_nv12_to_yuv420(const unsigned char *src, unsigned char *dest,
-		int width, int height, int yvu);
+void v4lconvert_nv12_to_yuv420(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int yvu);
+
+const struct v4lconvert_rgbyuv_ops *v4lconvert_get_rgbyuv_ops(void);
+
+const struct v4lconvert_bayer_ops *v4lconvert_get_bayer_ops(void);
 
 void v4lconvert_rotate90(unsigned char *src, unsigned char *dest,
 		struct v4l2_format *fmt);
@@ -298,13 +406,67 @@ void v4lconvert_rotate90(unsigned char *src, unsigned char *dest,
 void v4lconvert_flip(unsigned char *src, unsigned char *dest,
 		struct v4l2_format *fmt, int hflip, int vflip);
 
+/* Like v4lconvert_flip, but only writes lines first_row - (last_row - 1) of
+   dest and does not update fmt, first_row must be even for yuv420 */
+void v4lconvert_flip_rows(unsigned char *src, unsigned char *dest,
+		const struct v4l2_format *fmt, int hflip, int vflip,
+		int first_row, int last_row);
+
 void v4lconvert_crop(unsigned char *src, unsigned char *dest,
 		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt);
 
+/* Fused convert + flip + crop, for rgb24 / bgr24 output from bayer, packed
+   yuv and rgb24 / bgr24 input (see pipeline.c) */
+int v4lconvert_pipeline_supported(const struct v4l2_format *src_fmt,
+		const struct v4l2_format *dest_fmt, int processing);
+
+int v4lconvert_pipeline(struct v4lconvert_data *data,
+		unsigned char *src, int src_size, unsigned char *dest,
+		struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt,
+		int processing, int hflip, int vflip);
+
 int v4lconvert_helper_decompress(struct v4lconvert_data *data,
 		const char *helper, const unsigned char *src, int src_size,
 		unsigned char *dest, int dest_size, int width, int height, int command);
 
 void v4lconvert_helper_cleanup(struct v4lconvert_data *data);
 
+/* Call func for bands of lines covering lines 0 - (height - 1) from the
+   worker threads set up through v4lconvert_set_threads(), or for all lines at
+   once when there are none. Bands always start at an even line, so that 2x2
+   subsampled planes can be split too. band is the band number, there are
+   never more bands then v4lconvert_get_threads() returns */
+void v4lconvert_pool_run(struct v4lconvert_data *data,
+		void (*func)(void *arg, int band, int first_row, int last_row),
+		void *arg, int height);
+
+/* Call func once for each of no_tasks tasks (with first_row and last_row
+   equal to task and task + 1) from the worker threads set up through
+   v4lconvert_set_threads(), or one after the other when there are none */
+void v4lconvert_pool_run_tasks(struct v4lconvert_data *data,
+		void (*func)(void *arg, int task, int first_row, int last_row),
+		void *arg, int no_tasks);
+
+/* These split the frame in bands which get converted by the worker threads
+   set up through v4lconvert_set_threads(), or convert it in one go when
+   there are none */
+int v4lconvert_parallel_bayer(struct v4lconvert_data *data,
+		unsigned char *src, unsigned char *dest, int width, int height,
+		int stride, unsigned int src_pix_fmt, unsigned int dest_pix_fmt);
+
+void v4lconvert_parallel_packed(struct v4lconvert_data *data,
+		void (*func)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride),
+		unsigned char *src, unsigned char *dest, int width, int height,
+		int stride);
+
+void v4lconvert_parallel_processing(struct v4lconvert_data *data,
+		unsigned char *buf, const struct v4l2_format *fmt);
+
+void v4lconvert_parallel_flip(struct v4lconvert_data *data,
+		unsigned char *src, unsigned char *dest, struct v4l2_format *fmt,
+		int hflip, int vflip);
+
+void v4lconvert_parallel_cleanup(struct v4lconvert_data *data);
+
 #endif
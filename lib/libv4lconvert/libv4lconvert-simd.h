@@ -0,0 +1,105 @@
+/*
+
+# Helpers shared by the SIMD (SSE2 / AVX2 / NEON) converters
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+#ifndef __LIBV4LCONVERT_SIMD_H
+#define __LIBV4LCONVERT_SIMD_H
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_SIMD_X86 1
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define HAVE_SIMD_NEON 1
+#endif
+
+#ifdef HAVE_SIMD_X86
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+/* Squeeze 4 RGBX pixels into the low 12 bytes */
+static inline SSE2 __m128i sse2_pack_rgbx(__m128i p)
+{
+	__m128i lo = _mm_and_si128(p, _mm_set_epi32(0, 0x00ffffff, 0, 0x00ffffff));
+	__m128i hi = _mm_srli_epi64(_mm_and_si128(p,
+				_mm_set_epi32(0x00ffffff, 0, 0x00ffffff, 0)), 8);
+	__m128i x = _mm_or_si128(lo, hi);
+
+	return _mm_or_si128(_mm_move_epi64(x),
+			    _mm_slli_si128(_mm_srli_si128(x, 8), 6));
+}
+
+/* Interleave 16 R, G and B bytes into 48 bytes of packed rgb24 */
+static inline SSE2 void sse2_store_rgb24(unsigned char *dest, __m128i r,
+		__m128i g, __m128i b)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i rg_lo = _mm_unpacklo_epi8(r, g);
+	__m128i rg_hi = _mm_unpackhi_epi8(r, g);
+	__m128i bz_lo = _mm_unpacklo_epi8(b, zero);
+	__m128i bz_hi = _mm_unpackhi_epi8(b, zero);
+	__m128i p0 = sse2_pack_rgbx(_mm_unpacklo_epi16(rg_lo, bz_lo));
+	__m128i p1 = sse2_pack_rgbx(_mm_unpackhi_epi16(rg_lo, bz_lo));
+	__m128i p2 = sse2_pack_rgbx(_mm_unpacklo_epi16(rg_hi, bz_hi));
+	__m128i p3 = sse2_pack_rgbx(_mm_unpackhi_epi16(rg_hi, bz_hi));
+
+	_mm_storeu_si128((__m128i *)dest,
+			 _mm_or_si128(p0, _mm_slli_si128(p1, 12)));
+	_mm_storeu_si128((__m128i *)(dest + 16),
+			 _mm_or_si128(_mm_srli_si128(p1, 4), _mm_slli_si128(p2, 8)));
+	_mm_storeu_si128((__m128i *)(dest + 32),
+			 _mm_or_si128(_mm_srli_si128(p2, 8), _mm_slli_si128(p3, 4)));
+}
+
+/* Same as sse2_store_rgb24(), using pshufb (which AVX2 implies) */
+static inline AVX2 void avx2_store_rgb24(unsigned char *dest, __m128i r,
+		__m128i g, __m128i b)
+{
+#define Z -128
+	const __m128i m0r = _mm_setr_epi8(0, Z, Z, 1, Z, Z, 2, Z, Z, 3, Z, Z, 4, Z, Z, 5);
+	const __m128i m0g = _mm_setr_epi8(Z, 0, Z, Z, 1, Z, Z, 2, Z, Z, 3, Z, Z, 4, Z, Z);
+	const __m128i m0b = _mm_setr_epi8(Z, Z, 0, Z, Z, 1, Z, Z, 2, Z, Z, 3, Z, Z, 4, Z);
+	const __m128i m1r = _mm_setr_epi8(Z, Z, 6, Z, Z, 7, Z, Z, 8, Z, Z, 9, Z, Z, 10, Z);
+	const __m128i m1g = _mm_setr_epi8(5, Z, Z, 6, Z, Z, 7, Z, Z, 8, Z, Z, 9, Z, Z, 10);
+	const __m128i m1b = _mm_setr_epi8(Z, 5, Z, Z, 6, Z, Z, 7, Z, Z, 8, Z, Z, 9, Z, Z);
+	const __m128i m2r = _mm_setr_epi8(Z, 11, Z, Z, 12, Z, Z, 13, Z, Z, 14, Z, Z, 15, Z, Z);
+	const __m128i m2g = _mm_setr_epi8(Z, Z, 11, Z, Z, 12, Z, Z, 13, Z, Z, 14, Z, Z, 15, Z);
+	const __m128i m2b = _mm_setr_epi8(10, Z, Z, 11, Z, Z, 12, Z, Z, 13, Z, Z, 14, Z, Z, 15);
+#undef Z
+
+	_mm_storeu_si128((__m128i *)dest,
+		_mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, m0r),
+					  _mm_shuffle_epi8(g, m0g)),
+			     _mm_shuffle_epi8(b, m0b)));
+	_mm_storeu_si128((__m128i *)(dest + 16),
+		_mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, m1r),
+					  _mm_shuffle_epi8(g, m1g)),
+			     _mm_shuffle_epi8(b, m1b)));
+	_mm_storeu_si128((__m128i *)(dest + 32),
+		_mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, m2r),
+					  _mm_shuffle_epi8(g, m2g)),
+			     _mm_shuffle_epi8(b, m2b)));
+}
+
+#endif /* HAVE_SIMD_X86 */
+
+#endif
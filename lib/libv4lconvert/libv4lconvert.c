@@ -24,6 +24,7 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -32,6 +33,7 @@
 #include "libv4lsyscall-priv.h"
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
 #define BIT_MASK(nr) (1UL << ((nr) % BITS_PER_LONG))
 #define BIT_WORD(nr) ((nr) / BITS_PER_LONG)
 
@@ -140,6 +142,10 @@ static const struct v4lconvert_pixfmt supported_src_pixfmts[] = {
 	{ V4L2_PIX_FMT_M420,		12,	 6,	 3,	1 },
 	{ V4L2_PIX_FMT_HM12,		12,	 6,	 3,	1 },
 	{ V4L2_PIX_FMT_NV12,		12,	 6,	 3,	1 },
+	/* multi-planar yuv 4:2:0 formats, see v4lconvert_convert_mplane() */
+	{ V4L2_PIX_FMT_YUV420M,		12,	 6,	 1,	1 },
+	{ V4L2_PIX_FMT_YVU420M,		12,	 6,	 1,	1 },
+	{ V4L2_PIX_FMT_NV12M,		12,	 6,	 3,	1 },
 	{ V4L2_PIX_FMT_CPIA1,		 0,	 6,	 3,	1 },
 	/* JPEG and variants */
 	{ V4L2_PIX_FMT_MJPEG,		 0,	 7,	 7,	0 },
@@ -238,7 +244,10 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	data->dev_ops = dev_ops;
 	data->dev_ops_priv = dev_ops_priv;
 	data->decompress_pid = -1;
+	data->decompress_shm_fd = -1;
 	data->fps = 30;
+	data->rgbyuv = v4lconvert_get_rgbyuv_ops();
+	data->bayer = v4lconvert_get_bayer_ops();
 
 	/* Check supported formats */
 	for (i = 0; ; i++) {
@@ -298,13 +307,33 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	return data;
 }
 
-void v4lconvert_destroy(struct v4lconvert_data *data)
+struct v4lconvert_data *v4lconvert_create_worker(struct v4lconvert_data *data)
 {
-	if (!data)
-		return;
+	struct v4lconvert_data *worker = calloc(1, sizeof(*worker));
 
-	v4lprocessing_destroy(data->processing);
-	v4lcontrol_destroy(data->control);
+	if (!worker)
+		return NULL;
+
+	worker->fd = data->fd;
+	worker->flags = data->flags;
+	worker->control_flags = data->control_flags;
+	worker->fps = data->fps;
+	worker->bandwidth = data->bandwidth;
+	worker->control = data->control;
+	worker->rgbyuv = data->rgbyuv;
+	worker->bayer = data->bayer;
+	worker->demosaic = data->demosaic;
+	worker->dev_ops = data->dev_ops;
+	worker->dev_ops_priv = data->dev_ops_priv;
+	worker->decompress_pid = -1;
+	worker->decompress_shm_fd = -1;
+
+	return worker;
+}
+
+/* Free everything a worker / data owns, except for controls / processing */
+static void v4lconvert_free_state(struct v4lconvert_data *data)
+{
 	if (data->tinyjpeg) {
 		unsigned char *comps[3] = { NULL, NULL, NULL };
 
@@ -322,11 +351,31 @@ void v4lconvert_destroy(struct v4lconvert_data *data)
 	free(data->convert2_buf);
 	free(data->rotate90_buf);
 	free(data->flip_buf);
+	free(data->pipeline_buf);
+	free(data->bayer_buf);
 	free(data->convert_pixfmt_buf);
+	free(data->unpad_buf);
 	free(data->previous_frame);
 	free(data);
 }
 
+void v4lconvert_destroy_worker(struct v4lconvert_data *worker)
+{
+	if (worker)
+		v4lconvert_free_state(worker);
+}
+
+void v4lconvert_destroy(struct v4lconvert_data *data)
+{
+	if (!data)
+		return;
+
+	v4lconvert_parallel_cleanup(data);
+	v4lprocessing_destroy(data->processing);
+	v4lcontrol_destroy(data->control);
+	v4lconvert_free_state(data);
+}
+
 int v4lconvert_supported_dst_format(unsigned int pixelformat)
 {
 	int i;
@@ -526,8 +575,7 @@ static int v4lconvert_do_try_format(struct v4lconvert_data *data,
 
 		try_fmt = *dest_fmt;
 		try_fmt.fmt.pix.pixelformat = supported_src_pixfmts[i].fmt;
-		if (data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
-				VIDIOC_TRY_FMT, &try_fmt))
+		if (v4lconvert_src_fmt_ioctl(data, VIDIOC_TRY_FMT, &try_fmt))
 			continue;
 
 		if (try_fmt.fmt.pix.pixelformat !=
@@ -710,6 +758,25 @@ int v4lconvert_needs_conversion(struct v4lconvert_data *data,
 	return 0;
 }
 
+/* Would v4lconvert_convert() return an unmodified copy of the frame ? */
+int v4lconvert_is_passthrough(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt) /* in */
+{
+	if (!v4lconvert_supported_dst_format(dest_fmt->fmt.pix.pixelformat))
+		return 1;
+
+	if (src_fmt->fmt.pix.width != dest_fmt->fmt.pix.width ||
+			src_fmt->fmt.pix.height != dest_fmt->fmt.pix.height ||
+			src_fmt->fmt.pix.pixelformat != dest_fmt->fmt.pix.pixelformat)
+		return 0;
+
+	return !v4lprocessing_pre_processing(data->processing) &&
+		!(data->control_flags & V4LCONTROL_ROTATED_90_JPEG) &&
+		!v4lcontrol_get_ctrl(data->control, V4LCONTROL_HFLIP) &&
+		!v4lcontrol_get_ctrl(data->control, V4LCONTROL_VFLIP);
+}
+
 static int v4lconvert_processing_needs_double_conversion(
 		unsigned int src_pix_fmt, unsigned int dest_pix_fmt)
 {
@@ -753,6 +820,14 @@ static int v4lconvert_processing_needs_double_conversion(
 	return 1;
 }
 
+/* Can the bayer demosaicing for dest_pix_fmt take 10 and 16 bit bayer data
+   directly, or does it need to be narrowed to 8 bit first? */
+static int v4lconvert_bayer_direct(unsigned int dest_pix_fmt)
+{
+	return dest_pix_fmt == V4L2_PIX_FMT_RGB24 ||
+	       dest_pix_fmt == V4L2_PIX_FMT_BGR24;
+}
+
 unsigned char *v4lconvert_alloc_buffer(int needed,
 		unsigned char **buf, int *buf_size)
 {
@@ -775,21 +850,122 @@ int v4lconvert_oom_error(struct v4lconvert_data *data)
 	return -1;
 }
 
+/* Returns the length of a line without padding for src formats whose
+   converters expect lines without padding, 0 for formats which are
+   converted with their bytesperline taken into account */
+static unsigned int v4lconvert_unpadded_bytesperline(
+		const struct v4l2_format *fmt, unsigned int dest_pix_fmt)
+{
+	unsigned int width = fmt->fmt.pix.width;
+
+	switch (fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_GREY:
+	case V4L2_PIX_FMT_Y4:
+	case V4L2_PIX_FMT_Y6:
+	case V4L2_PIX_FMT_NV16:
+	case V4L2_PIX_FMT_NV61:
+		return width;
+	case V4L2_PIX_FMT_Y10BPACK:
+		return width * 10 / 8;
+	case V4L2_PIX_FMT_RGB565:
+	case V4L2_PIX_FMT_Y16:
+	case V4L2_PIX_FMT_Y16_BE:
+		return width * 2;
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+	case V4L2_PIX_FMT_HSV24:
+		return width * 3;
+	case V4L2_PIX_FMT_RGB32:
+	case V4L2_PIX_FMT_XRGB32:
+	case V4L2_PIX_FMT_ARGB32:
+	case V4L2_PIX_FMT_BGR32:
+	case V4L2_PIX_FMT_XBGR32:
+	case V4L2_PIX_FMT_ABGR32:
+	case V4L2_PIX_FMT_HSV32:
+		return width * 4;
+	/* The demosaicing handles padding, narrowing to 8 bits does not */
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SRGGB10P:
+		return v4lconvert_bayer_direct(dest_pix_fmt) ? 0 : width * 10 / 8;
+	case V4L2_PIX_FMT_SBGGR10:
+	case V4L2_PIX_FMT_SGBRG10:
+	case V4L2_PIX_FMT_SGRBG10:
+	case V4L2_PIX_FMT_SRGGB10:
+	case V4L2_PIX_FMT_SBGGR16:
+	case V4L2_PIX_FMT_SGBRG16:
+	case V4L2_PIX_FMT_SGRBG16:
+	case V4L2_PIX_FMT_SRGGB16:
+		return v4lconvert_bayer_direct(dest_pix_fmt) ? 0 : width * 2;
+	}
+
+	return 0;
+}
+
+/* reduce asks for the src to be decoded at half its size when that is cheap
+   (JPEG), fmt then gets updated to the size of the result. planes is only
+   used for yuv 4:2:0 src formats, when it is NULL they are found in src */
 static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest, int dest_size,
-	struct v4l2_format *fmt, unsigned int dest_pix_fmt)
+	struct v4l2_format *fmt, unsigned int dest_pix_fmt, int reduce,
+	const struct v4lconvert_planes *planes)
 {
 	int result = 0;
 	unsigned int src_pix_fmt = fmt->fmt.pix.pixelformat;
 	unsigned int width  = fmt->fmt.pix.width;
 	unsigned int height = fmt->fmt.pix.height;
 	unsigned int bytesperline = fmt->fmt.pix.bytesperline;
+	unsigned int unpadded = v4lconvert_unpadded_bytesperline(fmt,
+								dest_pix_fmt);
+	struct v4lconvert_planes my_planes;
+
+	/* Copy the lines of src formats whose converters can not deal with
+	   padding to a buffer of our own, leaving out the padding */
+	if (unpadded && bytesperline > unpadded) {
+		unsigned int i, lines = height;
+		unsigned char *d;
+
+		if (src_pix_fmt == V4L2_PIX_FMT_NV16 ||
+		    src_pix_fmt == V4L2_PIX_FMT_NV61)
+			lines *= 2;
+		lines = MIN(lines, src_size / bytesperline);
+
+		d = v4lconvert_alloc_buffer(unpadded * lines,
+				&data->unpad_buf, &data->unpad_buf_size);
+		if (!d)
+			return v4lconvert_oom_error(data);
+
+		for (i = 0; i < lines; i++)
+			memcpy(d + i * unpadded, src + i * bytesperline,
+			       unpadded);
+
+		src = d;
+		src_size = unpadded * lines;
+		bytesperline = unpadded;
+		fmt->fmt.pix.bytesperline = unpadded;
+		fmt->fmt.pix.sizeimage = src_size;
+	}
 
 	switch (src_pix_fmt) {
 	/* JPG and variants */
 	case V4L2_PIX_FMT_MJPEG:
 	case V4L2_PIX_FMT_JPEG:
 #ifdef HAVE_JPEG
+		/* tinyjpeg can decode the restart intervals of JPEGs
+		   which have them in parallel, libjpeg cannot, but a
+		   reduced size decode with libjpeg is cheaper still */
+		if (!(data->flags & V4LCONVERT_USE_TINYJPEG) &&
+		    v4lconvert_get_threads(data) > 1 && !reduce &&
+		    v4lconvert_jpeg_has_restarts(src, src_size,
+						 dest_pix_fmt)) {
+			result = v4lconvert_decode_jpeg_tinyjpeg(data,
+					src, src_size, dest, fmt, dest_pix_fmt,
+					TINYJPEG_FLAGS_ACCURATE_IDCT);
+			if (!result)
+				break;
+			/* Let libjpeg have a go at it */
+		}
 		if (data->flags & V4LCONVERT_USE_TINYJPEG) {
 #endif // HAVE_JPEG
 			result = v4lconvert_decode_jpeg_tinyjpeg(data,
@@ -799,7 +975,7 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		} else {
 			result = v4lconvert_decode_jpeg_libjpeg(data,
 							src, src_size, dest,
-							fmt, dest_pix_fmt);
+							fmt, dest_pix_fmt, reduce);
 			if (result == -1 && errno == EOPNOTSUPP) {
 				/* Fall back to tinyjpeg */
 				jpeg_destroy_decompress(&data->cinfo);
@@ -902,14 +1078,16 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 #endif
 		}
 
+		v4lconvert_yuv420_planes(&my_planes, d, width, height, width,
+					 yvu);
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yuv420_to_rgb24(data->convert_pixfmt_buf, dest, width,
-					height, yvu);
+			data->rgbyuv->yuv420_to_rgb24(&my_planes, dest, width,
+					height);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yuv420_to_bgr24(data->convert_pixfmt_buf, dest, width,
-					height, yvu);
+			data->rgbyuv->yuv420_to_bgr24(&my_planes, dest, width,
+					height);
 			break;
 		}
 		break;
@@ -935,18 +1113,29 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 
 		/* NV12 formats */
 	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV12M:
+		if (!planes) {
+			if (src_size < (MAX(width, bytesperline) * height * 3 / 2)) {
+				V4LCONVERT_ERR("short nv12 data frame\n");
+				errno = EPIPE;
+				result = -1;
+			}
+			v4lconvert_nv12_planes(&my_planes, src, width, height,
+					       bytesperline);
+			planes = &my_planes;
+		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_nv12_to_rgb24(src, dest, width, height, 0);
+			data->rgbyuv->nv12_to_rgb24(planes, dest, width, height, 0);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_nv12_to_rgb24(src, dest, width, height, 1);
+			data->rgbyuv->nv12_to_rgb24(planes, dest, width, height, 1);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_nv12_to_yuv420(src, dest, width, height, 0);
+			v4lconvert_nv12_to_yuv420(planes, dest, width, height, 0);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_nv12_to_yuv420(src, dest, width, height, 1);
+			v4lconvert_nv12_to_yuv420(planes, dest, width, height, 1);
 			break;
 		}
 		break;
@@ -1026,7 +1215,7 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		   cheaper, and bayer == rgb and our dest_fmt may be yuv */
 		tmpfmt.fmt.pix.bytesperline = width;
 		tmpfmt.fmt.pix.sizeimage = width * height;
-		v4lprocessing_processing(data->processing, tmpbuf, &tmpfmt);
+		v4lconvert_parallel_processing(data, tmpbuf, &tmpfmt);
 		/* Deliberate fall through to raw bayer fmt code! */
 		src_pix_fmt = tmpfmt.fmt.pix.pixelformat;
 		src = tmpbuf;
@@ -1043,16 +1232,9 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 
 		switch (src_pix_fmt) {
 		case V4L2_PIX_FMT_SBGGR10P:
-			src_pix_fmt = V4L2_PIX_FMT_SBGGR8;
-			break;
 		case V4L2_PIX_FMT_SGBRG10P:
-			src_pix_fmt = V4L2_PIX_FMT_SGBRG8;
-			break;
 		case V4L2_PIX_FMT_SGRBG10P:
-			src_pix_fmt = V4L2_PIX_FMT_SGRBG8;
-			break;
 		case V4L2_PIX_FMT_SRGGB10P:
-			src_pix_fmt = V4L2_PIX_FMT_SRGGB8;
 			break;
 		default:
 			b10format = 0;
@@ -1067,8 +1249,12 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 				result = -1;
 				break;
 			}
-			v4lconvert_bayer10p_to_bayer8(src, src, width, height);
-			bytesperline = width;
+			/* rgb24 / bgr24 demosaicing reads 10 bit data directly */
+			if (!v4lconvert_bayer_direct(dest_pix_fmt)) {
+				v4lconvert_bayer10p_to_bayer8(src, src, width, height);
+				src_pix_fmt = v4lconvert_bayer8_fmt(src_pix_fmt);
+				bytesperline = width;
+			}
 		}
 	}
 
@@ -1080,16 +1266,9 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 
 		switch (src_pix_fmt) {
 		case V4L2_PIX_FMT_SBGGR10:
-			src_pix_fmt = V4L2_PIX_FMT_SBGGR8;
-			break;
 		case V4L2_PIX_FMT_SGBRG10:
-			src_pix_fmt = V4L2_PIX_FMT_SGBRG8;
-			break;
 		case V4L2_PIX_FMT_SGRBG10:
-			src_pix_fmt = V4L2_PIX_FMT_SGRBG8;
-			break;
 		case V4L2_PIX_FMT_SRGGB10:
-			src_pix_fmt = V4L2_PIX_FMT_SRGGB8;
 			break;
 		default:
 			b10format = 0;
@@ -1104,8 +1283,11 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 				result = -1;
 				break;
 			}
-			v4lconvert_bayer10_to_bayer8(src, src, width, height);
-			bytesperline = width;
+			if (!v4lconvert_bayer_direct(dest_pix_fmt)) {
+				v4lconvert_bayer10_to_bayer8(src, src, width, height);
+				src_pix_fmt = v4lconvert_bayer8_fmt(src_pix_fmt);
+				bytesperline = width;
+			}
 		}
 	}
 
@@ -1117,16 +1299,9 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 
 		switch (src_pix_fmt) {
 		case V4L2_PIX_FMT_SBGGR16:
-			src_pix_fmt = V4L2_PIX_FMT_SBGGR8;
-			break;
 		case V4L2_PIX_FMT_SGBRG16:
-			src_pix_fmt = V4L2_PIX_FMT_SGBRG8;
-			break;
 		case V4L2_PIX_FMT_SGRBG16:
-			src_pix_fmt = V4L2_PIX_FMT_SGRBG8;
-			break;
 		case V4L2_PIX_FMT_SRGGB16:
-			src_pix_fmt = V4L2_PIX_FMT_SRGGB8;
 			break;
 		default:
 			b16format = 0;
@@ -1141,8 +1316,11 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 				result = -1;
 				break;
 			}
-			v4lconvert_bayer16_to_bayer8(src, src, width, height);
-			bytesperline = width;
+			if (!v4lconvert_bayer_direct(dest_pix_fmt)) {
+				v4lconvert_bayer16_to_bayer8(src, src, width, height);
+				src_pix_fmt = v4lconvert_bayer8_fmt(src_pix_fmt);
+				bytesperline = width;
+			}
 		}
 	}
 
@@ -1156,20 +1334,9 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 			errno = EPIPE;
 			result = -1;
 		}
-		switch (dest_pix_fmt) {
-		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_bayer_to_rgb24(src, dest, width, height, bytesperline, src_pix_fmt);
-			break;
-		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_bayer_to_bgr24(src, dest, width, height, bytesperline, src_pix_fmt);
-			break;
-		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_bayer_to_yuv420(src, dest, width, height, bytesperline, src_pix_fmt, 0);
-			break;
-		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_bayer_to_yuv420(src, dest, width, height, bytesperline, src_pix_fmt, 1);
-			break;
-		}
+		if (v4lconvert_parallel_bayer(data, src, dest, width, height,
+				bytesperline, src_pix_fmt, dest_pix_fmt))
+			return -1;
 		break;
 
 	case V4L2_PIX_FMT_SE401: {
@@ -1390,51 +1557,42 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		break;
 
 	case V4L2_PIX_FMT_YUV420:
-		if (src_size < (width * height * 3 / 2)) {
-			V4LCONVERT_ERR("short yuv420 data frame\n");
-			errno = EPIPE;
-			result = -1;
-		}
-		switch (dest_pix_fmt) {
-		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yuv420_to_rgb24(src, dest, width,
-					height, 0);
-			break;
-		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yuv420_to_bgr24(src, dest, width,
-					height, 0);
-			break;
-		case V4L2_PIX_FMT_YUV420:
-			memcpy(dest, src, width * height * 3 / 2);
-			break;
-		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_swap_uv(src, dest, fmt);
-			break;
-		}
-		break;
-
 	case V4L2_PIX_FMT_YVU420:
-		if (src_size < (width * height * 3 / 2)) {
-			V4LCONVERT_ERR("short yvu420 data frame\n");
-			errno = EPIPE;
-			result = -1;
+	case V4L2_PIX_FMT_YUV420M:
+	case V4L2_PIX_FMT_YVU420M:
+		if (!planes) {
+			if (src_size < (MAX(width, bytesperline) * height * 3 / 2)) {
+				V4LCONVERT_ERR("short yuv420 data frame\n");
+				errno = EPIPE;
+				result = -1;
+			}
+			v4lconvert_yuv420_planes(&my_planes, src, width, height,
+					bytesperline,
+					src_pix_fmt == V4L2_PIX_FMT_YVU420 ||
+					src_pix_fmt == V4L2_PIX_FMT_YVU420M);
+			planes = &my_planes;
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yuv420_to_rgb24(src, dest, width,
-					height, 1);
+			data->rgbyuv->yuv420_to_rgb24(planes, dest, width,
+					height);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yuv420_to_bgr24(src, dest, width,
-					height, 1);
+			data->rgbyuv->yuv420_to_bgr24(planes, dest, width,
+					height);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_swap_uv(src, dest, fmt);
+			v4lconvert_yuv420_copy(planes, dest, width, height);
 			break;
-		case V4L2_PIX_FMT_YVU420:
-			memcpy(dest, src, width * height * 3 / 2);
+		case V4L2_PIX_FMT_YVU420: {
+			struct v4lconvert_planes swapped = *planes;
+
+			swapped.u = planes->v;
+			swapped.v = planes->u;
+			v4lconvert_yuv420_copy(&swapped, dest, width, height);
 			break;
 		}
+		}
 		break;
 
 	case V4L2_PIX_FMT_NV16: {
@@ -1459,16 +1617,18 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yuyv_to_rgb24(src, dest, width, height, bytesperline);
+			v4lconvert_parallel_packed(data, data->rgbyuv->yuyv_to_rgb24,
+					src, dest, width, height, bytesperline);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yuyv_to_bgr24(src, dest, width, height, bytesperline);
+			v4lconvert_parallel_packed(data, data->rgbyuv->yuyv_to_bgr24,
+					src, dest, width, height, bytesperline);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_yuyv_to_yuv420(src, dest, width, height, bytesperline, 0);
+			data->rgbyuv->yuyv_to_yuv420(src, dest, width, height, bytesperline, 0);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_yuyv_to_yuv420(src, dest, width, height, bytesperline, 1);
+			data->rgbyuv->yuyv_to_yuv420(src, dest, width, height, bytesperline, 1);
 			break;
 		}
 		break;
@@ -1496,18 +1656,20 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yvyu_to_rgb24(src, dest, width, height, bytesperline);
+			v4lconvert_parallel_packed(data, data->rgbyuv->yvyu_to_rgb24,
+					src, dest, width, height, bytesperline);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yvyu_to_bgr24(src, dest, width, height, bytesperline);
+			v4lconvert_parallel_packed(data, data->rgbyuv->yvyu_to_bgr24,
+					src, dest, width, height, bytesperline);
 			break;
 		case V4L2_PIX_FMT_YUV420:
 			/* Note we use yuyv_to_yuv420 not v4lconvert_yvyu_to_yuv420,
 			   with the last argument reversed to make it have as we want */
-			v4lconvert_yuyv_to_yuv420(src, dest, width, height, bytesperline, 1);
+			data->rgbyuv->yuyv_to_yuv420(src, dest, width, height, bytesperline, 1);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_yuyv_to_yuv420(src, dest, width, height, bytesperline, 0);
+			data->rgbyuv->yuyv_to_yuv420(src, dest, width, height, bytesperline, 0);
 			break;
 		}
 		break;
@@ -1520,16 +1682,18 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_uyvy_to_rgb24(src, dest, width, height, bytesperline);
+			v4lconvert_parallel_packed(data, data->rgbyuv->uyvy_to_rgb24,
+					src, dest, width, height, bytesperline);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_uyvy_to_bgr24(src, dest, width, height, bytesperline);
+			v4lconvert_parallel_packed(data, data->rgbyuv->uyvy_to_bgr24,
+					src, dest, width, height, bytesperline);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_uyvy_to_yuv420(src, dest, width, height, bytesperline, 0);
+			data->rgbyuv->uyvy_to_yuv420(src, dest, width, height, bytesperline, 0);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_uyvy_to_yuv420(src, dest, width, height, bytesperline, 1);
+			data->rgbyuv->uyvy_to_yuv420(src, dest, width, height, bytesperline, 1);
 			break;
 		}
 		break;
@@ -1605,13 +1769,46 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	return result;
 }
 
-int v4lconvert_convert(struct v4lconvert_data *data,
+uint64_t v4lconvert_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Add the time passed since *start to *counter and restart *start */
+static void v4lconvert_time_stage(uint64_t *counter, uint64_t *start)
+{
+	uint64_t now = v4lconvert_ns();
+
+	*counter += now - *start;
+	*start = now;
+}
+
+static int v4lconvert_count_frame(struct v4lconvert_data *data, int result)
+{
+	if (result < 0) {
+		data->stats.errors++;
+		if (errno == EPIPE)
+			data->stats.short_frames++;
+	} else {
+		data->stats.frames++;
+	}
+
+	return result;
+}
+
+/* v4lconvert_convert() with the planes of a yuv 4:2:0 src frame in separate
+   buffers, planes must be NULL for other src formats */
+static int v4lconvert_convert_planes(struct v4lconvert_data *data,
 		const struct v4l2_format *src_fmt,  /* in */
 		const struct v4l2_format *dest_fmt, /* in */
+		const struct v4lconvert_planes *planes,
 		unsigned char *src, int src_size, unsigned char *dest, int dest_size)
 {
 	int res, dest_needed, temp_needed, processing, convert = 0;
-	int rotate90, vflip, hflip, crop;
+	int rotate90, vflip, hflip, crop, reduce;
 	unsigned char *convert1_dest = dest;
 	int convert1_dest_size = dest_size;
 	unsigned char *convert2_src = src, *convert2_dest = dest;
@@ -1621,8 +1818,11 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 	unsigned char *crop_src = src;
 	struct v4l2_format my_src_fmt = *src_fmt;
 	struct v4l2_format my_dest_fmt = *dest_fmt;
+	uint64_t start;
 
-	processing = v4lprocessing_pre_processing(data->processing);
+	/* batch workers have no processing */
+	processing = data->processing &&
+		v4lprocessing_pre_processing(data->processing);
 	rotate90 = data->control_flags & V4LCONTROL_ROTATED_90_JPEG;
 	hflip = v4lcontrol_get_ctrl(data->control, V4LCONTROL_HFLIP);
 	vflip = v4lcontrol_get_ctrl(data->control, V4LCONTROL_VFLIP);
@@ -1631,12 +1831,19 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 
 	if (/* If no conversion/processing is needed */
 			(src_fmt->fmt.pix.pixelformat == dest_fmt->fmt.pix.pixelformat &&
+			 /* a dest_fmt without bytesperline takes the src one */
+			 (!dest_fmt->fmt.pix.bytesperline ||
+			  dest_fmt->fmt.pix.bytesperline ==
+				src_fmt->fmt.pix.bytesperline) &&
 			 !processing && !rotate90 && !hflip && !vflip && !crop) ||
 			/* or if we should do processing/rotating/flipping but the app tries to
 			   use the native cam format, we just return an unprocessed frame copy */
 			!v4lconvert_supported_dst_format(dest_fmt->fmt.pix.pixelformat)) {
 		int to_copy = MIN(dest_size, src_size);
+
+		start = v4lconvert_ns();
 		memcpy(dest, src, to_copy);
+		v4lconvert_time_stage(&data->stats.copy_ns, &start);
 		return to_copy;
 	}
 
@@ -1682,6 +1889,43 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 		    source to dest */
 		 (!rotate90 && !hflip && !vflip && !crop))
 		convert = 1;
+	else {
+		/* rotate90 / flip / crop can not deal with padding, so let
+		   convert_pixfmt copy the src frame without it */
+		struct v4l2_format unpadded_fmt = my_src_fmt;
+
+		v4lconvert_fixup_fmt(&unpadded_fmt);
+		if (unpadded_fmt.fmt.pix.bytesperline !=
+				my_src_fmt.fmt.pix.bytesperline)
+			convert = 1;
+	}
+
+	/* For the common cases do convert_pixfmt -> flip -> crop in one pass,
+	   without going through the intermediate buffers */
+	if (convert != 2 && !rotate90 && (hflip || vflip || crop) &&
+			v4lconvert_pipeline_supported(&my_src_fmt, &my_dest_fmt,
+						      processing)) {
+		start = v4lconvert_ns();
+		res = v4lconvert_pipeline(data, src, src_size, dest,
+				&my_src_fmt, &my_dest_fmt, processing, hflip, vflip);
+		v4lconvert_time_stage(&data->stats.convert_ns, &start);
+		if (res)
+			return res;
+
+		return dest_needed;
+	}
+
+	/* When cropping is going to throw away every other pixel of a JPEG
+	   src, let the decoder produce the half size image instead. Cropping
+	   it then gives the same part of the picture, as long as crop does not
+	   need to reduce the half size image again */
+	reduce = !rotate90 &&
+		(my_src_fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG ||
+		 my_src_fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_JPEG) &&
+		my_src_fmt.fmt.pix.width  >= 2 * my_dest_fmt.fmt.pix.width &&
+		my_src_fmt.fmt.pix.height >= 2 * my_dest_fmt.fmt.pix.height &&
+		(my_src_fmt.fmt.pix.width  < 4 * my_dest_fmt.fmt.pix.width ||
+		 my_src_fmt.fmt.pix.height < 4 * my_dest_fmt.fmt.pix.height);
 
 	/* convert_pixfmt (only if convert == 2) -> processing -> convert_pixfmt ->
 	   rotate -> flip -> crop, all steps are optional */
@@ -1727,25 +1971,31 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 
 	/* Done setting sources / dest and allocating intermediate buffers,
 	   real conversion / processing / ... starts here. */
+	start = v4lconvert_ns();
 	if (convert == 2) {
 		res = v4lconvert_convert_pixfmt(data, src, src_size,
 				convert1_dest, convert1_dest_size,
 				&my_src_fmt,
-				V4L2_PIX_FMT_RGB24);
+				V4L2_PIX_FMT_RGB24, reduce, planes);
+		v4lconvert_time_stage(&data->stats.convert_ns, &start);
 		if (res)
 			return res;
 
 		src_size = my_src_fmt.fmt.pix.sizeimage;
 	}
 
-	if (processing)
-		v4lprocessing_processing(data->processing, convert2_src, &my_src_fmt);
+	if (processing) {
+		v4lconvert_parallel_processing(data, convert2_src, &my_src_fmt);
+		v4lconvert_time_stage(&data->stats.processing_ns, &start);
+	}
 
 	if (convert) {
 		res = v4lconvert_convert_pixfmt(data, convert2_src, src_size,
 				convert2_dest, convert2_dest_size,
 				&my_src_fmt,
-				my_dest_fmt.fmt.pix.pixelformat);
+				my_dest_fmt.fmt.pix.pixelformat, convert == 1 && reduce,
+				convert == 2 ? NULL : planes);
+		v4lconvert_time_stage(&data->stats.convert_ns, &start);
 		if (res)
 			return res;
 
@@ -1754,22 +2004,184 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 		/* We call processing here again in case the source format was not
 		   rgb, but the dest is. v4lprocessing checks it self it only actually
 		   does the processing once per frame. */
-		if (processing)
-			v4lprocessing_processing(data->processing, convert2_dest, &my_src_fmt);
+		if (processing) {
+			v4lconvert_parallel_processing(data, convert2_dest, &my_src_fmt);
+			v4lconvert_time_stage(&data->stats.processing_ns, &start);
+		}
 	}
 
 	if (rotate90)
 		v4lconvert_rotate90(rotate90_src, rotate90_dest, &my_src_fmt);
 
 	if (hflip || vflip)
-		v4lconvert_flip(flip_src, flip_dest, &my_src_fmt, hflip, vflip);
+		v4lconvert_parallel_flip(data, flip_src, flip_dest, &my_src_fmt,
+				hflip, vflip);
 
 	if (crop)
 		v4lconvert_crop(crop_src, dest, &my_src_fmt, &my_dest_fmt);
 
+	if (rotate90 || hflip || vflip || crop)
+		v4lconvert_time_stage(&data->stats.transform_ns, &start);
+
 	return dest_needed;
 }
 
+int v4lconvert_convert(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt, /* in */
+		unsigned char *src, int src_size, unsigned char *dest, int dest_size)
+{
+	return v4lconvert_count_frame(data, v4lconvert_convert_planes(data,
+			src_fmt, dest_fmt, NULL, src, src_size, dest, dest_size));
+}
+
+int v4lconvert_get_num_planes(unsigned int pixelformat)
+{
+	switch (pixelformat) {
+	case V4L2_PIX_FMT_NV12M:
+		return 2;
+	case V4L2_PIX_FMT_YUV420M:
+	case V4L2_PIX_FMT_YVU420M:
+		return 3;
+	}
+
+	return 1;
+}
+
+/* Turn a (possibly multi-planar) format into the single-planar format
+   describing the same frame with its planes one after the other */
+static void v4lconvert_pix_from_pix_mp(const struct v4l2_format *fmt,
+		struct v4l2_format *pix_fmt)
+{
+	const struct v4l2_pix_format_mplane *mp = &fmt->fmt.pix_mp;
+	unsigned int i;
+
+	if (fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE &&
+	    fmt->type != V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) {
+		*pix_fmt = *fmt;
+		return;
+	}
+
+	memset(pix_fmt, 0, sizeof(*pix_fmt));
+	pix_fmt->type = fmt->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ?
+		V4L2_BUF_TYPE_VIDEO_CAPTURE : V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	pix_fmt->fmt.pix.width = mp->width;
+	pix_fmt->fmt.pix.height = mp->height;
+	pix_fmt->fmt.pix.pixelformat = mp->pixelformat;
+	pix_fmt->fmt.pix.field = mp->field;
+	pix_fmt->fmt.pix.colorspace = mp->colorspace;
+	pix_fmt->fmt.pix.priv = V4L2_PIX_FMT_PRIV_MAGIC;
+	pix_fmt->fmt.pix.flags = mp->flags;
+	pix_fmt->fmt.pix.ycbcr_enc = mp->ycbcr_enc;
+	pix_fmt->fmt.pix.quantization = mp->quantization;
+	pix_fmt->fmt.pix.xfer_func = mp->xfer_func;
+	pix_fmt->fmt.pix.bytesperline = mp->plane_fmt[0].bytesperline;
+	for (i = 0; i < mp->num_planes && i < VIDEO_MAX_PLANES; i++)
+		pix_fmt->fmt.pix.sizeimage += mp->plane_fmt[i].sizeimage;
+}
+
+int v4lconvert_src_fmt_ioctl(struct v4lconvert_data *data,
+		unsigned long request, struct v4l2_format *fmt)
+{
+	struct v4l2_format mp_fmt;
+	int num_planes, result;
+
+	num_planes = v4lconvert_get_num_planes(fmt->fmt.pix.pixelformat);
+	if (fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || num_planes == 1)
+		return data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
+				request, fmt);
+
+	memset(&mp_fmt, 0, sizeof(mp_fmt));
+	mp_fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	mp_fmt.fmt.pix_mp.width = fmt->fmt.pix.width;
+	mp_fmt.fmt.pix_mp.height = fmt->fmt.pix.height;
+	mp_fmt.fmt.pix_mp.pixelformat = fmt->fmt.pix.pixelformat;
+	mp_fmt.fmt.pix_mp.field = fmt->fmt.pix.field;
+	mp_fmt.fmt.pix_mp.colorspace = fmt->fmt.pix.colorspace;
+	mp_fmt.fmt.pix_mp.num_planes = num_planes;
+	result = data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
+			request, &mp_fmt);
+	if (result)
+		return result;
+
+	v4lconvert_pix_from_pix_mp(&mp_fmt, fmt);
+	return 0;
+}
+
+int v4lconvert_convert_mplane(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt, /* in */
+		unsigned char *src[], const int src_size[],
+		unsigned char *dest, int dest_size)
+{
+	const struct v4l2_pix_format_mplane *mp = &src_fmt->fmt.pix_mp;
+	struct v4l2_format my_src_fmt, my_dest_fmt;
+	struct v4lconvert_planes planes;
+	int i, num_planes, uv_stride = 0, size = 0;
+
+	v4lconvert_pix_from_pix_mp(src_fmt, &my_src_fmt);
+	v4lconvert_pix_from_pix_mp(dest_fmt, &my_dest_fmt);
+
+	num_planes = v4lconvert_get_num_planes(my_src_fmt.fmt.pix.pixelformat);
+	if (num_planes == 1)
+		return v4lconvert_convert(data, &my_src_fmt, &my_dest_fmt,
+				src[0], src_size[0], dest, dest_size);
+
+	if (src_fmt->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ||
+	    src_fmt->type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE)
+		uv_stride = mp->plane_fmt[1].bytesperline;
+
+	/* The app uses the multi-planar format as is, give it the planes one
+	   after the other */
+	if (!v4lconvert_supported_dst_format(
+				my_dest_fmt.fmt.pix.pixelformat)) {
+		uint64_t start = v4lconvert_ns();
+
+		for (i = 0; i < num_planes; i++) {
+			int to_copy = MIN(dest_size - size, src_size[i]);
+
+			memcpy(dest + size, src[i], to_copy);
+			size += to_copy;
+		}
+		v4lconvert_time_stage(&data->stats.copy_ns, &start);
+		return v4lconvert_count_frame(data, size);
+	}
+
+	for (i = 0; i < num_planes; i++) {
+		if (src_size[i] <= 0) {
+			V4LCONVERT_ERR("short plane %d in data frame\n", i);
+			errno = EPIPE;
+			return v4lconvert_count_frame(data, -1);
+		}
+		size += src_size[i];
+	}
+
+	planes.y = src[0];
+	planes.y_stride = MAX(my_src_fmt.fmt.pix.bytesperline,
+			      my_src_fmt.fmt.pix.width);
+	switch (my_src_fmt.fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_NV12M:
+		planes.u = src[1];
+		planes.v = NULL;
+		planes.uv_stride = uv_stride ? uv_stride : planes.y_stride;
+		break;
+	case V4L2_PIX_FMT_YUV420M:
+	case V4L2_PIX_FMT_YVU420M:
+		planes.u = src[1];
+		planes.v = src[2];
+		if (my_src_fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_YVU420M) {
+			planes.u = src[2];
+			planes.v = src[1];
+		}
+		planes.uv_stride = uv_stride ? uv_stride : planes.y_stride / 2;
+		break;
+	}
+
+	return v4lconvert_count_frame(data, v4lconvert_convert_planes(data,
+			&my_src_fmt, &my_dest_fmt, &planes, src[0], size,
+			dest, dest_size));
+}
+
 const char *v4lconvert_get_error_message(struct v4lconvert_data *data)
 {
 	return data->error_msg;
@@ -1994,3 +2406,33 @@ void v4lconvert_set_fps(struct v4lconvert_data *data, int fps)
 {
 	data->fps = fps;
 }
+
+void v4lconvert_get_stats(struct v4lconvert_data *data,
+		struct v4lconvert_stats *stats)
+{
+	*stats = data->stats;
+}
+
+void v4lconvert_reset_stats(struct v4lconvert_data *data)
+{
+	memset(&data->stats, 0, sizeof(data->stats));
+}
+
+int v4lconvert_get_demosaic(struct v4lconvert_data *data)
+{
+	return data->demosaic;
+}
+
+int v4lconvert_set_demosaic(struct v4lconvert_data *data, int mode)
+{
+	switch (mode) {
+	case V4LCONVERT_DEMOSAIC_BILINEAR:
+	case V4LCONVERT_DEMOSAIC_EDGE_AWARE:
+		data->demosaic = mode;
+		return 0;
+	}
+
+	V4LCONVERT_ERR("invalid demosaic mode: %d\n", mode);
+	errno = EINVAL;
+	return -1;
+}
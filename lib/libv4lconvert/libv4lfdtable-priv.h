@@ -0,0 +1,90 @@
+/*
+
+# fd -> device lookup table for libv4l1 and libv4l2
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+#ifndef __LIBV4LFDTABLE_PRIV_H
+#define __LIBV4LFDTABLE_PRIV_H
+
+#include <stdlib.h>
+#include <string.h>
+
+/* fd -> device lookup table, used by libv4l1 and libv4l2 to find out if an
+   fd is one of theirs on every call they get, so this needs to be fast, also
+   for fds which are not ours.
+
+   This is a flat array indexed by the fd, so a lookup is a bounds check and
+   2 loads, without taking any locks. Changes are made with the library's open
+   mutex held. When the table needs to grow, a larger copy gets published and
+   the old one is left alone (never freed), so a lookup racing with the growth
+   never touches freed memory. As the kernel always hands out the lowest free
+   fd, the table stays small. */
+
+#define V4L_FD_TABLE_MIN_SIZE 64
+
+struct v4l_fd_table {
+	unsigned int size;
+	void *entries[];
+};
+
+static inline void *v4l_fd_table_get(struct v4l_fd_table **table, int fd)
+{
+	struct v4l_fd_table *t = __atomic_load_n(table, __ATOMIC_ACQUIRE);
+
+	if (fd < 0 || !t || (unsigned int)fd >= t->size)
+		return NULL;
+
+	return __atomic_load_n(&t->entries[fd], __ATOMIC_ACQUIRE);
+}
+
+/* Must be called with the open mutex held, returns -1 when out of memory */
+static inline int v4l_fd_table_set(struct v4l_fd_table **table, int fd,
+		void *entry)
+{
+	struct v4l_fd_table *t = *table, *new_t;
+	unsigned int size;
+
+	if (fd < 0)
+		return -1;
+
+	if (!t || (unsigned int)fd >= t->size) {
+		if (!entry)
+			return 0;
+
+		size = t ? t->size : V4L_FD_TABLE_MIN_SIZE;
+		while (size <= (unsigned int)fd)
+			size *= 2;
+
+		new_t = calloc(1, sizeof(*new_t) + size * sizeof(void *));
+		if (!new_t)
+			return -1;
+		if (t)
+			memcpy(new_t->entries, t->entries,
+			       t->size * sizeof(void *));
+		new_t->size = size;
+
+		__atomic_store_n(table, new_t, __ATOMIC_RELEASE);
+		t = new_t;
+	}
+
+	__atomic_store_n(&t->entries[fd], entry, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+#endif
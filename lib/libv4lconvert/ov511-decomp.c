@@ -18,6 +18,7 @@
 #include <string.h>
 #include <unistd.h>
 #include "helper-funcs.h"
+#include "helper-shm.h"
 
 /******************************************************************************
  * Decompression Functions
@@ -613,9 +614,11 @@ static int v4lconvert_ov511_to_yuv420(unsigned char *src, unsigned char *dest,
 
 int main(int argc, char *argv[])
 {
-	int width, height, yvu, src_size, dest_size;
+	int width, height, yvu, src_size, dest_size, shm = 0;
 	unsigned char src_buf[500000];
 	unsigned char dest_buf[500000];
+	unsigned char *src = src_buf, *dest = dest_buf;
+	size_t dest_max = sizeof(dest_buf);
 
 	while (1) {
 		if (v4lconvert_helper_read(STDIN_FILENO, &width, sizeof(int), argv[0]))
@@ -630,14 +633,31 @@ int main(int argc, char *argv[])
 		if (v4lconvert_helper_read(STDIN_FILENO, &src_size, sizeof(int), argv[0]))
 			return 1; /* Erm, no way to recover without loosing sync with libv4l */
 
-		if (src_size > sizeof(src_buf)) {
-			fprintf(stderr, "%s: error: src_buf too small, need: %d\n",
-					argv[0], src_size);
-			return 2;
+		if (width == 0 && height == 0 && src_size == 0 &&
+				yvu == V4LCONVERT_HELPER_SHM) {
+			/* libv4l wants to pass the data through shared memory */
+			shm = 1;
+			dest_size = V4LCONVERT_HELPER_SHM;
+			if (v4lconvert_helper_write(STDOUT_FILENO, &dest_size,
+						sizeof(int), argv[0]))
+				return 1;
+			continue;
 		}
 
-		if (v4lconvert_helper_read(STDIN_FILENO, src_buf, src_size, argv[0]))
-			return 1; /* Erm, no way to recover without loosing sync with libv4l */
+		if (shm) {
+			if (v4lconvert_helper_shm_map(src_size, &src, &dest,
+						&dest_max, argv[0]))
+				return 2;
+		} else {
+			if (src_size > sizeof(src_buf)) {
+				fprintf(stderr, "%s: error: src_buf too small, need: %d\n",
+						argv[0], src_size);
+				return 2;
+			}
+
+			if (v4lconvert_helper_read(STDIN_FILENO, src_buf, src_size, argv[0]))
+				return 1; /* Erm, no way to recover without loosing sync with libv4l */
+		}
 
 
 		dest_size = width * height * 3 / 2;
@@ -645,11 +665,11 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "%s: error: width or height out of bounds\n",
 					argv[0]);
 			dest_size = -1;
-		} else if (dest_size > sizeof(dest_buf)) {
+		} else if (dest_size > dest_max) {
 			fprintf(stderr, "%s: error: dest_buf too small, need: %d\n",
 					argv[0], dest_size);
 			dest_size = -1;
-		} else if (v4lconvert_ov511_to_yuv420(src_buf, dest_buf, width, height,
+		} else if (v4lconvert_ov511_to_yuv420(src, dest, width, height,
 					yvu, src_size))
 			dest_size = -1;
 
@@ -657,7 +677,7 @@ int main(int argc, char *argv[])
 					argv[0]))
 			return 1; /* Erm, no way to recover without loosing sync with libv4l */
 
-		if (dest_size == -1)
+		if (dest_size == -1 || shm)
 			continue;
 
 		if (v4lconvert_helper_write(STDOUT_FILENO, dest_buf, dest_size, argv[0]))
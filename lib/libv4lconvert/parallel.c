@@ -0,0 +1,614 @@
+/*
+
+# Worker pool for running conversion stages in parallel
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+/* Worker pool used to run the conversion stages which only need the source
+   lines around the lines they write (bayer demosaicing, packed yuv to rgb,
+   processing lookup tables and flipping) in horizontal bands in parallel */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "libv4lconvert-priv.h"
+
+#define V4LCONVERT_MAX_THREADS 64
+
+struct v4lconvert_pool {
+	pthread_t threads[V4LCONVERT_MAX_THREADS];
+	int no_threads; /* Worker threads, the calling thread helps too */
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	unsigned int generation;
+	int quit;
+	/* The job currently being run */
+	void (*func)(void *arg, int band, int first_row, int last_row);
+	void *arg;
+	int height;
+	int band_height;
+	int next_band;
+	int no_bands;
+	int bands_done;
+};
+
+/* Returns 1 if a band was run, 0 if there are no bands left. Must be
+   called with the pool lock held, returns with it held */
+static int v4lconvert_pool_run_band(struct v4lconvert_pool *pool)
+{
+	void (*func)(void *arg, int band, int first_row, int last_row) = pool->func;
+	void *arg = pool->arg;
+	int band, first_row, last_row;
+
+	if (pool->next_band >= pool->no_bands)
+		return 0;
+
+	band = pool->next_band++;
+	first_row = band * pool->band_height;
+	last_row = first_row + pool->band_height;
+	if (last_row > pool->height)
+		last_row = pool->height;
+
+	pthread_mutex_unlock(&pool->lock);
+	func(arg, band, first_row, last_row);
+	pthread_mutex_lock(&pool->lock);
+
+	pool->bands_done++;
+	if (pool->bands_done == pool->no_bands)
+		pthread_cond_signal(&pool->done_cond);
+
+	return 1;
+}
+
+static void *v4lconvert_pool_thread(void *arg)
+{
+	struct v4lconvert_pool *pool = arg;
+	unsigned int generation = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	while (1) {
+		while (!pool->quit && pool->generation == generation)
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+		if (pool->quit)
+			break;
+		generation = pool->generation;
+		while (v4lconvert_pool_run_band(pool))
+			;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+static void v4lconvert_pool_destroy(struct v4lconvert_pool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->no_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+static struct v4lconvert_pool *v4lconvert_pool_create(int no_threads)
+{
+	struct v4lconvert_pool *pool;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	for (; pool->no_threads < no_threads; pool->no_threads++) {
+		if (pthread_create(&pool->threads[pool->no_threads], NULL,
+				   v4lconvert_pool_thread, pool)) {
+			v4lconvert_pool_destroy(pool);
+			return NULL;
+		}
+	}
+
+	return pool;
+}
+
+static void v4lconvert_pool_run_bands(struct v4lconvert_pool *pool,
+		void (*func)(void *arg, int band, int first_row, int last_row),
+		void *arg, int height, int band_height)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->func = func;
+	pool->arg = arg;
+	pool->height = height;
+	pool->band_height = band_height;
+	pool->next_band = 0;
+	pool->no_bands = (height + band_height - 1) / band_height;
+	pool->bands_done = 0;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->work_cond);
+
+	while (v4lconvert_pool_run_band(pool))
+		;
+	while (pool->bands_done != pool->no_bands)
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void v4lconvert_pool_run(struct v4lconvert_data *data,
+		void (*func)(void *arg, int band, int first_row, int last_row),
+		void *arg, int height)
+{
+	struct v4lconvert_pool *pool = data->pool;
+	int band_height;
+
+	if (!pool || height < 4) {
+		func(arg, 0, 0, height);
+		return;
+	}
+
+	band_height = (height + pool->no_threads) / (pool->no_threads + 1);
+	band_height = (band_height + 1) & ~1;
+
+	v4lconvert_pool_run_bands(pool, func, arg, height, band_height);
+}
+
+void v4lconvert_pool_run_tasks(struct v4lconvert_data *data,
+		void (*func)(void *arg, int task, int first_row, int last_row),
+		void *arg, int no_tasks)
+{
+	int i;
+
+	if (!data->pool) {
+		for (i = 0; i < no_tasks; i++)
+			func(arg, i, i, i + 1);
+		return;
+	}
+
+	v4lconvert_pool_run_bands(data->pool, func, arg, no_tasks, 1);
+}
+
+static void v4lconvert_batch_cleanup(struct v4lconvert_data *data)
+{
+	int i;
+
+	if (!data->batch_workers)
+		return;
+
+	for (i = 0; i < v4lconvert_get_threads(data); i++)
+		v4lconvert_destroy_worker(data->batch_workers[i]);
+	free(data->batch_workers);
+	data->batch_workers = NULL;
+}
+
+int v4lconvert_set_threads(struct v4lconvert_data *data, int threads)
+{
+	if (threads < 0) {
+		V4LCONVERT_ERR("invalid number of threads: %d\n", threads);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		threads = cpus > 0 ? cpus : 1;
+	}
+	if (threads > V4LCONVERT_MAX_THREADS + 1)
+		threads = V4LCONVERT_MAX_THREADS + 1;
+
+	if (threads == v4lconvert_get_threads(data))
+		return 0;
+
+	v4lconvert_batch_cleanup(data);
+	if (data->pool) {
+		v4lconvert_pool_destroy(data->pool);
+		data->pool = NULL;
+	}
+
+	if (threads == 1)
+		return 0;
+
+	data->pool = v4lconvert_pool_create(threads - 1);
+	if (!data->pool) {
+		V4LCONVERT_ERR("creating conversion threads\n");
+		errno = ENOMEM;
+		return -1;
+	}
+
+	return 0;
+}
+
+int v4lconvert_get_threads(struct v4lconvert_data *data)
+{
+	return data->pool ? data->pool->no_threads + 1 : 1;
+}
+
+void v4lconvert_parallel_cleanup(struct v4lconvert_data *data)
+{
+	v4lconvert_batch_cleanup(data);
+	if (data->pool) {
+		v4lconvert_pool_destroy(data->pool);
+		data->pool = NULL;
+	}
+}
+
+/* The parallelized stages */
+
+struct v4lconvert_band_job {
+	struct v4lconvert_data *data;
+	unsigned char *src;
+	unsigned char *dest;
+	unsigned char *line_bufs; /* 3 lines per band, for 10 / 16 bit bayer */
+	const struct v4l2_format *fmt;
+	int width;
+	int height;
+	int stride;
+	unsigned int src_pix_fmt;
+	unsigned int dest_pix_fmt;
+	int hflip;
+	int vflip;
+	void (*packed_func)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+};
+
+static void v4lconvert_bayer_band(void *arg, int band, int first_row,
+		int last_row)
+{
+	struct v4lconvert_band_job *job = arg;
+	unsigned char *line_buf = NULL;
+
+	if (job->line_bufs)
+		line_buf = job->line_bufs + band * job->width * 3;
+
+	switch (job->dest_pix_fmt) {
+	case V4L2_PIX_FMT_RGB24:
+		v4lconvert_bayer_to_rgb24_rows(job->data, job->src,
+				job->dest + first_row * job->width * 3, job->width,
+				job->height, job->stride, job->src_pix_fmt,
+				line_buf, first_row, last_row);
+		break;
+	case V4L2_PIX_FMT_BGR24:
+		v4lconvert_bayer_to_bgr24_rows(job->data, job->src,
+				job->dest + first_row * job->width * 3, job->width,
+				job->height, job->stride, job->src_pix_fmt,
+				line_buf, first_row, last_row);
+		break;
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		v4lconvert_bayer_to_yuv420_rows(job->src, job->dest, job->width,
+				job->height, job->stride, job->src_pix_fmt,
+				job->dest_pix_fmt == V4L2_PIX_FMT_YVU420,
+				first_row, last_row);
+		break;
+	}
+}
+
+int v4lconvert_parallel_bayer(struct v4lconvert_data *data,
+		unsigned char *src, unsigned char *dest, int width, int height,
+		int stride, unsigned int src_pix_fmt, unsigned int dest_pix_fmt)
+{
+	struct v4lconvert_band_job job = {
+		.data = data,
+		.src = src,
+		.dest = dest,
+		.width = width,
+		.height = height,
+		.stride = stride,
+		.src_pix_fmt = src_pix_fmt,
+		.dest_pix_fmt = dest_pix_fmt,
+	};
+
+	/* 10 / 16 bit data gets narrowed to 8 bit a line at a time */
+	if (v4lconvert_bayer8_fmt(src_pix_fmt) != src_pix_fmt) {
+		job.line_bufs = v4lconvert_alloc_buffer(
+				v4lconvert_get_threads(data) * width * 3,
+				&data->bayer_buf, &data->bayer_buf_size);
+		if (!job.line_bufs)
+			return v4lconvert_oom_error(data);
+	}
+
+	v4lconvert_pool_run(data, v4lconvert_bayer_band, &job, height);
+
+	return 0;
+}
+
+static void v4lconvert_packed_band(void *arg, int band, int first_row,
+		int last_row)
+{
+	struct v4lconvert_band_job *job = arg;
+
+	job->packed_func(job->src + first_row * job->stride,
+			job->dest + first_row * job->width * 3,
+			job->width, last_row - first_row, job->stride);
+}
+
+void v4lconvert_parallel_packed(struct v4lconvert_data *data,
+		void (*func)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride),
+		unsigned char *src, unsigned char *dest, int width, int height,
+		int stride)
+{
+	struct v4lconvert_band_job job = {
+		.src = src,
+		.dest = dest,
+		.width = width,
+		.height = height,
+		.stride = stride,
+		.packed_func = func,
+	};
+
+	v4lconvert_pool_run(data, v4lconvert_packed_band, &job, height);
+}
+
+static void v4lconvert_processing_band(void *arg, int band, int first_row,
+		int last_row)
+{
+	struct v4lconvert_band_job *job = arg;
+
+	v4lprocessing_apply(job->data->processing, job->src, job->fmt,
+			first_row, last_row);
+}
+
+void v4lconvert_parallel_processing(struct v4lconvert_data *data,
+		unsigned char *buf, const struct v4l2_format *fmt)
+{
+	struct v4lconvert_band_job job = {
+		.data = data,
+		.src = buf,
+		.fmt = fmt,
+	};
+
+	/* batch workers have no processing */
+	if (!data->processing)
+		return;
+
+	if (v4lprocessing_prepare(data->processing, buf, fmt))
+		v4lconvert_pool_run(data, v4lconvert_processing_band, &job,
+				fmt->fmt.pix.height);
+}
+
+static void v4lconvert_flip_band(void *arg, int band, int first_row,
+		int last_row)
+{
+	struct v4lconvert_band_job *job = arg;
+
+	v4lconvert_flip_rows(job->src, job->dest, job->fmt, job->hflip,
+			job->vflip, first_row, last_row);
+}
+
+void v4lconvert_parallel_flip(struct v4lconvert_data *data,
+		unsigned char *src, unsigned char *dest, struct v4l2_format *fmt,
+		int hflip, int vflip)
+{
+	struct v4lconvert_band_job job = {
+		.src = src,
+		.dest = dest,
+		.fmt = fmt,
+		.hflip = hflip,
+		.vflip = vflip,
+	};
+
+	v4lconvert_pool_run(data, v4lconvert_flip_band, &job,
+			fmt->fmt.pix.height);
+
+	/* Our newly written data has no padding */
+	v4lconvert_fixup_fmt(fmt);
+}
+
+/* Batch conversion, the tasks are the per thread workers, which take the
+   next frame to convert until there are none left */
+
+struct v4lconvert_batch_error {
+	int frame; /* first frame the worker failed on, or -1 */
+	int error;
+	char msg[V4LCONVERT_ERROR_MSG_SIZE];
+};
+
+struct v4lconvert_batch_job {
+	struct v4lconvert_data *data;
+	const struct v4l2_format *src_fmt;
+	const struct v4l2_format *dest_fmt;
+	unsigned char **src;
+	const int *src_size;
+	unsigned char **dest;
+	int dest_size;
+	int *dest_result;
+	int count;
+	int next_frame;
+	struct v4lconvert_batch_error *errors; /* one per worker */
+};
+
+static void v4lconvert_batch_convert(struct v4lconvert_batch_job *job,
+		struct v4lconvert_data *data, struct v4lconvert_batch_error *error)
+{
+	int i;
+
+	error->frame = -1;
+	while ((i = __atomic_fetch_add(&job->next_frame, 1,
+				       __ATOMIC_RELAXED)) < job->count) {
+		job->dest_result[i] = v4lconvert_convert(data,
+				job->src_fmt, job->dest_fmt,
+				job->src[i], job->src_size[i],
+				job->dest[i], job->dest_size);
+		/* Frames are taken in order, so this is the worker's first */
+		if (job->dest_result[i] < 0 && error->frame == -1) {
+			error->frame = i;
+			error->error = errno;
+			memcpy(error->msg, data->error_msg, sizeof(error->msg));
+		}
+	}
+}
+
+static void v4lconvert_batch_task(void *arg, int task, int first_row,
+		int last_row)
+{
+	struct v4lconvert_batch_job *job = arg;
+
+	v4lconvert_batch_convert(job, job->data->batch_workers[task],
+				 &job->errors[task]);
+}
+
+/* Can the frames be converted independently of each other ? */
+static int v4lconvert_batch_parallel_ok(struct v4lconvert_data *data,
+		unsigned int src_pix_fmt)
+{
+	if (!data->pool || (data->processing &&
+			    v4lprocessing_pre_processing(data->processing)))
+		return 0;
+
+	switch (src_pix_fmt) {
+	/* These get decoded relative to the previous frame */
+	case V4L2_PIX_FMT_CPIA1:
+	case V4L2_PIX_FMT_MR97310A:
+	/* These use an external helper per device */
+	case V4L2_PIX_FMT_OV511:
+	case V4L2_PIX_FMT_OV518:
+		return 0;
+	}
+
+	return 1;
+}
+
+static int v4lconvert_batch_create_workers(struct v4lconvert_data *data)
+{
+	int i, threads = v4lconvert_get_threads(data);
+
+	if (data->batch_workers)
+		return 0;
+
+	data->batch_workers = calloc(threads, sizeof(*data->batch_workers));
+	if (!data->batch_workers)
+		return -1;
+
+	for (i = 0; i < threads; i++) {
+		data->batch_workers[i] = v4lconvert_create_worker(data);
+		if (!data->batch_workers[i]) {
+			v4lconvert_batch_cleanup(data);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void v4lconvert_add_stats(struct v4lconvert_stats *stats,
+		struct v4lconvert_stats *add)
+{
+	stats->frames += add->frames;
+	stats->errors += add->errors;
+	stats->short_frames += add->short_frames;
+	stats->convert_ns += add->convert_ns;
+	stats->processing_ns += add->processing_ns;
+	stats->transform_ns += add->transform_ns;
+	stats->copy_ns += add->copy_ns;
+	memset(add, 0, sizeof(*add));
+}
+
+int v4lconvert_convert_batch(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt, /* in */
+		unsigned char *src[], const int src_size[],
+		unsigned char *dest[], int dest_size, int dest_result[],
+		int count, struct v4lconvert_batch_stats *stats)
+{
+	struct v4lconvert_batch_job job = {
+		.data = data,
+		.src_fmt = src_fmt,
+		.dest_fmt = dest_fmt,
+		.src = src,
+		.src_size = src_size,
+		.dest = dest,
+		.dest_size = dest_size,
+		.dest_result = dest_result,
+		.count = count,
+	};
+	struct v4lconvert_batch_error error, *first = NULL;
+	int i, threads = 1, converted = 0;
+	uint64_t start = v4lconvert_ns();
+
+	if (count < 0 || (count && (!src || !src_size || !dest ||
+				    !dest_result))) {
+		V4LCONVERT_ERR("invalid batch arguments\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (v4lconvert_batch_parallel_ok(data,
+				src_fmt->fmt.pix.pixelformat) &&
+			count > 1 && v4lconvert_batch_create_workers(data) == 0)
+		threads = v4lconvert_get_threads(data);
+
+	if (threads > 1) {
+		job.errors = calloc(threads, sizeof(*job.errors));
+		if (!job.errors)
+			threads = 1;
+	}
+
+	if (threads > 1) {
+		v4lconvert_pool_run_tasks(data, v4lconvert_batch_task, &job,
+					  threads);
+		for (i = 0; i < threads; i++) {
+			v4lconvert_add_stats(&data->stats,
+					     &data->batch_workers[i]->stats);
+			if (job.errors[i].frame != -1 && (!first ||
+					job.errors[i].frame < first->frame))
+				first = &job.errors[i];
+		}
+	} else {
+		v4lconvert_batch_convert(&job, data, &error);
+		if (error.frame != -1)
+			first = &error;
+	}
+
+	if (stats)
+		memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < count; i++) {
+		if (dest_result[i] < 0)
+			continue;
+		converted++;
+		if (stats) {
+			stats->src_bytes += src_size[i];
+			stats->dest_bytes += dest_result[i];
+		}
+	}
+	if (stats) {
+		stats->frames = converted;
+		stats->errors = count - converted;
+		stats->elapsed_ns = v4lconvert_ns() - start;
+		stats->threads = threads;
+	}
+
+	if (first) {
+		memcpy(data->error_msg, first->msg, sizeof(data->error_msg));
+		errno = first->error;
+	}
+	free(job.errors);
+
+	return converted;
+}
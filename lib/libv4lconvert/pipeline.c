@@ -0,0 +1,298 @@
+/*
+
+# Fused single pass convert + flip + crop for rgb24 / bgr24 output
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+/* Instead of converting the whole frame into convert2_buf, flipping it into
+   flip_buf and then cropping it into dest, this converts one source line at
+   a time into a small line buffer and writes it flipped and cropped into
+   dest straight away, while it is still in the cache. The result is
+   identical to doing the separate steps (see flip.c and crop.c). */
+
+#include <errno.h>
+#include <string.h>
+#include "libv4lconvert-priv.h"
+
+enum v4lconvert_pipeline_crop {
+	V4LCONVERT_PIPELINE_CROP,
+	V4LCONVERT_PIPELINE_REDUCEANDCROP,
+	V4LCONVERT_PIPELINE_ADD_BORDER,
+};
+
+struct v4lconvert_pipeline {
+	struct v4lconvert_data *data;
+	const unsigned char *src;
+	unsigned char *dest;
+	unsigned char *line_bufs; /* 1 rgb + 3 bayer lines per band */
+	unsigned int src_pix_fmt;
+	unsigned int dest_pix_fmt;
+	int src_width, src_height, src_bpl;
+	int dest_width, dest_height;
+	int hflip, vflip;
+	enum v4lconvert_pipeline_crop crop;
+	int startx, starty, step; /* crop / reduceandcrop */
+	int borderx, bordery;     /* add_border */
+};
+
+static int v4lconvert_pipeline_src_ok(unsigned int src_pix_fmt,
+		unsigned int dest_pix_fmt)
+{
+	if (v4lconvert_bayer8_fmt(src_pix_fmt))
+		return 1;
+
+	switch (src_pix_fmt) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_UYVY:
+		return 1;
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		/* Only flip / crop, no conversion */
+		return src_pix_fmt == dest_pix_fmt;
+	}
+	return 0;
+}
+
+int v4lconvert_pipeline_supported(const struct v4l2_format *src_fmt,
+		const struct v4l2_format *dest_fmt, int processing)
+{
+	unsigned int src_pix_fmt = src_fmt->fmt.pix.pixelformat;
+	int sw = src_fmt->fmt.pix.width, sh = src_fmt->fmt.pix.height;
+	int dw = dest_fmt->fmt.pix.width, dh = dest_fmt->fmt.pix.height;
+
+	switch (dest_fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		break;
+	default:
+		return 0;
+	}
+
+	if (!v4lconvert_pipeline_src_ok(src_pix_fmt,
+				dest_fmt->fmt.pix.pixelformat))
+		return 0;
+
+	/* Processing works on whole frames, so we can only fuse the other steps
+	   if it can be done on the (8 bit bayer or rgb) source before converting */
+	if (processing && (src_pix_fmt == V4L2_PIX_FMT_YUYV ||
+			   src_pix_fmt == V4L2_PIX_FMT_YVYU ||
+			   src_pix_fmt == V4L2_PIX_FMT_UYVY ||
+			   v4lconvert_bayer8_fmt(src_pix_fmt) != src_pix_fmt))
+		return 0;
+
+	/* The packed yuv and bayer converters work on pixel pairs */
+	if ((sw & 1) || (sh & 1))
+		return 0;
+
+	/* We only support the cases v4lconvert_crop() handles sanely */
+	return (sw <= dw && sh <= dh) || (sw >= dw && sh >= dh);
+}
+
+/* Copy width pixels from src to dest, going step pixels through src for
+   each dest pixel, step may be negative */
+static void v4lconvert_pipeline_copy(const unsigned char *src,
+		unsigned char *dest, int width, int step)
+{
+	int x;
+
+	if (step == 1) {
+		memcpy(dest, src, width * 3);
+		return;
+	}
+
+	for (x = 0; x < width; x++) {
+		dest[0] = src[0];
+		dest[1] = src[1];
+		dest[2] = src[2];
+		dest += 3;
+		src += 3 * step;
+	}
+}
+
+/* Returns line "row" of the converted (but not yet flipped) frame */
+static const unsigned char *v4lconvert_pipeline_convert_line(
+		struct v4lconvert_pipeline *p, unsigned char *line_buf, int row)
+{
+	const struct v4lconvert_rgbyuv_ops *ops = p->data->rgbyuv;
+	const unsigned char *src = p->src + row * p->src_bpl;
+	int bgr = p->dest_pix_fmt == V4L2_PIX_FMT_BGR24;
+
+	if (v4lconvert_bayer8_fmt(p->src_pix_fmt)) {
+		unsigned char *bayer_buf = line_buf + p->src_width * 3;
+
+		if (bgr)
+			v4lconvert_bayer_to_bgr24_rows(p->data, p->src, line_buf,
+					p->src_width, p->src_height, p->src_bpl,
+					p->src_pix_fmt, bayer_buf, row, row + 1);
+		else
+			v4lconvert_bayer_to_rgb24_rows(p->data, p->src, line_buf,
+					p->src_width, p->src_height, p->src_bpl,
+					p->src_pix_fmt, bayer_buf, row, row + 1);
+		return line_buf;
+	}
+
+	switch (p->src_pix_fmt) {
+	case V4L2_PIX_FMT_YUYV:
+		(bgr ? ops->yuyv_to_bgr24 : ops->yuyv_to_rgb24)(src, line_buf,
+				p->src_width, 1, p->src_bpl);
+		return line_buf;
+	case V4L2_PIX_FMT_YVYU:
+		(bgr ? ops->yvyu_to_bgr24 : ops->yvyu_to_rgb24)(src, line_buf,
+				p->src_width, 1, p->src_bpl);
+		return line_buf;
+	case V4L2_PIX_FMT_UYVY:
+		(bgr ? ops->uyvy_to_bgr24 : ops->uyvy_to_rgb24)(src, line_buf,
+				p->src_width, 1, p->src_bpl);
+		return line_buf;
+	}
+
+	/* rgb24 / bgr24 source, nothing to convert */
+	return src;
+}
+
+static void v4lconvert_pipeline_band(void *arg, int band, int first_row,
+		int last_row)
+{
+	struct v4lconvert_pipeline *p = arg;
+	unsigned char *line_buf = p->line_bufs + band * p->src_width * 6;
+	int y, width = p->dest_width, x0 = p->startx;
+
+	if (p->crop == V4LCONVERT_PIPELINE_ADD_BORDER) {
+		width = p->src_width;
+		x0 = 0;
+	}
+
+	for (y = first_row; y < last_row; y++) {
+		unsigned char *dest = p->dest + y * p->dest_width * 3;
+		const unsigned char *line;
+		int row, step = p->step;
+
+		/* Find the line of the flipped frame we want */
+		if (p->crop == V4LCONVERT_PIPELINE_ADD_BORDER) {
+			row = y - p->bordery;
+			if (row < 0 || row >= p->src_height) {
+				memset(dest, 0, p->dest_width * 3);
+				continue;
+			}
+			memset(dest, 0, p->borderx * 3);
+			memset(dest + (p->borderx + width) * 3, 0,
+				(p->dest_width - p->borderx - width) * 3);
+			dest += p->borderx * 3;
+		} else
+			row = p->starty + y * step;
+
+		if (p->vflip)
+			row = p->src_height - 1 - row;
+
+		line = v4lconvert_pipeline_convert_line(p, line_buf, row);
+		if (p->hflip) {
+			line += (p->src_width - 1 - x0) * 3;
+			step = -step;
+		} else
+			line += x0 * 3;
+
+		v4lconvert_pipeline_copy(line, dest, width, step);
+	}
+}
+
+int v4lconvert_pipeline(struct v4lconvert_data *data,
+		unsigned char *src, int src_size, unsigned char *dest,
+		struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt,
+		int processing, int hflip, int vflip)
+{
+	struct v4lconvert_pipeline p = {
+		.data = data,
+		.src = src,
+		.dest = dest,
+		.src_pix_fmt = src_fmt->fmt.pix.pixelformat,
+		.dest_pix_fmt = dest_fmt->fmt.pix.pixelformat,
+		.src_width = src_fmt->fmt.pix.width,
+		.src_height = src_fmt->fmt.pix.height,
+		.src_bpl = src_fmt->fmt.pix.bytesperline,
+		.dest_width = dest_fmt->fmt.pix.width,
+		.dest_height = dest_fmt->fmt.pix.height,
+		.hflip = hflip,
+		.vflip = vflip,
+		.step = 1,
+	};
+	int needed, line_bufs_size;
+
+	switch (p.src_pix_fmt) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_UYVY:
+	case V4L2_PIX_FMT_SBGGR10:
+	case V4L2_PIX_FMT_SGBRG10:
+	case V4L2_PIX_FMT_SGRBG10:
+	case V4L2_PIX_FMT_SRGGB10:
+	case V4L2_PIX_FMT_SBGGR16:
+	case V4L2_PIX_FMT_SGBRG16:
+	case V4L2_PIX_FMT_SGRBG16:
+	case V4L2_PIX_FMT_SRGGB16:
+		needed = p.src_width * p.src_height * 2;
+		break;
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SRGGB10P:
+		needed = p.src_width * p.src_height * 10 / 8;
+		break;
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		needed = p.src_width * p.src_height * 3;
+		break;
+	default:
+		needed = p.src_width * p.src_height;
+	}
+	if (src_size < needed) {
+		V4LCONVERT_ERR("short raw data frame\n");
+		errno = EPIPE;
+		return -1;
+	}
+
+	line_bufs_size = v4lconvert_get_threads(data) * p.src_width * 6;
+	p.line_bufs = v4lconvert_alloc_buffer(line_bufs_size,
+			&data->pipeline_buf, &data->pipeline_buf_size);
+	if (!p.line_bufs)
+		return v4lconvert_oom_error(data);
+
+	/* Same choices and offsets as v4lconvert_crop() */
+	if (p.src_width <= p.dest_width && p.src_height <= p.dest_height) {
+		p.crop = V4LCONVERT_PIPELINE_ADD_BORDER;
+		p.borderx = (p.dest_width - p.src_width) / 2;
+		p.bordery = (p.dest_height - p.src_height) / 2;
+	} else if (p.src_width >= 2 * p.dest_width &&
+			p.src_height >= 2 * p.dest_height) {
+		p.crop = V4LCONVERT_PIPELINE_REDUCEANDCROP;
+		p.startx = p.src_width / 2 - p.dest_width;
+		p.starty = p.src_height / 2 - p.dest_height;
+		p.step = 2;
+	} else {
+		p.crop = V4LCONVERT_PIPELINE_CROP;
+		p.startx = (p.src_width - p.dest_width) / 2;
+		p.starty = (p.src_height - p.dest_height) / 2;
+	}
+
+	/* Processing on bayer / rgb data gets done in place on the source */
+	if (processing)
+		v4lconvert_parallel_processing(data, src, src_fmt);
+
+	v4lconvert_pool_run(data, v4lconvert_pipeline_band, &p, p.dest_height);
+
+	return 0;
+}
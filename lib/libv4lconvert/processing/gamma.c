@@ -58,5 +58,5 @@ static int gamma_calculate_lookup_tables(
 }
 
 struct v4lprocessing_filter gamma_filter = {
-	gamma_active, gamma_calculate_lookup_tables
+	gamma_active, gamma_calculate_lookup_tables, 0
 };
@@ -21,10 +21,41 @@
 #ifndef __LIBV4LPROCESSING_PRIV_H
 #define __LIBV4LPROCESSING_PRIV_H
 
+#include <pthread.h>
 #include "../control/libv4lcontrol.h"
 #include "../libv4lsyscall-priv.h"
 
-#define V4L2PROCESSING_UPDATE_RATE 10
+/* Default time between lookup table updates in ms (10 frames at 30 fps),
+   can be overridden with the LIBV4LPROCESSING_UPDATE_INTERVAL env var */
+#define V4L2PROCESSING_UPDATE_INTERVAL 333
+/* Default number of 2x2 bayer blocks / rgb pixels to sample for the frame
+   statistics, can be overridden with the LIBV4LPROCESSING_STATS_SAMPLES
+   env var */
+#define V4L2PROCESSING_STATS_SAMPLES 16384
+/* The env var gets clamped to 1 - this */
+#define V4L2PROCESSING_STATS_MAX_SAMPLES 16384
+
+/* Frame statistics for the filters. These get gathered from a sparse grid
+   of 2x2 bayer blocks / rgb pixels (every step-th one in both directions)
+   while applying the lookup tables to the frame before a lookup table
+   update, so that the frame only gets read once and the cost does not
+   depend on the resolution, see v4lprocessing_get_stats() */
+struct v4lprocessing_stats {
+	int valid;
+	unsigned int pixelformat;
+	int width;
+	int height;
+	int step;
+	/* Number of sampled 2x2 bayer blocks / rgb pixels */
+	unsigned int count;
+	/* Sum of the samples at the 4 positions of a 2x2 bayer block (even line
+	   even / odd column, odd line even / odd column), or of the 3 rgb / bgr
+	   components */
+	unsigned long long sum[4];
+	/* Sum and number of the samples of the center 1/2 x 1/2 of the frame */
+	unsigned long long center;
+	unsigned int center_count;
+};
 
 struct v4lprocessing_data {
 	struct v4lcontrol_data *control;
@@ -34,9 +65,21 @@ struct v4lprocessing_data {
 	/* True if any of the lookup tables does not contain
 	   linear 0-255 */
 	int lookup_table_active;
-	/* Counts the number of processed frames until a
-	   V4L2PROCESSING_UPDATE_RATE overflow happens */
-	int lookup_table_update_counter;
+	/* Lookup table updates happen update_interval ms apart, unless a filter
+	   asks for an update after a number of frames by setting
+	   lookup_table_update_countdown, 1 means the next frame */
+	int update_interval;
+	long long last_update;
+	int lookup_table_update_countdown;
+	/* True if the lookup tables must be updated for the next frame */
+	int update_pending;
+	int stats_samples;
+	/* True if any of the active filters uses frame statistics */
+	int stats_wanted;
+	/* True if the current frame's statistics must be gathered */
+	int gather_stats;
+	struct v4lprocessing_stats stats;
+	pthread_mutex_t stats_lock;
 	/* RGB/BGR lookup tables */
 	unsigned char comp1[256];
 	unsigned char green[256];
@@ -59,8 +102,17 @@ struct v4lprocessing_filter {
 	/* Returns 1 if any of the lookup tables was changed */
 	int (*calculate_lookup_tables)(struct v4lprocessing_data *data,
 			unsigned char *buf, const struct v4l2_format *fmt);
+	/* True if calculate_lookup_tables uses v4lprocessing_get_stats() */
+	int needs_stats;
 };
 
+/* Returns the statistics for the frame in buf. These normally got gathered
+   while processing the previous frame, if not (first frame, format change,
+   controls changed) they get gathered from buf now */
+const struct v4lprocessing_stats *v4lprocessing_get_stats(
+		struct v4lprocessing_data *data, unsigned char *buf,
+		const struct v4l2_format *fmt);
+
 extern struct v4lprocessing_filter whitebalance_filter;
 extern struct v4lprocessing_filter autogain_filter;
 extern struct v4lprocessing_filter gamma_filter;
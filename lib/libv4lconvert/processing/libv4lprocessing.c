@@ -19,13 +19,16 @@
  */
 
 #include <errno.h>
+#include <limits.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 #include "libv4lprocessing.h"
 #include "libv4lprocessing-priv.h"
 #include "../libv4lconvert-priv.h" /* for PIX_FMT defines */
+#include "../libv4lconvert-simd.h"
 
 static struct v4lprocessing_filter *filters[] = {
 	&whitebalance_filter,
@@ -37,6 +40,8 @@ struct v4lprocessing_data *v4lprocessing_create(int fd, struct v4lcontrol_data *
 {
 	struct v4lprocessing_data *data =
 		calloc(1, sizeof(struct v4lprocessing_data));
+	char *s, *end;
+	long val;
 
 	if (!data) {
 		fprintf(stderr, "libv4lprocessing: error: out of memory!\n");
@@ -45,12 +50,36 @@ struct v4lprocessing_data *v4lprocessing_create(int fd, struct v4lcontrol_data *
 
 	data->fd = fd;
 	data->control = control;
+	pthread_mutex_init(&data->stats_lock, NULL);
+
+	/* Ignore negative or garbage env values */
+	data->update_interval = V4L2PROCESSING_UPDATE_INTERVAL;
+	s = getenv("LIBV4LPROCESSING_UPDATE_INTERVAL");
+	if (s) {
+		val = strtol(s, &end, 0);
+		if (end != s && *end == '\0' && val >= 0 && val <= INT_MAX)
+			data->update_interval = val;
+	}
+
+	data->stats_samples = V4L2PROCESSING_STATS_SAMPLES;
+	s = getenv("LIBV4LPROCESSING_STATS_SAMPLES");
+	if (s) {
+		val = strtol(s, &end, 0);
+		if (end != s && *end == '\0') {
+			if (val < 1)
+				val = 1;
+			if (val > V4L2PROCESSING_STATS_MAX_SAMPLES)
+				val = V4L2PROCESSING_STATS_MAX_SAMPLES;
+			data->stats_samples = val;
+		}
+	}
 
 	return data;
 }
 
 void v4lprocessing_destroy(struct v4lprocessing_data *data)
 {
+	pthread_mutex_destroy(&data->stats_lock);
 	free(data);
 }
 
@@ -81,82 +110,309 @@ static void v4lprocessing_update_lookup_tables(struct v4lprocessing_data *data,
 	}
 
 	data->lookup_table_active = 0;
+	data->stats_wanted = 0;
 	for (i = 0; i < ARRAY_SIZE(filters); i++) {
 		if (filters[i]->active(data)) {
 			if (filters[i]->calculate_lookup_tables(data, buf, fmt))
 				data->lookup_table_active = 1;
+			if (filters[i]->needs_stats)
+				data->stats_wanted = 1;
 		}
 	}
 }
 
-static void v4lprocessing_do_processing(struct v4lprocessing_data *data,
-		unsigned char *buf, const struct v4l2_format *fmt)
+#ifdef HAVE_SIMD_NEON
+
+/* 256 byte table lookup of 16 samples, vqtbx leaves lanes with an out of
+   range index alone, so we can chain 4 lookups of 64 bytes each */
+static inline uint8x16_t neon_lut(const uint8x16x4_t t[4], uint8x16_t x)
 {
-	int x, y;
+	const uint8x16_t q = vdupq_n_u8(64);
+	uint8x16_t r = vqtbl4q_u8(t[0], x);
 
-	switch (fmt->fmt.pix.pixelformat) {
-	case V4L2_PIX_FMT_SGBRG8:
-	case V4L2_PIX_FMT_SGRBG8: /* Bayer patterns starting with green */
-		for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				*buf = data->green[*buf];
-				buf++;
-				*buf = data->comp1[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				*buf = data->comp2[*buf];
-				buf++;
-				*buf = data->green[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
+	x = vsubq_u8(x, q);
+	r = vqtbx4q_u8(r, t[1], x);
+	x = vsubq_u8(x, q);
+	r = vqtbx4q_u8(r, t[2], x);
+	x = vsubq_u8(x, q);
+	return vqtbx4q_u8(r, t[3], x);
+}
+
+static inline void neon_load_lut(uint8x16x4_t t[4], const unsigned char *lut)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		t[i] = vld1q_u8_x4(lut + 64 * i);
+}
+
+/* The NEON versions do 1 component per pass, so that only 1 table needs to
+   be kept in registers, the line is in the cache after the first pass */
+static int neon_bayer_line(unsigned char *p, int pairs,
+		const unsigned char *even, const unsigned char *odd)
+{
+	const unsigned char *luts[2] = { even, odd };
+	uint8x16x4_t t[4];
+	int c, x, done = pairs & ~15;
+
+	for (c = 0; c < 2; c++) {
+		neon_load_lut(t, luts[c]);
+		for (x = 0; x < done; x += 16) {
+			uint8x16x2_t v = vld2q_u8(p + 2 * x);
+
+			v.val[c] = neon_lut(t, v.val[c]);
+			vst2q_u8(p + 2 * x, v);
 		}
-		break;
+	}
 
-	case V4L2_PIX_FMT_SBGGR8:
-	case V4L2_PIX_FMT_SRGGB8: /* Bayer patterns *NOT* starting with green */
-		for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				*buf = data->comp1[*buf];
-				buf++;
-				*buf = data->green[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				*buf = data->green[*buf];
-				buf++;
-				*buf = data->comp2[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
+	return done;
+}
+
+static int neon_rgb_line(unsigned char *p, int width,
+		const unsigned char *comp1, const unsigned char *green,
+		const unsigned char *comp2)
+{
+	const unsigned char *luts[3] = { comp1, green, comp2 };
+	uint8x16x4_t t[4];
+	int c, x, done = width & ~15;
+
+	for (c = 0; c < 3; c++) {
+		neon_load_lut(t, luts[c]);
+		for (x = 0; x < done; x += 16) {
+			uint8x16x3_t v = vld3q_u8(p + 3 * x);
+
+			v.val[c] = neon_lut(t, v.val[c]);
+			vst3q_u8(p + 3 * x, v);
 		}
-		break;
+	}
+
+	return done;
+}
+
+#endif /* HAVE_SIMD_NEON */
+
+/* Apply the even / odd lookup tables to 1 line of bayer data */
+static void v4lprocessing_bayer_line(unsigned char *p, int pairs,
+		const unsigned char *even, const unsigned char *odd)
+{
+	int x = 0;
+
+#ifdef HAVE_SIMD_NEON
+	x = neon_bayer_line(p, pairs, even, odd);
+#endif
+	for (p += 2 * x; x < pairs; x++) {
+		p[0] = even[p[0]];
+		p[1] = odd[p[1]];
+		p += 2;
+	}
+}
+
+/* Same for 1 line of rgb / bgr data */
+static void v4lprocessing_rgb_line(unsigned char *p, int width,
+		const unsigned char *comp1, const unsigned char *green,
+		const unsigned char *comp2)
+{
+	int x = 0;
+
+#ifdef HAVE_SIMD_NEON
+	x = neon_rgb_line(p, width, comp1, green, comp2);
+#endif
+	for (p += 3 * x; x < width; x++) {
+		p[0] = comp1[p[0]];
+		p[1] = green[p[1]];
+		p[2] = comp2[p[2]];
+		p += 3;
+	}
+}
+
+/* Add the samples of 1 line of the stats grid to stats. A unit is a 2x2
+   bayer block (unit_size 2, 2 lines per unit line) or an rgb pixel
+   (unit_size 3), p points to the start of the line and y is the line's
+   number within the unit line. Note stats are gathered per band, so this
+   must not look at other lines. */
+static void v4lprocessing_sample_line(struct v4lprocessing_stats *stats,
+		const unsigned char *p, const struct v4l2_format *fmt,
+		int unit_size, int unit_y, int y)
+{
+	int units_per_line = unit_size == 2 ? fmt->fmt.pix.width / 2 :
+		fmt->fmt.pix.width;
+	int unit_lines = unit_size == 2 ? fmt->fmt.pix.height / 2 :
+		fmt->fmt.pix.height;
+	int step = stats->step, n = 0, x, i;
+	unsigned int s[3] = { 0, 0, 0 };
+	int left, right;
+
+	for (x = 0; x < units_per_line; x += step) {
+		for (i = 0; i < unit_size; i++)
+			s[i] += p[x * unit_size + i];
+		n++;
+	}
+
+	if (unit_size == 2) {
+		stats->sum[2 * y] += s[0];
+		stats->sum[2 * y + 1] += s[1];
+	} else {
+		stats->sum[0] += s[0];
+		stats->sum[1] += s[1];
+		stats->sum[2] += s[2];
+	}
+	if (y == 0)
+		stats->count += n;
+
+	/* Is this line in the center 1/2 x 1/2 ? */
+	if (unit_y < unit_lines / 4 || unit_y >= unit_lines / 4 + unit_lines / 2)
+		return;
+
+	left = units_per_line / 4;
+	right = left + units_per_line / 2;
+	left = (left + step - 1) / step * step;
+	for (x = left; x < right; x += step) {
+		for (i = 0; i < unit_size; i++)
+			stats->center += p[x * unit_size + i];
+		stats->center_count += unit_size;
+	}
+}
+
+/* Apply the lookup tables to (if lut) and / or gather stats from (if stats)
+   lines first_row - (last_row - 1). The stats get gathered a line at a time
+   right before applying the tables to it, while it is in the cache. */
+static void v4lprocessing_process_rows(struct v4lprocessing_data *data,
+		unsigned char *buf, const struct v4l2_format *fmt,
+		int first_row, int last_row, int lut,
+		struct v4lprocessing_stats *stats)
+{
+	int y, bayer, starts_with_green = 0;
 
+	switch (fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_SGBRG8:
+	case V4L2_PIX_FMT_SGRBG8:
+		starts_with_green = 1;
+		/* fall through */
+	case V4L2_PIX_FMT_SBGGR8:
+	case V4L2_PIX_FMT_SRGGB8:
+		bayer = 1;
+		break;
 	case V4L2_PIX_FMT_RGB24:
 	case V4L2_PIX_FMT_BGR24:
-		for (y = 0; y < fmt->fmt.pix.height; y++) {
-			for (x = 0; x < fmt->fmt.pix.width; x++) {
-				*buf = data->comp1[*buf];
-				buf++;
-				*buf = data->green[*buf];
-				buf++;
-				*buf = data->comp2[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - 3 * fmt->fmt.pix.width;
-		}
+		bayer = 0;
 		break;
+	default:
+		return;
+	}
+
+	for (y = first_row; y < last_row; y++) {
+		unsigned char *p = buf + y * fmt->fmt.pix.bytesperline;
+		const unsigned char *even, *odd;
+
+		if (stats) {
+			int unit_y = bayer ? y / 2 : y;
+
+			if (unit_y % stats->step == 0)
+				v4lprocessing_sample_line(stats, p, fmt,
+						bayer ? 2 : 3, unit_y,
+						bayer ? (y & 1) : 0);
+		}
+
+		if (!lut)
+			continue;
+
+		if (!bayer) {
+			v4lprocessing_rgb_line(p, fmt->fmt.pix.width,
+					data->comp1, data->green, data->comp2);
+			continue;
+		}
+
+		if (starts_with_green) {
+			even = (y & 1) ? data->comp2 : data->green;
+			odd  = (y & 1) ? data->green : data->comp1;
+		} else {
+			even = (y & 1) ? data->green : data->comp1;
+			odd  = (y & 1) ? data->comp2 : data->green;
+		}
+		v4lprocessing_bayer_line(p, fmt->fmt.pix.width / 2, even, odd);
 	}
 }
 
-void v4lprocessing_processing(struct v4lprocessing_data *data,
+void v4lprocessing_apply(struct v4lprocessing_data *data,
+		unsigned char *buf, const struct v4l2_format *fmt,
+		int first_row, int last_row)
+{
+	struct v4lprocessing_stats stats;
+	int i;
+
+	if (!data->gather_stats) {
+		v4lprocessing_process_rows(data, buf, fmt, first_row, last_row,
+				1, NULL);
+		return;
+	}
+
+	memset(&stats, 0, sizeof(stats));
+	stats.step = data->stats.step;
+	v4lprocessing_process_rows(data, buf, fmt, first_row, last_row,
+			data->lookup_table_active, &stats);
+
+	/* We may be 1 of multiple bands being processed in parallel */
+	pthread_mutex_lock(&data->stats_lock);
+	for (i = 0; i < 4; i++)
+		data->stats.sum[i] += stats.sum[i];
+	data->stats.count += stats.count;
+	data->stats.center += stats.center;
+	data->stats.center_count += stats.center_count;
+	pthread_mutex_unlock(&data->stats_lock);
+}
+
+static void v4lprocessing_reset_stats(struct v4lprocessing_data *data,
+		const struct v4l2_format *fmt)
+{
+	unsigned int units = fmt->fmt.pix.width * fmt->fmt.pix.height;
+	int step = 1;
+
+	memset(&data->stats, 0, sizeof(data->stats));
+	data->stats.valid = 1;
+	data->stats.pixelformat = fmt->fmt.pix.pixelformat;
+	data->stats.width = fmt->fmt.pix.width;
+	data->stats.height = fmt->fmt.pix.height;
+
+	/* Pick the smallest grid step giving at most stats_samples samples */
+	if (fmt->fmt.pix.pixelformat != V4L2_PIX_FMT_RGB24 &&
+			fmt->fmt.pix.pixelformat != V4L2_PIX_FMT_BGR24)
+		units /= 4;
+	while (units / (step * step) > data->stats_samples)
+		step++;
+	data->stats.step = step;
+}
+
+const struct v4lprocessing_stats *v4lprocessing_get_stats(
+		struct v4lprocessing_data *data, unsigned char *buf,
+		const struct v4l2_format *fmt)
+{
+	if (!data->stats.valid ||
+			data->stats.pixelformat != fmt->fmt.pix.pixelformat ||
+			data->stats.width != fmt->fmt.pix.width ||
+			data->stats.height != fmt->fmt.pix.height) {
+		v4lprocessing_reset_stats(data, fmt);
+		v4lprocessing_process_rows(data, buf, fmt, 0,
+				fmt->fmt.pix.height, 0, &data->stats);
+	}
+
+	return &data->stats;
+}
+
+static long long v4lprocessing_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+int v4lprocessing_prepare(struct v4lprocessing_data *data,
 		unsigned char *buf, const struct v4l2_format *fmt)
 {
+	long long now;
+
 	if (!data->do_process)
-		return;
+		return 0;
 
 	/* Do we support the current pixformat? */
 	switch (fmt->fmt.pix.pixelformat) {
@@ -168,21 +424,43 @@ void v4lprocessing_processing(struct v4lprocessing_data *data,
 	case V4L2_PIX_FMT_BGR24:
 		break;
 	default:
-		return; /* Non supported pix format */
+		return 0; /* Non supported pix format */
 	}
 
-	if (data->controls_changed ||
-			data->lookup_table_update_counter == V4L2PROCESSING_UPDATE_RATE) {
+	now = v4lprocessing_now();
+	if (data->controls_changed || data->update_pending) {
 		data->controls_changed = 0;
-		data->lookup_table_update_counter = 0;
-		/* Do this after resetting lookup_table_update_counter so that filters can
-		   force the next update to be sooner when they changed camera settings */
+		data->update_pending = 0;
+		data->lookup_table_update_countdown = 0;
+		data->last_update = now;
+		/* Do this after resetting lookup_table_update_countdown so that
+		   filters can force the next update to be sooner when they changed
+		   camera settings */
 		v4lprocessing_update_lookup_tables(data, buf, fmt);
-	} else
-		data->lookup_table_update_counter++;
+		/* Used up, the next update needs fresh ones */
+		data->stats.valid = 0;
+	}
+
+	/* Is the next frame due for an update? Then gather the stats for it
+	   while processing this frame */
+	if (data->lookup_table_update_countdown) {
+		if (--data->lookup_table_update_countdown == 0)
+			data->update_pending = 1;
+	} else if (now - data->last_update >= data->update_interval)
+		data->update_pending = 1;
 
-	if (data->lookup_table_active)
-		v4lprocessing_do_processing(data, buf, fmt);
+	data->gather_stats = data->stats_wanted && data->update_pending;
+	if (data->gather_stats)
+		v4lprocessing_reset_stats(data, fmt);
 
 	data->do_process = 0;
+
+	return data->lookup_table_active || data->gather_stats;
+}
+
+void v4lprocessing_processing(struct v4lprocessing_data *data,
+		unsigned char *buf, const struct v4l2_format *fmt)
+{
+	if (v4lprocessing_prepare(data, buf, fmt))
+		v4lprocessing_apply(data, buf, fmt, 0, fmt->fmt.pix.height);
 }
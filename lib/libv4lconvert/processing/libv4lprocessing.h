@@ -44,4 +44,14 @@ int v4lprocessing_pre_processing(struct v4lprocessing_data *data);
 void v4lprocessing_processing(struct v4lprocessing_data *data,
   unsigned char *buf, const struct v4l2_format *fmt);
 
+/* v4lprocessing_processing() split in 2 steps, so that the frame can be
+   processed in multiple bands in parallel. v4lprocessing_prepare() updates
+   the lookup tables and returns 1 if v4lprocessing_apply() must be called
+   to apply them. For bayer formats first_row must be even. */
+int v4lprocessing_prepare(struct v4lprocessing_data *data,
+  unsigned char *buf, const struct v4l2_format *fmt);
+void v4lprocessing_apply(struct v4lprocessing_data *data,
+  unsigned char *buf, const struct v4l2_format *fmt,
+  int first_row, int last_row);
+
 #endif
@@ -99,9 +99,8 @@ static int whitebalance_calculate_lookup_tables_generic(
 		 * update cycle, as asking for an update each frame while
 		 * some other pluging is trying to adjust hw settings is bad.
 		 */
-		if (throttling && data->lookup_table_update_counter == 0)
-			data->lookup_table_update_counter =
-						V4L2PROCESSING_UPDATE_RATE;
+		if (throttling && data->lookup_table_update_countdown == 0)
+			data->lookup_table_update_countdown = 1;
 	}
 
 	if (abs(data->green_avg - data->comp1_avg) < threshold &&
@@ -124,37 +123,31 @@ static int whitebalance_calculate_lookup_tables_bayer(
 		struct v4lprocessing_data *data, unsigned char *buf,
 		const struct v4l2_format *fmt, int starts_with_green)
 {
-	int x, y, a1 = 0, a2 = 0, b1 = 0, b2 = 0;
+	const struct v4lprocessing_stats *stats;
+	unsigned long long a1, a2, b1, b2, norm;
 	int green_avg, comp1_avg, comp2_avg;
 
-	for (y = 0; y < fmt->fmt.pix.height; y += 2) {
-		for (x = 0; x < fmt->fmt.pix.width; x += 2) {
-			a1 += *buf++;
-			a2 += *buf++;
-		}
-		buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-		for (x = 0; x < fmt->fmt.pix.width; x += 2) {
-			b1 += *buf++;
-			b2 += *buf++;
-		}
-		buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-	}
+	stats = v4lprocessing_get_stats(data, buf, fmt);
+	if (!stats->count)
+		return 0;
+
+	/* Norm avg to ~ 0 - 4095 */
+	a1 = stats->sum[0] * 16;
+	a2 = stats->sum[1] * 16;
+	b1 = stats->sum[2] * 16;
+	b2 = stats->sum[3] * 16;
+	norm = stats->count;
 
 	if (starts_with_green) {
-		green_avg = a1 / 2 + b2 / 2;
-		comp1_avg = a2;
-		comp2_avg = b1;
+		green_avg = (a1 / 2 + b2 / 2) / norm;
+		comp1_avg = a2 / norm;
+		comp2_avg = b1 / norm;
 	} else {
-		green_avg = a2 / 2 + b1 / 2;
-		comp1_avg = a1;
-		comp2_avg = b2;
+		green_avg = (a2 / 2 + b1 / 2) / norm;
+		comp1_avg = a1 / norm;
+		comp2_avg = b2 / norm;
 	}
 
-	/* Norm avg to ~ 0 - 4095 */
-	green_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 64;
-	comp1_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 64;
-	comp2_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 64;
-
 	return whitebalance_calculate_lookup_tables_generic(data, green_avg,
 			comp1_avg, comp2_avg);
 }
@@ -163,21 +156,19 @@ static int whitebalance_calculate_lookup_tables_rgb(
 		struct v4lprocessing_data *data, unsigned char *buf,
 		const struct v4l2_format *fmt)
 {
-	int x, y, green_avg = 0, comp1_avg = 0, comp2_avg = 0;
-
-	for (y = 0; y < fmt->fmt.pix.height; y++) {
-		for (x = 0; x < fmt->fmt.pix.width; x++) {
-			comp1_avg += *buf++;
-			green_avg += *buf++;
-			comp2_avg += *buf++;
-		}
-		buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width * 3;
-	}
+	const struct v4lprocessing_stats *stats;
+	unsigned long long norm;
+	int green_avg, comp1_avg, comp2_avg;
+
+	stats = v4lprocessing_get_stats(data, buf, fmt);
+	if (!stats->count)
+		return 0;
 
 	/* Norm avg to ~ 0 - 4095 */
-	green_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 16;
-	comp1_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 16;
-	comp2_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 16;
+	norm = stats->count;
+	comp1_avg = stats->sum[0] * 16 / norm;
+	green_avg = stats->sum[1] * 16 / norm;
+	comp2_avg = stats->sum[2] * 16 / norm;
 
 	return whitebalance_calculate_lookup_tables_generic(data, green_avg,
 			comp1_avg, comp2_avg);
@@ -206,5 +197,5 @@ static int whitebalance_calculate_lookup_tables(
 }
 
 struct v4lprocessing_filter whitebalance_filter = {
-	whitebalance_active, whitebalance_calculate_lookup_tables
+	whitebalance_active, whitebalance_calculate_lookup_tables, 1
 };
@@ -0,0 +1,796 @@
+/*
+
+# SIMD (SSE2 / AVX2 / NEON) versions of the rgbyuv.c YUV converters
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+/*
+ * All code in here must produce exactly the same output as the plain C
+ * versions in rgbyuv.c, the only difference is that 16 pixels get converted
+ * per iteration. The fixed point math of the "fast multiplication free" code
+ * fits in 16 bits, so it maps 1:1 onto signed 16 bit vector lanes, and the
+ * saturating pack instructions do the CLIP() for us. The more accurate
+ * YUV2R / YUV2G / YUV2B code used for NV12 needs 32 bit intermediates.
+ *
+ * Width tails (width % 16) are done with the scalar pixel helpers below,
+ * odd widths are simply handed to the C versions.
+ */
+
+#include "libv4lconvert-priv.h"
+#include "libv4lconvert-simd.h"
+
+static const struct v4lconvert_rgbyuv_ops rgbyuv_c_ops = {
+	.yuv420_to_rgb24 = v4lconvert_yuv420_to_rgb24,
+	.yuv420_to_bgr24 = v4lconvert_yuv420_to_bgr24,
+	.yuyv_to_rgb24 = v4lconvert_yuyv_to_rgb24,
+	.yuyv_to_bgr24 = v4lconvert_yuyv_to_bgr24,
+	.yuyv_to_yuv420 = v4lconvert_yuyv_to_yuv420,
+	.yvyu_to_rgb24 = v4lconvert_yvyu_to_rgb24,
+	.yvyu_to_bgr24 = v4lconvert_yvyu_to_bgr24,
+	.uyvy_to_rgb24 = v4lconvert_uyvy_to_rgb24,
+	.uyvy_to_bgr24 = v4lconvert_uyvy_to_bgr24,
+	.uyvy_to_yuv420 = v4lconvert_uyvy_to_yuv420,
+	.nv12_to_rgb24 = v4lconvert_nv12_to_rgb24,
+};
+
+#if defined(HAVE_SIMD_X86) || defined(HAVE_SIMD_NEON)
+
+#define CLIP(color) (unsigned char)(((color) > 0xFF) ? 0xff : (((color) < 0) ? 0 : (color)))
+
+/* Byte offsets of the Y0 / U / Y1 / V components within a packed 4:2:2 pair */
+enum packed_layout {
+	LAYOUT_YUYV,
+	LAYOUT_YVYU,
+	LAYOUT_UYVY,
+};
+
+static const int packed_offsets[3][4] = {
+	[LAYOUT_YUYV] = { 0, 1, 2, 3 },
+	[LAYOUT_YVYU] = { 0, 3, 2, 1 },
+	[LAYOUT_UYVY] = { 1, 0, 3, 2 },
+};
+
+/* Scalar version of the fast multiplication free code, for the tails */
+static inline void fast_pixel_pair(int y0, int y1, int u, int v,
+		unsigned char *dest, int bgr)
+{
+	int u1 = (((u - 128) << 7) +  (u - 128)) >> 6;
+	int rg = (((u - 128) << 1) +  (u - 128) +
+			((v - 128) << 2) + ((v - 128) << 1)) >> 3;
+	int v1 = (((v - 128) << 1) +  (v - 128)) >> 1;
+	int r_off = bgr ? 2 : 0;
+
+	dest[r_off] = CLIP(y0 + v1);
+	dest[1] = CLIP(y0 - rg);
+	dest[2 - r_off] = CLIP(y0 + u1);
+	dest[3 + r_off] = CLIP(y1 + v1);
+	dest[4] = CLIP(y1 - rg);
+	dest[5 - r_off] = CLIP(y1 + u1);
+}
+
+/* Scalar version of YUV2R / YUV2G / YUV2B, for the nv12 tails */
+static inline void accurate_pixel(int y, int u, int v, unsigned char *dest,
+		int bgr)
+{
+	int r = y + ((((v) - 128) * 1436) >> 10);
+	int g = y - ((((u) - 128) * 352 + ((v) - 128) * 731) >> 10);
+	int b = y + ((((u) - 128) * 1814) >> 10);
+
+	dest[bgr ? 2 : 0] = CLIP(r);
+	dest[1] = CLIP(g);
+	dest[bgr ? 0 : 2] = CLIP(b);
+}
+
+static void planar_row_tail(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dest, int count, int bgr)
+{
+	int j;
+
+	for (j = 0; j + 1 < count; j += 2) {
+		fast_pixel_pair(ysrc[j], ysrc[j + 1], usrc[j / 2], vsrc[j / 2],
+				dest, bgr);
+		dest += 6;
+	}
+}
+
+static void packed_row_tail(const unsigned char *src, unsigned char *dest,
+		int count, enum packed_layout layout, int bgr)
+{
+	const int *o = packed_offsets[layout];
+	int j;
+
+	for (j = 0; j + 1 < count; j += 2) {
+		fast_pixel_pair(src[o[0]], src[o[2]], src[o[1]], src[o[3]],
+				dest, bgr);
+		src += 4;
+		dest += 6;
+	}
+}
+
+static void nv12_row_tail(const unsigned char *ysrc,
+		const unsigned char *uvsrc, unsigned char *dest, int count, int bgr)
+{
+	int j;
+
+	for (j = 0; j < count; j++) {
+		accurate_pixel(ysrc[j], uvsrc[j & ~1], uvsrc[(j & ~1) + 1],
+			       dest, bgr);
+		dest += 3;
+	}
+}
+
+static void packed_to_yuv420_tail(const unsigned char *src,
+		const unsigned char *src1, unsigned char *udest,
+		unsigned char *vdest, int count, enum packed_layout layout)
+{
+	const int *o = packed_offsets[layout];
+	int j;
+
+	for (j = 0; j + 1 < count; j += 2) {
+		*udest++ = ((int) src[o[1]] + src1[o[1]]) / 2;
+		*vdest++ = ((int) src[o[3]] + src1[o[3]]) / 2;
+		src += 4;
+		src1 += 4;
+	}
+}
+
+/*
+ * Frame loops, shared by all instruction sets. The per ISA code only needs
+ * to provide kernels which convert 16 pixels from:
+ * - 16 Y + 8 U + 8 V planar samples        -> 48 bytes rgb / bgr
+ * - 32 bytes of packed 4:2:2               -> 48 bytes rgb / bgr
+ * - 16 Y + 16 bytes of interleaved UV      -> 48 bytes rgb / bgr (accurate)
+ * - 2 x 32 bytes of packed 4:2:2           -> 16 Y + 8 U + 8 V (one Y row)
+ */
+typedef void (*planar16_fn)(const unsigned char *y, const unsigned char *u,
+		const unsigned char *v, unsigned char *dest, int bgr);
+typedef void (*packed16_fn)(const unsigned char *src, unsigned char *dest,
+		enum packed_layout layout, int bgr);
+typedef void (*nv12_16_fn)(const unsigned char *y, const unsigned char *uv,
+		unsigned char *dest, int bgr);
+typedef void (*packed16_yuv420_fn)(const unsigned char *src,
+		const unsigned char *src1, unsigned char *ydest,
+		unsigned char *udest, unsigned char *vdest,
+		enum packed_layout layout);
+
+static inline void yuv420_loop(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int bgr,
+		planar16_fn kernel)
+{
+	int i, j;
+
+	for (i = 0; i < height; i++) {
+		const unsigned char *y = src->y + i * src->y_stride;
+		const unsigned char *u = src->u + (i / 2) * src->uv_stride;
+		const unsigned char *v = src->v + (i / 2) * src->uv_stride;
+
+		for (j = 0; j + 16 <= width; j += 16)
+			kernel(y + j, u + j / 2, v + j / 2, dest + j * 3, bgr);
+		planar_row_tail(y + j, u + j / 2, v + j / 2, dest + j * 3,
+				width - j, bgr);
+		dest += width * 3;
+	}
+}
+
+static inline void packed_loop(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, enum packed_layout layout,
+		int bgr, packed16_fn kernel)
+{
+	int i, j;
+
+	for (i = 0; i < height; i++) {
+		for (j = 0; j + 16 <= width; j += 16)
+			kernel(src + j * 2, dest + j * 3, layout, bgr);
+		packed_row_tail(src + j * 2, dest + j * 3, width - j, layout,
+				bgr);
+		src += stride;
+		dest += width * 3;
+	}
+}
+
+static inline void nv12_loop(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int bgr,
+		nv12_16_fn kernel)
+{
+	int i, j;
+
+	for (i = 0; i < height; i++) {
+		const unsigned char *y = src->y + i * src->y_stride;
+		const unsigned char *uv = src->u + (i / 2) * src->uv_stride;
+
+		for (j = 0; j + 16 <= width; j += 16)
+			kernel(y + j, uv + j, dest + j * 3, bgr);
+		nv12_row_tail(y + j, uv + j, dest + j * 3, width - j, bgr);
+		dest += width * 3;
+	}
+}
+
+static inline void packed_to_yuv420_loop(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride, int yvu,
+		enum packed_layout layout, packed16_yuv420_fn kernel)
+{
+	const int *o = packed_offsets[layout];
+	unsigned char *udest, *vdest;
+	int i, j;
+
+	if (yvu) {
+		vdest = dest + width * height;
+		udest = vdest + width * height / 4;
+	} else {
+		udest = dest + width * height;
+		vdest = udest + width * height / 4;
+	}
+
+	for (i = 0; i < height; i += 2) {
+		const unsigned char *src0 = src + i * stride;
+		const unsigned char *src1 = src0 + stride;
+		unsigned char *y0 = dest + i * width;
+		unsigned char *y1 = y0 + width;
+		int last_row = i + 1 >= height;
+
+		for (j = 0; j + 16 <= width; j += 16) {
+			kernel(src0 + j * 2, src1 + j * 2, y0 + j,
+			       udest + j / 2, vdest + j / 2, layout);
+			/* The kernel only stores the Y of its first row */
+			if (!last_row)
+				kernel(src1 + j * 2, src1 + j * 2, y1 + j,
+				       NULL, NULL, layout);
+		}
+		packed_to_yuv420_tail(src0 + j * 2, src1 + j * 2,
+				      udest + j / 2, vdest + j / 2, width - j,
+				      layout);
+		for (; j + 1 < width; j += 2) {
+			y0[j] = src0[j * 2 + o[0]];
+			y0[j + 1] = src0[j * 2 + o[2]];
+			if (!last_row) {
+				y1[j] = src1[j * 2 + o[0]];
+				y1[j + 1] = src1[j * 2 + o[2]];
+			}
+		}
+		udest += width / 2;
+		vdest += width / 2;
+	}
+}
+
+#endif /* HAVE_SIMD_X86 || HAVE_SIMD_NEON */
+
+#ifdef HAVE_SIMD_X86
+
+/* 16 bit fixed point chroma offsets, for 8 chroma samples at once */
+static inline SSE2 void sse2_fast_chroma(__m128i u16, __m128i v16,
+		__m128i *u1, __m128i *rg, __m128i *v1)
+{
+	__m128i du = _mm_sub_epi16(u16, _mm_set1_epi16(128));
+	__m128i dv = _mm_sub_epi16(v16, _mm_set1_epi16(128));
+
+	*u1 = _mm_srai_epi16(_mm_mullo_epi16(du, _mm_set1_epi16(129)), 6);
+	*rg = _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(du, _mm_set1_epi16(3)),
+					   _mm_mullo_epi16(dv, _mm_set1_epi16(6))), 3);
+	*v1 = _mm_srai_epi16(_mm_mullo_epi16(dv, _mm_set1_epi16(3)), 1);
+}
+
+/* 16 Y bytes + 8 U and V samples (as 16 bit lanes) -> 48 bytes rgb / bgr */
+static inline SSE2 void sse2_yuv16_to_rgb24(__m128i y, __m128i u16,
+		__m128i v16, unsigned char *dest, int bgr)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i y_lo = _mm_unpacklo_epi8(y, zero);
+	__m128i y_hi = _mm_unpackhi_epi8(y, zero);
+	__m128i u1, rg, v1, r, g, b;
+
+	sse2_fast_chroma(u16, v16, &u1, &rg, &v1);
+
+	r = _mm_packus_epi16(_mm_add_epi16(y_lo, _mm_unpacklo_epi16(v1, v1)),
+			     _mm_add_epi16(y_hi, _mm_unpackhi_epi16(v1, v1)));
+	g = _mm_packus_epi16(_mm_sub_epi16(y_lo, _mm_unpacklo_epi16(rg, rg)),
+			     _mm_sub_epi16(y_hi, _mm_unpackhi_epi16(rg, rg)));
+	b = _mm_packus_epi16(_mm_add_epi16(y_lo, _mm_unpacklo_epi16(u1, u1)),
+			     _mm_add_epi16(y_hi, _mm_unpackhi_epi16(u1, u1)));
+
+	if (bgr)
+		sse2_store_rgb24(dest, b, g, r);
+	else
+		sse2_store_rgb24(dest, r, g, b);
+}
+
+/* Split 32 bytes of packed 4:2:2 into 16 Y bytes and 8 U / V 16 bit lanes */
+static inline SSE2 void sse2_unpack_422(const unsigned char *src,
+		enum packed_layout layout, __m128i *y, __m128i *u16, __m128i *v16)
+{
+	__m128i mask = _mm_set1_epi16(0x00ff);
+	__m128i a = _mm_loadu_si128((const __m128i *)src);
+	__m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+	__m128i c;
+
+	if (layout == LAYOUT_UYVY) {
+		*y = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+		c = _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+	} else {
+		*y = _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+		c = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+	}
+
+	if (layout == LAYOUT_YVYU) {
+		*v16 = _mm_and_si128(c, mask);
+		*u16 = _mm_srli_epi16(c, 8);
+	} else {
+		*u16 = _mm_and_si128(c, mask);
+		*v16 = _mm_srli_epi16(c, 8);
+	}
+}
+
+static SSE2 void sse2_planar16(const unsigned char *y, const unsigned char *u,
+		const unsigned char *v, unsigned char *dest, int bgr)
+{
+	__m128i zero = _mm_setzero_si128();
+
+	sse2_yuv16_to_rgb24(_mm_loadu_si128((const __m128i *)y),
+		_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)u), zero),
+		_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)v), zero),
+		dest, bgr);
+}
+
+static SSE2 void sse2_packed16(const unsigned char *src, unsigned char *dest,
+		enum packed_layout layout, int bgr)
+{
+	__m128i y, u16, v16;
+
+	sse2_unpack_422(src, layout, &y, &u16, &v16);
+	sse2_yuv16_to_rgb24(y, u16, v16, dest, bgr);
+}
+
+/* YUV2R / YUV2G / YUV2B offsets for 8 chroma samples, in 32 bit precision */
+static inline SSE2 __m128i sse2_madd_shift(__m128i a, __m128i b, __m128i coef)
+{
+	__m128i lo = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(a, b), coef), 10);
+	__m128i hi = _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(a, b), coef), 10);
+
+	return _mm_packs_epi32(lo, hi);
+}
+
+static SSE2 void sse2_nv12_16(const unsigned char *ysrc,
+		const unsigned char *uvsrc, unsigned char *dest, int bgr)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i y = _mm_loadu_si128((const __m128i *)ysrc);
+	__m128i uv = _mm_loadu_si128((const __m128i *)uvsrc);
+	__m128i du = _mm_sub_epi16(_mm_and_si128(uv, _mm_set1_epi16(0x00ff)),
+				   _mm_set1_epi16(128));
+	__m128i dv = _mm_sub_epi16(_mm_srli_epi16(uv, 8), _mm_set1_epi16(128));
+	__m128i y_lo = _mm_unpacklo_epi8(y, zero);
+	__m128i y_hi = _mm_unpackhi_epi8(y, zero);
+	__m128i roff = sse2_madd_shift(dv, zero, _mm_set1_epi32(1436));
+	__m128i goff = sse2_madd_shift(du, dv, _mm_set1_epi32((731 << 16) | 352));
+	__m128i boff = sse2_madd_shift(du, zero, _mm_set1_epi32(1814));
+	__m128i r, g, b;
+
+	r = _mm_packus_epi16(_mm_add_epi16(y_lo, _mm_unpacklo_epi16(roff, roff)),
+			     _mm_add_epi16(y_hi, _mm_unpackhi_epi16(roff, roff)));
+	g = _mm_packus_epi16(_mm_sub_epi16(y_lo, _mm_unpacklo_epi16(goff, goff)),
+			     _mm_sub_epi16(y_hi, _mm_unpackhi_epi16(goff, goff)));
+	b = _mm_packus_epi16(_mm_add_epi16(y_lo, _mm_unpacklo_epi16(boff, boff)),
+			     _mm_add_epi16(y_hi, _mm_unpackhi_epi16(boff, boff)));
+
+	if (bgr)
+		sse2_store_rgb24(dest, b, g, r);
+	else
+		sse2_store_rgb24(dest, r, g, b);
+}
+
+static SSE2 void sse2_packed16_yuv420(const unsigned char *src,
+		const unsigned char *src1, unsigned char *ydest,
+		unsigned char *udest, unsigned char *vdest,
+		enum packed_layout layout)
+{
+	__m128i mask = _mm_set1_epi16(0x00ff);
+	__m128i y, u0, v0, u1, v1, uv;
+
+	sse2_unpack_422(src, layout, &y, &u0, &v0);
+	_mm_storeu_si128((__m128i *)ydest, y);
+	if (!udest)
+		return;
+
+	sse2_unpack_422(src1, layout, &y, &u1, &v1);
+	u0 = _mm_srli_epi16(_mm_add_epi16(u0, u1), 1);
+	v0 = _mm_srli_epi16(_mm_add_epi16(v0, v1), 1);
+	uv = _mm_packus_epi16(_mm_and_si128(u0, mask), _mm_and_si128(v0, mask));
+	_mm_storel_epi64((__m128i *)udest, uv);
+	_mm_storel_epi64((__m128i *)vdest, _mm_srli_si128(uv, 8));
+}
+
+/*
+ * The AVX2 kernels do all 16 pixels in a single set of 16 bit lanes and use
+ * pshufb (which AVX2 implies) for the rgb24 interleaving.
+ */
+
+/* Duplicate 8 chroma 16 bit lanes into 16 lanes, one per pixel */
+static inline AVX2 __m256i avx2_dup_chroma(__m128i c16)
+{
+	return _mm256_inserti128_si256(
+			_mm256_castsi128_si256(_mm_unpacklo_epi16(c16, c16)),
+			_mm_unpackhi_epi16(c16, c16), 1);
+}
+
+static inline AVX2 __m128i avx2_packus(__m256i x)
+{
+	return _mm_packus_epi16(_mm256_castsi256_si128(x),
+				_mm256_extracti128_si256(x, 1));
+}
+
+static inline AVX2 void avx2_yuv16_to_rgb24(__m128i y8, __m128i u16,
+		__m128i v16, unsigned char *dest, int bgr)
+{
+	__m256i y = _mm256_cvtepu8_epi16(y8);
+	__m256i du = _mm256_sub_epi16(avx2_dup_chroma(u16), _mm256_set1_epi16(128));
+	__m256i dv = _mm256_sub_epi16(avx2_dup_chroma(v16), _mm256_set1_epi16(128));
+	__m256i u1, rg, v1;
+	__m128i r, g, b;
+
+	u1 = _mm256_srai_epi16(_mm256_mullo_epi16(du, _mm256_set1_epi16(129)), 6);
+	rg = _mm256_srai_epi16(_mm256_add_epi16(
+				_mm256_mullo_epi16(du, _mm256_set1_epi16(3)),
+				_mm256_mullo_epi16(dv, _mm256_set1_epi16(6))), 3);
+	v1 = _mm256_srai_epi16(_mm256_mullo_epi16(dv, _mm256_set1_epi16(3)), 1);
+
+	r = avx2_packus(_mm256_add_epi16(y, v1));
+	g = avx2_packus(_mm256_sub_epi16(y, rg));
+	b = avx2_packus(_mm256_add_epi16(y, u1));
+
+	if (bgr)
+		avx2_store_rgb24(dest, b, g, r);
+	else
+		avx2_store_rgb24(dest, r, g, b);
+}
+
+static AVX2 void avx2_planar16(const unsigned char *y, const unsigned char *u,
+		const unsigned char *v, unsigned char *dest, int bgr)
+{
+	avx2_yuv16_to_rgb24(_mm_loadu_si128((const __m128i *)y),
+		_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)u)),
+		_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)v)),
+		dest, bgr);
+}
+
+static AVX2 void avx2_packed16(const unsigned char *src, unsigned char *dest,
+		enum packed_layout layout, int bgr)
+{
+	__m128i y, u16, v16;
+
+	sse2_unpack_422(src, layout, &y, &u16, &v16);
+	avx2_yuv16_to_rgb24(y, u16, v16, dest, bgr);
+}
+
+static AVX2 void avx2_nv12_16(const unsigned char *ysrc,
+		const unsigned char *uvsrc, unsigned char *dest, int bgr)
+{
+	__m256i y = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)ysrc));
+	__m128i uv = _mm_loadu_si128((const __m128i *)uvsrc);
+	__m256i du = _mm256_sub_epi16(avx2_dup_chroma(
+			_mm_and_si128(uv, _mm_set1_epi16(0x00ff))),
+			_mm256_set1_epi16(128));
+	__m256i dv = _mm256_sub_epi16(avx2_dup_chroma(_mm_srli_epi16(uv, 8)),
+			_mm256_set1_epi16(128));
+	__m256i roff, goff, boff;
+	__m128i r, g, b;
+
+#define AVX2_MADD(a, b, coef) \
+	_mm256_packs_epi32( \
+		_mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), coef), 10), \
+		_mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), coef), 10))
+	roff = AVX2_MADD(dv, _mm256_setzero_si256(), _mm256_set1_epi32(1436));
+	goff = AVX2_MADD(du, dv, _mm256_set1_epi32((731 << 16) | 352));
+	boff = AVX2_MADD(du, _mm256_setzero_si256(), _mm256_set1_epi32(1814));
+#undef AVX2_MADD
+
+	r = avx2_packus(_mm256_add_epi16(y, roff));
+	g = avx2_packus(_mm256_sub_epi16(y, goff));
+	b = avx2_packus(_mm256_add_epi16(y, boff));
+
+	if (bgr)
+		avx2_store_rgb24(dest, b, g, r);
+	else
+		avx2_store_rgb24(dest, r, g, b);
+}
+
+#define RGBYUV_ISA_FUNCS(isa) \
+static isa##_ATTR void isa##_yuv420_to_rgb24( \
+		const struct v4lconvert_planes *src, unsigned char *dest, \
+		int width, int height) \
+{ \
+	if (width & 1) { \
+		v4lconvert_yuv420_to_rgb24(src, dest, width, height); \
+		return; \
+	} \
+	yuv420_loop(src, dest, width, height, 0, isa##_planar16); \
+} \
+static isa##_ATTR void isa##_yuv420_to_bgr24( \
+		const struct v4lconvert_planes *src, unsigned char *dest, \
+		int width, int height) \
+{ \
+	if (width & 1) { \
+		v4lconvert_yuv420_to_bgr24(src, dest, width, height); \
+		return; \
+	} \
+	yuv420_loop(src, dest, width, height, 1, isa##_planar16); \
+} \
+RGBYUV_PACKED_FUNC(isa, yuyv, rgb24, LAYOUT_YUYV, 0) \
+RGBYUV_PACKED_FUNC(isa, yuyv, bgr24, LAYOUT_YUYV, 1) \
+RGBYUV_PACKED_FUNC(isa, yvyu, rgb24, LAYOUT_YVYU, 0) \
+RGBYUV_PACKED_FUNC(isa, yvyu, bgr24, LAYOUT_YVYU, 1) \
+RGBYUV_PACKED_FUNC(isa, uyvy, rgb24, LAYOUT_UYVY, 0) \
+RGBYUV_PACKED_FUNC(isa, uyvy, bgr24, LAYOUT_UYVY, 1) \
+static isa##_ATTR void isa##_nv12_to_rgb24( \
+		const struct v4lconvert_planes *src, unsigned char *dest, \
+		int width, int height, int bgr) \
+{ \
+	if (width & 1) { \
+		v4lconvert_nv12_to_rgb24(src, dest, width, height, bgr); \
+		return; \
+	} \
+	nv12_loop(src, dest, width, height, bgr, isa##_nv12_16); \
+}
+
+#define RGBYUV_PACKED_FUNC(isa, in, out, layout, bgr) \
+static isa##_ATTR void isa##_##in##_to_##out(const unsigned char *src, \
+		unsigned char *dest, int width, int height, int stride) \
+{ \
+	if (width & 1) { \
+		v4lconvert_##in##_to_##out(src, dest, width, height, stride); \
+		return; \
+	} \
+	packed_loop(src, dest, width, height, stride, layout, bgr, \
+		    isa##_packed16); \
+}
+
+#define sse2_ATTR SSE2
+#define avx2_ATTR AVX2
+
+RGBYUV_ISA_FUNCS(sse2)
+RGBYUV_ISA_FUNCS(avx2)
+
+static SSE2 void sse2_yuyv_to_yuv420(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride, int yvu)
+{
+	if (width & 1) {
+		v4lconvert_yuyv_to_yuv420(src, dest, width, height, stride,
+					  yvu);
+		return;
+	}
+	packed_to_yuv420_loop(src, dest, width, height, stride, yvu,
+			      LAYOUT_YUYV, sse2_packed16_yuv420);
+}
+
+static SSE2 void sse2_uyvy_to_yuv420(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride, int yvu)
+{
+	if (width & 1) {
+		v4lconvert_uyvy_to_yuv420(src, dest, width, height, stride,
+					  yvu);
+		return;
+	}
+	packed_to_yuv420_loop(src, dest, width, height, stride, yvu,
+			      LAYOUT_UYVY, sse2_packed16_yuv420);
+}
+
+static const struct v4lconvert_rgbyuv_ops rgbyuv_sse2_ops = {
+	.yuv420_to_rgb24 = sse2_yuv420_to_rgb24,
+	.yuv420_to_bgr24 = sse2_yuv420_to_bgr24,
+	.yuyv_to_rgb24 = sse2_yuyv_to_rgb24,
+	.yuyv_to_bgr24 = sse2_yuyv_to_bgr24,
+	.yuyv_to_yuv420 = sse2_yuyv_to_yuv420,
+	.yvyu_to_rgb24 = sse2_yvyu_to_rgb24,
+	.yvyu_to_bgr24 = sse2_yvyu_to_bgr24,
+	.uyvy_to_rgb24 = sse2_uyvy_to_rgb24,
+	.uyvy_to_bgr24 = sse2_uyvy_to_bgr24,
+	.uyvy_to_yuv420 = sse2_uyvy_to_yuv420,
+	.nv12_to_rgb24 = sse2_nv12_to_rgb24,
+};
+
+/* The 4:2:2 -> 4:2:0 repacking is memory bound, so AVX2 reuses SSE2 there */
+static const struct v4lconvert_rgbyuv_ops rgbyuv_avx2_ops = {
+	.yuv420_to_rgb24 = avx2_yuv420_to_rgb24,
+	.yuv420_to_bgr24 = avx2_yuv420_to_bgr24,
+	.yuyv_to_rgb24 = avx2_yuyv_to_rgb24,
+	.yuyv_to_bgr24 = avx2_yuyv_to_bgr24,
+	.yuyv_to_yuv420 = sse2_yuyv_to_yuv420,
+	.yvyu_to_rgb24 = avx2_yvyu_to_rgb24,
+	.yvyu_to_bgr24 = avx2_yvyu_to_bgr24,
+	.uyvy_to_rgb24 = avx2_uyvy_to_rgb24,
+	.uyvy_to_bgr24 = avx2_uyvy_to_bgr24,
+	.uyvy_to_yuv420 = sse2_uyvy_to_yuv420,
+	.nv12_to_rgb24 = avx2_nv12_to_rgb24,
+};
+
+#endif /* HAVE_SIMD_X86 */
+
+#ifdef HAVE_SIMD_NEON
+
+static inline void neon_yuv16_to_rgb24(uint8x16_t y, uint8x8_t u,
+		uint8x8_t v, unsigned char *dest, int bgr)
+{
+	int16x8_t du = vreinterpretq_s16_u16(vsubl_u8(u, vdup_n_u8(128)));
+	int16x8_t dv = vreinterpretq_s16_u16(vsubl_u8(v, vdup_n_u8(128)));
+	int16x8_t u1 = vshrq_n_s16(vmulq_n_s16(du, 129), 6);
+	int16x8_t rg = vshrq_n_s16(vaddq_s16(vmulq_n_s16(du, 3),
+					     vmulq_n_s16(dv, 6)), 3);
+	int16x8_t v1 = vshrq_n_s16(vmulq_n_s16(dv, 3), 1);
+	int16x8_t y_lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(y)));
+	int16x8_t y_hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(y)));
+	uint8x16_t r, g, b;
+	uint8x16x3_t rgb;
+
+	r = vcombine_u8(vqmovun_s16(vaddq_s16(y_lo, vzip1q_s16(v1, v1))),
+			vqmovun_s16(vaddq_s16(y_hi, vzip2q_s16(v1, v1))));
+	g = vcombine_u8(vqmovun_s16(vsubq_s16(y_lo, vzip1q_s16(rg, rg))),
+			vqmovun_s16(vsubq_s16(y_hi, vzip2q_s16(rg, rg))));
+	b = vcombine_u8(vqmovun_s16(vaddq_s16(y_lo, vzip1q_s16(u1, u1))),
+			vqmovun_s16(vaddq_s16(y_hi, vzip2q_s16(u1, u1))));
+
+	rgb.val[0] = bgr ? b : r;
+	rgb.val[1] = g;
+	rgb.val[2] = bgr ? r : b;
+	vst3q_u8(dest, rgb);
+}
+
+static inline void neon_unpack_422(const unsigned char *src,
+		enum packed_layout layout, uint8x16_t *y, uint8x8_t *u,
+		uint8x8_t *v)
+{
+	uint8x8x4_t p = vld4_u8(src);
+	const int *o = packed_offsets[layout];
+
+	*y = vcombine_u8(vzip1_u8(p.val[o[0]], p.val[o[2]]),
+			 vzip2_u8(p.val[o[0]], p.val[o[2]]));
+	*u = p.val[o[1]];
+	*v = p.val[o[3]];
+}
+
+static void neon_planar16(const unsigned char *y, const unsigned char *u,
+		const unsigned char *v, unsigned char *dest, int bgr)
+{
+	neon_yuv16_to_rgb24(vld1q_u8(y), vld1_u8(u), vld1_u8(v), dest, bgr);
+}
+
+static void neon_packed16(const unsigned char *src, unsigned char *dest,
+		enum packed_layout layout, int bgr)
+{
+	uint8x16_t y;
+	uint8x8_t u, v;
+
+	neon_unpack_422(src, layout, &y, &u, &v);
+	neon_yuv16_to_rgb24(y, u, v, dest, bgr);
+}
+
+static inline int16x8_t neon_accurate_off(int16x8_t a, int16_t ca,
+		int16x8_t b, int16_t cb)
+{
+	int32x4_t lo = vmlal_n_s16(vmull_n_s16(vget_low_s16(a), ca),
+				   vget_low_s16(b), cb);
+	int32x4_t hi = vmlal_n_s16(vmull_n_s16(vget_high_s16(a), ca),
+				   vget_high_s16(b), cb);
+
+	return vcombine_s16(vmovn_s32(vshrq_n_s32(lo, 10)),
+			    vmovn_s32(vshrq_n_s32(hi, 10)));
+}
+
+static void neon_nv12_16(const unsigned char *ysrc,
+		const unsigned char *uvsrc, unsigned char *dest, int bgr)
+{
+	uint8x16_t y = vld1q_u8(ysrc);
+	uint8x8x2_t uv = vld2_u8(uvsrc);
+	int16x8_t du = vreinterpretq_s16_u16(vsubl_u8(uv.val[0], vdup_n_u8(128)));
+	int16x8_t dv = vreinterpretq_s16_u16(vsubl_u8(uv.val[1], vdup_n_u8(128)));
+	int16x8_t roff = neon_accurate_off(dv, 1436, du, 0);
+	int16x8_t goff = neon_accurate_off(du, 352, dv, 731);
+	int16x8_t boff = neon_accurate_off(du, 1814, dv, 0);
+	int16x8_t y_lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(y)));
+	int16x8_t y_hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(y)));
+	uint8x16_t r, g, b;
+	uint8x16x3_t rgb;
+
+	r = vcombine_u8(vqmovun_s16(vaddq_s16(y_lo, vzip1q_s16(roff, roff))),
+			vqmovun_s16(vaddq_s16(y_hi, vzip2q_s16(roff, roff))));
+	g = vcombine_u8(vqmovun_s16(vsubq_s16(y_lo, vzip1q_s16(goff, goff))),
+			vqmovun_s16(vsubq_s16(y_hi, vzip2q_s16(goff, goff))));
+	b = vcombine_u8(vqmovun_s16(vaddq_s16(y_lo, vzip1q_s16(boff, boff))),
+			vqmovun_s16(vaddq_s16(y_hi, vzip2q_s16(boff, boff))));
+
+	rgb.val[0] = bgr ? b : r;
+	rgb.val[1] = g;
+	rgb.val[2] = bgr ? r : b;
+	vst3q_u8(dest, rgb);
+}
+
+static void neon_packed16_yuv420(const unsigned char *src,
+		const unsigned char *src1, unsigned char *ydest,
+		unsigned char *udest, unsigned char *vdest,
+		enum packed_layout layout)
+{
+	uint8x16_t y;
+	uint8x8_t u0, v0, u1, v1;
+
+	neon_unpack_422(src, layout, &y, &u0, &v0);
+	vst1q_u8(ydest, y);
+	if (!udest)
+		return;
+
+	neon_unpack_422(src1, layout, &y, &u1, &v1);
+	/* vhadd is a truncating (a + b) >> 1, just like the C code */
+	vst1_u8(udest, vhadd_u8(u0, u1));
+	vst1_u8(vdest, vhadd_u8(v0, v1));
+}
+
+#define neon_ATTR
+
+RGBYUV_ISA_FUNCS(neon)
+
+static void neon_yuyv_to_yuv420(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride, int yvu)
+{
+	if (width & 1) {
+		v4lconvert_yuyv_to_yuv420(src, dest, width, height, stride,
+					  yvu);
+		return;
+	}
+	packed_to_yuv420_loop(src, dest, width, height, stride, yvu,
+			      LAYOUT_YUYV, neon_packed16_yuv420);
+}
+
+static void neon_uyvy_to_yuv420(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride, int yvu)
+{
+	if (width & 1) {
+		v4lconvert_uyvy_to_yuv420(src, dest, width, height, stride,
+					  yvu);
+		return;
+	}
+	packed_to_yuv420_loop(src, dest, width, height, stride, yvu,
+			      LAYOUT_UYVY, neon_packed16_yuv420);
+}
+
+static const struct v4lconvert_rgbyuv_ops rgbyuv_neon_ops = {
+	.yuv420_to_rgb24 = neon_yuv420_to_rgb24,
+	.yuv420_to_bgr24 = neon_yuv420_to_bgr24,
+	.yuyv_to_rgb24 = neon_yuyv_to_rgb24,
+	.yuyv_to_bgr24 = neon_yuyv_to_bgr24,
+	.yuyv_to_yuv420 = neon_yuyv_to_yuv420,
+	.yvyu_to_rgb24 = neon_yvyu_to_rgb24,
+	.yvyu_to_bgr24 = neon_yvyu_to_bgr24,
+	.uyvy_to_rgb24 = neon_uyvy_to_rgb24,
+	.uyvy_to_bgr24 = neon_uyvy_to_bgr24,
+	.uyvy_to_yuv420 = neon_uyvy_to_yuv420,
+	.nv12_to_rgb24 = neon_nv12_to_rgb24,
+};
+
+#endif /* HAVE_SIMD_NEON */
+
+const struct v4lconvert_rgbyuv_ops *v4lconvert_get_rgbyuv_ops(void)
+{
+#ifdef HAVE_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return &rgbyuv_avx2_ops;
+	if (__builtin_cpu_supports("sse2"))
+		return &rgbyuv_sse2_ops;
+#endif
+#ifdef HAVE_SIMD_NEON
+	/* Advanced SIMD is mandatory on aarch64 */
+	return &rgbyuv_neon_ops;
+#endif
+	return &rgbyuv_c_ops;
+}
@@ -92,23 +92,66 @@ void v4lconvert_rgb24_to_yuv420(const unsigned char *src, unsigned char *dest,
 
 #define CLIP(color) (unsigned char)(((color) > 0xFF) ? 0xff : (((color) < 0) ? 0 : (color)))
 
-void v4lconvert_yuv420_to_bgr24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int yvu)
+void v4lconvert_yuv420_planes(struct v4lconvert_planes *planes,
+		const unsigned char *src, int width, int height,
+		int bytesperline, int yvu)
 {
-	int i, j;
-
-	const unsigned char *ysrc = src;
-	const unsigned char *usrc, *vsrc;
+	int stride = bytesperline > width ? bytesperline : width;
 
+	planes->y = src;
+	planes->y_stride = stride;
+	planes->uv_stride = stride / 2;
 	if (yvu) {
-		vsrc = src + width * height;
-		usrc = vsrc + (width * height) / 4;
+		planes->v = src + stride * height;
+		planes->u = planes->v + (stride * height) / 4;
 	} else {
-		usrc = src + width * height;
-		vsrc = usrc + (width * height) / 4;
+		planes->u = src + stride * height;
+		planes->v = planes->u + (stride * height) / 4;
 	}
+}
+
+void v4lconvert_nv12_planes(struct v4lconvert_planes *planes,
+		const unsigned char *src, int width, int height,
+		int bytesperline)
+{
+	int stride = bytesperline > width ? bytesperline : width;
+
+	planes->y = src;
+	planes->u = src + stride * height;
+	planes->v = NULL;
+	planes->y_stride = stride;
+	planes->uv_stride = stride;
+}
+
+void v4lconvert_yuv420_copy(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height)
+{
+	int i;
 
 	for (i = 0; i < height; i++) {
+		memcpy(dest, src->y + i * src->y_stride, width);
+		dest += width;
+	}
+	for (i = 0; i < height / 2; i++) {
+		memcpy(dest, src->u + i * src->uv_stride, width / 2);
+		dest += width / 2;
+	}
+	for (i = 0; i < height / 2; i++) {
+		memcpy(dest, src->v + i * src->uv_stride, width / 2);
+		dest += width / 2;
+	}
+}
+
+void v4lconvert_yuv420_to_bgr24(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height)
+{
+	int i, j;
+
+	for (i = 0; i < height; i++) {
+		const unsigned char *ysrc = src->y + i * src->y_stride;
+		const unsigned char *usrc = src->u + (i / 2) * src->uv_stride;
+		const unsigned char *vsrc = src->v + (i / 2) * src->uv_stride;
+
 		for (j = 0; j < width; j += 2) {
 #if 1 /* fast slightly less accurate multiplication free code */
 			int u1 = (((*usrc - 128) << 7) +  (*usrc - 128)) >> 6;
@@ -138,31 +181,19 @@ void v4lconvert_yuv420_to_bgr24(const unsigned char *src, unsigned char *dest,
 			usrc++;
 			vsrc++;
 		}
-		/* Rewind u and v for next line */
-		if (!(i & 1)) {
-			usrc -= width / 2;
-			vsrc -= width / 2;
-		}
 	}
 }
 
-void v4lconvert_yuv420_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int yvu)
+void v4lconvert_yuv420_to_rgb24(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height)
 {
 	int i, j;
 
-	const unsigned char *ysrc = src;
-	const unsigned char *usrc, *vsrc;
-
-	if (yvu) {
-		vsrc = src + width * height;
-		usrc = vsrc + (width * height) / 4;
-	} else {
-		usrc = src + width * height;
-		vsrc = usrc + (width * height) / 4;
-	}
-
 	for (i = 0; i < height; i++) {
+		const unsigned char *ysrc = src->y + i * src->y_stride;
+		const unsigned char *usrc = src->u + (i / 2) * src->uv_stride;
+		const unsigned char *vsrc = src->v + (i / 2) * src->uv_stride;
+
 		for (j = 0; j < width; j += 2) {
 #if 1 /* fast slightly less accurate multiplication free code */
 			int u1 = (((*usrc - 128) << 7) +  (*usrc - 128)) >> 6;
@@ -192,11 +223,6 @@ void v4lconvert_yuv420_to_rgb24(const unsigned char *src, unsigned char *dest,
 			usrc++;
 			vsrc++;
 		}
-		/* Rewind u and v for next line */
-		if (!(i&1)) {
-			usrc -= width / 2;
-			vsrc -= width / 2;
-		}
 	}
 }
 
@@ -473,35 +499,6 @@ void v4lconvert_swap_rgb(const unsigned char *src, unsigned char *dst,
 	}
 }
 
-void v4lconvert_swap_uv(const unsigned char *src, unsigned char *dest,
-		const struct v4l2_format *src_fmt)
-{
-	int y;
-
-	/* Copy Y */
-	for (y = 0; y < src_fmt->fmt.pix.height; y++) {
-		memcpy(dest, src, src_fmt->fmt.pix.width);
-		dest += src_fmt->fmt.pix.width;
-		src += src_fmt->fmt.pix.bytesperline;
-	}
-
-	/* Copy component 2 */
-	src += src_fmt->fmt.pix.height * src_fmt->fmt.pix.bytesperline / 4;
-	for (y = 0; y < src_fmt->fmt.pix.height / 2; y++) {
-		memcpy(dest, src, src_fmt->fmt.pix.width / 2);
-		dest += src_fmt->fmt.pix.width / 2;
-		src += src_fmt->fmt.pix.bytesperline / 2;
-	}
-
-	/* Copy component 1 */
-	src -= src_fmt->fmt.pix.height * src_fmt->fmt.pix.bytesperline / 2;
-	for (y = 0; y < src_fmt->fmt.pix.height / 2; y++) {
-		memcpy(dest, src, src_fmt->fmt.pix.width / 2);
-		dest += src_fmt->fmt.pix.width / 2;
-		src += src_fmt->fmt.pix.bytesperline / 2;
-	}
-}
-
 void v4lconvert_rgb565_to_rgb24(const unsigned char *src, unsigned char *dest,
 		int width, int height)
 {
@@ -846,14 +843,15 @@ void v4lconvert_hsv_to_rgb24(const unsigned char *src, unsigned char *dest,
 		}
 }
 
-void v4lconvert_nv12_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int bgr)
+void v4lconvert_nv12_to_rgb24(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int bgr)
 {
 	int i, j;
-	const unsigned char *ysrc = src;
-	const unsigned char *uvsrc = src + width * height;
 
 	for (i = 0; i < height; i++) {
+		const unsigned char *ysrc = src->y + i * src->y_stride;
+		const unsigned char *uvsrc = src->u + (i / 2) * src->uv_stride;
+
 		for (j = 0; j < width; j ++) {
 			if (bgr) {
 				*dest++ = YUV2B(*ysrc, *uvsrc, *(uvsrc + 1));
@@ -868,36 +866,34 @@ void v4lconvert_nv12_to_rgb24(const unsigned char *src, unsigned char *dest,
 			if (j&1)
 				uvsrc += 2;
 		}
-
-		/* Rewind u and v for next line */
-		if (!(i&1))
-			uvsrc -= width;
 	}
 }
 
-void v4lconvert_nv12_to_yuv420(const unsigned char *src, unsigned char *dest,
-		int width, int height, int yvu)
+void v4lconvert_nv12_to_yuv420(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int yvu)
 {
 	int i, j;
-	const unsigned char *ysrc = src;
-	const unsigned char *uvsrc = src + width * height;
-	unsigned char *ydst = dest;
 	unsigned char *udst, *vdst;
 
 	if (yvu) {
-		vdst = ydst + width * height;
+		vdst = dest + width * height;
 		udst = vdst + ((width / 2) * (height / 2));
 	} else {
-		udst = ydst + width * height;
+		udst = dest + width * height;
 		vdst = udst + ((width / 2) * (height / 2));
 	}
 
-	for (i = 0; i < height; i++)
-		for (j = 0; i < width; j++) {
-			*ydst++ = *ysrc++;
-			if (((i % 2) == 0) && ((j % 2) == 0)) {
-				*udst++ = *uvsrc++;
-				*vdst++ = *uvsrc++;
-			}
+	for (i = 0; i < height; i++) {
+		memcpy(dest, src->y + i * src->y_stride, width);
+		dest += width;
+	}
+
+	for (i = 0; i < height / 2; i++) {
+		const unsigned char *uvsrc = src->u + i * src->uv_stride;
+
+		for (j = 0; j < width / 2; j++) {
+			*udst++ = *uvsrc++;
+			*vdst++ = *uvsrc++;
 		}
+	}
 }
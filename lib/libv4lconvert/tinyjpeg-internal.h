@@ -36,6 +36,7 @@
 #define __TINYJPEG_INTERNAL_H_
 
 #include <setjmp.h>
+#include "tinyjpeg.h"
 
 #define SANITY_CHECK 1
 
@@ -56,16 +57,22 @@ struct huffman_table {
 	short int lookup[HUFFMAN_HASH_SIZE];
 	/* code size: give the number of bits of a symbol is encoded */
 	unsigned char code_size[HUFFMAN_HASH_SIZE];
-	/* some place to store value that is not encoded in the lookup table
-	 * IMPROVEME: Calculate if 256 value is enough to store all values
-	 */
-	uint16_t slowtable[16 - HUFFMAN_HASH_NBITS][256];
+	/* For AC tables, when the code and the bits of the coefficient value
+	 * following it fit in HUFFMAN_HASH_NBITS bits, we can have directly
+	 * value << 8 | zero run << 4 | total bits, 0 if they do not fit */
+	short int fast_ac[HUFFMAN_HASH_SIZE];
+	/* For the codes longer than HUFFMAN_HASH_NBITS bits: the largest code of
+	 * each length (-1 if none), and the offset of its symbol in vals */
+	int maxcode[17];
+	int valoffset[17];
+	unsigned char vals[256];
 };
 
 struct component {
 	unsigned int Hfactor;
 	unsigned int Vfactor;
 	float *Q_table;		/* Pointer to the quantisation table to use */
+	int16_t *IQ_table;	/* Same for the integer IDCT */
 	struct huffman_table *AC_table;
 	struct huffman_table *DC_table;
 	short int previous_DC;	/* Previous DC coefficient */
@@ -79,6 +86,22 @@ struct component {
 typedef void (*decode_MCU_fct) (struct jdec_private *priv);
 typedef void (*convert_colorspace_fct) (struct jdec_private *priv);
 
+/* Fractional bits of the integer IDCT's dequantized coefficients */
+#define TINYJPEG_IFAST_PASS1_BITS 2
+
+/* The integer IDCT gets too inaccurate with fine quantization, tables with
+   an average step below this (about quality 87 and up) use the float IDCT */
+#define TINYJPEG_IFAST_MIN_QUANT 16
+
+/* The IDCT and colorspace conversions, picked for the cpu we run on */
+struct tinyjpeg_simd_ops {
+	void (*idct)(struct component *compptr, uint8_t *output_buf, int stride);
+	/* Indexed like the convert_colorspace_* tables (1x1, 1x2, 2x1, 2x2),
+	   NULL where the C version must be used */
+	convert_colorspace_fct rgb24[4];
+	convert_colorspace_fct bgr24[4];
+};
+
 struct jdec_private {
 	/* Public variables */
 	uint8_t *components[COMPONENTS];
@@ -94,6 +117,7 @@ struct jdec_private {
 
 	struct component component_infos[COMPONENTS];
 	float Q_tables[COMPONENTS][64];		/* quantization tables */
+	int16_t IQ_tables[COMPONENTS][64];	/* same for the integer IDCT */
 	struct huffman_table HTDC[HUFFMAN_TABLES];	/* DC huffman tables   */
 	struct huffman_table HTAC[HUFFMAN_TABLES];	/* AC huffman tables   */
 	int default_huffman_table_initialized;
@@ -109,6 +133,12 @@ struct jdec_private {
 	/* Temp space used after the IDCT to store each components */
 	uint8_t Y[64 * 4], Cr[64], Cb[64];
 
+	const struct tinyjpeg_simd_ops *simd;
+	/* simd->idct, or the float IDCT for finely quantized JPEGs, re-evaluated
+	   each time a quantization table is (re)built */
+	void (*idct)(struct component *compptr, uint8_t *output_buf, int stride);
+	unsigned int fine_Q_tables;	/* bitmask of finely quantized tables */
+
 	jmp_buf jump_state;
 	/* Internal Pointer use for colorspace conversion, do not modify it !!! */
 	uint8_t *plane[COMPONENTS];
@@ -118,10 +148,25 @@ struct jdec_private {
 	/* Temp buffers for multipass planar JPG -> RGB decoding */
 	int tmp_buf_y_size;
 	uint8_t *tmp_buf[COMPONENTS];
+
+	/* Parallel decoding of restart intervals */
+	tinyjpeg_run_fct run;
+	void *run_opaque;
+	unsigned char *restart_starts;
+	int restart_starts_size;
+	struct tinyjpeg_band *bands;
+	int bands_size;
+};
+
+/* Per band decoder state for parallel decoding */
+struct tinyjpeg_band {
+	struct jdec_private *priv;
+	int result;
 };
 
-#define IDCT tinyjpeg_idct_float
+#define IDCT priv->idct
 void tinyjpeg_idct_float (struct component *compptr, uint8_t *output_buf, int stride);
+const struct tinyjpeg_simd_ops *tinyjpeg_get_simd_ops(void);
 
 #endif
 
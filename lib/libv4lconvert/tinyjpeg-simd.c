@@ -0,0 +1,514 @@
+/*
+
+# SSE2 / NEON versions of the tinyjpeg IDCT and colorspace conversion
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+/* The IDCT is the same Arai, Agui and Nakajima algorithm as jidctflt.c, but
+   done in 16 bit fixed point like the IJG's jidctfst.c, so that 8 columns
+   (or rows) fit in a single register. The dequantized coefficients have
+   TINYJPEG_IFAST_PASS1_BITS fractional bits (these are in the IQ_tables, see
+   build_quantization_table()), and the constants have 8. Multiplying by a
+   constant c is done as (x * c) >> 8 == n * x + ((x * (c - 256 * n)) >> 8),
+   picking n so that c - 256 * n fits in the 8 bits the 16 bit multiply
+   instructions leave us, which keeps the result exact.
+
+   The colorspace conversions give the exact same results as the C versions
+   in tinyjpeg.c. */
+
+#include <stdint.h>
+#include "tinyjpeg-internal.h"
+#include "libv4lconvert-simd.h"
+
+#define DCTSIZE	   8
+
+#define SCALEBITS       10
+#define ONE_HALF        (1UL << (SCALEBITS - 1))
+#define FIX(x)          ((int)((x) * (1UL << SCALEBITS) + 0.5))
+
+/* 1.414213562, 1.847759065, 1.082392200 and -2.613125930 as
+   n * 256 + frac */
+#define MUL_1_414(x, frac)	ADD(x, frac(x, 106))
+#define MUL_1_847(x, frac)	ADD(ADD(x, x), frac(x, -39))
+#define MUL_1_082(x, frac)	ADD(x, frac(x, 21))
+#define MUL_M2_613(x, frac)	SUB(frac(x, 99), ADD(ADD(x, x), x))
+
+/* The 1-D IDCT on 8 vectors, see jidctflt.c for the details */
+#define IDCT_1D(v, frac) do { \
+	VEC tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7; \
+	VEC tmp10, tmp11, tmp12, tmp13; \
+	VEC z5, z10, z11, z12, z13; \
+ \
+	/* Even part */ \
+	tmp10 = ADD(v[0], v[4]); \
+	tmp11 = SUB(v[0], v[4]); \
+	tmp13 = ADD(v[2], v[6]); \
+	tmp12 = SUB(MUL_1_414(SUB(v[2], v[6]), frac), tmp13); \
+ \
+	tmp0 = ADD(tmp10, tmp13); \
+	tmp3 = SUB(tmp10, tmp13); \
+	tmp1 = ADD(tmp11, tmp12); \
+	tmp2 = SUB(tmp11, tmp12); \
+ \
+	/* Odd part */ \
+	z13 = ADD(v[5], v[3]); \
+	z10 = SUB(v[5], v[3]); \
+	z11 = ADD(v[1], v[7]); \
+	z12 = SUB(v[1], v[7]); \
+ \
+	tmp7 = ADD(z11, z13); \
+	tmp11 = MUL_1_414(SUB(z11, z13), frac); \
+ \
+	z5 = MUL_1_847(ADD(z10, z12), frac); \
+	tmp10 = SUB(MUL_1_082(z12, frac), z5); \
+	tmp12 = ADD(MUL_M2_613(z10, frac), z5); \
+ \
+	tmp6 = SUB(tmp12, tmp7); \
+	tmp5 = SUB(tmp11, tmp6); \
+	tmp4 = ADD(tmp10, tmp5); \
+ \
+	v[0] = ADD(tmp0, tmp7); \
+	v[7] = SUB(tmp0, tmp7); \
+	v[1] = ADD(tmp1, tmp6); \
+	v[6] = SUB(tmp1, tmp6); \
+	v[2] = ADD(tmp2, tmp5); \
+	v[5] = SUB(tmp2, tmp5); \
+	v[4] = ADD(tmp3, tmp4); \
+	v[3] = SUB(tmp3, tmp4); \
+} while (0)
+
+/* Rounding for the final descale, added to the DC term of each row which
+   ends up in all the outputs of the row */
+#define IDCT_ROUND	(1 << (TINYJPEG_IFAST_PASS1_BITS + 2))
+#define IDCT_DESCALE	(TINYJPEG_IFAST_PASS1_BITS + 3)
+
+#ifdef HAVE_SIMD_X86
+
+#define VEC __m128i
+#define ADD _mm_add_epi16
+#define SUB _mm_sub_epi16
+/* (x * frac) >> 8 */
+#define SSE2_FRAC(x, frac) _mm_mulhi_epi16(x, _mm_set1_epi16((frac) * 256))
+
+static inline SSE2 void sse2_transpose_8x8(__m128i v[8])
+{
+	__m128i a0 = _mm_unpacklo_epi16(v[0], v[1]);
+	__m128i a1 = _mm_unpackhi_epi16(v[0], v[1]);
+	__m128i a2 = _mm_unpacklo_epi16(v[2], v[3]);
+	__m128i a3 = _mm_unpackhi_epi16(v[2], v[3]);
+	__m128i a4 = _mm_unpacklo_epi16(v[4], v[5]);
+	__m128i a5 = _mm_unpackhi_epi16(v[4], v[5]);
+	__m128i a6 = _mm_unpacklo_epi16(v[6], v[7]);
+	__m128i a7 = _mm_unpackhi_epi16(v[6], v[7]);
+	__m128i b0 = _mm_unpacklo_epi32(a0, a2);
+	__m128i b1 = _mm_unpackhi_epi32(a0, a2);
+	__m128i b2 = _mm_unpacklo_epi32(a1, a3);
+	__m128i b3 = _mm_unpackhi_epi32(a1, a3);
+	__m128i b4 = _mm_unpacklo_epi32(a4, a6);
+	__m128i b5 = _mm_unpackhi_epi32(a4, a6);
+	__m128i b6 = _mm_unpacklo_epi32(a5, a7);
+	__m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+	v[0] = _mm_unpacklo_epi64(b0, b4);
+	v[1] = _mm_unpackhi_epi64(b0, b4);
+	v[2] = _mm_unpacklo_epi64(b1, b5);
+	v[3] = _mm_unpackhi_epi64(b1, b5);
+	v[4] = _mm_unpacklo_epi64(b2, b6);
+	v[5] = _mm_unpackhi_epi64(b2, b6);
+	v[6] = _mm_unpacklo_epi64(b3, b7);
+	v[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+static SSE2 void tinyjpeg_idct_ifast_sse2(struct component *compptr,
+		uint8_t *output_buf, int stride)
+{
+	const __m128i center = _mm_set1_epi8(-128);
+	__m128i v[8], ac;
+	int i;
+
+	for (i = 0; i < DCTSIZE; i++)
+		v[i] = _mm_loadu_si128((const __m128i *)(compptr->DCT + DCTSIZE * i));
+
+	/* Blocks with only a DC term are common, they are a single color */
+	ac = _mm_or_si128(_mm_or_si128(_mm_or_si128(v[1], v[2]),
+				       _mm_or_si128(v[3], v[4])),
+			  _mm_or_si128(_mm_or_si128(v[5], v[6]), v[7]));
+	ac = _mm_or_si128(ac, _mm_srli_si128(v[0], 2));
+	if (_mm_movemask_epi8(_mm_cmpeq_epi16(ac, _mm_setzero_si128())) == 0xffff) {
+		__m128i dc = _mm_set1_epi16((int16_t)(compptr->DCT[0] *
+						      compptr->IQ_table[0] + IDCT_ROUND));
+		__m128i p;
+
+		dc = _mm_srai_epi16(dc, IDCT_DESCALE);
+		p = _mm_xor_si128(_mm_packs_epi16(dc, dc), center);
+
+		for (i = 0; i < DCTSIZE; i++)
+			_mm_storel_epi64((__m128i *)(output_buf + i * stride), p);
+		return;
+	}
+
+	for (i = 0; i < DCTSIZE; i++)
+		v[i] = _mm_mullo_epi16(v[i], _mm_loadu_si128(
+				(const __m128i *)(compptr->IQ_table + DCTSIZE * i)));
+
+	/* Pass 1: process columns, each vector holds 1 row of all 8 columns */
+	IDCT_1D(v, SSE2_FRAC);
+	sse2_transpose_8x8(v);
+
+	/* Pass 2: process rows */
+	v[0] = _mm_add_epi16(v[0], _mm_set1_epi16(IDCT_ROUND));
+	IDCT_1D(v, SSE2_FRAC);
+	for (i = 0; i < DCTSIZE; i++)
+		v[i] = _mm_srai_epi16(v[i], IDCT_DESCALE);
+	sse2_transpose_8x8(v);
+
+	for (i = 0; i < DCTSIZE; i += 2) {
+		__m128i p = _mm_xor_si128(_mm_packs_epi16(v[i], v[i + 1]), center);
+
+		_mm_storel_epi64((__m128i *)(output_buf + i * stride), p);
+		_mm_storel_epi64((__m128i *)(output_buf + (i + 1) * stride),
+				 _mm_srli_si128(p, 8));
+	}
+}
+
+#undef VEC
+#undef ADD
+#undef SUB
+
+/* add_r, add_g and add_b >> SCALEBITS of 8 Cb / Cr samples, see
+   YCrCB_to_RGB24_1x1() in tinyjpeg.c */
+static inline SSE2 void sse2_chroma(const uint8_t *Cb, const uint8_t *Cr,
+		__m128i *add_r, __m128i *add_g, __m128i *add_b)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c128 = _mm_set1_epi16(128);
+	const __m128i half = _mm_set1_epi32(ONE_HALF);
+	const __m128i k_r = _mm_setr_epi16(0, FIX(1.40200), 0, FIX(1.40200),
+			0, FIX(1.40200), 0, FIX(1.40200));
+	const __m128i k_g = _mm_setr_epi16(-FIX(0.34414), -FIX(0.71414),
+			-FIX(0.34414), -FIX(0.71414), -FIX(0.34414), -FIX(0.71414),
+			-FIX(0.34414), -FIX(0.71414));
+	const __m128i k_b = _mm_setr_epi16(FIX(1.77200), 0, FIX(1.77200), 0,
+			FIX(1.77200), 0, FIX(1.77200), 0);
+	__m128i cb = _mm_sub_epi16(_mm_unpacklo_epi8(
+			_mm_loadl_epi64((const __m128i *)Cb), zero), c128);
+	__m128i cr = _mm_sub_epi16(_mm_unpacklo_epi8(
+			_mm_loadl_epi64((const __m128i *)Cr), zero), c128);
+	__m128i lo = _mm_unpacklo_epi16(cb, cr);
+	__m128i hi = _mm_unpackhi_epi16(cb, cr);
+
+#define SSE2_CHROMA(k) _mm_packs_epi32( \
+	_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lo, k), half), SCALEBITS), \
+	_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(hi, k), half), SCALEBITS))
+	*add_r = SSE2_CHROMA(k_r);
+	*add_g = SSE2_CHROMA(k_g);
+	*add_b = SSE2_CHROMA(k_b);
+#undef SSE2_CHROMA
+}
+
+/* Convert 16 Y samples sharing 8 horizontally subsampled chroma samples */
+static inline SSE2 void sse2_line_2x(const uint8_t *Y, __m128i add_r,
+		__m128i add_g, __m128i add_b, unsigned char *p, int bgr)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i y = _mm_loadu_si128((const __m128i *)Y);
+	__m128i y_lo = _mm_unpacklo_epi8(y, zero);
+	__m128i y_hi = _mm_unpackhi_epi8(y, zero);
+	__m128i r, g, b;
+
+#define SSE2_UPSAMPLE_ADD(add) _mm_packus_epi16( \
+	_mm_add_epi16(y_lo, _mm_unpacklo_epi16(add, add)), \
+	_mm_add_epi16(y_hi, _mm_unpackhi_epi16(add, add)))
+	r = SSE2_UPSAMPLE_ADD(add_r);
+	g = SSE2_UPSAMPLE_ADD(add_g);
+	b = SSE2_UPSAMPLE_ADD(add_b);
+#undef SSE2_UPSAMPLE_ADD
+
+	if (bgr)
+		sse2_store_rgb24(p, b, g, r);
+	else
+		sse2_store_rgb24(p, r, g, b);
+}
+
+static inline SSE2 void sse2_ycc_2x1(struct jdec_private *priv, int bgr)
+{
+	unsigned char *p = priv->plane[0];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		__m128i add_r, add_g, add_b;
+
+		sse2_chroma(priv->Cb + 8 * i, priv->Cr + 8 * i,
+			    &add_r, &add_g, &add_b);
+		sse2_line_2x(priv->Y + 16 * i, add_r, add_g, add_b, p, bgr);
+		p += priv->width * 3;
+	}
+}
+
+static inline SSE2 void sse2_ycc_2x2(struct jdec_private *priv, int bgr)
+{
+	unsigned char *p = priv->plane[0];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		__m128i add_r, add_g, add_b;
+
+		sse2_chroma(priv->Cb + 8 * i, priv->Cr + 8 * i,
+			    &add_r, &add_g, &add_b);
+		sse2_line_2x(priv->Y + 32 * i, add_r, add_g, add_b, p, bgr);
+		p += priv->width * 3;
+		sse2_line_2x(priv->Y + 32 * i + 16, add_r, add_g, add_b, p, bgr);
+		p += priv->width * 3;
+	}
+}
+
+static SSE2 void YCrCB_to_RGB24_2x1_sse2(struct jdec_private *priv)
+{
+	sse2_ycc_2x1(priv, 0);
+}
+
+static SSE2 void YCrCB_to_BGR24_2x1_sse2(struct jdec_private *priv)
+{
+	sse2_ycc_2x1(priv, 1);
+}
+
+static SSE2 void YCrCB_to_RGB24_2x2_sse2(struct jdec_private *priv)
+{
+	sse2_ycc_2x2(priv, 0);
+}
+
+static SSE2 void YCrCB_to_BGR24_2x2_sse2(struct jdec_private *priv)
+{
+	sse2_ycc_2x2(priv, 1);
+}
+
+static const struct tinyjpeg_simd_ops tinyjpeg_sse2_ops = {
+	.idct = tinyjpeg_idct_ifast_sse2,
+	.rgb24 = { NULL, NULL, YCrCB_to_RGB24_2x1_sse2, YCrCB_to_RGB24_2x2_sse2 },
+	.bgr24 = { NULL, NULL, YCrCB_to_BGR24_2x1_sse2, YCrCB_to_BGR24_2x2_sse2 },
+};
+
+#endif /* HAVE_SIMD_X86 */
+
+#ifdef HAVE_SIMD_NEON
+
+#define VEC int16x8_t
+#define ADD vaddq_s16
+#define SUB vsubq_s16
+/* (x * frac) >> 8 */
+#define NEON_FRAC(x, frac) vqdmulhq_n_s16(x, (frac) * 128)
+
+static inline void neon_transpose_8x8(int16x8_t v[8])
+{
+	int16x8x2_t t0 = vtrnq_s16(v[0], v[1]);
+	int16x8x2_t t1 = vtrnq_s16(v[2], v[3]);
+	int16x8x2_t t2 = vtrnq_s16(v[4], v[5]);
+	int16x8x2_t t3 = vtrnq_s16(v[6], v[7]);
+	int32x4x2_t u0 = vtrnq_s32(vreinterpretq_s32_s16(t0.val[0]),
+				   vreinterpretq_s32_s16(t1.val[0]));
+	int32x4x2_t u1 = vtrnq_s32(vreinterpretq_s32_s16(t0.val[1]),
+				   vreinterpretq_s32_s16(t1.val[1]));
+	int32x4x2_t u2 = vtrnq_s32(vreinterpretq_s32_s16(t2.val[0]),
+				   vreinterpretq_s32_s16(t3.val[0]));
+	int32x4x2_t u3 = vtrnq_s32(vreinterpretq_s32_s16(t2.val[1]),
+				   vreinterpretq_s32_s16(t3.val[1]));
+
+#define NEON_LOW(x)  vget_low_s16(vreinterpretq_s16_s32(x))
+#define NEON_HIGH(x) vget_high_s16(vreinterpretq_s16_s32(x))
+	v[0] = vcombine_s16(NEON_LOW(u0.val[0]), NEON_LOW(u2.val[0]));
+	v[4] = vcombine_s16(NEON_HIGH(u0.val[0]), NEON_HIGH(u2.val[0]));
+	v[2] = vcombine_s16(NEON_LOW(u0.val[1]), NEON_LOW(u2.val[1]));
+	v[6] = vcombine_s16(NEON_HIGH(u0.val[1]), NEON_HIGH(u2.val[1]));
+	v[1] = vcombine_s16(NEON_LOW(u1.val[0]), NEON_LOW(u3.val[0]));
+	v[5] = vcombine_s16(NEON_HIGH(u1.val[0]), NEON_HIGH(u3.val[0]));
+	v[3] = vcombine_s16(NEON_LOW(u1.val[1]), NEON_LOW(u3.val[1]));
+	v[7] = vcombine_s16(NEON_HIGH(u1.val[1]), NEON_HIGH(u3.val[1]));
+#undef NEON_LOW
+#undef NEON_HIGH
+}
+
+static void tinyjpeg_idct_ifast_neon(struct component *compptr,
+		uint8_t *output_buf, int stride)
+{
+	const int16x8_t center = vdupq_n_s16(128);
+	int16x8_t v[8], ac;
+	int i;
+
+	for (i = 0; i < DCTSIZE; i++)
+		v[i] = vld1q_s16(compptr->DCT + DCTSIZE * i);
+
+	/* Blocks with only a DC term are common, they are a single color */
+	ac = vorrq_s16(vorrq_s16(vorrq_s16(v[1], v[2]), vorrq_s16(v[3], v[4])),
+		       vorrq_s16(vorrq_s16(v[5], v[6]), v[7]));
+	ac = vorrq_s16(ac, vsetq_lane_s16(0, v[0], 0));
+	if (vmaxvq_u16(vreinterpretq_u16_s16(ac)) == 0) {
+		int16x8_t dc = vdupq_n_s16((int16_t)(compptr->DCT[0] *
+						     compptr->IQ_table[0] + IDCT_ROUND));
+		uint8x8_t p = vqmovun_s16(vaddq_s16(
+				vshrq_n_s16(dc, IDCT_DESCALE), center));
+
+		for (i = 0; i < DCTSIZE; i++)
+			vst1_u8(output_buf + i * stride, p);
+		return;
+	}
+
+	for (i = 0; i < DCTSIZE; i++)
+		v[i] = vmulq_s16(v[i], vld1q_s16(compptr->IQ_table + DCTSIZE * i));
+
+	/* Pass 1: process columns, each vector holds 1 row of all 8 columns */
+	IDCT_1D(v, NEON_FRAC);
+	neon_transpose_8x8(v);
+
+	/* Pass 2: process rows */
+	v[0] = vaddq_s16(v[0], vdupq_n_s16(IDCT_ROUND));
+	IDCT_1D(v, NEON_FRAC);
+	for (i = 0; i < DCTSIZE; i++)
+		v[i] = vshrq_n_s16(v[i], IDCT_DESCALE);
+	neon_transpose_8x8(v);
+
+	for (i = 0; i < DCTSIZE; i++)
+		vst1_u8(output_buf + i * stride,
+			vqmovun_s16(vaddq_s16(v[i], center)));
+}
+
+#undef VEC
+#undef ADD
+#undef SUB
+
+/* add_r, add_g and add_b >> SCALEBITS of 8 Cb / Cr samples, see
+   YCrCB_to_RGB24_1x1() in tinyjpeg.c, vrshrn adds ONE_HALF */
+static inline void neon_chroma(const uint8_t *Cb, const uint8_t *Cr,
+		int16x8_t *add_r, int16x8_t *add_g, int16x8_t *add_b)
+{
+	const uint8x8_t c128 = vdup_n_u8(128);
+	int16x8_t cb = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(Cb), c128));
+	int16x8_t cr = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(Cr), c128));
+	int16x4_t cb_lo = vget_low_s16(cb), cb_hi = vget_high_s16(cb);
+	int16x4_t cr_lo = vget_low_s16(cr), cr_hi = vget_high_s16(cr);
+
+	*add_r = vcombine_s16(
+		vrshrn_n_s32(vmull_n_s16(cr_lo, FIX(1.40200)), SCALEBITS),
+		vrshrn_n_s32(vmull_n_s16(cr_hi, FIX(1.40200)), SCALEBITS));
+	*add_g = vcombine_s16(
+		vrshrn_n_s32(vmlal_n_s16(vmull_n_s16(cb_lo, -FIX(0.34414)),
+					 cr_lo, -FIX(0.71414)), SCALEBITS),
+		vrshrn_n_s32(vmlal_n_s16(vmull_n_s16(cb_hi, -FIX(0.34414)),
+					 cr_hi, -FIX(0.71414)), SCALEBITS));
+	*add_b = vcombine_s16(
+		vrshrn_n_s32(vmull_n_s16(cb_lo, FIX(1.77200)), SCALEBITS),
+		vrshrn_n_s32(vmull_n_s16(cb_hi, FIX(1.77200)), SCALEBITS));
+}
+
+/* Convert 16 Y samples sharing 8 horizontally subsampled chroma samples */
+static inline void neon_line_2x(const uint8_t *Y, int16x8_t add_r,
+		int16x8_t add_g, int16x8_t add_b, unsigned char *p, int bgr)
+{
+	uint8x16_t y = vld1q_u8(Y);
+	int16x8_t y_lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(y)));
+	int16x8_t y_hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(y)));
+	int16x8x2_t r = vzipq_s16(add_r, add_r);
+	int16x8x2_t g = vzipq_s16(add_g, add_g);
+	int16x8x2_t b = vzipq_s16(add_b, add_b);
+	uint8x16x3_t out;
+
+#define NEON_ADD(add) vcombine_u8(vqmovun_s16(vaddq_s16(y_lo, add.val[0])), \
+				  vqmovun_s16(vaddq_s16(y_hi, add.val[1])))
+	out.val[bgr ? 2 : 0] = NEON_ADD(r);
+	out.val[1] = NEON_ADD(g);
+	out.val[bgr ? 0 : 2] = NEON_ADD(b);
+#undef NEON_ADD
+
+	vst3q_u8(p, out);
+}
+
+static inline void neon_ycc_2x1(struct jdec_private *priv, int bgr)
+{
+	unsigned char *p = priv->plane[0];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		int16x8_t add_r, add_g, add_b;
+
+		neon_chroma(priv->Cb + 8 * i, priv->Cr + 8 * i,
+			    &add_r, &add_g, &add_b);
+		neon_line_2x(priv->Y + 16 * i, add_r, add_g, add_b, p, bgr);
+		p += priv->width * 3;
+	}
+}
+
+static inline void neon_ycc_2x2(struct jdec_private *priv, int bgr)
+{
+	unsigned char *p = priv->plane[0];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		int16x8_t add_r, add_g, add_b;
+
+		neon_chroma(priv->Cb + 8 * i, priv->Cr + 8 * i,
+			    &add_r, &add_g, &add_b);
+		neon_line_2x(priv->Y + 32 * i, add_r, add_g, add_b, p, bgr);
+		p += priv->width * 3;
+		neon_line_2x(priv->Y + 32 * i + 16, add_r, add_g, add_b, p, bgr);
+		p += priv->width * 3;
+	}
+}
+
+static void YCrCB_to_RGB24_2x1_neon(struct jdec_private *priv)
+{
+	neon_ycc_2x1(priv, 0);
+}
+
+static void YCrCB_to_BGR24_2x1_neon(struct jdec_private *priv)
+{
+	neon_ycc_2x1(priv, 1);
+}
+
+static void YCrCB_to_RGB24_2x2_neon(struct jdec_private *priv)
+{
+	neon_ycc_2x2(priv, 0);
+}
+
+static void YCrCB_to_BGR24_2x2_neon(struct jdec_private *priv)
+{
+	neon_ycc_2x2(priv, 1);
+}
+
+static const struct tinyjpeg_simd_ops tinyjpeg_neon_ops = {
+	.idct = tinyjpeg_idct_ifast_neon,
+	.rgb24 = { NULL, NULL, YCrCB_to_RGB24_2x1_neon, YCrCB_to_RGB24_2x2_neon },
+	.bgr24 = { NULL, NULL, YCrCB_to_BGR24_2x1_neon, YCrCB_to_BGR24_2x2_neon },
+};
+
+#endif /* HAVE_SIMD_NEON */
+
+static const struct tinyjpeg_simd_ops tinyjpeg_c_ops = {
+	.idct = tinyjpeg_idct_float,
+};
+
+const struct tinyjpeg_simd_ops *tinyjpeg_get_simd_ops(void)
+{
+#ifdef HAVE_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		return &tinyjpeg_sse2_ops;
+#endif
+#ifdef HAVE_SIMD_NEON
+	/* Advanced SIMD is mandatory on aarch64 */
+	return &tinyjpeg_neon_ops;
+#endif
+	return &tinyjpeg_c_ops;
+}
@@ -134,6 +134,19 @@ static const unsigned char zigzag[64] = {
 	35, 36, 48, 49, 57, 58, 62, 63
 };
 
+/* Inverse of zigzag[]: the natural position of the n-th coefficient in the
+ * stream, so that the huffman decoder can store them in place */
+static const unsigned char dezigzag[64] = {
+	 0,  1,  8, 16,  9,  2,  3, 10,
+	17, 24, 32, 25, 18, 11,  4,  5,
+	12, 19, 26, 33, 40, 48, 41, 34,
+	27, 20, 13,  6,  7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36,
+	29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46,
+	53, 60, 61, 54, 47, 55, 62, 63,
+};
+
 /* Set up the standard Huffman tables (cf. JPEG standard section K.3) */
 /* IMPORTANT: these are only valid for 8-bit data precision! */
 static const unsigned char bits_dc_luminance[17] = {
@@ -312,16 +325,16 @@ static void resync(struct jdec_private *priv);
  * To speedup the procedure, we look HUFFMAN_HASH_NBITS bits and the code is
  * lower than HUFFMAN_HASH_NBITS we have automaticaly the length of the code
  * and the value by using two lookup table.
- * Else if the value is not found, just search (linear) into an array for each
- * bits is the code is present.
+ * Else if the value is not found, we try each longer code length, the codes
+ * of a length are consecutive, so 1 compare against the largest code of that
+ * length tells if the code has that length.
  *
  * If the code is not present for any reason, -1 is return.
  */
 static int get_next_huffman_code(struct jdec_private *priv, struct huffman_table *huffman_table)
 {
 	int value, hcode;
-	unsigned int extra_nbits, nbits;
-	uint16_t *slowtable;
+	unsigned int nbits;
 
 	look_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, HUFFMAN_HASH_NBITS, hcode);
 	value = huffman_table->lookup[hcode];
@@ -333,18 +346,11 @@ static int get_next_huffman_code(struct jdec_private *priv, struct huffman_table
 	}
 
 	/* Decode more bits each time ... */
-	for (extra_nbits = 0; extra_nbits < 16 - HUFFMAN_HASH_NBITS; extra_nbits++) {
-		nbits = HUFFMAN_HASH_NBITS + 1 + extra_nbits;
-
+	for (nbits = HUFFMAN_HASH_NBITS + 1; nbits <= 16; nbits++) {
 		look_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, nbits, hcode);
-		slowtable = huffman_table->slowtable[extra_nbits];
-		/* Search if the code is in this array */
-		while (slowtable[0]) {
-			if (slowtable[0] == hcode) {
-				skip_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, nbits);
-				return slowtable[1];
-			}
-			slowtable += 2;
+		if (hcode <= huffman_table->maxcode[nbits]) {
+			skip_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, nbits);
+			return huffman_table->vals[huffman_table->valoffset[nbits] + hcode];
 		}
 	}
 	snprintf(priv->error_string, sizeof(priv->error_string),
@@ -356,7 +362,7 @@ static int get_next_huffman_code(struct jdec_private *priv, struct huffman_table
 /**
  *
  * Decode a single block that contains the DCT coefficients.
- * The table coefficients is already dezigzaged at the end of the operation.
+ * The coefficients get stored dezigzaged straight away.
  *
  */
 static void process_Huffman_data_unit(struct jdec_private *priv, int component)
@@ -364,18 +370,20 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
 	unsigned char j;
 	unsigned int huff_code;
 	unsigned char size_val, count_0;
+	int value;
 
 	struct component *c = &priv->component_infos[component];
-	short int DCT[64];
+	const short int *fast_ac = c->AC_table->fast_ac;
+	short int *DCT = c->DCT;
 
 	/* Initialize the DCT coef table */
-	memset(DCT, 0, sizeof(DCT));
+	memset(c->DCT, 0, sizeof(c->DCT));
 
 	/* DC coefficient decoding */
 	huff_code = get_next_huffman_code(priv, c->DC_table);
 	if (huff_code) {
-		get_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, huff_code, DCT[0]);
-		DCT[0] += c->previous_DC;
+		get_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, huff_code, value);
+		DCT[0] = value + c->previous_DC;
 		c->previous_DC = DCT[0];
 	} else {
 		DCT[0] = c->previous_DC;
@@ -385,6 +393,19 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
 	/* AC coefficient decoding */
 	j = 1;
 	while (j < 64) {
+		/* Most codes and their extra bits fit in HUFFMAN_HASH_NBITS */
+		look_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, HUFFMAN_HASH_NBITS, value);
+		value = fast_ac[value];
+		if (value) {
+			skip_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, value & 0xF);
+			j += (value >> 4) & 0xF;	/* skip count_0 zeroes */
+			if (j < 64) {
+				DCT[dezigzag[j]] = value >> 8;
+				j++;
+			}
+			continue;
+		}
+
 		huff_code = get_next_huffman_code(priv, c->AC_table);
 
 		size_val = huff_code & 0xF;
@@ -398,7 +419,8 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
 		} else {
 			j += count_0;	/* skip count_0 zeroes */
 			if (j < 64) {
-				get_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, size_val, DCT[j]);
+				get_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, size_val, value);
+				DCT[dezigzag[j]] = value;
 				j++;
 			}
 		}
@@ -409,9 +431,6 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
 				"error: more than 63 AC components (%d) in huffman unit\n", (int)j);
 		longjmp(priv->jump_state, -EIO);
 	}
-
-	for (j = 0; j < 64; j++)
-		c->DCT[j] = DCT[zigzag[j]];
 }
 
 /*
@@ -419,19 +438,26 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
  *
  * lookup will return the symbol if the code is less or equal than HUFFMAN_HASH_NBITS.
  * code_size will be used to known how many bits this symbol is encoded.
- * slowtable will be used when the first lookup didn't give the result.
+ * fast_ac will give the decoded AC coefficient if the code and its extra bits
+ * together are less or equal than HUFFMAN_HASH_NBITS.
+ * maxcode and valoffset will be used when the first lookup didn't give the result.
  */
 static int build_huffman_table(struct jdec_private *priv, const unsigned char *bits, const unsigned char *vals, struct huffman_table *table)
 {
-	unsigned int i, j, code, code_size, val, nbits;
+	unsigned int i, j, code, code_size, val, nbits, count;
 	unsigned char huffsize[257], *hz;
 	unsigned int huffcode[257], *hc;
-	int slowtable_used[16 - HUFFMAN_HASH_NBITS];
 
 	/*
 	 * Build a temp array
 	 *   huffsize[X] => numbers of bits to write vals[X]
 	 */
+	count = 0;
+	for (i = 1; i <= 16; i++)
+		count += bits[i];
+	if (count > 256)
+		error("Huffman table with %u symbols\n", count);
+
 	hz = huffsize;
 	for (i = 1; i <= 16; i++) {
 		for (j = 1; j <= bits[i]; j++)
@@ -440,8 +466,6 @@ static int build_huffman_table(struct jdec_private *priv, const unsigned char *b
 	*hz = 0;
 
 	memset(table->lookup, 0xff, sizeof(table->lookup));
-	for (i = 0; i < (16 - HUFFMAN_HASH_NBITS); i++)
-		slowtable_used[i] = 0;
 
 	/* Build a temp array
 	 *   huffcode[X] => code used to write vals[X]
@@ -460,8 +484,12 @@ static int build_huffman_table(struct jdec_private *priv, const unsigned char *b
 	}
 
 	/*
-	 * Build the lookup table, and the slowtable if needed.
+	 * Build the lookup table, and the tables for the longer codes.
 	 */
+	for (i = 0; i <= 16; i++)
+		table->maxcode[i] = -1;
+	memcpy(table->vals, vals, count);
+
 	for (i = 0; huffsize[i]; i++) {
 		val = vals[i];
 		code = huffcode[i];
@@ -482,22 +510,39 @@ static int build_huffman_table(struct jdec_private *priv, const unsigned char *b
 				table->lookup[code++] = val;
 
 		} else {
-			/* Perhaps sorting the array will be an optimization */
-			int slowtable_index = code_size - HUFFMAN_HASH_NBITS - 1;
-
-			if (slowtable_used[slowtable_index] == 254)
-				error("slow Huffman table overflow\n");
-
-			table->slowtable[slowtable_index][slowtable_used[slowtable_index]]
-				= code;
-			table->slowtable[slowtable_index][slowtable_used[slowtable_index] + 1]
-				= val;
-			slowtable_used[slowtable_index] += 2;
+			/* Codes of 1 length are consecutive, and so are their vals */
+			if (table->maxcode[code_size] == -1)
+				table->valoffset[code_size] = i - code;
+			table->maxcode[code_size] = code;
 		}
 	}
 
-	for (i = 0; i < (16 - HUFFMAN_HASH_NBITS); i++)
-		table->slowtable[i][slowtable_used[i]] = 0;
+	/*
+	 * Build the fast AC table: run << 4 | size in the symbol, followed by size
+	 * bits giving the coefficient value
+	 */
+	for (i = 0; i < HUFFMAN_HASH_SIZE; i++) {
+		int value, run, size;
+
+		table->fast_ac[i] = 0;
+		if (table->lookup[i] < 0)
+			continue;
+
+		val = table->lookup[i];
+		code_size = table->code_size[val];
+		run = val >> 4;
+		size = val & 0xF;
+		if (size == 0 || code_size + size > HUFFMAN_HASH_NBITS)
+			continue;
+
+		value = (i >> (HUFFMAN_HASH_NBITS - code_size - size)) & ((1 << size) - 1);
+		if (value < (1 << (size - 1)))
+			value -= (1 << size) - 1;
+		if (value < -128 || value > 127)
+			continue;
+
+		table->fast_ac[i] = value * 256 + run * 16 + code_size + size;
+	}
 
 	return 0;
 }
@@ -1380,7 +1425,8 @@ static void decode_MCU_2x1_3planes(struct jdec_private *priv)
 	IDCT(&priv->component_infos[cCr], priv->Cr, 8);
 }
 
-static void build_quantization_table(float *qtable, const unsigned char *ref_table);
+static void build_quantization_table(struct jdec_private *priv, int qi,
+		const unsigned char *ref_table);
 
 static void pixart_decode_MCU_2x1_3planes(struct jdec_private *priv)
 {
@@ -1465,7 +1511,7 @@ static void pixart_decode_MCU_2x1_3planes(struct jdec_private *priv)
 			j = (pixart_q[lumi][i] * comp + 50) / 100;
 			qt[i] = (j < 255) ? j : 255;
 		}
-		build_quantization_table(priv->Q_tables[0], qt);
+		build_quantization_table(priv, 0, qt);
 
 		/* If bit 7 of the marker is set chrominance uses the
 		   luminance quantization table */
@@ -1476,7 +1522,7 @@ static void pixart_decode_MCU_2x1_3planes(struct jdec_private *priv)
 				qt[i] = (j < 255) ? j : 255;
 			}
 		}
-		build_quantization_table(priv->Q_tables[1], qt);
+		build_quantization_table(priv, 1, qt);
 
 		priv->marker = marker;
 	}
@@ -1657,7 +1703,16 @@ static void print_SOF(const unsigned char *stream)
  *
  ******************************************************************************/
 
-static void build_quantization_table(float *qtable, const unsigned char *ref_table)
+static void select_idct(struct jdec_private *priv)
+{
+	if ((priv->flags & TINYJPEG_FLAGS_ACCURATE_IDCT) || priv->fine_Q_tables)
+		priv->idct = tinyjpeg_idct_float;
+	else
+		priv->idct = priv->simd->idct;
+}
+
+static void build_quantization_table(struct jdec_private *priv, int qi,
+		const unsigned char *ref_table)
 {
 	/* Taken from libjpeg. Copyright Independent JPEG Group's LLM idct.
 	 * For float AA&N IDCT method, divisors are equal to quantization
@@ -1667,6 +1722,8 @@ static void build_quantization_table(float *qtable, const unsigned char *ref_tab
 	 * We apply a further scale factor of 8.
 	 * What's actually stored is 1/divisor so that the inner loop can
 	 * use a multiplication rather than a division.
+	 * The integer IDCT gets the same table with TINYJPEG_IFAST_PASS1_BITS
+	 * fractional bits.
 	 */
 	int i, j;
 	static const double aanscalefactor[8] = {
@@ -1674,17 +1731,28 @@ static void build_quantization_table(float *qtable, const unsigned char *ref_tab
 		1.0, 0.785694958, 0.541196100, 0.275899379
 	};
 	const unsigned char *zz = zigzag;
+	float *qtable = priv->Q_tables[qi];
+	int16_t *iqtable = priv->IQ_tables[qi];
+	unsigned int sum = 0;
 
-	for (i = 0; i < 8; i++)
-		for (j = 0; j < 8; j++)
-			*qtable++ = ref_table[*zz++] * aanscalefactor[i] * aanscalefactor[j];
+	for (i = 0; i < 8; i++) {
+		for (j = 0; j < 8; j++) {
+			sum += ref_table[*zz];
+			*qtable = ref_table[*zz++] * aanscalefactor[i] * aanscalefactor[j];
+			*iqtable++ = *qtable++ * (1 << TINYJPEG_IFAST_PASS1_BITS) + 0.5;
+		}
+	}
 
+	if (sum < 64 * TINYJPEG_IFAST_MIN_QUANT)
+		priv->fine_Q_tables |= 1 << qi;
+	else
+		priv->fine_Q_tables &= ~(1 << qi);
+	select_idct(priv);
 }
 
 static int parse_DQT(struct jdec_private *priv, const unsigned char *stream)
 {
 	int qi;
-	float *table;
 	const unsigned char *dqt_block_end;
 
 	trace("> DQT marker\n");
@@ -1700,8 +1768,7 @@ static int parse_DQT(struct jdec_private *priv, const unsigned char *stream)
 			error("No more than %d quantization tables supported (got %d)\n",
 					COMPONENTS, qi + 1);
 #endif
-		table = priv->Q_tables[qi];
-		build_quantization_table(table, stream);
+		build_quantization_table(priv, qi, stream);
 		stream += 64;
 	}
 	trace("< DQT marker\n");
@@ -1744,6 +1811,7 @@ static int parse_SOF(struct jdec_private *priv, const unsigned char *stream)
 		c->Vfactor = sampling_factor & 0xf;
 		c->Hfactor = sampling_factor >> 4;
 		c->Q_table = priv->Q_tables[Q_table];
+		c->IQ_table = priv->IQ_tables[Q_table];
 		trace("Component:%d  factor:%dx%d  Quantization table:%d\n",
 				cid, c->Hfactor, c->Hfactor, Q_table);
 
@@ -1980,6 +2048,10 @@ static int parse_JFIF(struct jdec_private *priv, const unsigned char *stream)
 	int dht_marker_found = 0;
 	const unsigned char *next_chunck;
 
+	/* parse_DQT() may switch to the float IDCT */
+	priv->fine_Q_tables = 0;
+	select_idct(priv);
+
 	/* Parse marker */
 	while (!sos_marker_found) {
 		if (*stream++ != 0xff)
@@ -2081,6 +2153,7 @@ struct jdec_private *tinyjpeg_init(void)
 	priv = (struct jdec_private *)calloc(1, sizeof(struct jdec_private));
 	if (priv == NULL)
 		return NULL;
+	priv->simd = tinyjpeg_get_simd_ops();
 	return priv;
 }
 
@@ -2101,6 +2174,10 @@ void tinyjpeg_free(struct jdec_private *priv)
 	}
 	priv->tmp_buf_y_size = 0;
 	free(priv->stream_filtered);
+	free(priv->restart_starts);
+	for (i = 0; i < priv->bands_size; i++)
+		free(priv->bands[i].priv);
+	free(priv->bands);
 	free(priv);
 }
 
@@ -2236,6 +2313,193 @@ kernel: 0xff 0xff 0x00 0xff 0x96, and we skip one unknown byte */
  *
  * Note: components will be automaticaly allocated if no memory is attached.
  */
+/*
+ * Parallel decoding of restart intervals.
+ *
+ * The DC predictors and the bit reader get reset at every restart marker, so
+ * the restart intervals can be decoded independently of each other. We find
+ * the start of each interval with a quick scan for the RST markers and then
+ * let the run function set with tinyjpeg_set_run_fct() decode bands of
+ * intervals on several threads, each band with its own copy of the decoder
+ * state, writing its MCUs straight into the output buffer.
+ */
+
+struct tinyjpeg_parallel_job {
+	struct jdec_private *priv;
+	const unsigned char **starts;	/* Start of each restart interval */
+	decode_MCU_fct decode_MCU;
+	convert_colorspace_fct convert_to_pixfmt;
+	int count;			/* Number of restart intervals */
+	unsigned int mcus_per_row, mcus;
+	unsigned int *bytes_per_blocklines, *bytes_per_mcu;
+};
+
+/* Find the start of the first count restart intervals, returns -1 if
+   the markers are not where they should be */
+static int find_restart_intervals(struct jdec_private *priv,
+		const unsigned char **starts, int count)
+{
+	const unsigned char *stream = priv->stream;
+	const unsigned char *end = priv->stream_end;
+	int n = 1;
+
+	starts[0] = stream;
+	while (n < count) {
+		stream = memchr(stream, 0xff, end - stream);
+		if (stream == NULL)
+			return -1;
+		/* Skip the ff and any padding ff bytes */
+		do {
+			if (++stream >= end)
+				return -1;
+		} while (*stream == 0xff);
+
+		if (*stream == 0x00)	/* Stuffed 0xff data byte */
+			continue;
+		if (*stream != RST + ((n - 1) & 7))
+			return -1;
+		starts[n++] = ++stream;
+	}
+	return 0;
+}
+
+static void decode_restart_intervals(void *arg, int band, int first,
+		int last)
+{
+	struct tinyjpeg_parallel_job *job = arg;
+	struct tinyjpeg_band *b = &job->priv->bands[band];
+	struct jdec_private *priv;
+	unsigned int i, mcu, end;
+	int c;
+
+	if (b->priv == NULL) {
+		b->priv = malloc(sizeof(*b->priv));
+		if (b->priv == NULL) {
+			b->result = -ENOMEM;
+			return;
+		}
+	}
+
+	/* Our own copy of the (read only) tables and the decoder state */
+	priv = b->priv;
+	memcpy(priv, job->priv, sizeof(*priv));
+	if (setjmp(priv->jump_state)) {
+		b->result = -EIO;
+		return;
+	}
+
+	for (i = first; i < (unsigned int)last; i++) {
+		priv->stream = job->starts[i];
+		resync(priv);
+
+		mcu = i * priv->restart_interval;
+		end = mcu + priv->restart_interval;
+		if (end > job->mcus)
+			end = job->mcus;
+
+		for (; mcu < end; mcu++) {
+			if (mcu == i * priv->restart_interval ||
+			    mcu % job->mcus_per_row == 0) {
+				unsigned int x = mcu % job->mcus_per_row;
+				unsigned int y = mcu / job->mcus_per_row;
+
+				for (c = 0; c < COMPONENTS; c++)
+					priv->plane[c] = priv->components[c] +
+						y * job->bytes_per_blocklines[c] +
+						x * job->bytes_per_mcu[c];
+			}
+			job->decode_MCU(priv);
+			job->convert_to_pixfmt(priv);
+			for (c = 0; c < COMPONENTS; c++)
+				priv->plane[c] += job->bytes_per_mcu[c];
+		}
+
+		/* Like the single threaded decoder, see if the data of this
+		   interval ended before the next RST marker */
+		if ((int)i + 1 < job->count &&
+		    priv->stream - priv->nbits_in_reservoir / 8 >
+		    job->starts[i + 1] - 2) {
+			snprintf(priv->error_string, sizeof(priv->error_string),
+				 "Wrong Reset marker found, abording\n");
+			b->result = -EIO;
+			return;
+		}
+	}
+	b->result = 0;
+}
+
+/* Returns 1 if the image cannot be decoded in parallel */
+static int tinyjpeg_decode_parallel(struct jdec_private *priv,
+		decode_MCU_fct decode_MCU, convert_colorspace_fct convert_to_pixfmt,
+		unsigned int xstride_by_mcu, unsigned int ystride_by_mcu,
+		unsigned int *bytes_per_blocklines, unsigned int *bytes_per_mcu)
+{
+	struct tinyjpeg_parallel_job job = {
+		.priv = priv,
+		.decode_MCU = decode_MCU,
+		.convert_to_pixfmt = convert_to_pixfmt,
+		.bytes_per_blocklines = bytes_per_blocklines,
+		.bytes_per_mcu = bytes_per_mcu,
+	};
+	int i, count;
+
+	if (priv->run == NULL || priv->restart_interval <= 0 ||
+	    (priv->flags & TINYJPEG_FLAGS_PIXART_JPEG))
+		return 1;
+
+	/* The colorspace conversion writes whole MCUs, if the last one in a
+	   row sticks out it overwrites pixels of the next row */
+	if (priv->width % xstride_by_mcu)
+		return 1;
+
+	job.mcus_per_row = priv->width / xstride_by_mcu;
+	job.mcus = job.mcus_per_row * (priv->height / ystride_by_mcu);
+	count = (job.mcus + priv->restart_interval - 1) / priv->restart_interval;
+	job.count = count;
+	if (count < 2)
+		return 1;
+
+	job.starts = (const unsigned char **)v4lconvert_alloc_buffer(
+			count * sizeof(*job.starts), &priv->restart_starts,
+			&priv->restart_starts_size);
+	if (job.starts == NULL)
+		error("Out of memory!\n");
+
+	/* Leave broken streams to the normal decoder, which can deal with
+	   missing markers */
+	if (find_restart_intervals(priv, job.starts, count))
+		return 1;
+
+	if (count > priv->bands_size) {
+		struct tinyjpeg_band *bands;
+
+		bands = realloc(priv->bands, count * sizeof(*bands));
+		if (bands == NULL)
+			error("Out of memory!\n");
+		memset(bands + priv->bands_size, 0,
+		       (count - priv->bands_size) * sizeof(*bands));
+		priv->bands = bands;
+		priv->bands_size = count;
+	}
+	/* The run function uses no more bands then it has threads, so the
+	   bands allocate their decoder copies on demand */
+	for (i = 0; i < count; i++)
+		priv->bands[i].result = 1;
+
+	priv->run(priv->run_opaque, decode_restart_intervals, &job, count);
+
+	for (i = 0; i < count && priv->bands[i].result != 1; i++) {
+		if (priv->bands[i].result == -ENOMEM)
+			error("Out of memory!\n");
+		if (priv->bands[i].result) {
+			memcpy(priv->error_string, priv->bands[i].priv->error_string,
+			       sizeof(priv->error_string));
+			return -1;
+		}
+	}
+	return 0;
+}
+
 int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 {
 	unsigned int x, y, xstride_by_mcu, ystride_by_mcu;
@@ -2243,7 +2507,9 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 	decode_MCU_fct decode_MCU;
 	const decode_MCU_fct *decode_mcu_table;
 	const convert_colorspace_fct *colorspace_array_conv;
+	const convert_colorspace_fct *simd_array_conv = NULL;
 	convert_colorspace_fct convert_to_pixfmt;
+	int sampling, result;
 
 	if (setjmp(priv->jump_state))
 		return -1;
@@ -2298,6 +2564,7 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 
 	case TINYJPEG_FMT_RGB24:
 		colorspace_array_conv = convert_colorspace_rgb24;
+		simd_array_conv = priv->simd->rgb24;
 		if (priv->components[0] == NULL)
 			priv->components[0] = (uint8_t *)malloc(priv->width * priv->height * 3);
 		bytes_per_blocklines[0] = priv->width * 3;
@@ -2306,6 +2573,7 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 
 	case TINYJPEG_FMT_BGR24:
 		colorspace_array_conv = convert_colorspace_bgr24;
+		simd_array_conv = priv->simd->bgr24;
 		if (priv->components[0] == NULL)
 			priv->components[0] = (uint8_t *)malloc(priv->width * priv->height * 3);
 		bytes_per_blocklines[0] = priv->width * 3;
@@ -2329,27 +2597,28 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 
 	xstride_by_mcu = ystride_by_mcu = 8;
 	if ((priv->component_infos[cY].Hfactor | priv->component_infos[cY].Vfactor) == 1) {
-		decode_MCU = decode_mcu_table[0];
-		convert_to_pixfmt = colorspace_array_conv[0];
+		sampling = 0;
 		trace("Use decode 1x1 sampling\n");
 	} else if (priv->component_infos[cY].Hfactor == 1) {
-		decode_MCU = decode_mcu_table[1];
-		convert_to_pixfmt = colorspace_array_conv[1];
+		sampling = 1;
 		ystride_by_mcu = 16;
 		trace("Use decode 1x2 sampling (not supported)\n");
 	} else if (priv->component_infos[cY].Vfactor == 2) {
-		decode_MCU = decode_mcu_table[3];
-		convert_to_pixfmt = colorspace_array_conv[3];
+		sampling = 3;
 		xstride_by_mcu = 16;
 		ystride_by_mcu = 16;
 		trace("Use decode 2x2 sampling\n");
 	} else {
-		decode_MCU = decode_mcu_table[2];
-		convert_to_pixfmt = colorspace_array_conv[2];
+		sampling = 2;
 		xstride_by_mcu = 16;
 		trace("Use decode 2x1 sampling\n");
 	}
 
+	decode_MCU = decode_mcu_table[sampling];
+	convert_to_pixfmt = colorspace_array_conv[sampling];
+	if (simd_array_conv && simd_array_conv[sampling])
+		convert_to_pixfmt = simd_array_conv[sampling];
+
 	if (decode_MCU == NULL)
 		error("no decode MCU function for this JPEG format (PIXART?)\n");
 
@@ -2364,6 +2633,12 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 	bytes_per_mcu[1] *= xstride_by_mcu / 8;
 	bytes_per_mcu[2] *= xstride_by_mcu / 8;
 
+	result = tinyjpeg_decode_parallel(priv, decode_MCU, convert_to_pixfmt,
+			xstride_by_mcu, ystride_by_mcu, bytes_per_blocklines,
+			bytes_per_mcu);
+	if (result != 1)
+		return result;
+
 	/* Just the decode the image by macroblock (size is 8x8, 8x16, or 16x16) */
 	for (y = 0; y < priv->height / ystride_by_mcu; y++) {
 		//trace("Decoding row %d\n", y);
@@ -2668,3 +2943,14 @@ int tinyjpeg_set_flags(struct jdec_private *priv, int flags)
 	return oldflags;
 }
 
+/**
+ * Set the function used to decode the restart intervals of JPEGs which have
+ * them in parallel, run may be NULL to always decode in a single thread.
+ */
+void tinyjpeg_set_run_fct(struct jdec_private *priv, tinyjpeg_run_fct run,
+		void *opaque)
+{
+	priv->run = run;
+	priv->run_opaque = opaque;
+}
+
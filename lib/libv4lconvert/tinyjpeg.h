@@ -45,6 +45,8 @@ struct jdec_private;
 #define TINYJPEG_FLAGS_MJPEG_TABLE	(1<<1)
 #define TINYJPEG_FLAGS_PIXART_JPEG	(1<<2)
 #define TINYJPEG_FLAGS_PLANAR_JPEG	(1<<3)
+/* Always use the float IDCT, whose output is the closest to libjpeg's */
+#define TINYJPEG_FLAGS_ACCURATE_IDCT	(1<<4)
 
 /* Format accepted in outout */
 enum tinyjpeg_fmt {
@@ -66,6 +68,14 @@ int tinyjpeg_set_components(struct jdec_private *priv, unsigned char **component
 				unsigned int ncomponents);
 int tinyjpeg_set_flags(struct jdec_private *priv, int flags);
 
+/* Must call func(arg, band, first, last) for consecutive bands of
+   [0, count), numbering the bands from 0, and return when all are done */
+typedef void (*tinyjpeg_run_fct)(void *opaque,
+		void (*func)(void *arg, int band, int first, int last),
+		void *arg, int count);
+void tinyjpeg_set_run_fct(struct jdec_private *priv, tinyjpeg_run_fct run,
+		void *opaque);
+
 #ifdef __cplusplus
 }
 #endif
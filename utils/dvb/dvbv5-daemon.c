@@ -195,25 +195,37 @@ void local_log(int level, const char *fmt, ...)
  * Static data used by the code
  */
 
-static pthread_mutex_t msg_mutex;
-static pthread_mutex_t dvb_read_mutex;
-static pthread_t read_id = 0;
+/*
+ * Each client connection gets its own struct dvb_client, with its own
+ * struct dvb_device (so, its own frontend), its own open descriptors
+ * and its own thread reading from its demux/dvr devices. Several clients
+ * can then use different adapters at the same time.
+ */
+struct dvb_client {
+	int fd;				/* client socket */
+	int ready;			/* version handshake done */
+	struct dvb_device *dvb;
+
+	pthread_mutex_t msg_mutex;	/* serializes messages sent to fd */
+
+	/* Open descriptors and demux/dvr fds to read, under read_mutex */
+	pthread_mutex_t read_mutex;
+	void *desc_root;
+	struct pollfd fds[NUM_FOPEN];
+	nfds_t numfds;
+
+	pthread_t read_id;
+	int read_started, read_running;
+
+	char output_charset[256];
+	char default_charset[256];
+};
 
 struct dvb_descriptors {
 	int uid;
 	struct dvb_open_descriptor *open_dev;
 };
 
-static struct dvb_device *dvb = NULL;
-static void *desc_root = NULL;
-static int dvb_fd = -1;
-
-static struct pollfd fds[NUM_FOPEN];
-static nfds_t numfds = 0;
-
-static char output_charset[256] = "utf-8";
-static char default_charset[256] = "iso-8859-1";
-
 void stack_dump()
 {
 #ifdef HAVE_BACKTRACE
@@ -246,15 +258,20 @@ static int dvb_desc_compare(const void *__a, const void *__b)
 	return (b->uid - a->uid);
 }
 
-static struct dvb_open_descriptor *get_open_dev(int uid)
+/*
+ * Only the client thread changes the descriptors tree, holding
+ * client->read_mutex, which the read thread also holds to look at it.
+ */
+static struct dvb_open_descriptor *get_open_dev(struct dvb_client *client,
+						int uid)
 {
 	struct dvb_descriptors desc, **p;
 
-	if (!desc_root)
+	if (!client->desc_root)
 		return NULL;
 
 	desc.uid = uid;
-	p = tfind(&desc, &desc_root, dvb_desc_compare);
+	p = tfind(&desc, &client->desc_root, dvb_desc_compare);
 
 	if (!p) {
 		err("open element not retrieved!");
@@ -264,14 +281,20 @@ static struct dvb_open_descriptor *get_open_dev(int uid)
 	return (*p)->open_dev;
 }
 
-static void destroy_open_dev(int uid)
+static void destroy_open_dev(struct dvb_client *client, int uid)
 {
-	struct dvb_descriptors desc, **p;
+	struct dvb_descriptors desc, *cur, **p;
 
 	desc.uid = uid;
-	p = tdelete(&desc, &desc_root, dvb_desc_compare);
-	if (!p)
+	p = tfind(&desc, &client->desc_root, dvb_desc_compare);
+	if (!p) {
 		err("can't destroy opened element");
+		return;
+	}
+
+	cur = *p;
+	tdelete(&desc, &client->desc_root, dvb_desc_compare);
+	free(cur);
 }
 
 static void free_opendevs(void *node)
@@ -285,13 +308,14 @@ static void free_opendevs(void *node)
 	free (desc);
 }
 
-static void close_all_devs(void)
+static void close_all_devs(struct dvb_client *client)
 {
-	dvb_fd = -1;
-	numfds = 0;
-	tdestroy(desc_root, free_opendevs);
+	pthread_mutex_lock(&client->read_mutex);
+	client->numfds = 0;
+	tdestroy(client->desc_root, free_opendevs);
 
-	desc_root = NULL;
+	client->desc_root = NULL;
+	pthread_mutex_unlock(&client->read_mutex);
 }
 
 /*
@@ -303,9 +327,6 @@ static void sigterm_handler(int const sig_class)
 	info(PROGRAM_NAME" interrupted.");
 
 	pthread_exit(NULL);
-
-	close_all_devs();
-	dvb_dev_free(dvb);
 }
 
 static void start_signal_handler(void)
@@ -430,35 +451,65 @@ static ssize_t prepare_data(char *buf, const size_t size,
 	return ret;
 }
 
-static int send_buf(int fd, const char *buf, size_t size)
+static int send_buf(struct dvb_client *client, const char *buf, size_t size)
 {
 	int ret;
 	int32_t i32;
 
-	if (fd < 0)
+	if (client->fd < 0)
 		return ECONNRESET;
 
-	pthread_mutex_lock(&msg_mutex);
+	pthread_mutex_lock(&client->msg_mutex);
 	i32 = htobe32(size);
-	ret = send(fd, (void *)&i32, 4, MSG_MORE);
+	ret = send(client->fd, (void *)&i32, 4, MSG_MORE | MSG_NOSIGNAL);
 	if (ret >= 0)
-		ret = send(fd, buf, size, 0);
-	pthread_mutex_unlock(&msg_mutex);
+		ret = send(client->fd, buf, size, MSG_NOSIGNAL);
+	pthread_mutex_unlock(&client->msg_mutex);
 	if (ret < 0) {
+		/* The client thread cleans up when recv() fails */
 		local_perror("write");
-		if (ret == ECONNRESET)
-			close_all_devs();
-
 		return errno;
 	}
 
 	return ret;
 }
 
-static ssize_t send_data(int fd, const char *fmt, ...)
+/*
+ * Sends a REMOTE_DATA_FRAME. The first 4 bytes of buf are reserved for
+ * the frame size, so the whole frame goes out with a single send().
+ */
+static int send_data_frame(struct dvb_client *client, char *buf, size_t size)
+{
+	ssize_t ret = 0;
+	size_t pos = 0;
+	uint32_t u32;
+
+	if (client->fd < 0)
+		return -ECONNRESET;
+
+	u32 = htobe32(REMOTE_DATA_FRAME | (size - 4));
+	memcpy(buf, &u32, 4);
+
+	pthread_mutex_lock(&client->msg_mutex);
+	while (pos < size) {
+		ret = send(client->fd, buf + pos, size - pos, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -errno;
+			break;
+		}
+		pos += ret;
+	}
+	pthread_mutex_unlock(&client->msg_mutex);
+
+	return ret < 0 ? ret : 0;
+}
+
+static ssize_t send_data(struct dvb_client *client, const char *fmt, ...)
 	__attribute__ (( format( printf, 2, 3 )));
 
-static ssize_t send_data(int fd, const char *fmt, ...)
+static ssize_t send_data(struct dvb_client *client, const char *fmt, ...)
 {
 	char buf[REMOTE_BUF_SIZE];
 	va_list ap;
@@ -473,7 +524,7 @@ static ssize_t send_data(int fd, const char *fmt, ...)
 	if (ret < 0)
 		return ret;
 
-	return send_buf(fd, buf, ret);
+	return send_buf(client, buf, ret);
 }
 
 static ssize_t scan_data(char *buf, int buf_size, const char *fmt, ...)
@@ -559,7 +610,7 @@ void dvb_remote_log(void *priv, int level, const char *fmt, ...)
 	char *buf;
 
 	va_list ap;
-	int fd = *(int*)priv;
+	struct dvb_client *client = priv;
 
 	va_start(ap, fmt);
 	ret = vasprintf(&buf, fmt, ap);
@@ -570,8 +621,8 @@ void dvb_remote_log(void *priv, int level, const char *fmt, ...)
 
 	va_end(ap);
 
-	if (fd >= 0)
-		send_data(fd, "%i%s%i%s", 0, "log", level, buf);
+	if (client->ready)
+		send_data(client, "%i%s%i%s", 0, "log", level, buf);
 	else
 		local_log(level, buf);
 
@@ -581,7 +632,9 @@ void dvb_remote_log(void *priv, int level, const char *fmt, ...)
 static int dev_change_monitor(char *sysname,
 			      enum dvb_dev_change_type type, void *user_priv)
 {
-	send_data(dvb_fd, "%i%s%i%s", 0, "dev_change", type, sysname);
+	struct dvb_client *client = user_priv;
+
+	send_data(client, "%i%s%i%s", 0, "dev_change", type, sysname);
 
 	return 0;
 }
@@ -590,15 +643,15 @@ static int dev_change_monitor(char *sysname,
 /*
  * command handler methods
  */
-static int daemon_get_version(uint32_t seq, char *cmd, int fd,
+static int daemon_get_version(uint32_t seq, char *cmd, struct dvb_client *client,
 			      char *buf, ssize_t size)
 {
 	int ret = 0;
 
-	return send_data(fd, "%i%s%i%s", seq, cmd, ret, argp_program_version);
+	return send_data(client, "%i%s%i%s", seq, cmd, ret, argp_program_version);
 }
 
-static int dev_find(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
+static int dev_find(uint32_t seq, char *cmd, struct dvb_client *client, char *buf, ssize_t size)
 {
 	int enable_monitor = 0, ret;
 	dvb_dev_change_t handler = NULL;
@@ -610,21 +663,21 @@ static int dev_find(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 	if (enable_monitor)
 		handler = &dev_change_monitor;
 
-	ret = dvb_dev_find(dvb, handler, NULL);
+	ret = dvb_dev_find(client->dvb, handler, client);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_stop_monitor(uint32_t seq, char *cmd, int fd,
+static int dev_stop_monitor(uint32_t seq, char *cmd, struct dvb_client *client,
 			    char *buf, ssize_t size)
 {
-	dvb_dev_stop_monitor(dvb);
+	dvb_dev_stop_monitor(client->dvb);
 
-	return send_data(fd, "%i%s%i", seq, cmd, 0);
+	return send_data(client, "%i%s%i", seq, cmd, 0);
 }
 
-static int dev_seek_by_adapter(uint32_t seq, char *cmd, int fd,
+static int dev_seek_by_adapter(uint32_t seq, char *cmd, struct dvb_client *client,
 			       char *buf, ssize_t size)
 {
 	struct dvb_dev_list *dev;
@@ -634,19 +687,19 @@ static int dev_seek_by_adapter(uint32_t seq, char *cmd, int fd,
 	if (ret < 0)
 		goto error;
 
-	dev = dvb_dev_seek_by_adapter(dvb, adapter, num, type);
+	dev = dvb_dev_seek_by_adapter(client->dvb, adapter, num, type);
 	if (!dev)
 		goto error;
 
-	return send_data(fd, "%i%s%i%s%s%s%i%s%s%s%s%s", seq, cmd, ret,
+	return send_data(client, "%i%s%i%s%s%s%i%s%s%s%s%s", seq, cmd, ret,
 			 dev->syspath, dev->path, dev->sysname, dev->dvb_type,
 			 dev->bus_addr, dev->bus_id, dev->manufacturer,
 			 dev->product, dev->serial);
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_get_dev_info(uint32_t seq, char *cmd, int fd,
+static int dev_get_dev_info(uint32_t seq, char *cmd, struct dvb_client *client,
 			       char *buf, ssize_t size)
 {
 	struct dvb_dev_list *dev;
@@ -657,40 +710,65 @@ static int dev_get_dev_info(uint32_t seq, char *cmd, int fd,
 	if (ret < 0)
 		goto error;
 
-	dev = dvb_get_dev_info(dvb, sysname);
+	dev = dvb_get_dev_info(client->dvb, sysname);
 	if (!dev)
 		goto error;
 
-	return send_data(fd, "%i%s%i%s%s%s%i%s%s%s%s%s", seq, cmd, ret,
+	return send_data(client, "%i%s%i%s%s%s%i%s%s%s%s%s", seq, cmd, ret,
 			 dev->syspath, dev->path, dev->sysname, dev->dvb_type,
 			 dev->bus_addr, dev->bus_id, dev->manufacturer,
 			 dev->product, dev->serial);
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
+/*
+ * Largest chunk read from one device per pass. The client drops a chunk
+ * whole if it doesn't fit in its ring buffer (REMOTE_BUF_SIZE * 32 by
+ * default), so keep this a small fraction of it.
+ */
+#define REMOTE_MAX_CHUNK_SIZE	(REMOTE_BUF_SIZE * 4)
+
+/*
+ * Reads the data from all demux/dvr devices of a client ready at each
+ * poll() pass, batching it into REMOTE_DATA_FRAMEs. The devices are served
+ * round-robin, each one getting an equal share of a frame, up to
+ * REMOTE_MAX_CHUNK_SIZE, so a busy device can't starve the others.
+ */
 static void *read_data(void *privdata)
 {
+	struct dvb_client *client = privdata;
 	struct dvb_open_descriptor *open_dev;
 	int timeout;
-	int ret, read_ret = -1, fd, i;
-	char databuf[REMOTE_BUF_SIZE];
-	char buf[REMOTE_BUF_SIZE + 32], *p;
-	size_t size;
-	size_t count;
+	int ret, read_ret, fd, i, n, first = 0, ready;
+	char *buf, *p, *endp;
+	int32_t i32;
+	size_t count, share;
 	struct pollfd __fds[NUM_FOPEN];
 	nfds_t __numfds;
 
+	/* Room for the frame size, and for the chunks */
+	buf = malloc(4 + REMOTE_DATA_FRAME_SIZE);
+	if (!buf) {
+		local_perror("malloc");
+		pthread_mutex_lock(&client->read_mutex);
+		client->read_running = 0;
+		pthread_mutex_unlock(&client->read_mutex);
+		return NULL;
+	}
+	endp = buf + 4 + REMOTE_DATA_FRAME_SIZE;
+
 	timeout = 10; /* ms */
 	while (1) {
-		pthread_mutex_lock(&dvb_read_mutex);
-		if (!numfds) {
-			pthread_mutex_unlock(&dvb_read_mutex);
+		pthread_mutex_lock(&client->read_mutex);
+		if (!client->numfds) {
+			client->read_running = 0;
+			pthread_mutex_unlock(&client->read_mutex);
 			break;
 		}
-		__numfds = numfds;
-		memcpy(__fds, fds, sizeof(fds));
-		pthread_mutex_unlock(&dvb_read_mutex);
+		__numfds = client->numfds;
+		memcpy(__fds, client->fds, sizeof(*__fds) * __numfds);
+		pthread_mutex_unlock(&client->read_mutex);
 
 		ret = poll(__fds, __numfds, timeout);
 		if (!ret)
@@ -700,81 +778,100 @@ static void *read_data(void *privdata)
 			continue;
 		}
 
+		/*
+		 * An error condition likely means that the file was
+		 * closed.
+		 */
+		ready = 0;
 		for (i = 0; i < __numfds; i++) {
 			if (__fds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
-				continue;
+				__fds[i].revents = 0;
 			if (__fds[i].revents)
-				break;
+				ready++;
 		}
-
-		/*
-		 * it means that one error condition happened.
-		 * Likely the file was closed.
-		 */
-		if (i == __numfds)
+		if (!ready)
 			continue;
 
-		fd = __fds[i].fd;
+		share = REMOTE_DATA_FRAME_SIZE / ready - 8;
+		if (share > REMOTE_MAX_CHUNK_SIZE)
+			share = REMOTE_MAX_CHUNK_SIZE;
+		if (share < REMOTE_BUF_SIZE)
+			share = REMOTE_BUF_SIZE;
 
-		if (!desc_root)
-			break;
+		/* Start from a different device at each pass */
+		first = (first + 1) % __numfds;
 
-		open_dev = get_open_dev(fd);
-		if (!open_dev) {
-			err("Couldn't find opened file %d", fd);
-			continue;
-		}
+		p = buf + 4;
+		for (n = 0; n < __numfds; n++) {
+			i = (first + n) % __numfds;
+			if (!__fds[i].revents)
+				continue;
 
-		count = REMOTE_BUF_SIZE;
-		read_ret = dvb_dev_read(open_dev, databuf, count);
-		if (verbose) {
-			if (read_ret < 0)
-				dbg("#%d: read error: %d on %p", fd, read_ret, open_dev);
-			else
-				dbg("#%d: read %d bytes (count %d)", fd, read_ret, count);
-		}
+			fd = __fds[i].fd;
 
-		/* Initialize to the start of the buffer */
-		p = buf;
-		size = sizeof(buf);
+			/* Send what was already read, if there's no room left */
+			if (endp - p < 8 + share) {
+				ret = send_data_frame(client, buf, p - buf);
+				if (ret < 0)
+					goto send_error;
+				p = buf + 4;
+			}
 
-		ret = prepare_data(p, size, "%i%s%i%i", 0, "data_read",
-				   read_ret, fd);
-		if (ret < 0) {
-			err("Failed to prepare answer to dvb_read()");
-			break;
-		}
+			/* Hold the lock, as the client thread may close it */
+			pthread_mutex_lock(&client->read_mutex);
+			open_dev = get_open_dev(client, fd);
+			if (!open_dev) {
+				pthread_mutex_unlock(&client->read_mutex);
+				err("Couldn't find opened file %d", fd);
+				continue;
+			}
 
-		p += ret;
-		size -= ret;
+			count = share;
+			read_ret = dvb_dev_read(open_dev, p + 8, count);
+			pthread_mutex_unlock(&client->read_mutex);
 
-		if (read_ret > 0) {
-			if (read_ret > size) {
-				dbg("buffer to short to store read data!");
-				read_ret = -EOVERFLOW;
-			} else {
-				memcpy(p, databuf, read_ret);
-				p += read_ret;
+			if (verbose) {
+				if (read_ret < 0)
+					dbg("#%d: read error: %d on %p", fd, read_ret, open_dev);
+				else
+					dbg("#%d: read %d bytes (count %zd)", fd, read_ret, count);
 			}
+
+			i32 = htobe32(fd);
+			memcpy(p, &i32, 4);
+			i32 = htobe32(read_ret);
+			memcpy(p + 4, &i32, 4);
+			p += 8;
+			if (read_ret > 0)
+				p += read_ret;
 		}
 
-		ret = send_buf(dvb_fd, buf, p - buf);
-		if (ret < 0) {
-			err("Error %d sending buffer\n", ret);
-			if (ret == ECONNRESET) {
-				close_all_devs();
-				break;
-			}
+		if (p == buf + 4)
 			continue;
+
+		ret = send_data_frame(client, buf, p - buf);
+		if (ret < 0)
+			goto send_error;
+		continue;
+
+send_error:
+		err("Error %d sending buffer\n", ret);
+		if (ret == -ECONNRESET || ret == -EPIPE) {
+			/* The client thread will close the devices */
+			pthread_mutex_lock(&client->read_mutex);
+			client->read_running = 0;
+			pthread_mutex_unlock(&client->read_mutex);
+			break;
 		}
 	}
 
+	free(buf);
 	dbg("Finishing kthread");
-	read_id = 0;
 	return NULL;
 }
 
-static int dev_open(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
+static int dev_open(uint32_t seq, char *cmd, struct dvb_client *client,
+		    char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
 	struct dvb_dev_list *dev;
@@ -801,61 +898,71 @@ static int dev_open(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 	 */
 	flags &= ~O_NONBLOCK;
 
-	open_dev = dvb_dev_open(dvb, sysname, flags);
+	open_dev = dvb_dev_open(client->dvb, sysname, flags);
 	if (!open_dev) {
 		ret = -errno;
 		free(desc);
 		goto error;
 	}
 
-
 	if (verbose)
 		dbg("open dev handler for %s: %p with uid#%d", sysname, open_dev, open_dev->fd);
 
-	dev = open_dev->dev;
-	if (dev->dvb_type == DVB_DEVICE_DEMUX ||
-	    dev->dvb_type == DVB_DEVICE_DVR) {
-		pthread_mutex_lock(&dvb_read_mutex);
-		fds[numfds].fd = open_dev->fd;
-		fds[numfds].events = POLLIN | POLLPRI;
-		numfds++;
-		pthread_mutex_unlock(&dvb_read_mutex);
-	}
-
-	if (!read_id) {
-		ret = pthread_create(&read_id, NULL, read_data, NULL);
-		if (ret < 0) {
-			local_perror("pthread_create");
-			pthread_mutex_unlock(&msg_mutex);
-			free(desc);
-			return -1;
-		}
-	}
-
-	pthread_mutex_unlock(&msg_mutex);
 	uid = open_dev->fd;
 
 	desc->uid = uid;
 	desc->open_dev = open_dev;
 
+	pthread_mutex_lock(&client->read_mutex);
+
 	/* Add element to the desc_root tree */
-	p = tsearch(desc, &desc_root, dvb_desc_compare);
+	p = tsearch(desc, &client->desc_root, dvb_desc_compare);
 	if (!p) {
 		local_perror("tsearch");
-		uid = 0;
+		pthread_mutex_unlock(&client->read_mutex);
+		dvb_dev_close(open_dev);
+		free(desc);
+		ret = -ENOMEM;
+		goto error;
 	}
 	if (*p != desc) {
-		err("uid %d was already opened!");
+		err("uid %d was already opened!", uid);
+	}
+
+	dev = open_dev->dev;
+	if ((dev->dvb_type == DVB_DEVICE_DEMUX ||
+	     dev->dvb_type == DVB_DEVICE_DVR) && client->numfds < NUM_FOPEN) {
+		client->fds[client->numfds].fd = open_dev->fd;
+		client->fds[client->numfds].events = POLLIN | POLLPRI;
+		client->numfds++;
+
+		if (!client->read_running) {
+			/* A previous read thread may still be finishing */
+			if (client->read_started)
+				pthread_join(client->read_id, NULL);
+			client->read_started = 0;
+
+			ret = pthread_create(&client->read_id, NULL,
+					     read_data, client);
+			if (ret) {
+				errno = ret;
+				local_perror("pthread_create");
+			} else {
+				client->read_started = 1;
+				client->read_running = 1;
+			}
+		}
 	}
 
-	pthread_mutex_unlock(&msg_mutex);
+	pthread_mutex_unlock(&client->read_mutex);
 
 	ret = uid;
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_close(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
+static int dev_close(uint32_t seq, char *cmd, struct dvb_client *client,
+		     char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
 	int uid, ret, i;
@@ -864,7 +971,7 @@ static int dev_close(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
+	open_dev = get_open_dev(client, uid);
 	if (!open_dev) {
 		err("Can't find uid to close");
 		ret = -1;
@@ -872,30 +979,26 @@ static int dev_close(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 	}
 
 	/* Delete fd from the opened array */
-	pthread_mutex_lock(&dvb_read_mutex);
-	for (i = 0; i < numfds; i++) {
-		if (fds[i].fd != open_dev->fd)
+	pthread_mutex_lock(&client->read_mutex);
+	for (i = 0; i < client->numfds; i++) {
+		if (client->fds[i].fd != open_dev->fd)
 		    continue;
-		if (i < numfds - 1)
-			memmove(&fds[i], &fds[i + 1],
-				sizeof(*fds)*(numfds - i - 1));
-		numfds--;
+		if (i < client->numfds - 1)
+			memmove(&client->fds[i], &client->fds[i + 1],
+				sizeof(*client->fds)*(client->numfds - i - 1));
+		client->numfds--;
 		break;
 	}
-	pthread_mutex_unlock(&dvb_read_mutex);
-	if (read_id && !numfds) {
-		pthread_cancel(read_id);
-		read_id = 0;
-	}
 
 	dvb_dev_close(open_dev);
-	destroy_open_dev(uid);
+	destroy_open_dev(client, uid);
+	pthread_mutex_unlock(&client->read_mutex);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_dmx_stop(uint32_t seq, char *cmd, int fd,
+static int dev_dmx_stop(uint32_t seq, char *cmd, struct dvb_client *client,
 			char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
@@ -905,7 +1008,7 @@ static int dev_dmx_stop(uint32_t seq, char *cmd, int fd,
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
+	open_dev = get_open_dev(client, uid);
 	if (!open_dev) {
 		ret = -1;
 		err("Can't find uid to stop");
@@ -915,10 +1018,10 @@ static int dev_dmx_stop(uint32_t seq, char *cmd, int fd,
 	dvb_dev_dmx_stop(open_dev);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_set_bufsize(uint32_t seq, char *cmd, int fd,
+static int dev_set_bufsize(uint32_t seq, char *cmd, struct dvb_client *client,
 			   char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
@@ -928,7 +1031,7 @@ static int dev_set_bufsize(uint32_t seq, char *cmd, int fd,
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
+	open_dev = get_open_dev(client, uid);
 	if (!open_dev) {
 		ret = -1;
 		err("Can't find uid to stop");
@@ -938,10 +1041,10 @@ static int dev_set_bufsize(uint32_t seq, char *cmd, int fd,
 	dvb_dev_set_bufsize(open_dev, bufsize);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_dmx_set_pesfilter(uint32_t seq, char *cmd, int fd,
+static int dev_dmx_set_pesfilter(uint32_t seq, char *cmd, struct dvb_client *client,
 				 char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
@@ -952,7 +1055,7 @@ static int dev_dmx_set_pesfilter(uint32_t seq, char *cmd, int fd,
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
+	open_dev = get_open_dev(client, uid);
 	if (!open_dev) {
 		ret = -1;
 		err("Can't find uid to set pesfilter");
@@ -962,10 +1065,10 @@ static int dev_dmx_set_pesfilter(uint32_t seq, char *cmd, int fd,
 	ret = dvb_dev_dmx_set_pesfilter(open_dev, pid, type, output, bufsize);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_dmx_set_section_filter(uint32_t seq, char *cmd, int fd,
+static int dev_dmx_set_section_filter(uint32_t seq, char *cmd, struct dvb_client *client,
 				      char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
@@ -977,7 +1080,7 @@ static int dev_dmx_set_section_filter(uint32_t seq, char *cmd, int fd,
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
+	open_dev = get_open_dev(client, uid);
 	if (!open_dev) {
 		ret = -1;
 		err("Can't find uid to set section filter");
@@ -988,10 +1091,10 @@ static int dev_dmx_set_section_filter(uint32_t seq, char *cmd, int fd,
 					     mask, mode, flags);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_dmx_get_pmt_pid(uint32_t seq, char *cmd, int fd,
+static int dev_dmx_get_pmt_pid(uint32_t seq, char *cmd, struct dvb_client *client,
 			       char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
@@ -1001,7 +1104,7 @@ static int dev_dmx_get_pmt_pid(uint32_t seq, char *cmd, int fd,
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
+	open_dev = get_open_dev(client, uid);
 	if (!open_dev) {
 		ret = -1;
 		err("Can't find uid to get PMT PID");
@@ -1011,10 +1114,10 @@ static int dev_dmx_get_pmt_pid(uint32_t seq, char *cmd, int fd,
 	ret = dvb_dev_dmx_get_pmt_pid(open_dev, sid);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_scan(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
+static int dev_scan(uint32_t seq, char *cmd, struct dvb_client *client, char *buf, ssize_t size)
 {
 	int ret = -1;
 
@@ -1031,7 +1134,7 @@ static int dev_scan(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
+	open_dev = get_open_dev(client, uid);
 	if (!open_dev) {
 		ret = -1;
 		err("Can't find uid to scan");
@@ -1041,16 +1144,16 @@ static int dev_scan(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 	ret = dvb_scan(foo);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 #else
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 #endif
 }
 
-static int dev_set_sys(uint32_t seq, char *cmd, int fd,
+static int dev_set_sys(uint32_t seq, char *cmd, struct dvb_client *client,
 		       char *buf, ssize_t size)
 {
-	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->fe_parms;
+	struct dvb_v5_fe_parms_priv *parms = (void *)client->dvb->fe_parms;
 	struct dvb_v5_fe_parms *p = (void *)parms;
 	int sys = 0, ret;
 
@@ -1060,13 +1163,13 @@ static int dev_set_sys(uint32_t seq, char *cmd, int fd,
 
 	ret = __dvb_set_sys(p, sys);
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_get_parms(uint32_t seq, char *cmd, int fd,
+static int dev_get_parms(uint32_t seq, char *cmd, struct dvb_client *client,
 			 char *inbuf, ssize_t insize)
 {
-	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->fe_parms;
+	struct dvb_v5_fe_parms_priv *parms = (void *)client->dvb->fe_parms;
 	struct dvb_v5_fe_parms *par = (void *)parms;
 	struct dvb_frontend_info *info = &par->info;
 	int ret, i;
@@ -1142,18 +1245,18 @@ static int dev_get_parms(uint32_t seq, char *cmd, int fd,
 		size -= ret;
 	}
 
-	strcpy(output_charset, par->output_charset);
-	strcpy(default_charset, par->default_charset);
+	strcpy(client->output_charset, par->output_charset);
+	strcpy(client->default_charset, par->default_charset);
 
-	return send_buf(fd, buf, p - buf);
+	return send_buf(client, buf, p - buf);
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_set_parms(uint32_t seq, char *cmd, int fd,
+static int dev_set_parms(uint32_t seq, char *cmd, struct dvb_client *client,
 			 char *buf, ssize_t size)
 {
-	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->fe_parms;
+	struct dvb_v5_fe_parms_priv *parms = (void *)client->dvb->fe_parms;
 	struct dvb_v5_fe_parms *par = (void *)parms;
 	int ret, i;
 	char *p = buf;
@@ -1172,7 +1275,8 @@ static int dev_set_parms(uint32_t seq, char *cmd, int fd,
 	ret = scan_data(p, size, "%i%i%s%i%i%i%i%s%s",
 			&par->abort, &par->lna, new_lnb,
 			&par->sat_number, &par->freq_bpf, &par->diseqc_wait,
-			&par->verbose, default_charset, output_charset);
+			&par->verbose, client->default_charset,
+			client->output_charset);
 
 	if (ret < 0)
 		goto error;
@@ -1215,19 +1319,19 @@ static int dev_set_parms(uint32_t seq, char *cmd, int fd,
 		par->lnb = dvb_sat_get_lnb(lnb);
 	}
 
-	par->output_charset = output_charset;
-	par->default_charset = default_charset;
+	par->output_charset = client->output_charset;
+	par->default_charset = client->default_charset;
 
 	ret = __dvb_fe_set_parms(par);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_get_stats(uint32_t seq, char *cmd, int fd,
+static int dev_get_stats(uint32_t seq, char *cmd, struct dvb_client *client,
 			 char *inbuf, ssize_t insize)
 {
-	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->fe_parms;
+	struct dvb_v5_fe_parms_priv *parms = (void *)client->dvb->fe_parms;
 	struct dvb_v5_stats *st = &parms->stats;
 	struct dvb_v5_fe_parms *par = (void *)parms;
 	int ret, i;
@@ -1295,22 +1399,23 @@ static int dev_get_stats(uint32_t seq, char *cmd, int fd,
 		size -= ret;
 	}
 
-	return send_buf(fd, buf, p - buf);
+	return send_buf(client, buf, p - buf);
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
 /*
  * Structure with all methods with RPC calls
  */
 
-typedef int (*method_handler) (uint32_t seq, char *cmd, int fd,
+typedef int (*method_handler) (uint32_t seq, char *cmd,
+			       struct dvb_client *client,
 			       char *buf, ssize_t size);
 
 struct method_types {
 	char *name;
 	method_handler handler;
-	int locks_dvb;
+	int handshake;
 };
 
 static const struct method_types methods[] = {
@@ -1337,33 +1442,68 @@ static const struct method_types methods[] = {
 	{}
 };
 
-static void *start_server(void *fd_pointer)
+static void free_client(struct dvb_client *client)
+{
+	/* Makes any pending send() at the read thread to fail */
+	shutdown(client->fd, SHUT_RDWR);
+
+	close_all_devs(client);
+	if (client->read_started)
+		pthread_join(client->read_id, NULL);
+
+	close(client->fd);
+	if (client->dvb)
+		dvb_dev_free(client->dvb);
+
+	pthread_mutex_destroy(&client->read_mutex);
+	pthread_mutex_destroy(&client->msg_mutex);
+	free(client);
+}
+
+static void *start_server(void *privdata)
 {
+	struct dvb_client *client = privdata;
 	const struct method_types *method;
-	int fd = *(int *)fd_pointer, ret, flag = 1;
+	int fd = client->fd, ret, flag = 1;
 	char buf[REMOTE_BUF_SIZE + 8], cmd[80], *p;
 	ssize_t size;
-	uint32_t seq;
+	uint32_t seq, len;
 	int bufsize;
 
 	if (verbose)
 		dbg("Opening socket %d", fd);
 
 	/* Set a large buffer for read() to work better */
-	bufsize = REMOTE_BUF_SIZE;
+	bufsize = REMOTE_DATA_FRAME_SIZE * 2;
 	setsockopt(fd, SOL_SOCKET, SO_SNDBUF,
 		   (void *)&bufsize, (int)sizeof(bufsize));
 
 	/* Disable Naggle algorithm, as we want errors to be sent ASAP */
 	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char *) &flag, sizeof(int));
 
+	/* Each client has its own view of the DVB devices */
+	client->dvb = dvb_dev_alloc();
+	if (!client->dvb) {
+		err("Can't allocate DVB data\n");
+		free_client(client);
+		return NULL;
+	}
+	dvb_dev_find(client->dvb, 0, NULL);
+
+	/* FIXME: should allow the caller to set the verbosity */
+	dvb_dev_set_logpriv(client->dvb, 1, dvb_remote_log, client);
+
 	/* Command dispatcher */
 	do {
-		size = recv(fd, buf, 4, MSG_WAITALL);
+		size = recv(fd, &len, 4, MSG_WAITALL);
 		if (size <= 0)
 			break;
-		size = (uint32_t)buf[0] << 24 | (uint32_t)buf[1] << 16 |
-		       (uint32_t)buf[2] << 8 | (uint32_t)buf[3];
+		size = be32toh(len);
+		if (size > sizeof(buf)) {
+			if (verbose)
+				dbg("message too big: %d", size);
+			break;
+		}
 		size = recv(fd, buf, size, MSG_WAITALL);
 		if (size <= 0)
 			break;
@@ -1372,7 +1512,7 @@ static void *start_server(void *fd_pointer)
 		if (ret < 0) {
 			if (verbose)
 				dbg("message too short: %d", size);
-			send_data(fd, "%i%s%i%s", 0, "log", LOG_ERR,
+			send_data(client, "%i%s%i%s", 0, "log", LOG_ERR,
 				  "msg too short");
 			continue;
 		}
@@ -1386,7 +1526,7 @@ static void *start_server(void *fd_pointer)
 		if (size > buf + sizeof(buf) - p) {
 			if (verbose)
 				dbg("data length too big: %d", size);
-			send_data(fd, "%i%s%i%s", 0, "log", LOG_ERR,
+			send_data(client, "%i%s%i%s", 0, "log", LOG_ERR,
 				  "data length too big");
 			continue;
 		}
@@ -1394,17 +1534,17 @@ static void *start_server(void *fd_pointer)
 		method = methods;
 		while (method->name) {
 			if (!strcmp(cmd, method->name)) {
-				if (dvb_fd > 0 || method->locks_dvb) {
+				if (client->ready || method->handshake) {
 					ret = method->handler(seq, cmd,
-							      fd, p, size);
+							      client, p, size);
 					if (ret < 0)
 						break;
-					if (method->locks_dvb)
-						dvb_fd = fd;
+					if (method->handshake)
+						client->ready = 1;
 					break;
 				}
-				send_data(fd, "%i%s%i%s", 0, "log", LOG_ERR,
-					  "daemon busy");
+				send_data(client, "%i%s%i%s", 0, "log", LOG_ERR,
+					  "version handshake needed");
 				break;
 			}
 			method++;
@@ -1412,7 +1552,7 @@ static void *start_server(void *fd_pointer)
 		if (!method->name) {
 			if (verbose)
 				dbg("invalid command: %s", cmd);
-			send_data(fd, "%i%s%i%s", 0, "log", LOG_ERR,
+			send_data(client, "%i%s%i%s", 0, "log", LOG_ERR,
 				  "invalid command");
 		}
 	} while (1);
@@ -1420,13 +1560,7 @@ static void *start_server(void *fd_pointer)
 	if (verbose)
 		dbg("Closing socket %d", fd);
 
-	close(fd);
-	if (read_id) {
-		pthread_cancel(read_id);
-		read_id = 0;
-	}
-	if (dvb_fd > 0)
-		close_all_devs();
+	free_client(client);
 
 	return NULL;
 }
@@ -1458,15 +1592,6 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	/* Allocate DVB structure and start seek for devices */
-	dvb = dvb_dev_alloc();
-	if (!dvb) {
-		err("Can't allocate DVB data\n");
-		return -1;
-	}
-
-	dvb_dev_find(dvb, 0, NULL);
-
 	/* Create a socket */
 	sockfd = socket(AF_INET, SOCK_STREAM, 0);
 	if (sockfd < 0) {
@@ -1487,16 +1612,11 @@ int main(int argc, char *argv[])
 		goto error;
 	}
 
-	/* FIXME: should allow the caller to set the verbosity */
-	dvb_dev_set_logpriv(dvb, 1, dvb_remote_log, &dvb_fd);
-
 	/* Listen up to 5 connections */
 	listen(sockfd, 5);
 	addrlen = sizeof(cli_addr);
 
 	start_signal_handler();
-	pthread_mutex_init(&msg_mutex, NULL);
-	pthread_mutex_init(&dvb_read_mutex, NULL);
 
 	/* Accept actual connection from the client */
 
@@ -1511,6 +1631,7 @@ int main(int argc, char *argv[])
 	info(PROGRAM_NAME" started.");
 
 	while (1) {
+		struct dvb_client *client;
 		int fd;
 		pthread_t id;
 
@@ -1524,11 +1645,31 @@ int main(int argc, char *argv[])
 
 		if (verbose)
 			dbg("accepted connection %d", fd);
-		ret = pthread_create(&id, NULL, start_server, (void *)&fd);
-		if (ret < 0) {
+
+		client = calloc(1, sizeof(*client));
+		if (!client) {
+			err("Can't allocate client data");
+			close(fd);
+			continue;
+		}
+		client->fd = fd;
+		pthread_mutex_init(&client->msg_mutex, NULL);
+		pthread_mutex_init(&client->read_mutex, NULL);
+		strcpy(client->output_charset, "utf-8");
+		strcpy(client->default_charset, "iso-8859-1");
+
+		/* Each connection is served by its own thread */
+		ret = pthread_create(&id, NULL, start_server, client);
+		if (ret) {
+			errno = ret;
 			local_perror("pthread_create");
-			break;
+			close(fd);
+			pthread_mutex_destroy(&client->read_mutex);
+			pthread_mutex_destroy(&client->msg_mutex);
+			free(client);
+			continue;
 		}
+		pthread_detach(id);
 	}
 
 	/* Just in case we add some way for the remote part to stop the daemon */
@@ -1539,8 +1680,5 @@ error:
 
 	pthread_exit(NULL);
 
-	if (dvb)
-		dvb_dev_free(dvb);
-
 	return -1;
 }
@@ -63,7 +63,7 @@ struct arguments {
 	unsigned adapter, n_adapter, adapter_fe, adapter_dmx, frontend, demux, get_detected, get_nit;
 	int lna, lnb, sat_number, freq_bpf;
 	unsigned diseqc_wait, dont_add_new_freqs, timeout_multiply;
-	unsigned other_nit;
+	unsigned other_nit, max_filters;
 	enum dvb_file_formats input_format, output_format;
 	const char *cc;
 
@@ -87,6 +87,7 @@ static const struct argp_option options[] = {
 	{"file-freqs-only", 'F', NULL,			0, N_("don't use the other frequencies discovered during scan"), 0},
 	{"timeout-multiply", 'T', N_("factor"),		0, N_("Multiply scan timeouts by this factor"), 0},
 	{"parse-other-nit", 'p', NULL,			0, N_("Parse the other NIT/SDT tables"), 0},
+	{"parallel",	'P',	N_("filters"),		0, N_("read up to this number of MPEG-TS tables at the same time (default: 1)"), 0},
 	{"input-format", 'I',	N_("format"),		0, N_("Input format: CHANNEL, DVBV5 (default: DVBV5)"), 0},
 	{"output-format", 'O',	N_("format"),		0, N_("Output format: VDR, CHANNEL, ZAP, DVBV5 (default: DVBV5)"), 0},
 	{"cc",		'C',	N_("country_code"),	0, N_("Set the default country to be used (in ISO 3166-1 two letter code)"), 0},
@@ -396,6 +397,9 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	case 'p':
 		args->other_nit++;
 		break;
+	case 'P':
+		args->max_filters = strtoul(optarg, NULL, 0);
+		break;
 	case 'v':
 		verbose++;
 		break;
@@ -554,6 +558,7 @@ int main(int argc, char **argv)
 	err = dvb_fe_set_default_country(parms, args.cc);
 	if (err < 0)
 		fprintf(stderr, _("Failed to set the country code:%s\n"), args.cc);
+	dvb_scan_set_max_filters(parms, args.max_filters);
 
 	timeout_flag = &parms->abort;
 	signal(SIGTERM, do_timeout);
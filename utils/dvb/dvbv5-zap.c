@@ -38,7 +38,15 @@
  */
 #define BUFLEN (188 * 512)
 
+/*
+ * Number of memory-mapped DVR buffers, when the Kernel supports them.
+ * The Kernel hands them out partially filled, as the DVR is opened with
+ * O_NONBLOCK, so their size doesn't delay the data.
+ */
+#define DVR_MMAP_BUFFERS 64
+
 #include <unistd.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -549,30 +557,93 @@ static struct timespec *elapsed_time(struct timespec *start)
 	return &elapsed;
 }
 
+static void report_overrun(long long int rc, struct timespec *start)
+{
+	struct timespec *elapsed;
+
+	elapsed = elapsed_time(start);
+	if (!elapsed)
+		fprintf(stderr, _("buffer overrun at %lld\n"), rc);
+	else
+		fprintf(stderr, _("buffer overrun after %lld.%02ld seconds\n"),
+			(long long)elapsed->tv_sec,
+			elapsed->tv_nsec / 10000000);
+}
+
 static void copy_to_file(struct dvb_open_descriptor *in_fd, int out_fd,
 			 int timeout, int silent)
 {
 	char buf[BUFLEN];
-	int r, first = 1;
+	const void *data;
+	unsigned int flags;
+	struct pollfd pfd;
+	int r, first = 1, use_mmap, flush = -1;
 	long long int rc = 0LL;
-	struct timespec start, *elapsed;
+	struct timespec start = { 0 };
 
-	while (timeout_flag == 0) {
-		r = dvb_dev_read(in_fd, buf, sizeof(buf));
+	/*
+	 * Let the Kernel fill memory-mapped buffers, when it supports it,
+	 * instead of copying everything through read().
+	 */
+	use_mmap = dvb_dev_mmap_start(in_fd, DVR_MMAP_BUFFERS, 0) == 0;
+
+	/*
+	 * The DVR is opened with O_NONBLOCK: wait for data with a timeout,
+	 * so that the timeout / terminate signals always stop the loop.
+	 * Remote devices have no fd to poll, their reads return -EAGAIN
+	 * while no data is there, so just retry them a bit later.
+	 */
+	pfd.fd = dvb_dev_get_fd(in_fd);
+	pfd.events = POLLIN;
+
+	while (flush) {
+		if (timeout_flag && flush < 0) {
+			/*
+			 * Get the buffers the Kernel already filled, before
+			 * dvb_dev_mmap_stop() drops them.
+			 */
+			if (!use_mmap)
+				break;
+			flush = DVR_MMAP_BUFFERS;
+		}
+
+		if (flush < 0 && pfd.fd >= 0) {
+			r = poll(&pfd, 1, 1000);
+			if (r < 0 && errno != EINTR) {
+				PERROR(_("poll failed"));
+				break;
+			}
+			if (r <= 0)
+				continue;
+		}
+
+		flags = 0;
+		if (use_mmap) {
+			r = dvb_dev_mmap_read(in_fd, &data, &flags);
+		} else {
+			r = dvb_dev_read(in_fd, buf, sizeof(buf));
+			data = buf;
+		}
 		if (r < 0) {
+			if (flush > 0)
+				break;
+			if (r == -EAGAIN && pfd.fd < 0)
+				usleep(10000);
+			if (r == -EAGAIN || r == -EINTR)
+				continue;
 			if (r == -EOVERFLOW) {
-				elapsed = elapsed_time(&start);
-				if (!elapsed)
-					fprintf(stderr, _("buffer overrun at %lld\n"), rc);
-				else
-					fprintf(stderr, _("buffer overrun after %lld.%02ld seconds\n"),
-						(long long)elapsed->tv_sec,
-						elapsed->tv_nsec / 10000000);
+				report_overrun(rc, &start);
 				continue;
 			}
 			ERROR("Read failed");
 			break;
 		}
+		if (flush > 0)
+			flush--;
+
+		/* The memory-mapped buffers report overruns this way */
+		if (flags & DMX_BUFFER_FLAG_DISCONTINUITY_DETECTED)
+			report_overrun(rc, &start);
 
 		/*
 		 * It takes a while for a DVB device to start streaming, as the
@@ -581,7 +652,7 @@ static void copy_to_file(struct dvb_open_descriptor *in_fd, int out_fd,
 		 * time specified by the user is to restart the timeout alarm
 		 * here, after the first succeded read.
 		 */
-		if (first) {
+		if (first && r > 0) {
 			if (timeout > 0)
 				alarm(timeout);
 
@@ -589,13 +660,15 @@ static void copy_to_file(struct dvb_open_descriptor *in_fd, int out_fd,
 			first = 0;
 		}
 
-		if (write(out_fd, buf, r) < 0) {
+		if (write(out_fd, data, r) < 0) {
 			PERROR(_("Write failed"));
 			break;
 		}
 
 		rc += r;
 	}
+	if (use_mmap)
+		dvb_dev_mmap_stop(in_fd);
 	if (silent < 2) {
 		if (timeout)
 			fprintf(stderr, _("received %lld bytes (%lld Kbytes/sec)\n"), rc,
@@ -1310,7 +1383,7 @@ int main(int argc, char **argv)
 			get_show_stats(stderr, &args, parms, 0);
 
 		if (file_fd >= 0) {
-			dvr_fd = dvb_dev_open(dvb, args.dvr_dev, O_RDONLY);
+			dvr_fd = dvb_dev_open(dvb, args.dvr_dev, O_RDONLY | O_NONBLOCK);
 			if (!dvr_fd) {
 				ERROR("failed opening '%s'", args.dvr_dev);
 				goto err;
@@ -1337,7 +1410,7 @@ int main(int argc, char **argv)
 
 			fprintf(stderr, _("DVR pipe interface '%s' will be opened\n"), args.dvr_pipe);
 
-			dvr_fd = dvb_dev_open(dvb, args.dvr_dev, O_RDONLY);
+			dvr_fd = dvb_dev_open(dvb, args.dvr_dev, O_RDONLY | O_NONBLOCK);
 			if (!dvr_fd) {
 				ERROR("failed opening '%s'", args.dvr_dev);
 				err = -1;